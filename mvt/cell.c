@@ -0,0 +1,301 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+#include <immintrin.h>
+#endif
+
+#include <mvt/mvt.h>
+#include "private.h"
+#include "debug.h"
+
+/*! \addtogroup Cell
+ * @{
+ **/
+
+typedef void (*mvt_fill_attributes_func_t)(mvt_attribute_t *p, const mvt_attribute_t *attribute, size_t count);
+typedef void (*mvt_fill_cells_func_t)(mvt_cell_t *p, const mvt_cell_t *cell, size_t count);
+
+static void mvt_fill_attributes_generic(mvt_attribute_t *p, const mvt_attribute_t *attribute, size_t count)
+{
+    while (count--)
+        *p++ = *attribute;
+}
+
+static void mvt_fill_cells_generic(mvt_cell_t *p, const mvt_cell_t *cell, size_t count)
+{
+    while (count--)
+        *p++ = *cell;
+}
+
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+
+__attribute__((target("sse2")))
+static void mvt_fill_attributes_sse2(mvt_attribute_t *p, const mvt_attribute_t *attribute, size_t count)
+{
+    int value;
+    __m128i v;
+    memcpy(&value, attribute, sizeof value);
+    v = _mm_set1_epi32(value);
+    for (; count >= 4; count -= 4, p += 4)
+        _mm_storeu_si128((__m128i *)p, v);
+    mvt_fill_attributes_generic(p, attribute, count);
+}
+
+__attribute__((target("sse2")))
+static void mvt_fill_cells_sse2(mvt_cell_t *p, const mvt_cell_t *cell, size_t count)
+{
+    long long value;
+    __m128i v;
+    memcpy(&value, cell, sizeof value);
+    v = _mm_set1_epi64x(value);
+    for (; count >= 2; count -= 2, p += 2)
+        _mm_storeu_si128((__m128i *)p, v);
+    mvt_fill_cells_generic(p, cell, count);
+}
+
+__attribute__((target("avx2")))
+static void mvt_fill_attributes_avx2(mvt_attribute_t *p, const mvt_attribute_t *attribute, size_t count)
+{
+    int value;
+    __m256i v;
+    memcpy(&value, attribute, sizeof value);
+    v = _mm256_set1_epi32(value);
+    for (; count >= 8; count -= 8, p += 8)
+        _mm256_storeu_si256((__m256i *)p, v);
+    mvt_fill_attributes_generic(p, attribute, count);
+}
+
+__attribute__((target("avx2")))
+static void mvt_fill_cells_avx2(mvt_cell_t *p, const mvt_cell_t *cell, size_t count)
+{
+    long long value;
+    __m256i v;
+    memcpy(&value, cell, sizeof value);
+    v = _mm256_set1_epi64x(value);
+    for (; count >= 4; count -= 4, p += 4)
+        _mm256_storeu_si256((__m256i *)p, v);
+    mvt_fill_cells_generic(p, cell, count);
+}
+
+#endif
+
+static void mvt_fill_attributes_init(mvt_attribute_t *p, const mvt_attribute_t *attribute, size_t count);
+static void mvt_fill_cells_init(mvt_cell_t *p, const mvt_cell_t *cell, size_t count);
+
+static mvt_fill_attributes_func_t mvt_fill_attributes = mvt_fill_attributes_init;
+static mvt_fill_cells_func_t mvt_fill_cells = mvt_fill_cells_init;
+
+/**
+ * Choose the fill kernels for this CPU on the first call.
+ */
+static void mvt_fill_select(void)
+{
+    mvt_fill_attributes_func_t fill_attributes = mvt_fill_attributes_generic;
+    mvt_fill_cells_func_t fill_cells = mvt_fill_cells_generic;
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+    /* the kernels broadcast a cell as one 64-bit lane */
+    assert(sizeof (mvt_attribute_t) == 4 && sizeof (mvt_cell_t) == 8);
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fill_attributes = mvt_fill_attributes_avx2;
+        fill_cells = mvt_fill_cells_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        fill_attributes = mvt_fill_attributes_sse2;
+        fill_cells = mvt_fill_cells_sse2;
+    }
+#endif
+    mvt_fill_attributes = fill_attributes;
+    mvt_fill_cells = fill_cells;
+}
+
+static void mvt_fill_attributes_init(mvt_attribute_t *p, const mvt_attribute_t *attribute, size_t count)
+{
+    mvt_fill_select();
+    (*mvt_fill_attributes)(p, attribute, count);
+}
+
+static void mvt_fill_cells_init(mvt_cell_t *p, const mvt_cell_t *cell, size_t count)
+{
+    mvt_fill_select();
+    (*mvt_fill_cells)(p, cell, count);
+}
+
+/**
+ * Allocate a run of cells. The content is not initialized.
+ * @param row a row to be set
+ * @param count number of cells
+ * @retval 0 success
+ * @retval -1 out of memory
+ */
+int mvt_row_alloc(mvt_row_t *row, size_t count)
+{
+#ifdef ENABLE_SPLIT_CELLS
+    row->text = malloc(count * sizeof (mvt_char_t));
+    if (!row->text)
+        return -1;
+    row->attribute = malloc(count * sizeof (mvt_attribute_t));
+    if (!row->attribute) {
+        free(row->text);
+        row->text = NULL;
+        return -1;
+    }
+#else
+    *row = malloc(count * sizeof (mvt_cell_t));
+    if (!*row)
+        return -1;
+#endif
+    return 0;
+}
+
+/**
+ * Change the number of cells, keeping the content.
+ * @param row a row to be resized
+ * @param count new number of cells
+ * @retval 0 success
+ * @retval -1 out of memory, the row is left unchanged
+ */
+int mvt_row_realloc(mvt_row_t *row, size_t count)
+{
+#ifdef ENABLE_SPLIT_CELLS
+    mvt_char_t *text;
+    mvt_attribute_t *attribute;
+    text = realloc(row->text, count * sizeof (mvt_char_t));
+    if (!text)
+        return -1;
+    row->text = text;
+    attribute = realloc(row->attribute, count * sizeof (mvt_attribute_t));
+    if (!attribute)
+        return -1;
+    row->attribute = attribute;
+#else
+    mvt_cell_t *cells = realloc(*row, count * sizeof (mvt_cell_t));
+    if (!cells)
+        return -1;
+    *row = cells;
+#endif
+    return 0;
+}
+
+void mvt_row_free(mvt_row_t *row)
+{
+#ifdef ENABLE_SPLIT_CELLS
+    free(row->text);
+    free(row->attribute);
+    row->text = NULL;
+    row->attribute = NULL;
+#else
+    free(*row);
+    *row = NULL;
+#endif
+}
+
+/**
+ * Clear cells with the attribute
+ * @param row a row
+ * @param x the first cell
+ * @param count number of cells
+ * @param attribute attribute of the blank cells
+ */
+void mvt_row_fill(mvt_row_t row, size_t x, size_t count, const mvt_attribute_t *attribute)
+{
+#ifdef ENABLE_SPLIT_CELLS
+    memset(&row.text[x], 0, count * sizeof (mvt_char_t));
+    (*mvt_fill_attributes)(&row.attribute[x], attribute, count);
+#else
+    mvt_cell_t blank;
+    blank.text = '\0';
+    blank.attribute = *attribute;
+    (*mvt_fill_cells)(&row[x], &blank, count);
+#endif
+}
+
+/**
+ * Move cells. The source and the destination may overlap.
+ */
+void mvt_row_move(mvt_row_t dst, size_t dst_x, mvt_row_t src, size_t src_x, size_t count)
+{
+#ifdef ENABLE_SPLIT_CELLS
+    memmove(&dst.text[dst_x], &src.text[src_x], count * sizeof (mvt_char_t));
+    memmove(&dst.attribute[dst_x], &src.attribute[src_x], count * sizeof (mvt_attribute_t));
+#else
+    memmove(&dst[dst_x], &src[src_x], count * sizeof (mvt_cell_t));
+#endif
+}
+
+/**
+ * Get texts and attributes of cells as two arrays, as the screen
+ * expects them. With interleaved cells, they are copied into the
+ * buffers given by the caller, which must hold count elements.
+ */
+void mvt_row_unpack(mvt_row_t row, size_t x, size_t count, mvt_char_t *text_buffer, mvt_attribute_t *attribute_buffer, const mvt_char_t **text, const mvt_attribute_t **attribute)
+{
+#ifdef ENABLE_SPLIT_CELLS
+    *text = &row.text[x];
+    *attribute = &row.attribute[x];
+#else
+    const mvt_cell_t *p = &row[x];
+    *text = text_buffer;
+    *attribute = attribute_buffer;
+    while (count--) {
+        *text_buffer++ = p->text;
+        *attribute_buffer++ = p->attribute;
+        p++;
+    }
+#endif
+}
+
+/**
+ * Copy cells into a buffer as they are laid out in memory, which
+ * mvt_row_load reads back.
+ * @param buf where to write, or NULL to get the size
+ * @return number of bytes
+ */
+size_t mvt_row_save(mvt_row_t row, size_t count, void *buf)
+{
+#ifdef ENABLE_SPLIT_CELLS
+    if (buf) {
+        memcpy(buf, row.text, count * sizeof (mvt_char_t));
+        memcpy((char *)buf + count * sizeof (mvt_char_t), row.attribute, count * sizeof (mvt_attribute_t));
+    }
+    return count * (sizeof (mvt_char_t) + sizeof (mvt_attribute_t));
+#else
+    if (buf)
+        memcpy(buf, row, count * sizeof (mvt_cell_t));
+    return count * sizeof (mvt_cell_t);
+#endif
+}
+
+void mvt_row_load(mvt_row_t row, size_t count, const void *buf)
+{
+#ifdef ENABLE_SPLIT_CELLS
+    memcpy(row.text, buf, count * sizeof (mvt_char_t));
+    memcpy(row.attribute, (const char *)buf + count * sizeof (mvt_char_t), count * sizeof (mvt_attribute_t));
+#else
+    memcpy(row, buf, count * sizeof (mvt_cell_t));
+#endif
+}
+
+/** @} */
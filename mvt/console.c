@@ -41,13 +41,48 @@
  **/
 
 /**
- * Get the offset in the buffer
+ * Get the line
  * @param console a console
- * @param virtual_y virtual Y position 
+ * @param virtual_y virtual Y position
  */
-#define mvt_console_offset(console, virtual_y)                  \
-    ((((virtual_y) + (console)->offset)                         \
-      % (console)->virtual_height) * (console)->width)
+#define mvt_console_line(console, virtual_y)                    \
+    (&(console)->lines[((virtual_y) + (console)->offset)        \
+                       % (console)->virtual_height])
+
+/* a line or a history longer than this is taken as broken data */
+#define MVT_CONSOLE_MAX_SAVED_SIZE 0x1000000
+
+#define MVT_CONSOLE_SAVED_BLANK   (1 << 0)
+#define MVT_CONSOLE_SAVED_WRAPPED (1 << 1)
+
+/**
+ * the state saved by mvt_console_save. It is followed by the title,
+ * a mvt_console_saved_line_t for each virtual line from the top and
+ * the cells of the lines which are not blank.
+ */
+typedef struct _mvt_console_saved {
+    int32_t width;
+    int32_t height;
+    int32_t save_height;
+    int32_t virtual_height;
+    int32_t top;
+    int32_t cursor_x;
+    int32_t cursor_y;
+    int32_t save_cursor_x;
+    int32_t save_cursor_y;
+    int32_t show_cursor;
+    int32_t scroll_y1;
+    int32_t scroll_y2;
+    mvt_attribute_t attribute;
+    mvt_attribute_t reset_attribute;
+    uint32_t title_length;
+} mvt_console_saved_t;
+
+typedef struct _mvt_console_saved_line {
+    int32_t width; /** number of cells saved */
+    uint32_t flags;
+    mvt_attribute_t blank_attribute;
+} mvt_console_saved_line_t;
 
 #define mvt_console_get_char_pointer(console, offset) ((char *)NULL)
 #define mvt_console_get_color_pair_pointer(console, offset) ((char *)NULL)
@@ -56,9 +91,17 @@
 
 static size_t mvt_console_write0(mvt_console_t *console, const mvt_char_t *ws, size_t len);
 static void mvt_console_erase_line0(mvt_console_t *console, int startx, int endx, int cy);
-static void mvt_console_clear_buffer(mvt_console_t *consle, size_t offset, size_t length);
+static void mvt_console_reset_line(const mvt_console_t *console, mvt_line_t *line);
+static int mvt_console_virtual_height(const mvt_console_t *console, int height);
+static int mvt_console_init0(mvt_console_t *console, int width, int height, int save_height, int virtual_height);
 static int mvt_console_resize0(mvt_console_t *console, int width, int height, int virtual_height);
-static void mvt_console_copy_buffer(mvt_console_t *console, size_t dst_offset, size_t src_offset, size_t count);
+static int mvt_console_rewrap(const mvt_console_t *console, int start, int width, mvt_line_t **lines, int *count, int *cursor_x, int *cursor_y);
+static const mvt_attribute_t *mvt_console_blank_attribute(const mvt_console_t *console, const mvt_line_t *line);
+static const mvt_attribute_t *mvt_console_attribute_at(const mvt_line_t *line, int x);
+static mvt_char_t mvt_console_text_at(const mvt_line_t *line, int x);
+static mvt_line_t *mvt_console_fill_line(mvt_console_t *console, int y);
+static void mvt_console_clear_line(mvt_console_t *console, int y);
+static void mvt_console_swap_lines(mvt_console_t *console, int y1, int y2);
 static void mvt_console_scroll(mvt_console_t *console, int start, int end, int count);
 static void mvt_console_erase_display0(mvt_console_t *console, int start, int end);
 static int mvt_console_adjust_to_char(const mvt_console_t *console, int x, int y, int *rx);
@@ -67,6 +110,11 @@ static void mvt_console_update(const mvt_console_t *console, int x1, int y1, int
 static void mvt_console_clear_selection(mvt_console_t *console);
 
 int mvt_console_init(mvt_console_t *console, int width, int height, int save_height)
+{
+    return mvt_console_init0(console, width, height, save_height, height + save_height);
+}
+
+static int mvt_console_init0(mvt_console_t *console, int width, int height, int save_height, int virtual_height)
 {
     memset(console, 0, sizeof (*console));
     console->attribute.foreground_color = MVT_DEFAULT_COLOR;
@@ -81,7 +129,7 @@ int mvt_console_init(mvt_console_t *console, int width, int height, int save_hei
     console->selection_y1 = -1;
     console->selection_x2 = -1;
     console->selection_y2 = -1;
-    if (mvt_console_resize0(console, width, height, height + save_height) == -1) {
+    if (mvt_console_resize0(console, width, height, virtual_height) == -1) {
         free(console->title);
         return -1;
     }
@@ -90,8 +138,14 @@ int mvt_console_init(mvt_console_t *console, int width, int height, int save_hei
 
 void mvt_console_destroy(mvt_console_t *console)
 {
-    free(console->text_buffer);
-    free(console->attribute_buffer);
+    int y;
+    if (console->lines) {
+        for (y = 0; y < console->virtual_height; y++)
+            mvt_row_free(&console->lines[y].cells);
+        free(console->lines);
+    }
+    free(console->paint_text);
+    free(console->paint_attribute);
     if (console->input_buffer) free(console->input_buffer);
     if (console->title) free(console->title);
     memset(console, 0, sizeof *console);
@@ -107,7 +161,7 @@ int mvt_console_set_screen(mvt_console_t *console, mvt_screen_t *screen)
     assert(width > 0);
     assert(height > 0);
     if (console->width != width || console->height != height)
-        mvt_console_resize0(console, width, height, height + console->save_height);
+        mvt_console_resize0(console, width, height, mvt_console_virtual_height(console, height));
     mvt_screen_move_cursor(console->screen, MVT_CURSOR_CURRENT, console->cursor_x, console->cursor_y);
     mvt_screen_set_scroll_info(console->screen, console->top, console->top + console->height);
     mvt_screen_set_title(console->screen, console->title);
@@ -136,7 +190,7 @@ int mvt_console_resize(mvt_console_t *console)
     old_cursor_y = console->cursor_y - console->top;
     if (old_cursor_y >= height)
         old_cursor_y = height - 1;
-    if (mvt_console_resize0(console, width, height, height + console->save_height) == -1)
+    if (mvt_console_resize0(console, width, height, mvt_console_virtual_height(console, height)) == -1)
         return -1;
     mvt_screen_move_cursor(console->screen, MVT_CURSOR_CURRENT, old_cursor_x, old_cursor_y + console->top);
     mvt_screen_set_scroll_info(console->screen, console->top, console->top + console->height);
@@ -151,7 +205,8 @@ mvt_console_begin (mvt_console_t *console)
 
     assert(!console->gc);
 
-    console->gc = mvt_screen_begin(console->screen);
+    if (console->screen)
+        console->gc = mvt_screen_begin(console->screen);
     
     if (console->show_cursor) {
         x = console->cursor_x;
@@ -243,6 +298,8 @@ mvt_console_write (mvt_console_t *console, const mvt_char_t *ws, size_t count)
         count -= n;
         if (count > 0) {
             MVT_DEBUG_PRINT1("mvt_console_write: wrapped\n");
+            if (!mvt_console_blank_attribute(console, mvt_console_line(console, console->cursor_y)))
+                mvt_console_line(console, console->cursor_y)->wrapped = TRUE;
             mvt_console_carriage_return(console);
             mvt_console_line_feed(console);
         }
@@ -252,13 +309,14 @@ mvt_console_write (mvt_console_t *console, const mvt_char_t *ws, size_t count)
 static size_t mvt_console_write0(mvt_console_t *console, const mvt_char_t *ws, size_t count)
 {
     const mvt_char_t *p = ws;
-    mvt_char_t wc, *text;
+    mvt_char_t wc;
     mvt_attribute_t *attribute;
-    int new_x, char_width, offset;
+    mvt_line_t *line;
+    int new_x, char_width;
 
-    offset = mvt_console_offset(console, console->cursor_y);
-    text = &console->text_buffer[offset + console->cursor_x];
-    attribute = &console->attribute_buffer[offset + console->cursor_x];
+    line = mvt_console_fill_line(console, console->cursor_y);
+    if (!line)
+        return count;
     new_x = console->cursor_x;
     while (count--) {
         wc = *p;
@@ -271,16 +329,15 @@ static size_t mvt_console_write0(mvt_console_t *console, const mvt_char_t *ws, s
             /* the character doesn't fit in the line */
             break;
         }
-        *text++ = wc;
+        mvt_row_text(line->cells, new_x) = wc;
+        attribute = &mvt_row_attribute(line->cells, new_x);
         *attribute = console->attribute;
-        if (char_width > 1)
-            attribute->wide = TRUE;
-        attribute++;
         if (char_width > 1) {
-            *text++ = '\0';
+            attribute->wide = TRUE;
+            mvt_row_text(line->cells, new_x + 1) = '\0';
+            attribute = &mvt_row_attribute(line->cells, new_x + 1);
             *attribute = console->attribute;
             attribute->no_char = TRUE;
-            attribute++;
         }
         p++;
         new_x += char_width;
@@ -327,8 +384,6 @@ void mvt_console_carriage_return(mvt_console_t *console)
 void
 mvt_console_line_feed (mvt_console_t *console)
 {
-    size_t offset;
-
     /* MVT_DEBUG_PRINT2("mvt_console_line_feed: height=%d,top=%d,offset=%d,virtual_height=%d\n", console->height, console->top, console->top, console->virtual_height); */
 
     if (console->cursor_y == console->scroll_y2) {
@@ -347,15 +402,15 @@ mvt_console_line_feed (mvt_console_t *console)
     if (console->top + console->height < console->virtual_height) {
         console->top++;
         console->cursor_y++;
-        mvt_screen_set_scroll_info(console->screen, console->top, console->top + console->height);
+        if (console->screen)
+            mvt_screen_set_scroll_info(console->screen, console->top, console->top + console->height);
         return;
     }
 
     console->offset++;
     if (console->offset >= console->virtual_height)
         console->offset = 0;
-    offset = mvt_console_offset(console, console->cursor_y);
-    mvt_console_clear_buffer(console, offset, console->width);
+    mvt_console_clear_line(console, console->cursor_y);
     if (mvt_console_has_selection(console)) {
         if (console->selection_y1 == 0) {
             console->selection_x1 = -1;
@@ -433,6 +488,48 @@ mvt_console_update (const mvt_console_t *console, int x1, int y1, int x2, int y2
     mvt_console_paint(console, console->gc, x1, y1, x2, y2);
 }
 
+/**
+ * Get cells of a line into the scratch rows if they are not stored
+ * as they are painted.
+ * @param y virtual Y position
+ **/
+static void
+mvt_console_get_cells (const mvt_console_t *console, int x1, int y, int count, const mvt_char_t **text_ret, const mvt_attribute_t **attribute_ret)
+{
+    const mvt_line_t *line = mvt_console_line(console, y);
+    const mvt_attribute_t *blank = mvt_console_blank_attribute(console, line);
+    const mvt_char_t *text = console->paint_text;
+    const mvt_attribute_t *attribute = console->paint_attribute;
+    int n = 0;
+    if (!blank) {
+        n = line->width - x1;
+        if (n > count)
+            n = count;
+        if (n > 0)
+            mvt_row_unpack(line->cells, x1, n,
+                           console->paint_text, console->paint_attribute,
+                           &text, &attribute);
+        blank = &line->blank_attribute;
+    }
+    if (n < count) {
+        /* a blank line or a line narrower than the console */
+        int x;
+        if (n < 0)
+            n = 0;
+        if (n > 0 && text != console->paint_text) {
+            memcpy(console->paint_text, text, n * sizeof (mvt_char_t));
+            memcpy(console->paint_attribute, attribute, n * sizeof (mvt_attribute_t));
+        }
+        memset(&console->paint_text[n], 0, (count - n) * sizeof (mvt_char_t));
+        for (x = n; x < count; x++)
+            console->paint_attribute[x] = *blank;
+        text = console->paint_text;
+        attribute = console->paint_attribute;
+    }
+    *text_ret = text;
+    *attribute_ret = attribute;
+}
+
 /*! 
  * Paint the specified area.
  * @param console console
@@ -453,21 +550,217 @@ mvt_console_paint (const mvt_console_t *console, void *gc, int x1, int y1, int x
     assert(y2 < console->top + console->height);
     
     while (y1 <= y2) {
-        int offset = mvt_console_offset(console, y1);
-        mvt_char_t *text = &console->text_buffer[offset + x1];
-        mvt_attribute_t *attribute = &console->attribute_buffer[offset + x1];
-        mvt_screen_draw_text(console->screen, gc, x1, y1, text, attribute, x2 - x1 + 1);
+        const mvt_char_t *text;
+        const mvt_attribute_t *attribute;
+        int count = x2 - x1 + 1;
+        mvt_console_get_cells(console, x1, y1, count, &text, &attribute);
+        mvt_screen_draw_text(console->screen, gc, x1, y1, text, attribute, count);
         y1++;
     }
 }
 
+/**
+ * Take a copy of the visible cells, the cursor and the title for
+ * remote viewers.
+ * @retval 0 success
+ * @retval -1 out of memory
+ */
+int
+mvt_console_capture (const mvt_console_t *console, mvt_stream_state_t *state)
+{
+    const mvt_char_t *text;
+    const mvt_attribute_t *attribute;
+    size_t title_length = 0;
+    int x, y;
+    if (state->width != console->width || state->height != console->height) {
+        if (mvt_stream_state_resize(state, console->width, console->height) == -1)
+            return -1;
+    }
+    if (console->title)
+        while (console->title[title_length])
+            title_length++;
+    if (title_length != state->title_length
+        || (title_length > 0 && memcmp(console->title, state->title, title_length * sizeof (mvt_char_t)) != 0)) {
+        if (mvt_stream_state_set_title(state, console->title, title_length) == -1)
+            return -1;
+    }
+    for (y = 0; y < console->height; y++) {
+        mvt_char_t *state_text = &state->text[(size_t)y * console->width];
+        uint32_t *state_attribute = &state->attribute[(size_t)y * console->width];
+        mvt_console_get_cells(console, 0, console->top + y, console->width, &text, &attribute);
+        memcpy(state_text, text, console->width * sizeof (mvt_char_t));
+        for (x = 0; x < console->width; x++)
+            state_attribute[x] = mvt_stream_pack_attribute(&attribute[x]);
+    }
+    state->cursor_x = console->cursor_x;
+    state->cursor_y = console->cursor_y - console->top;
+    state->cursor_visible = console->show_cursor;
+    return 0;
+}
+
+/**
+ * Save the lines, the cursor, the scroll region and the title. The
+ * cells are copied a line at a time as they are in memory, so the
+ * data is read back only by the same build.
+ * @param buf where to write, or NULL to get the size
+ * @return number of bytes
+ */
+size_t
+mvt_console_save (const mvt_console_t *console, uint8_t *buf)
+{
+    mvt_console_saved_t saved;
+    mvt_console_saved_line_t saved_line;
+    size_t title_length, lines_offset, offset;
+    int y;
+
+    title_length = console->title ? mvt_strlen(console->title) : 0;
+    if (buf) {
+        saved.width = console->width;
+        saved.height = console->height;
+        saved.save_height = console->save_height;
+        saved.virtual_height = console->virtual_height;
+        saved.top = console->top;
+        saved.cursor_x = console->cursor_x;
+        saved.cursor_y = console->cursor_y;
+        saved.save_cursor_x = console->save_cursor_x;
+        saved.save_cursor_y = console->save_cursor_y;
+        saved.show_cursor = console->show_cursor;
+        saved.scroll_y1 = console->scroll_y1;
+        saved.scroll_y2 = console->scroll_y2;
+        saved.attribute = console->attribute;
+        saved.reset_attribute = console->reset_attribute;
+        saved.title_length = title_length;
+        memcpy(buf, &saved, sizeof saved);
+        if (title_length > 0)
+            memcpy(buf + sizeof saved, console->title, title_length * sizeof (mvt_char_t));
+    }
+    lines_offset = sizeof saved + title_length * sizeof (mvt_char_t);
+    offset = lines_offset + console->virtual_height * sizeof saved_line;
+    for (y = 0; y < console->virtual_height; y++) {
+        const mvt_line_t *line = mvt_console_line(console, y);
+        const mvt_attribute_t *blank = mvt_console_blank_attribute(console, line);
+        if (blank) {
+            saved_line.width = 0;
+            saved_line.flags = MVT_CONSOLE_SAVED_BLANK;
+            saved_line.blank_attribute = *blank;
+        } else {
+            saved_line.width = line->width;
+            saved_line.flags = line->wrapped ? MVT_CONSOLE_SAVED_WRAPPED : 0;
+            saved_line.blank_attribute = line->blank_attribute;
+            offset += mvt_row_save(line->cells, line->width, buf ? buf + offset : NULL);
+        }
+        if (buf)
+            memcpy(buf + lines_offset + y * sizeof saved_line, &saved_line, sizeof saved_line);
+    }
+    return offset;
+}
+
+/**
+ * Load the state saved by mvt_console_save. The console keeps its
+ * screen and its input, and is repainted if it has a screen. It is
+ * left unchanged on failure.
+ * @return number of bytes read, or 0 if the data is broken or out of
+ * memory
+ */
+size_t
+mvt_console_restore (mvt_console_t *console, const uint8_t *data, size_t count)
+{
+    mvt_console_t new_console;
+    mvt_console_saved_t saved;
+    mvt_console_saved_line_t saved_line;
+    size_t lines_offset, offset, n;
+    int virtual_height, y;
+
+    if (count < sizeof saved)
+        return 0;
+    memcpy(&saved, data, sizeof saved);
+    if (saved.width < 1 || saved.width > MVT_CONSOLE_MAX_SAVED_SIZE
+        || saved.height < 1 || saved.height > MVT_CONSOLE_MAX_SAVED_SIZE
+        || saved.save_height < 0 || saved.save_height > MVT_CONSOLE_MAX_SAVED_SIZE
+        || saved.virtual_height < saved.height + saved.save_height
+        || saved.virtual_height > 3 * MVT_CONSOLE_MAX_SAVED_SIZE
+        || saved.title_length > (count - sizeof saved) / sizeof (mvt_char_t))
+        return 0;
+    virtual_height = saved.virtual_height;
+    lines_offset = sizeof saved + saved.title_length * sizeof (mvt_char_t);
+    if ((count - lines_offset) / sizeof saved_line < (size_t)virtual_height
+        || saved.top < 0 || saved.top + saved.height > virtual_height
+        || saved.cursor_x < 0 || saved.cursor_x > saved.width
+        || saved.cursor_y < 0 || saved.cursor_y >= virtual_height
+        || saved.save_cursor_x < 0 || saved.save_cursor_x > saved.width
+        || saved.save_cursor_y < 0 || saved.save_cursor_y >= saved.height
+        || (saved.scroll_y1 != -1
+            && (saved.scroll_y1 < 0 || saved.scroll_y1 > saved.scroll_y2
+                || saved.scroll_y2 >= virtual_height)))
+        return 0;
+
+    if (mvt_console_init0(&new_console, saved.width, saved.height, saved.save_height, virtual_height) == -1)
+        return 0;
+    offset = lines_offset + virtual_height * sizeof saved_line;
+    for (y = 0; y < virtual_height; y++) {
+        mvt_line_t *line = &new_console.lines[y];
+        memcpy(&saved_line, data + lines_offset + y * sizeof saved_line, sizeof saved_line);
+        line->blank_attribute = saved_line.blank_attribute;
+        if (saved_line.flags & MVT_CONSOLE_SAVED_BLANK)
+            continue;
+        if (saved_line.width < 1 || saved_line.width > MVT_CONSOLE_MAX_SAVED_SIZE)
+            goto error;
+        n = mvt_row_save(line->cells, saved_line.width, NULL);
+        if (count - offset < n)
+            goto error;
+        if (mvt_row_alloc(&line->cells, saved_line.width) == -1)
+            goto error;
+        mvt_row_load(line->cells, saved_line.width, data + offset);
+        offset += n;
+        line->capacity = saved_line.width;
+        line->width = saved_line.width;
+        line->blank = FALSE;
+        line->wrapped = (saved_line.flags & MVT_CONSOLE_SAVED_WRAPPED) != 0;
+    }
+    new_console.title = malloc((saved.title_length + 1) * sizeof (mvt_char_t));
+    if (!new_console.title)
+        goto error;
+    memcpy(new_console.title, data + sizeof saved, saved.title_length * sizeof (mvt_char_t));
+    new_console.title[saved.title_length] = '\0';
+
+    new_console.top = saved.top;
+    new_console.cursor_x = saved.cursor_x;
+    new_console.cursor_y = saved.cursor_y;
+    new_console.save_cursor_x = saved.save_cursor_x;
+    new_console.save_cursor_y = saved.save_cursor_y;
+    new_console.show_cursor = saved.show_cursor;
+    new_console.scroll_y1 = saved.scroll_y1;
+    new_console.scroll_y2 = saved.scroll_y2;
+    /* the saved lines below the screen may hold text */
+    new_console.below_height = virtual_height - saved.top - saved.height;
+    new_console.attribute = saved.attribute;
+    new_console.reset_attribute = saved.reset_attribute;
+
+    /* the input is not part of the state */
+    new_console.input_buffer = console->input_buffer;
+    new_console.input_buffer_index = console->input_buffer_index;
+    new_console.input_buffer_length = console->input_buffer_length;
+    console->input_buffer = NULL;
+    new_console.screen = console->screen;
+    mvt_console_destroy(console);
+    *console = new_console;
+    if (console->screen) {
+        mvt_console_set_screen(console, console->screen);
+        mvt_console_repaint(console);
+    }
+    return offset;
+error:
+    mvt_console_destroy(&new_console);
+    return 0;
+}
+
 void mvt_console_repaint(const mvt_console_t *console)
 {
     void *gc;
     if (!console->screen) return;
     gc = mvt_screen_begin(console->screen);
     if (gc == NULL) return;
-    mvt_console_paint(console, gc, 0, 0, console->width - 1, console->height - 1);
+    mvt_console_paint(console, gc, 0, console->top, console->width - 1, console->top + console->height - 1);
     mvt_screen_end(console->screen, gc);
     mvt_screen_set_scroll_info(console->screen, console->top, console->top + console->height);
 }
@@ -483,10 +776,8 @@ mvt_console_erase_display0 (mvt_console_t *console, int y1, int y2)
     int y;
     if (y2 < y1)
         return;
-    for (y = y1; y <= y2; y++) {
-        int offset = mvt_console_offset(console, y);
-        mvt_console_clear_buffer(console, offset, width);
-    }
+    for (y = y1; y <= y2; y++)
+        mvt_console_clear_line(console, y);
     if (!console->screen) return;
     if (!console->gc) return;
     mvt_screen_clear_rect(console->screen, console->gc, 0, y1, width - 1, y2,
@@ -500,12 +791,18 @@ mvt_console_erase_display0 (mvt_console_t *console, int y1, int y2)
 static void
 mvt_console_erase_line0 (mvt_console_t *console, int x1, int x2, int y)
 {
-    int offset = mvt_console_offset(console, y);
+    mvt_line_t *line;
     int char_width;
     (void)mvt_console_adjust_to_char(console, x1, y, &x1);
     char_width = mvt_console_adjust_to_char(console, x2, y, &x2);
     x2 += char_width - 1;
-    mvt_console_clear_buffer(console, offset + x1, x2 - x1 + 1);
+    if (x1 == 0 && x2 == console->width - 1) {
+        mvt_console_clear_line(console, y);
+    } else {
+        line = mvt_console_fill_line(console, y);
+        if (line)
+            mvt_row_fill(line->cells, x1, x2 - x1 + 1, &console->attribute);
+    }
     if (!console->screen) return;
     if (!console->gc) return;
     mvt_screen_clear_rect(console->screen, console->gc, x1, y, x2, y,
@@ -517,6 +814,9 @@ mvt_console_delete_lines (mvt_console_t *console, int count)
 {
   int start = console->cursor_y > console->scroll_y1 ? console->cursor_y : console->scroll_y1;
   int end = console->scroll_y2 == -1 ? console->virtual_height - 1 : console->scroll_y2;
+  if (count < 0 && console->scroll_y2 == -1)
+      /* lines inserted push the bottom of the screen below it */
+      console->below_height -= count;
   mvt_console_scroll(console, start, end, -count);
 }
 
@@ -527,28 +827,28 @@ mvt_console_delete_lines (mvt_console_t *console, int count)
 static void
 mvt_console_move_chars (mvt_console_t *console, int x1, int x2, int y, int count)
 {
-    int offset;
-    offset = mvt_console_offset(console, y);
+    mvt_line_t *line = mvt_console_fill_line(console, y);
+    if (!line)
+        return;
     if (count > 0) {
         if (x2 - x1 - count + 1 > 0) {
-            mvt_console_copy_buffer(console, offset + x1 + count, offset + x1,
-                                    x2 - x1 - count + 1);
-            mvt_console_clear_buffer(console, offset + x1, count);
+            mvt_row_move(line->cells, x1 + count, line->cells, x1,
+                         x2 - x1 - count + 1);
+            mvt_row_fill(line->cells, x1, count, &console->attribute);
         } else {
-            mvt_console_clear_buffer(console, offset + x1, x2 - x1 + 1);
+            mvt_row_fill(line->cells, x1, x2 - x1 + 1, &console->attribute);
         }
     } else {
         if (x2 - x1 + count + 1 > 0) {
-            mvt_console_copy_buffer(console, offset + x1, offset + x1 - count,
-                                    x2 - x1 + count + 1);
-            mvt_console_clear_buffer(console, offset + x2 + count + 1, -count);
+            mvt_row_move(line->cells, x1, line->cells, x1 - count,
+                         x2 - x1 + count + 1);
+            mvt_row_fill(line->cells, x2 + count + 1, -count, &console->attribute);
         } else {
-            mvt_console_clear_buffer(console, offset + x1, x2 - x1 + 1);
+            mvt_row_fill(line->cells, x1, x2 - x1 + 1, &console->attribute);
         }
     }
     if (!console->screen) return;
     if (!console->gc) return;
-    offset = mvt_console_offset(console, y);
     if (count > 0) {
         if (x2 - x1 - count + 1 > 0) {
             mvt_console_paint(console, console->gc, x1 + count, y, x2, y);
@@ -616,24 +916,17 @@ mvt_console_scroll (mvt_console_t *console, int y1, int y2, int count)
         scroll_height += count;
 
     for (i = 0; i < scroll_height; i++) {
-        int src_offset, dst_offset;
-        if (count > 0) {
-            src_offset = mvt_console_offset(console, y2 - i - count);
-            dst_offset = mvt_console_offset(console, y2 - i);
-        } else {
-            src_offset = mvt_console_offset(console, y1 + i - count);
-            dst_offset = mvt_console_offset(console, y1 + i);
-        }
-        mvt_console_copy_buffer(console, dst_offset, src_offset, width);
+        if (count > 0)
+            mvt_console_swap_lines(console, y2 - i, y2 - i - count);
+        else
+            mvt_console_swap_lines(console, y1 + i, y1 + i - count);
     }
 
     clear_height = count > 0 ? count : -count;
 
     j = count > 0 ? y1 : y2 - clear_height + 1;
-    for (i = 0; i < clear_height; i++) {
-        int offset = mvt_console_offset(console, i + j);
-        mvt_console_clear_buffer(console, offset, width);
-    }
+    for (i = 0; i < clear_height; i++)
+        mvt_console_clear_line(console, i + j);
 
     if (!console->screen) return;
     if (scroll_height > 0) {
@@ -651,25 +944,103 @@ mvt_console_scroll (mvt_console_t *console, int y1, int y2, int count)
     mvt_screen_end(console->screen, gc);
 }
 
-static void mvt_console_clear_buffer(mvt_console_t *console, size_t offset, size_t count)
+/**
+ * Get the attribute of a blank line
+ * @param console a console
+ * @param line a line
+ * @return the attribute to clear the line with, or NULL if the cells
+ * of the line are valid
+ */
+static const mvt_attribute_t *mvt_console_blank_attribute(const mvt_console_t *console, const mvt_line_t *line)
 {
-    mvt_char_t *ws;
-    mvt_attribute_t *attribute;
-    ws = &console->text_buffer[offset];
-    memset(ws, 0, sizeof (mvt_char_t) * count);
-    attribute = &console->attribute_buffer[offset];
-    while (count--)
-        *attribute++ = console->attribute;
+    if (line->generation != console->generation)
+        return &console->reset_attribute;
+    if (line->blank)
+        return &line->blank_attribute;
+    return NULL;
+}
+
+/**
+ * Get the attribute of a cell of a line which isn't blank. Cells
+ * beyond the width of the line have the blank attribute.
+ */
+static const mvt_attribute_t *mvt_console_attribute_at(const mvt_line_t *line, int x)
+{
+    if (x >= line->width)
+        return &line->blank_attribute;
+    return &mvt_row_attribute(line->cells, x);
+}
+
+/**
+ * Get the text of a cell of a line which isn't blank
+ */
+static mvt_char_t mvt_console_text_at(const mvt_line_t *line, int x)
+{
+    if (x >= line->width)
+        return '\0';
+    return mvt_row_text(line->cells, x);
 }
 
-static void mvt_console_copy_buffer(mvt_console_t *console, size_t dst_offset, size_t src_offset, size_t count)
+/**
+ * Make the cells of a line valid and as wide as the console so that
+ * it can be modified
+ * @param y virtual Y position
+ * @return the line, or NULL if out of memory
+ */
+static mvt_line_t *mvt_console_fill_line(mvt_console_t *console, int y)
+{
+    mvt_line_t *line = mvt_console_line(console, y);
+    const mvt_attribute_t *blank = mvt_console_blank_attribute(console, line);
+    int width = console->width;
+    if (!blank && line->width == width)
+        return line;
+    if (line->capacity < width) {
+        if (mvt_row_realloc(&line->cells, width) == -1)
+            return NULL;
+        line->capacity = width;
+    }
+    if (blank) {
+        line->blank_attribute = *blank;
+        line->wrapped = FALSE;
+        mvt_row_fill(line->cells, 0, width, &line->blank_attribute);
+    } else if (line->width < width) {
+        mvt_row_fill(line->cells, line->width, width - line->width, &line->blank_attribute);
+    } else if (mvt_row_attribute(line->cells, width - 1).wide) {
+        /* don't leave the left half of a zenkaku character */
+        mvt_row_fill(line->cells, width - 1, 1, &line->blank_attribute);
+    }
+    line->width = width;
+    line->generation = console->generation;
+    line->blank = FALSE;
+    return line;
+}
+
+/**
+ * Clear a whole line with the current attribute without touching
+ * its cells
+ * @param y virtual Y position
+ */
+static void mvt_console_clear_line(mvt_console_t *console, int y)
+{
+    mvt_line_t *line = mvt_console_line(console, y);
+    line->generation = console->generation;
+    line->blank = TRUE;
+    line->wrapped = FALSE;
+    line->blank_attribute = console->attribute;
+}
+
+/**
+ * Exchange two lines. The cells are not copied.
+ * @param y1 virtual Y position
+ * @param y2 virtual Y position
+ */
+static void mvt_console_swap_lines(mvt_console_t *console, int y1, int y2)
 {
-    memmove(&console->text_buffer[dst_offset],
-            &console->text_buffer[src_offset],
-            count * sizeof (mvt_char_t));
-    memmove(&console->attribute_buffer[dst_offset],
-            &console->attribute_buffer[src_offset],
-            count * sizeof (mvt_attribute_t));
+    mvt_line_t *line1 = mvt_console_line(console, y1);
+    mvt_line_t *line2 = mvt_console_line(console, y2);
+    mvt_line_t t = *line1;
+    *line1 = *line2;
+    *line2 = t;
 }
 
 int mvt_console_set_save_height(mvt_console_t *console, int save_height)
@@ -681,83 +1052,319 @@ int mvt_console_set_save_height(mvt_console_t *console, int save_height)
     return 0;
 }
 
-static int mvt_console_resize0(mvt_console_t *console, int width, int height, int virtual_height)
+/**
+ * Add a line to an array of lines
+ * @retval 0 success
+ * @retval -1 out of memory
+ */
+static int mvt_console_append_line(mvt_line_t **lines, int *count, int *size, const mvt_line_t *line)
 {
-    mvt_char_t *new_text_buffer, *new_text, *old_text;
-    mvt_attribute_t *new_attribute_buffer, *new_attribute, *old_attribute;
-    size_t size;
-    int offset, new_top;
-    int y, copy_start, copy_width, copy_height, new_cursor_y;
-
-    size = width * virtual_height;
-    new_text_buffer = malloc(size * sizeof (mvt_char_t));
-    if (!new_text_buffer)
-        return -1;
-    new_attribute_buffer = malloc(size * sizeof (mvt_attribute_t));
-    if (!new_attribute_buffer) {
-        free(new_text_buffer);
+    if (*count == *size) {
+        int new_size = *size ? *size * 2 : 16;
+        mvt_line_t *new_lines = realloc(*lines, new_size * sizeof (mvt_line_t));
+        if (!new_lines)
+            return -1;
+        *lines = new_lines;
+        *size = new_size;
+    }
+    (*lines)[(*count)++] = *line;
+    return 0;
+}
+
+/**
+ * Wrap the text from a line to the bottom of the screen again at a
+ * new width. Lines wrapped by mvt_console_write are joined and split
+ * at the new width; other lines are kept as they are. The lines of
+ * the console are not changed.
+ * @param console a console
+ * @param start virtual Y position of the first line, which must not
+ * be a continued line
+ * @param width new width
+ * @param lines new lines to be set
+ * @param count number of new lines to be set
+ * @param cursor_x new X position of the cursor to be set
+ * @param cursor_y new virtual Y position of the cursor to be set
+ * @retval 0 success
+ * @retval -1 out of memory
+ */
+static int
+mvt_console_rewrap (const mvt_console_t *console, int start, int width, mvt_line_t **lines, int *count, int *cursor_x, int *cursor_y)
+{
+    int end = console->top + console->height;
+    mvt_line_t *new_lines = NULL;
+    int new_count = 0, new_size = 0;
+    mvt_row_t buffer;
+    size_t size = 0;
+    int y;
+
+    /* a buffer for the cells of one text */
+    for (y = start; y < end; y++) {
+        const mvt_line_t *line = mvt_console_line(console, y);
+        size += line->width > console->width ? line->width : console->width;
+    }
+    if (mvt_row_alloc(&buffer, size) == -1)
         return -1;
+
+    y = start;
+    while (y < end) {
+        const mvt_line_t *line;
+        const mvt_attribute_t *blank;
+        mvt_attribute_t pad;
+        int length = 0, last = 0, cursor = -1, src, n;
+
+        /* join the lines of the text */
+        do {
+            line = mvt_console_line(console, y);
+            blank = mvt_console_blank_attribute(console, line);
+            last = length;
+            if (y == console->cursor_y)
+                cursor = length + console->cursor_x;
+            if (blank) {
+                pad = *blank;
+            } else {
+                pad = line->blank_attribute;
+                mvt_row_move(buffer, length, line->cells, 0, line->width);
+                length += line->width;
+                /* a zenkaku character didn't fit in the last column */
+                if (line->wrapped && length > last
+                    && mvt_row_text(buffer, length - 1) == '\0'
+                    && !mvt_row_attribute(buffer, length - 1).no_char)
+                    length--;
+            }
+            y++;
+        } while (!blank && line->wrapped && y < end);
+
+        /* trailing blanks are not a part of the text */
+        while (length > last && length > cursor
+               && mvt_row_text(buffer, length - 1) == '\0'
+               && !mvt_row_attribute(buffer, length - 1).no_char
+               && mvt_row_attribute(buffer, length - 1).background_color == pad.background_color
+               && mvt_row_attribute(buffer, length - 1).reverse == pad.reverse)
+            length--;
+        if (cursor > length) {
+            mvt_row_fill(buffer, length, cursor - length, &pad);
+            length = cursor;
+        }
+
+        /* split it at the new width */
+        src = 0;
+        do {
+            mvt_line_t new_line;
+            memset(&new_line, 0, sizeof new_line);
+            new_line.generation = console->generation;
+            new_line.blank_attribute = pad;
+            n = length - src;
+            if (n > width)
+                n = width;
+            /* don't split a zenkaku character */
+            if (n == width && n > 1 && src + n < length
+                && mvt_row_attribute(buffer, src + n - 1).wide)
+                n--;
+            if (length == 0) {
+                new_line.blank = TRUE;
+            } else {
+                if (mvt_row_alloc(&new_line.cells, width) == -1)
+                    goto error;
+                new_line.capacity = width;
+                new_line.width = width;
+                new_line.wrapped = src + n < length;
+                mvt_row_move(new_line.cells, 0, buffer, src, n);
+                mvt_row_fill(new_line.cells, n, width - n, &pad);
+            }
+            if (cursor >= src && (cursor < src + n || src + n == length)) {
+                *cursor_x = cursor - src;
+                *cursor_y = start + new_count;
+                cursor = -1;
+            }
+            if (mvt_console_append_line(&new_lines, &new_count, &new_size, &new_line) == -1) {
+                mvt_row_free(&new_line.cells);
+                goto error;
+            }
+            src += n;
+        } while (src < length);
     }
-    new_text = new_text_buffer;
-    new_attribute = new_attribute_buffer;
-    while (size--) {
-        *new_text++ = '\0';
-        *new_attribute++ = console->attribute;
+
+    mvt_row_free(&buffer);
+    *lines = new_lines;
+    *count = new_count;
+    return 0;
+
+ error:
+    while (new_count > 0)
+        mvt_row_free(&new_lines[--new_count].cells);
+    free(new_lines);
+    mvt_row_free(&buffer);
+    return -1;
+}
+
+/**
+ * Make a line blank, freeing its cells
+ */
+static void mvt_console_reset_line(const mvt_console_t *console, mvt_line_t *line)
+{
+    mvt_row_free(&line->cells);
+    memset(line, 0, sizeof (mvt_line_t));
+    line->generation = console->generation;
+    line->blank = TRUE;
+    line->blank_attribute = console->attribute;
+}
+
+/**
+ * Get the number of lines the ring needs for a screen. The ring is
+ * kept while the screen and the history fit in it, so that resizing
+ * the window doesn't move the history. Once the screen outgrows it,
+ * room is made for twice the height.
+ */
+static int mvt_console_virtual_height(const mvt_console_t *console, int height)
+{
+    if (height + console->save_height <= console->virtual_height)
+        return console->virtual_height;
+    return height * 2 + console->save_height;
+}
+
+/**
+ * Lay the console out at a new size. When the number of lines in
+ * the ring doesn't change, the ring stays in place and only the
+ * screen, with the text continued into it from up to a screen above,
+ * is rewrapped. History lines keep the width they were written at.
+ */
+static int mvt_console_resize0(mvt_console_t *console, int width, int height, int virtual_height)
+{
+    mvt_line_t *new_lines = NULL, *wrapped_lines = NULL;
+    mvt_char_t *new_paint_text = NULL;
+    mvt_attribute_t *new_paint_attribute = NULL;
+    int wrapped_count = 0;
+    int y, start, end, count, shift, new_top, new_cursor_x, new_cursor_y;
+
+    if (virtual_height != console->virtual_height) {
+        new_lines = malloc(virtual_height * sizeof (mvt_line_t));
+        if (!new_lines)
+            return -1;
+    }
+    if (width != console->width) {
+        new_paint_text = malloc(width * sizeof (mvt_char_t));
+        new_paint_attribute = malloc(width * sizeof (mvt_attribute_t));
+        if (!new_paint_text || !new_paint_attribute) {
+            free(new_lines);
+            free(new_paint_text);
+            free(new_paint_attribute);
+            return -1;
+        }
     }
 
-    /* If there's an old buffer, copy from it */
-    if (console->text_buffer) {
+    /* If there's an old buffer, move lines from it */
+    if (console->lines) {
+        int old_end = console->top + console->height;
         new_top = console->top;
+        new_cursor_x = console->cursor_x;
         new_cursor_y = console->cursor_y;
-        copy_start = 0;
-        copy_width = console->width;
-        copy_height = console->top + console->height;
-        if (copy_width > width)
-            copy_width = width;
-        if (height > console->height) {
-            assert(height - console->height > 0);
-            new_top -= height - console->height;
-            if (new_top < 0) {
-                new_top = 0;
+        start = old_end;
+        if (width != console->width) {
+            /* rewrap the screen and the text continued into it */
+            start = console->top;
+            while (start > 0 && start > console->top - height) {
+                const mvt_line_t *line = mvt_console_line(console, start - 1);
+                if (mvt_console_blank_attribute(console, line) || !line->wrapped)
+                    break;
+                start--;
+            }
+            if (mvt_console_rewrap(console, start, width, &wrapped_lines, &wrapped_count,
+                                   &new_cursor_x, &new_cursor_y) == -1) {
+                free(new_lines);
+                free(new_paint_text);
+                free(new_paint_attribute);
+                return -1;
             }
+            new_top = start;
+        }
+        /* lines 0 to end - 1 are kept lines followed by rewrapped lines */
+        end = start + wrapped_count;
+        if (new_top + height > end) {
+            new_top = end - height;
+            if (new_top < 0)
+                new_top = 0;
         }
         if (new_cursor_y >= new_top + height) {
-            copy_height = console->cursor_y + 1;
-            new_top = copy_height - height;
+            end = new_cursor_y + 1;
+            new_top = end - height;
         }
-        if (copy_height > virtual_height) {
-            assert(copy_height - virtual_height > 0);
-            copy_start = copy_height - virtual_height;
-            new_top = virtual_height - height;
-			new_cursor_y -= copy_height - virtual_height;
-            copy_height = virtual_height;
+        if (end > new_top + virtual_height)
+            end = new_top + virtual_height;
+        count = end > new_top + height ? end : new_top + height;
+        shift = count > virtual_height ? count - virtual_height : 0;
+
+        if (new_lines) {
+            for (y = 0; y < virtual_height; y++) {
+                int src = y + shift;
+                if (src < end) {
+                    if (src < start)
+                        new_lines[y] = *mvt_console_line(console, src);
+                    else
+                        new_lines[y] = wrapped_lines[src - start];
+                } else {
+                    memset(&new_lines[y], 0, sizeof (mvt_line_t));
+                    mvt_console_reset_line(console, &new_lines[y]);
+                }
+            }
+            /* free the lines which are not moved */
+            for (y = 0; y < console->virtual_height; y++) {
+                if (y >= start || y < shift || y >= end)
+                    mvt_row_free(&mvt_console_line(console, y)->cells);
+            }
+            free(console->lines);
+            console->lines = new_lines;
+            console->offset = 0;
+        } else {
+            /* blank the rewrapped lines, the lines cut off below the
+             * cursor or below the screen, and the oldest lines which
+             * make room */
+            int clear_end = count < virtual_height ? count : virtual_height;
+            if (clear_end < old_end + console->below_height)
+                clear_end = old_end + console->below_height;
+            if (clear_end > virtual_height)
+                clear_end = virtual_height;
+            for (y = start < end ? start : end; y < clear_end; y++)
+                mvt_console_reset_line(console, mvt_console_line(console, y));
+            for (y = 0; y < shift && y < start; y++)
+                mvt_console_reset_line(console, mvt_console_line(console, y));
+            console->offset = (console->offset + shift) % virtual_height;
         }
-        for (y = 0; y < copy_height; y++) {
-            new_text = &new_text_buffer[y * width];
-            new_attribute = &new_attribute_buffer[y * width];
-            offset = mvt_console_offset(console, y + copy_start);
-            old_text = &console->text_buffer[offset];
-            old_attribute = &console->attribute_buffer[offset];
-            memcpy(new_text, old_text, copy_width * sizeof (mvt_char_t));
-            memcpy(new_attribute, old_attribute, copy_width * sizeof (mvt_attribute_t));
+        for (y = 0; y < wrapped_count; y++) {
+            if (start + y < shift || start + y >= end)
+                mvt_row_free(&wrapped_lines[y].cells);
+            else if (!new_lines)
+                *mvt_console_line(console, start + y - shift) = wrapped_lines[y];
         }
-        free(console->text_buffer);
-        free(console->attribute_buffer);
-        if (console->cursor_x > width)
-            console->cursor_x = width - 1;
+        free(wrapped_lines);
+        new_top -= shift;
+        new_cursor_y -= shift;
+        end -= shift;
+        console->below_height = end > new_top + height ? end - new_top - height : 0;
+        if (new_cursor_x > width)
+            new_cursor_x = width - 1;
     } else {
+        for (y = 0; y < virtual_height; y++) {
+            memset(&new_lines[y], 0, sizeof (mvt_line_t));
+            mvt_console_reset_line(console, &new_lines[y]);
+        }
+        console->lines = new_lines;
+        console->offset = 0;
         new_top = 0;
-        console->cursor_x = 0;
+        new_cursor_x = 0;
         new_cursor_y = 0;
     }
     /* xterm resets scroll region and Emacs depends on it. */
     console->scroll_y1 = -1;
     console->scroll_y2 = -1;
+    console->cursor_x = new_cursor_x;
     console->cursor_y = new_cursor_y;
-    console->text_buffer = new_text_buffer;
-    console->attribute_buffer = new_attribute_buffer;
+    if (new_paint_text) {
+        free(console->paint_text);
+        free(console->paint_attribute);
+        console->paint_text = new_paint_text;
+        console->paint_attribute = new_paint_attribute;
+    }
     console->top = new_top;
-    console->offset = 0;
     console->width = width;
     console->height = height;
     console->virtual_height = virtual_height;
@@ -804,7 +1411,13 @@ void mvt_console_full_reset(mvt_console_t *console)
     memset(&console->attribute, 0, sizeof (console->attribute));
     console->attribute.foreground_color = MVT_DEFAULT_COLOR;
     console->attribute.background_color = MVT_DEFAULT_COLOR;
-    mvt_console_clear_buffer(console, 0, console->width * console->virtual_height);
+    console->reset_attribute = console->attribute;
+    if (++console->generation == 0) {
+        /* the generation wrapped around, lines can't tell it any more */
+        int y;
+        for (y = 0; y < console->virtual_height; y++)
+            mvt_console_clear_line(console, y);
+    }
     console->top = 0;
     console->cursor_x = 0;
     console->cursor_y = 0;
@@ -819,26 +1432,25 @@ void mvt_console_full_reset(mvt_console_t *console)
 int mvt_console_append_input(mvt_console_t *console, const mvt_char_t *ws, size_t count)
 {
     mvt_char_t *new_buf;
-    size_t new_count;
+    size_t rest = 0;
     if (console->input_buffer) {
-        new_count = console->input_buffer_length
-            - console->input_buffer_index + count;
-        new_buf = malloc(new_count * sizeof (mvt_char_t));
+        /* the keys not read yet go first */
+        rest = console->input_buffer_length - console->input_buffer_index;
+        new_buf = malloc((rest + count) * sizeof (mvt_char_t));
         if (new_buf == NULL)
             return -1;
         memcpy(new_buf, console->input_buffer + console->input_buffer_index,
-               (console->input_buffer_length - console->input_buffer_index) * sizeof (mvt_char_t));
+               rest * sizeof (mvt_char_t));
         free(console->input_buffer);
-        memcpy(new_buf + console->input_buffer_index, ws, count * sizeof (mvt_char_t));
     } else {
         new_buf = malloc(count * sizeof (mvt_char_t));
         if (new_buf == NULL)
             return -1;
-        memcpy(new_buf, ws, count * sizeof (mvt_char_t));
     }
+    memcpy(new_buf + rest, ws, count * sizeof (mvt_char_t));
     console->input_buffer = new_buf;
     console->input_buffer_index = 0;
-    console->input_buffer_length += count;
+    console->input_buffer_length = rest + count;
     return 0;
 }
 
@@ -1033,7 +1645,7 @@ mvt_console_get_selection (const mvt_console_t *console, int *x1, int *y1, int *
 static int
 mvt_console_adjust_to_char (const mvt_console_t *console, int x, int y, int *rx)
 {
-    size_t offset = mvt_console_offset(console, y);
+    const mvt_line_t *line = mvt_console_line(console, y);
     int char_width;
 
     assert(rx != NULL);
@@ -1041,13 +1653,18 @@ mvt_console_adjust_to_char (const mvt_console_t *console, int x, int y, int *rx)
     /* cursor is at the last columns */
     if (x == console->width) x--;
 
+    if (mvt_console_blank_attribute(console, line)) {
+        *rx = x;
+        return 1;
+    }
+
     /* cursor is at the right half of a zenkaku character */
-    if (console->attribute_buffer[x + offset].no_char) {
+    if (mvt_console_attribute_at(line, x)->no_char) {
         assert(x > 0);
         if (x > 0) x--;
     }
 
-    if (console->attribute_buffer[x + offset].wide)
+    if (mvt_console_attribute_at(line, x)->wide)
         char_width = 2;
     else
         char_width = 1;
@@ -1061,32 +1678,34 @@ mvt_console_adjust_to_char (const mvt_console_t *console, int x, int y, int *rx)
 static void
 mvt_console_adjust_point_to_char (const mvt_console_t *console, int end, int x, int y, int align, int *rx, int *ry)
 {
-    mvt_char_t *text;
-    mvt_attribute_t *attribute;
-    int offset;
+    const mvt_line_t *line;
 
     assert(rx != NULL && ry != NULL);
 
-    offset = mvt_console_offset(console, y);
-    text = &console->text_buffer[offset];
-    attribute = &console->attribute_buffer[offset];
+    line = mvt_console_line(console, y);
     if (align != 0) {
-        if (attribute[x].no_char) {
+        if (mvt_console_blank_attribute(console, line)) {
+            /* every character of a blank line is NIL */
+            if (align > 0)
+                x++;
+            if (x > 0)
+                x = console->width;
+        } else if (mvt_console_attribute_at(line, x)->no_char) {
             x++;
             while (x < console->width) {
-                if (!attribute[x].no_char) {
+                if (!mvt_console_attribute_at(line, x)->no_char) {
                     break;
                 }
                 x++;
             }
-        } else if (!attribute[x].wide) {
+        } else if (!mvt_console_attribute_at(line, x)->wide) {
             if (align > 0)
                 x++;
-            if (x > 0 && text[x - 1] == '\0' && !attribute[x - 1].no_char) {
+            if (x > 0 && mvt_console_text_at(line, x - 1) == '\0' && !mvt_console_attribute_at(line, x - 1)->no_char) {
                 int t = x;
                 /* check if this NIL character is beyond the end of line */
                 while (t < console->width) {
-                    if (text[t] != '\0') {
+                    if (mvt_console_text_at(line, t) != '\0') {
                         t = x;
                         break;
                     }
@@ -0,0 +1,256 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Time the console hot paths on a terminal without a driver.
+ *
+ *   console_bench [-w width] [-h height] [-s save_height] [-n count]
+ *
+ * The grid operations run with no screen attached. Paint and resize
+ * run against a screen whose functions do nothing, so they measure
+ * the console and not a renderer.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mvt/mvt.h>
+#include "private.h"
+
+static int bench_width = 200;
+static int bench_height = 60;
+static int bench_top;
+
+static unsigned long long get_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *null_begin(mvt_screen_t *screen)
+{
+    return screen;
+}
+
+static void null_end(mvt_screen_t *screen, void *gc)
+{
+}
+
+static void null_draw_text(mvt_screen_t *screen, void *gc, int x, int y, const mvt_char_t *ws, const mvt_attribute_t *attribute, size_t count)
+{
+}
+
+static void null_clear_rect(mvt_screen_t *screen, void *gc, int x1, int y1, int x2, int y2, mvt_color_t background_color)
+{
+}
+
+static void null_scroll(mvt_screen_t *screen, int y1, int y2, int count)
+{
+}
+
+static void null_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor, int x, int y)
+{
+}
+
+static void null_beep(mvt_screen_t *screen)
+{
+}
+
+static void null_get_size(mvt_screen_t *screen, int *width, int *height)
+{
+    *width = bench_width;
+    *height = bench_height;
+}
+
+static int null_resize(mvt_screen_t *screen, int width, int height)
+{
+    bench_width = width;
+    bench_height = height;
+    return 0;
+}
+
+static void null_set_title(mvt_screen_t *screen, const mvt_char_t *ws)
+{
+}
+
+static void null_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height)
+{
+    /* the first visible line, which paint takes */
+    bench_top = scroll_position;
+}
+
+static void null_set_mode(mvt_screen_t *screen, int mode, int value)
+{
+}
+
+static const mvt_screen_vt_t null_screen_vt = {
+    null_begin,
+    null_end,
+    null_draw_text,
+    null_clear_rect,
+    null_scroll,
+    null_move_cursor,
+    null_beep,
+    null_get_size,
+    null_resize,
+    null_set_title,
+    null_set_scroll_info,
+    null_set_mode
+};
+
+static mvt_screen_t null_screen = {
+    &null_screen_vt,
+    NULL,
+    NULL
+};
+
+static void write_ascii(mvt_terminal_t *terminal, const char *s)
+{
+    mvt_char_t buf[512];
+    size_t count = 0;
+    while (*s) {
+        buf[count++] = (unsigned char)*s++;
+        if (count == sizeof buf / sizeof buf[0]) {
+            mvt_terminal_write(terminal, buf, count);
+            count = 0;
+        }
+    }
+    if (count > 0)
+        mvt_terminal_write(terminal, buf, count);
+}
+
+/* write the same sequence count times and return the time per write */
+static double time_write(mvt_terminal_t *terminal, const char *s, int count)
+{
+    unsigned long long nsec;
+    int i;
+    nsec = get_nsec();
+    for (i = 0; i < count; i++)
+        write_ascii(terminal, s);
+    return (double)(get_nsec() - nsec) / count;
+}
+
+static void report(const char *name, double nsec, const char *unit)
+{
+    if (nsec >= 10000)
+        printf("  %-14s %8.1f us  %s\n", name, nsec / 1000, unit);
+    else
+        printf("  %-14s %8.0f ns  %s\n", name, nsec, unit);
+}
+
+int main(int argc, char *argv[])
+{
+    mvt_terminal_t *terminal;
+    char line[1024], seq[64];
+    unsigned long long nsec;
+    int save_height = 1000;
+    int count = 10000;
+    int width, height;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "w:h:s:n:")) != -1) {
+        switch (c) {
+        case 'w':
+            bench_width = atoi(optarg);
+            break;
+        case 'h':
+            bench_height = atoi(optarg);
+            break;
+        case 's':
+            save_height = atoi(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-w width] [-h height] [-s save_height] [-n count]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc || bench_width < 8 || bench_width >= (int)sizeof line - 3
+        || bench_height < 4 || save_height < 0 || count <= 0) {
+        fprintf(stderr, "usage: %s [-w width] [-h height] [-s save_height] [-n count]\n", argv[0]);
+        return 1;
+    }
+    width = bench_width;
+    height = bench_height;
+    terminal = mvt_terminal_new(width, height, save_height);
+    if (!terminal) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+#ifdef ENABLE_SPLIT_CELLS
+    printf("%dx%d, %d lines of history, split cells\n", width, height, save_height);
+#else
+    printf("%dx%d, %d lines of history, packed cells\n", width, height, save_height);
+#endif
+
+    /* fill the history so that scrolling drops lines */
+    for (i = 0; i < width - 1; i++)
+        line[i] = 'a' + i % 26;
+    line[i++] = '\r';
+    line[i++] = '\n';
+    line[i] = '\0';
+    for (i = 0; i < height + save_height; i++)
+        write_ascii(terminal, line);
+    report("write+LF", time_write(terminal, line, count), "per line");
+
+    /* LF at the bottom of a region which does not reach the history */
+    snprintf(seq, sizeof seq, "\033[2;%dr\033[%d;1H", height - 1, height - 1);
+    write_ascii(terminal, seq);
+    report("scroll", time_write(terminal, "\n", count), "per region scroll");
+    write_ascii(terminal, "\033[r");
+
+    snprintf(seq, sizeof seq, "\033[%d;%dH", height / 2, width / 2);
+    write_ascii(terminal, seq);
+    report("ICH/DCH", time_write(terminal, "\033[4@\033[4P", count) / 2, "per op");
+
+    report("ED 2", time_write(terminal, "\033[2J", count), "per screen");
+
+    snprintf(seq, sizeof seq, "\033[%d;1H\033[K", height / 2);
+    report("EL 0", time_write(terminal, seq, count), "per line");
+
+    /* put text back for paint to draw */
+    write_ascii(terminal, "\033[H");
+    for (i = 0; i < height; i++)
+        write_ascii(terminal, line);
+
+    mvt_terminal_set_screen(terminal, &null_screen);
+    nsec = get_nsec();
+    for (i = 0; i < count; i++)
+        mvt_terminal_paint(terminal, &null_screen, 0, bench_top, width - 1, bench_top + height - 1);
+    report("paint (full)", (double)(get_nsec() - nsec) / count, "per frame, null draw_text");
+
+    /* one column narrower and back, with the history full */
+    nsec = get_nsec();
+    for (i = 0; i < count / 100 + 1; i++) {
+        null_resize(&null_screen, width - (i % 2 == 0), height);
+        mvt_terminal_resize(terminal);
+    }
+    report("resize", (double)(get_nsec() - nsec) / (count / 100 + 1), "per resize");
+
+    mvt_terminal_set_screen(terminal, NULL);
+    mvt_terminal_delete(terminal);
+    return 0;
+}
@@ -12,6 +12,8 @@ spec = spec .. ",height=34"
 mvtui.default_screen_spec = spec
 mvtui.default_terminal_spec_list = {}
 mvtui.default_session_spec = nil
+mvtui.pool_spec = "pty"
+mvtui.pool_size = 0
 screen = mvtui.start_default_ui()
 
 screen.theme_normal = function (this)
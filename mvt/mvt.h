@@ -51,6 +51,33 @@ typedef struct _mvt_screen mvt_screen_t;
 typedef struct _mvt_session mvt_session_t;
 typedef struct _mvt_terminal mvt_terminal_t;
 typedef uint32_t mvt_char_t;
+typedef struct _mvt_iovec mvt_iovec_t;
+typedef struct _mvt_session_stats mvt_session_stats_t;
+typedef struct _mvt_stream_stats mvt_stream_stats_t;
+
+/* a piece of the bytes written at once with mvt_session_writev() */
+struct _mvt_iovec {
+    const void *base;
+    size_t len;
+};
+
+/* what went through a session, and the time spent in it without the
+ * time spent in its source */
+struct _mvt_session_stats {
+    unsigned long long read_calls;
+    unsigned long long read_bytes;
+    unsigned long long read_nsec;
+    unsigned long long write_calls;
+    unsigned long long write_bytes;
+    unsigned long long write_nsec;
+};
+
+/* what was sent to a remote viewer of the screen */
+struct _mvt_stream_stats {
+    unsigned long long updates;
+    unsigned long long bytes;
+    unsigned long long encode_usec;
+};
 
 extern const int mvt_major_version;
 extern const int mvt_minor_version;
@@ -89,22 +116,34 @@ void mvt_terminal_repaint(const mvt_terminal_t *terminal);
 int mvt_terminal_keydown(mvt_terminal_t *terminal, int meta, int code);
 int mvt_terminal_mousebutton(mvt_terminal_t *terminal, int down, int button, uint32_t mod, int x, int y, int align);
 int mvt_terminal_mousemove(mvt_terminal_t *terminal, int x, int y, int align);
+int mvt_terminal_save(const mvt_terminal_t *terminal, void **data, size_t *size);
+int mvt_terminal_restore(mvt_terminal_t *terminal, const void *data, size_t size);
 
 /* mvt_session_t */
 void mvt_session_close(mvt_session_t *session);
 int mvt_session_connect(mvt_session_t *session);
 int mvt_session_read(mvt_session_t *session, void *buf, size_t count, size_t *countread);
 int mvt_session_write(mvt_session_t *session, const void *buf, size_t count, size_t *countwrite);
+int mvt_session_writev(mvt_session_t *session, const mvt_iovec_t *iov, int iovcnt, size_t *countwrite);
 void mvt_session_shutdown(mvt_session_t *session);
 void mvt_session_resize(mvt_session_t *session, int width, int height);
+int mvt_session_is_alive(mvt_session_t *session);
+void mvt_session_get_stats(const mvt_session_t *session, mvt_session_stats_t *stats);
 
 /* mvt_session_t */
 mvt_session_t *mvt_socket_open(char **args, mvt_session_t *source, int width, int height);
 mvt_session_t *mvt_telnet_open(char **args, mvt_session_t *source, int width, int height);
+int mvt_telnet_get_compression(mvt_session_t *session, unsigned long long *read_bytes,
+                               unsigned long long *inflated_bytes,
+                               unsigned long long *written_bytes,
+                               unsigned long long *deflated_bytes);
 mvt_session_t *mvt_pty_open(char **args, mvt_session_t *source, int width, int height);
-mvt_session_t *mvt_pipe_open (void);
+mvt_session_t *mvt_exec_open(char **args, mvt_session_t *source, int width, int height);
+mvt_session_t *mvt_log_open(char **args, mvt_session_t *source, int width, int height);
+mvt_session_t *mvt_pipe_open(char **args, mvt_session_t *source, int width, int height);
 void *mvt_pipe_lock_in(mvt_session_t *session, size_t count);
 void mvt_pipe_unlock_in(mvt_session_t *session, size_t count);
+void mvt_pipe_close_in(mvt_session_t *session);
 void *mvt_pipe_lock_out(mvt_session_t *session, size_t *count);
 void mvt_pipe_unlock_out(mvt_session_t *session, size_t count);
 
@@ -138,6 +177,10 @@ int mvt_set_terminal_attribute(mvt_terminal_t *terminal, const char *name, const
 int mvt_attach(mvt_terminal_t *terminal, mvt_screen_t *screen);
 int mvt_open(mvt_terminal_t *terminal, const char *spec);
 int mvt_connect(mvt_terminal_t *terminal);
+mvt_session_t *mvt_get_session(mvt_terminal_t *terminal);
+int mvt_get_session_stats(mvt_terminal_t *terminal, int index, mvt_session_stats_t *stats);
+int mvt_get_stream_stats(mvt_terminal_t *terminal, int index, mvt_stream_stats_t *stats);
+int mvt_set_pool(const char *spec, int size);
 void mvt_suspend(mvt_terminal_t *terminal);
 void mvt_resume(mvt_terminal_t *terminal);
 void mvt_shutdown(mvt_terminal_t *terminal);
@@ -0,0 +1,1088 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* A driver which renders screens into an in-memory RGBA framebuffer
+ * without any display. Frames can be written as PPM or PNG files. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <assert.h>
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+#include <immintrin.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <mvt/mvt.h>
+#include "misc.h"
+#include "debug.h"
+#include "driver.h"
+
+/* Default number of frames presented per second at most */
+#define MVT_HEADLESS_FRAME_RATE 60
+
+/* Initial number of glyphs in the atlas */
+#define MVT_HEADLESS_GLYPH_CAPACITY 128
+
+/* The palette has the 256 colors, then the default colors */
+#define MVT_HEADLESS_DEFAULT_FOREGROUND MVT_DEFAULT_COLOR
+#define MVT_HEADLESS_DEFAULT_BACKGROUND (MVT_DEFAULT_COLOR + 1)
+#define MVT_HEADLESS_PALETTE_SIZE (MVT_DEFAULT_COLOR + 2)
+
+typedef struct _mvt_headless_screen mvt_headless_screen_t;
+
+struct _mvt_headless_screen {
+    mvt_screen_t parent;
+
+    /* size in cells and the framebuffer */
+    int width, height;
+    uint32_t *pixels;
+    int pixel_width, pixel_height;
+
+    /* font */
+    char *font_path;
+    int font_size;
+    FT_Face face;
+    int cell_width, cell_height;
+    int ascender;
+
+    /* Glyph atlas. Each glyph has a slot of alpha values two cells
+     * wide, so that wide characters fit. */
+    uint8_t *atlas;
+    mvt_char_t *glyph_chars;
+    int *glyph_hash;
+    int glyph_count, glyph_capacity;
+    int slot_width, slot_size;
+
+    uint32_t foreground_color;
+    uint32_t background_color;
+    uint32_t palette[MVT_HEADLESS_PALETTE_SIZE];
+
+    /* the virtual line at the top */
+    int scroll_top;
+
+    int cursor_x, cursor_y;
+    int selection_start_x, selection_start_y;
+    int selection_end_x, selection_end_y;
+
+    /* cells drawn between begin and end */
+    int invalid_left, invalid_top;
+    int invalid_right, invalid_bottom;
+    /* pixels changed since the last frame */
+    int damage_left, damage_top;
+    int damage_right, damage_bottom;
+
+    char *output;
+    unsigned int frame_interval;
+    unsigned int frame_ticks;
+    unsigned int frame_count;
+};
+
+typedef void (*mvt_blend_func_t)(uint32_t *p, const uint8_t *alpha, size_t count, uint32_t foreground, uint32_t background);
+
+/* Only one screen is presented */
+static mvt_headless_screen_t *global_headless_screen = NULL;
+static FT_Library library;
+static pthread_mutex_t headless_mutex;
+static pthread_cond_t headless_cond;
+static int request_pending;
+static int loop;
+
+/* utilities */
+static unsigned int mvt_headless_get_ticks(void);
+static uint32_t mvt_color_value_to_pixel(uint32_t color_value);
+static void mvt_fill_pixels(uint32_t *p, uint32_t pixel, size_t count);
+static void mvt_blend_init(uint32_t *p, const uint8_t *alpha, size_t count, uint32_t foreground, uint32_t background);
+static int mvt_headless_write_frame(const mvt_headless_screen_t *headless_screen, const char *filename);
+
+/* mvt_headless_screen_t */
+
+static void *mvt_headless_screen_begin(mvt_screen_t *screen);
+static void mvt_headless_screen_end(mvt_screen_t *screen, void *gc);
+static void mvt_headless_screen_draw_text(mvt_screen_t *screen, void *gc, int x, int y, const mvt_char_t *ws, const mvt_attribute_t *attribute, size_t len);
+static void mvt_headless_screen_clear_rect(mvt_screen_t *screen, void *gc, int x1, int y1, int x2, int y2, mvt_color_t background_color);
+static void mvt_headless_screen_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor, int x, int y);
+static void mvt_headless_screen_scroll(mvt_screen_t *screen, int y1, int y2, int count);
+static void mvt_headless_screen_beep(mvt_screen_t *screen);
+static void mvt_headless_screen_get_size(mvt_screen_t *screen, int *width, int *height);
+static int mvt_headless_screen_resize(mvt_screen_t *screen, int width, int height);
+static void mvt_headless_screen_set_title(mvt_screen_t *screen, const mvt_char_t *ws);
+static void mvt_headless_screen_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height);
+static void mvt_headless_screen_set_mode(mvt_screen_t *screen, int mode, int value);
+static int mvt_headless_set_screen_attribute0(mvt_headless_screen_t *headless_screen, const char *name, const char *value);
+
+static const mvt_screen_vt_t headless_screen_vt = {
+    mvt_headless_screen_begin,
+    mvt_headless_screen_end,
+    mvt_headless_screen_draw_text,
+    mvt_headless_screen_clear_rect,
+    mvt_headless_screen_scroll,
+    mvt_headless_screen_move_cursor,
+    mvt_headless_screen_beep,
+    mvt_headless_screen_get_size,
+    mvt_headless_screen_resize,
+    mvt_headless_screen_set_title,
+    mvt_headless_screen_set_scroll_info,
+    mvt_headless_screen_set_mode
+};
+
+static mvt_blend_func_t mvt_blend = mvt_blend_init;
+
+/**
+ * Blend the foreground over the background with the alpha values.
+ * x/255 is rounded as (x + 128 + ((x + 128) >> 8)) >> 8, which the
+ * SIMD kernels compute exactly as well, so frames do not depend on
+ * the CPU.
+ */
+static void mvt_blend_generic(uint32_t *p, const uint8_t *alpha, size_t count, uint32_t foreground, uint32_t background)
+{
+    const uint8_t *f = (const uint8_t *)&foreground;
+    const uint8_t *b = (const uint8_t *)&background;
+    uint8_t *d;
+    unsigned int a, x;
+    int i;
+    while (count--) {
+        a = *alpha++;
+        d = (uint8_t *)p++;
+        for (i = 0; i < 4; i++) {
+            x = f[i] * a + b[i] * (255 - a) + 128;
+            d[i] = (x + (x >> 8)) >> 8;
+        }
+    }
+}
+
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+
+__attribute__((target("sse2")))
+static void mvt_blend_sse2(uint32_t *p, const uint8_t *alpha, size_t count, uint32_t foreground, uint32_t background)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i f = _mm_unpacklo_epi8(_mm_set1_epi32(foreground), zero);
+    __m128i b = _mm_unpacklo_epi8(_mm_set1_epi32(background), zero);
+    __m128i max = _mm_set1_epi16(255);
+    __m128i half = _mm_set1_epi16(128);
+    __m128i a, lo, hi;
+    int a4;
+    for (; count >= 4; count -= 4, p += 4, alpha += 4) {
+        memcpy(&a4, alpha, sizeof a4);
+        if (a4 == 0) {
+            mvt_fill_pixels(p, background, 4);
+            continue;
+        }
+        /* each alpha value repeated for the 4 channels, 2 pixels a vector */
+        a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(a4), zero);
+        a = _mm_unpacklo_epi16(a, a);
+        lo = _mm_unpacklo_epi32(a, a);
+        hi = _mm_unpackhi_epi32(a, a);
+        lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(f, lo),
+                                         _mm_mullo_epi16(b, _mm_sub_epi16(max, lo))), half);
+        hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(f, hi),
+                                         _mm_mullo_epi16(b, _mm_sub_epi16(max, hi))), half);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(lo, hi));
+    }
+    mvt_blend_generic(p, alpha, count, foreground, background);
+}
+
+#endif
+
+/**
+ * Choose the blend kernel for this CPU on the first call.
+ */
+static void mvt_blend_init(uint32_t *p, const uint8_t *alpha, size_t count, uint32_t foreground, uint32_t background)
+{
+    mvt_blend_func_t blend = mvt_blend_generic;
+#ifdef HAVE_BUILTIN_CPU_SUPPORTS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        blend = mvt_blend_sse2;
+#endif
+    mvt_blend = blend;
+    (*mvt_blend)(p, alpha, count, foreground, background);
+}
+
+static void mvt_fill_pixels(uint32_t *p, uint32_t pixel, size_t count)
+{
+    while (count--)
+        *p++ = pixel;
+}
+
+static int mvt_headless_screen_init(mvt_headless_screen_t *headless_screen)
+{
+    memset(headless_screen, 0, sizeof *headless_screen);
+    headless_screen->parent.vt = &headless_screen_vt;
+    headless_screen->width = 80;
+    headless_screen->height = 24;
+    headless_screen->font_size = 12;
+    headless_screen->foreground_color = 0xffffff;
+    headless_screen->background_color = 0;
+    headless_screen->selection_start_x = -1;
+    headless_screen->selection_start_y = -1;
+    headless_screen->selection_end_x = -1;
+    headless_screen->selection_end_y = -1;
+    headless_screen->frame_interval = 1000 / MVT_HEADLESS_FRAME_RATE;
+    return 0;
+}
+
+static void mvt_headless_screen_destroy(mvt_headless_screen_t *headless_screen)
+{
+    if (headless_screen->face)
+        FT_Done_Face(headless_screen->face);
+    free(headless_screen->font_path);
+    free(headless_screen->atlas);
+    free(headless_screen->glyph_chars);
+    free(headless_screen->glyph_hash);
+    free(headless_screen->pixels);
+    free(headless_screen->output);
+    memset(headless_screen, 0, sizeof *headless_screen);
+}
+
+static void mvt_headless_update_palette(mvt_headless_screen_t *headless_screen)
+{
+    int i;
+    for (i = 0; i < MVT_DEFAULT_COLOR; i++)
+        headless_screen->palette[i] = mvt_color_value_to_pixel(mvt_color_value(i));
+    headless_screen->palette[MVT_HEADLESS_DEFAULT_FOREGROUND] =
+        mvt_color_value_to_pixel(headless_screen->foreground_color);
+    headless_screen->palette[MVT_HEADLESS_DEFAULT_BACKGROUND] =
+        mvt_color_value_to_pixel(headless_screen->background_color);
+}
+
+/**
+ * Rasterize a glyph into a slot of the atlas.
+ */
+static void mvt_headless_rasterize(mvt_headless_screen_t *headless_screen, mvt_char_t wc, uint8_t *slot)
+{
+    FT_GlyphSlot glyph;
+    FT_Bitmap *bitmap;
+    int row, col, sx, sy, a;
+
+    memset(slot, 0, headless_screen->slot_size);
+    if (FT_Load_Char(headless_screen->face, wc, FT_LOAD_RENDER) != 0)
+        return;
+    glyph = headless_screen->face->glyph;
+    bitmap = &glyph->bitmap;
+    for (row = 0; row < (int)bitmap->rows; row++) {
+        sy = headless_screen->ascender - glyph->bitmap_top + row;
+        if (sy < 0 || sy >= headless_screen->cell_height)
+            continue;
+        for (col = 0; col < (int)bitmap->width; col++) {
+            sx = glyph->bitmap_left + col;
+            if (sx < 0 || sx >= headless_screen->slot_width)
+                continue;
+            if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO)
+                a = (bitmap->buffer[row * bitmap->pitch + col / 8] >> (7 - col % 8)) & 1 ? 255 : 0;
+            else
+                a = bitmap->buffer[row * bitmap->pitch + col];
+            slot[sy * headless_screen->slot_width + sx] = a;
+        }
+    }
+}
+
+static void mvt_headless_rehash(mvt_headless_screen_t *headless_screen)
+{
+    int hash_size = headless_screen->glyph_capacity * 2;
+    int i, h;
+    for (i = 0; i < hash_size; i++)
+        headless_screen->glyph_hash[i] = -1;
+    for (i = 0; i < headless_screen->glyph_count; i++) {
+        h = (headless_screen->glyph_chars[i] * 2654435761u) & (hash_size - 1);
+        while (headless_screen->glyph_hash[h] != -1)
+            h = (h + 1) & (hash_size - 1);
+        headless_screen->glyph_hash[h] = i;
+    }
+}
+
+/**
+ * Get the alpha values of a glyph, rasterizing it on the first use.
+ * @retval NULL out of memory
+ */
+static const uint8_t *mvt_headless_glyph(mvt_headless_screen_t *headless_screen, mvt_char_t wc)
+{
+    int hash_size = headless_screen->glyph_capacity * 2;
+    int h, i, capacity;
+    uint8_t *atlas;
+    mvt_char_t *glyph_chars;
+    int *glyph_hash;
+
+    h = (wc * 2654435761u) & (hash_size - 1);
+    while ((i = headless_screen->glyph_hash[h]) != -1) {
+        if (headless_screen->glyph_chars[i] == wc)
+            return &headless_screen->atlas[i * headless_screen->slot_size];
+        h = (h + 1) & (hash_size - 1);
+    }
+    if (headless_screen->glyph_count == headless_screen->glyph_capacity) {
+        capacity = headless_screen->glyph_capacity * 2;
+        atlas = realloc(headless_screen->atlas, capacity * headless_screen->slot_size);
+        if (!atlas)
+            return NULL;
+        headless_screen->atlas = atlas;
+        glyph_chars = realloc(headless_screen->glyph_chars, capacity * sizeof (mvt_char_t));
+        if (!glyph_chars)
+            return NULL;
+        headless_screen->glyph_chars = glyph_chars;
+        glyph_hash = realloc(headless_screen->glyph_hash, capacity * 2 * sizeof (int));
+        if (!glyph_hash)
+            return NULL;
+        headless_screen->glyph_hash = glyph_hash;
+        headless_screen->glyph_capacity = capacity;
+        mvt_headless_rehash(headless_screen);
+        hash_size = capacity * 2;
+        h = (wc * 2654435761u) & (hash_size - 1);
+        while (headless_screen->glyph_hash[h] != -1)
+            h = (h + 1) & (hash_size - 1);
+    }
+    i = headless_screen->glyph_count++;
+    headless_screen->glyph_chars[i] = wc;
+    headless_screen->glyph_hash[h] = i;
+    mvt_headless_rasterize(headless_screen, wc, &headless_screen->atlas[i * headless_screen->slot_size]);
+    return &headless_screen->atlas[i * headless_screen->slot_size];
+}
+
+/**
+ * Open the font and rasterize the printable ASCII characters.
+ */
+static int mvt_headless_update_font(mvt_headless_screen_t *headless_screen)
+{
+    const char *font_path;
+    FT_Face face;
+    mvt_char_t wc;
+    int capacity;
+
+    font_path = headless_screen->font_path;
+    if (!font_path)
+        font_path = getenv("MVT_FONTPATH");
+    if (!font_path)
+        font_path = "./font.ttf";
+    if (FT_New_Face(library, font_path, 0, &face) != 0) {
+        MVT_DEBUG_PRINT1("Unable to open TrueType font\n");
+        return -1;
+    }
+    if (FT_Set_Pixel_Sizes(face, 0, headless_screen->font_size) != 0
+        || FT_Load_Char(face, '0', FT_LOAD_DEFAULT) != 0) {
+        FT_Done_Face(face);
+        return -1;
+    }
+    if (headless_screen->face)
+        FT_Done_Face(headless_screen->face);
+    headless_screen->face = face;
+    headless_screen->cell_width = face->glyph->advance.x >> 6;
+    headless_screen->cell_height = face->size->metrics.height >> 6;
+    headless_screen->ascender = face->size->metrics.ascender >> 6;
+    if (headless_screen->cell_width < 1)
+        headless_screen->cell_width = 1;
+    if (headless_screen->cell_height < 1)
+        headless_screen->cell_height = 1;
+    headless_screen->slot_width = headless_screen->cell_width * 2;
+    headless_screen->slot_size = headless_screen->slot_width * headless_screen->cell_height;
+
+    capacity = MVT_HEADLESS_GLYPH_CAPACITY;
+    free(headless_screen->atlas);
+    free(headless_screen->glyph_chars);
+    free(headless_screen->glyph_hash);
+    headless_screen->atlas = malloc(capacity * headless_screen->slot_size);
+    headless_screen->glyph_chars = malloc(capacity * sizeof (mvt_char_t));
+    headless_screen->glyph_hash = malloc(capacity * 2 * sizeof (int));
+    headless_screen->glyph_count = 0;
+    headless_screen->glyph_capacity = capacity;
+    if (!headless_screen->atlas || !headless_screen->glyph_chars || !headless_screen->glyph_hash)
+        return -1;
+    mvt_headless_rehash(headless_screen);
+    for (wc = 0x21; wc < 0x7f; wc++)
+        mvt_headless_glyph(headless_screen, wc);
+    return mvt_headless_screen_resize((mvt_screen_t *)headless_screen,
+                                      headless_screen->width,
+                                      headless_screen->height);
+}
+
+static void mvt_headless_damage(mvt_headless_screen_t *headless_screen, int left, int top, int right, int bottom)
+{
+    if (headless_screen->damage_left >= headless_screen->damage_right) {
+        headless_screen->damage_left = left;
+        headless_screen->damage_top = top;
+        headless_screen->damage_right = right;
+        headless_screen->damage_bottom = bottom;
+        return;
+    }
+    if (headless_screen->damage_left > left)
+        headless_screen->damage_left = left;
+    if (headless_screen->damage_top > top)
+        headless_screen->damage_top = top;
+    if (headless_screen->damage_right < right)
+        headless_screen->damage_right = right;
+    if (headless_screen->damage_bottom < bottom)
+        headless_screen->damage_bottom = bottom;
+}
+
+static void *mvt_headless_screen_begin(mvt_screen_t *screen)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    headless_screen->invalid_left = headless_screen->width;
+    headless_screen->invalid_top = headless_screen->height;
+    headless_screen->invalid_right = -1;
+    headless_screen->invalid_bottom = -1;
+    return (void *)headless_screen->pixels;
+}
+
+static void mvt_headless_screen_end(mvt_screen_t *screen, void *gc)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    if (headless_screen->invalid_left <= headless_screen->invalid_right
+        && headless_screen->invalid_top <= headless_screen->invalid_bottom) {
+        mvt_headless_damage(headless_screen,
+                            headless_screen->invalid_left * headless_screen->cell_width,
+                            headless_screen->invalid_top * headless_screen->cell_height,
+                            (headless_screen->invalid_right + 1) * headless_screen->cell_width,
+                            (headless_screen->invalid_bottom + 1) * headless_screen->cell_height);
+    }
+}
+
+static void mvt_headless_invalidate(mvt_headless_screen_t *headless_screen, int x1, int y1, int x2, int y2)
+{
+    if (headless_screen->invalid_left > x1) headless_screen->invalid_left = x1;
+    if (headless_screen->invalid_top > y1) headless_screen->invalid_top = y1;
+    if (headless_screen->invalid_right < x2) headless_screen->invalid_right = x2;
+    if (headless_screen->invalid_bottom < y2) headless_screen->invalid_bottom = y2;
+}
+
+static void mvt_headless_screen_draw_text(mvt_screen_t *screen, void *gc, int x, int y, const mvt_char_t *ws, const mvt_attribute_t *attribute, size_t len)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    int cell_width = headless_screen->cell_width;
+    int cell_height = headless_screen->cell_height;
+    int pixel_width = headless_screen->pixel_width;
+    int foreground_index, background_index, swap_index;
+    int selection_x1, selection_x2, cursor_x;
+    int row, line, n, underline;
+    uint32_t foreground, background;
+    uint32_t *p;
+    const uint8_t *alpha;
+    mvt_char_t wc;
+
+    assert(x >= 0 && len <= (size_t)(headless_screen->width - x));
+    line = y - headless_screen->scroll_top;
+    if (line < 0 || line >= headless_screen->height || len == 0)
+        return;
+    mvt_headless_invalidate(headless_screen, x, line, x + len - 1, line);
+
+    /* the selected cells and the cursor on this line */
+    selection_x1 = 1;
+    selection_x2 = 0;
+    if (y >= headless_screen->selection_start_y && y <= headless_screen->selection_end_y) {
+        selection_x1 = y == headless_screen->selection_start_y ? headless_screen->selection_start_x : 0;
+        selection_x2 = y == headless_screen->selection_end_y ? headless_screen->selection_end_x : headless_screen->width;
+    }
+    cursor_x = y == headless_screen->cursor_y ? headless_screen->cursor_x : -1;
+    underline = headless_screen->ascender + 1;
+    if (underline >= cell_height)
+        underline = cell_height - 1;
+
+    for (; len > 0; len--, x++, ws++, attribute++) {
+        if (attribute->no_char)
+            continue;
+        n = attribute->wide && x + 1 < headless_screen->width ? 2 : 1;
+
+        foreground_index = attribute->foreground_color;
+        background_index = attribute->background_color;
+        if (background_index == MVT_DEFAULT_COLOR)
+            background_index = MVT_HEADLESS_DEFAULT_BACKGROUND;
+        if (x >= selection_x1 && x <= selection_x2) {
+            swap_index = background_index;
+            background_index = foreground_index;
+            foreground_index = swap_index;
+        }
+        if (x == cursor_x || attribute->reverse) {
+            swap_index = background_index;
+            background_index = foreground_index;
+            foreground_index = swap_index;
+        }
+        foreground = headless_screen->palette[foreground_index];
+        background = headless_screen->palette[background_index];
+
+        p = &headless_screen->pixels[line * cell_height * pixel_width + x * cell_width];
+        wc = *ws;
+        alpha = NULL;
+        if (wc > 0x20 && !attribute->hidden)
+            alpha = mvt_headless_glyph(headless_screen, wc);
+        for (row = 0; row < cell_height; row++, p += pixel_width) {
+            if (attribute->underscore && row == underline)
+                mvt_fill_pixels(p, foreground, n * cell_width);
+            else if (alpha)
+                (*mvt_blend)(p, &alpha[row * headless_screen->slot_width], n * cell_width,
+                             foreground, background);
+            else
+                mvt_fill_pixels(p, background, n * cell_width);
+        }
+    }
+}
+
+static void mvt_headless_screen_clear_rect(mvt_screen_t *screen, void *gc, int x1, int y1, int x2, int y2, mvt_color_t background_color)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    uint32_t *p, pixel;
+    int row, rows, count;
+    assert(x1 >= 0 && x2 >= x1 && headless_screen->width > x2);
+    y1 -= headless_screen->scroll_top;
+    y2 -= headless_screen->scroll_top;
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 >= headless_screen->height)
+        y2 = headless_screen->height - 1;
+    if (y1 > y2)
+        return;
+    mvt_headless_invalidate(headless_screen, x1, y1, x2, y2);
+    if (background_color == MVT_DEFAULT_COLOR)
+        background_color = MVT_HEADLESS_DEFAULT_BACKGROUND;
+    pixel = headless_screen->palette[background_color];
+    p = &headless_screen->pixels[y1 * headless_screen->cell_height * headless_screen->pixel_width
+                                 + x1 * headless_screen->cell_width];
+    rows = (y2 - y1 + 1) * headless_screen->cell_height;
+    count = (x2 - x1 + 1) * headless_screen->cell_width;
+    for (row = 0; row < rows; row++, p += headless_screen->pixel_width)
+        mvt_fill_pixels(p, pixel, count);
+}
+
+static void mvt_headless_screen_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor, int x, int y)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    switch (cursor) {
+    case MVT_CURSOR_CURRENT:
+        headless_screen->cursor_x = x;
+        headless_screen->cursor_y = y;
+        break;
+    case MVT_CURSOR_SELECTION_START:
+        headless_screen->selection_start_x = x;
+        headless_screen->selection_start_y = y;
+        break;
+    case MVT_CURSOR_SELECTION_END:
+        headless_screen->selection_end_x = x;
+        headless_screen->selection_end_y = y;
+        break;
+    }
+}
+
+/**
+ * Move rows down by count rows, or up if negative, and blank the
+ * rows left.
+ */
+static void mvt_headless_scroll_rows(mvt_headless_screen_t *headless_screen, int y1, int y2, int count)
+{
+    size_t pixels_per_row;
+    uint32_t *pixels;
+
+    if (count == 0)
+        return;
+    if (count >= y2 - y1 + 1 || count <= -(y2 - y1 + 1))
+        count = 0;
+    pixels = headless_screen->pixels;
+    pixels_per_row = (size_t)headless_screen->pixel_width * headless_screen->cell_height;
+    mvt_headless_damage(headless_screen, 0, y1 * headless_screen->cell_height,
+                        headless_screen->pixel_width, (y2 + 1) * headless_screen->cell_height);
+    if (count > 0) {
+        memmove(pixels + (y1 + count) * pixels_per_row,
+                pixels + y1 * pixels_per_row,
+                (y2 - y1 + 1 - count) * pixels_per_row * sizeof (uint32_t));
+        y2 = y1 + count - 1;
+    } else if (count < 0) {
+        memmove(pixels + y1 * pixels_per_row,
+                pixels + (y1 - count) * pixels_per_row,
+                (y2 - y1 + 1 + count) * pixels_per_row * sizeof (uint32_t));
+        y1 = y2 + count + 1;
+    }
+    /* the rows scrolled in, or all if everything has gone */
+    mvt_fill_pixels(pixels + y1 * pixels_per_row,
+                    headless_screen->palette[MVT_HEADLESS_DEFAULT_BACKGROUND],
+                    (y2 - y1 + 1) * pixels_per_row);
+}
+
+static void mvt_headless_screen_scroll(mvt_screen_t *screen, int y1, int y2, int count)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    y1 = y1 == -1 ? 0 : y1 - headless_screen->scroll_top;
+    y2 = y2 == -1 ? headless_screen->height - 1 : y2 - headless_screen->scroll_top;
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 >= headless_screen->height)
+        y2 = headless_screen->height - 1;
+    if (y1 <= y2)
+        mvt_headless_scroll_rows(headless_screen, y1, y2, count);
+}
+
+static void mvt_headless_screen_beep(mvt_screen_t *screen)
+{
+    MVT_DEBUG_PRINT1("mvt_headless_screen_beep\n");
+}
+
+static void mvt_headless_screen_get_size(mvt_screen_t *screen, int *width, int *height)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    *width = headless_screen->width;
+    *height = headless_screen->height;
+}
+
+static int mvt_headless_screen_resize(mvt_screen_t *screen, int width, int height)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    uint32_t *pixels;
+    int pixel_width, pixel_height;
+
+    if (width < 1 || height < 1)
+        return -1;
+    pixel_width = width * headless_screen->cell_width;
+    pixel_height = height * headless_screen->cell_height;
+    pixels = malloc((size_t)pixel_width * pixel_height * sizeof (uint32_t));
+    if (!pixels)
+        return -1;
+    free(headless_screen->pixels);
+    headless_screen->pixels = pixels;
+    headless_screen->width = width;
+    headless_screen->height = height;
+    headless_screen->pixel_width = pixel_width;
+    headless_screen->pixel_height = pixel_height;
+    mvt_headless_update_palette(headless_screen);
+    mvt_fill_pixels(pixels, headless_screen->palette[MVT_HEADLESS_DEFAULT_BACKGROUND],
+                    (size_t)pixel_width * pixel_height);
+    headless_screen->damage_left = headless_screen->damage_right = 0;
+    mvt_headless_damage(headless_screen, 0, 0, pixel_width, pixel_height);
+    return 0;
+}
+
+static void mvt_headless_screen_set_title(mvt_screen_t *screen, const mvt_char_t *ws)
+{
+}
+
+/**
+ * Follow the lines shown. When the console moves them up as it
+ * fills the lines saved, the rows are moved the same.
+ */
+static void mvt_headless_screen_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    int count = scroll_position - headless_screen->scroll_top;
+    headless_screen->scroll_top = scroll_position;
+    if (count > 0 && count < headless_screen->height)
+        mvt_headless_scroll_rows(headless_screen, 0, headless_screen->height - 1, -count);
+}
+
+static void mvt_headless_screen_set_mode(mvt_screen_t *screen, int mode, int value)
+{
+}
+
+/**
+ * Present the damaged frame if one is due, writing it when an output
+ * is set.
+ * @return milliseconds until the next frame is due, or 0
+ */
+static unsigned int mvt_headless_present(mvt_headless_screen_t *headless_screen)
+{
+    unsigned int elapsed;
+    char filename[1024];
+    if (headless_screen->damage_left >= headless_screen->damage_right)
+        return 0;
+    elapsed = mvt_headless_get_ticks() - headless_screen->frame_ticks;
+    if (elapsed < headless_screen->frame_interval)
+        return headless_screen->frame_interval - elapsed;
+    headless_screen->frame_count++;
+    MVT_DEBUG_PRINT2("mvt_headless_present: frame %u\n", headless_screen->frame_count);
+    if (headless_screen->output) {
+        snprintf(filename, sizeof filename, headless_screen->output, headless_screen->frame_count);
+        mvt_headless_write_frame(headless_screen, filename);
+    }
+    headless_screen->damage_left = headless_screen->damage_right = 0;
+    headless_screen->damage_top = headless_screen->damage_bottom = 0;
+    headless_screen->frame_ticks = mvt_headless_get_ticks();
+    return 0;
+}
+
+static int mvt_headless_write_ppm(const mvt_headless_screen_t *headless_screen, FILE *fp)
+{
+    const uint8_t *p;
+    uint8_t *row, *q;
+    int x, y, ret = -1;
+    row = malloc((size_t)headless_screen->pixel_width * 3);
+    if (!row)
+        return -1;
+    fprintf(fp, "P6\n%d %d\n255\n", headless_screen->pixel_width, headless_screen->pixel_height);
+    p = (const uint8_t *)headless_screen->pixels;
+    for (y = 0; y < headless_screen->pixel_height; y++) {
+        for (x = 0, q = row; x < headless_screen->pixel_width; x++, p += 4, q += 3) {
+            q[0] = p[0];
+            q[1] = p[1];
+            q[2] = p[2];
+        }
+        if (fwrite(row, headless_screen->pixel_width * 3, 1, fp) != 1)
+            goto out;
+    }
+    ret = 0;
+out:
+    free(row);
+    return ret;
+}
+
+#ifdef HAVE_ZLIB
+
+static void mvt_png_put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static int mvt_png_write_chunk(FILE *fp, const char *type, const uint8_t *data, size_t len)
+{
+    uint8_t buf[8];
+    uLong crc;
+    mvt_png_put32(buf, len);
+    memcpy(buf + 4, type, 4);
+    crc = crc32(crc32(0, NULL, 0), buf + 4, 4);
+    if (len > 0)
+        crc = crc32(crc, data, len);
+    if (fwrite(buf, 8, 1, fp) != 1)
+        return -1;
+    if (len > 0 && fwrite(data, len, 1, fp) != 1)
+        return -1;
+    mvt_png_put32(buf, crc);
+    if (fwrite(buf, 4, 1, fp) != 1)
+        return -1;
+    return 0;
+}
+
+static int mvt_headless_write_png(const mvt_headless_screen_t *headless_screen, FILE *fp)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    size_t row_size = (size_t)headless_screen->pixel_width * 4 + 1;
+    size_t raw_size = row_size * headless_screen->pixel_height;
+    uLongf compressed_size = compressBound(raw_size);
+    uint8_t header[13];
+    uint8_t *raw, *compressed;
+    int y, ret = -1;
+
+    raw = malloc(raw_size);
+    compressed = malloc(compressed_size);
+    if (!raw || !compressed)
+        goto out;
+    /* RGBA rows, each without a filter */
+    for (y = 0; y < headless_screen->pixel_height; y++) {
+        raw[y * row_size] = 0;
+        memcpy(&raw[y * row_size + 1],
+               &headless_screen->pixels[(size_t)y * headless_screen->pixel_width],
+               row_size - 1);
+    }
+    if (compress2(compressed, &compressed_size, raw, raw_size, Z_BEST_SPEED) != Z_OK)
+        goto out;
+    mvt_png_put32(header, headless_screen->pixel_width);
+    mvt_png_put32(header + 4, headless_screen->pixel_height);
+    header[8] = 8; /* bit depth */
+    header[9] = 6; /* RGBA */
+    header[10] = header[11] = header[12] = 0;
+    if (fwrite(signature, sizeof signature, 1, fp) != 1
+        || mvt_png_write_chunk(fp, "IHDR", header, sizeof header) == -1
+        || mvt_png_write_chunk(fp, "IDAT", compressed, compressed_size) == -1
+        || mvt_png_write_chunk(fp, "IEND", NULL, 0) == -1)
+        goto out;
+    ret = 0;
+out:
+    free(raw);
+    free(compressed);
+    return ret;
+}
+
+#endif
+
+/**
+ * Write the framebuffer as PNG if the filename ends with .png, as PPM
+ * otherwise.
+ */
+static int mvt_headless_write_frame(const mvt_headless_screen_t *headless_screen, const char *filename)
+{
+    FILE *fp;
+    size_t len;
+    int ret;
+    fp = fopen(filename, "wb");
+    if (!fp)
+        return -1;
+    len = strlen(filename);
+#ifdef HAVE_ZLIB
+    if (len >= 4 && strcmp(filename + len - 4, ".png") == 0)
+        ret = mvt_headless_write_png(headless_screen, fp);
+    else
+#endif
+        ret = mvt_headless_write_ppm(headless_screen, fp);
+    if (fclose(fp) != 0)
+        ret = -1;
+    return ret;
+}
+
+/**
+ * Check that an output is a printf format taking the frame number:
+ * %% and at most one conversion of an optional zero flag, a width,
+ * and u or d.
+ * @return 0 if it is, or -1
+ */
+static int mvt_headless_check_output(const char *output)
+{
+    const char *p;
+    int conversions = 0;
+    for (p = output; *p; p++) {
+        if (*p != '%')
+            continue;
+        p++;
+        if (*p == '%')
+            continue;
+        if (*p == '0')
+            p++;
+        while (*p >= '0' && *p <= '9')
+            p++;
+        if ((*p != 'u' && *p != 'd') || ++conversions > 1)
+            return -1;
+    }
+    return 0;
+}
+
+static int mvt_headless_set_screen_attribute0(mvt_headless_screen_t *headless_screen, const char *name, const char *value)
+{
+    char *s;
+    if (strcmp(name, "width") == 0)
+        headless_screen->width = atoi(value);
+    else if (strcmp(name, "height") == 0)
+        headless_screen->height = atoi(value);
+    else if (strcmp(name, "font-size") == 0)
+        headless_screen->font_size = atoi(value);
+    else if (strcmp(name, "font") == 0) {
+        s = strdup(value);
+        if (!s)
+            return -1;
+        free(headless_screen->font_path);
+        headless_screen->font_path = s;
+    } else if (strcmp(name, "foreground-color") == 0)
+        headless_screen->foreground_color = mvt_atocolor(value);
+    else if (strcmp(name, "background-color") == 0)
+        headless_screen->background_color = mvt_atocolor(value);
+    else if (strcmp(name, "output") == 0) {
+        /* a printf format taking the frame number */
+        if (mvt_headless_check_output(value) == -1)
+            return -1;
+        s = strdup(value);
+        if (!s)
+            return -1;
+        free(headless_screen->output);
+        headless_screen->output = s;
+    } else if (strcmp(name, "frame-rate") == 0) {
+        int frame_rate = atoi(value);
+        if (frame_rate <= 0)
+            return -1;
+        headless_screen->frame_interval = 1000 / frame_rate;
+    }
+    return 0;
+}
+
+static mvt_screen_t *mvt_headless_open_screen(char **args)
+{
+    mvt_headless_screen_t *headless_screen;
+    const char *name, *value;
+    char **p;
+
+    if (global_headless_screen) {
+        MVT_DEBUG_PRINT1("Only one screen can be opened on headless\n");
+        return NULL;
+    }
+    headless_screen = malloc(sizeof (mvt_headless_screen_t));
+    if (!headless_screen)
+        return NULL;
+    mvt_headless_screen_init(headless_screen);
+    p = args;
+    while (*p) {
+        name = *p++;
+        if (!*p)
+            goto error;
+        value = *p++;
+        if (mvt_headless_set_screen_attribute0(headless_screen, name, value) == -1)
+            goto error;
+    }
+    if (mvt_headless_update_font(headless_screen) == -1)
+        goto error;
+    global_headless_screen = headless_screen;
+    return (mvt_screen_t *)headless_screen;
+error:
+    mvt_headless_screen_destroy(headless_screen);
+    free(headless_screen);
+    return NULL;
+}
+
+static void mvt_headless_close_screen(mvt_screen_t *screen)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    mvt_screen_dispatch_close(screen);
+    mvt_headless_screen_destroy(headless_screen);
+    free(screen);
+    global_headless_screen = NULL;
+}
+
+static int mvt_headless_set_screen_attribute(mvt_screen_t *screen, const char *name, const char *value)
+{
+    mvt_headless_screen_t *headless_screen = (mvt_headless_screen_t *)screen;
+    if (strcmp(name, "dump") == 0) {
+        /* write the current frame now */
+        return mvt_headless_write_frame(headless_screen, value);
+    }
+    if (mvt_headless_set_screen_attribute0(headless_screen, name, value) == -1)
+        return -1;
+    if (mvt_headless_update_font(headless_screen) == -1)
+        return -1;
+    mvt_screen_dispatch_repaint(screen);
+    return 0;
+}
+
+void mvt_notify_request(void)
+{
+    pthread_mutex_lock(&headless_mutex);
+    request_pending = TRUE;
+    pthread_cond_signal(&headless_cond);
+    pthread_mutex_unlock(&headless_mutex);
+}
+
+static int mvt_headless_init(int *argc, char ***argv, mvt_event_func_t event_func)
+{
+    pthread_condattr_t attr;
+    if (FT_Init_FreeType(&library) != 0) {
+        fprintf(stderr, "Unable to init FreeType\n");
+        return -1;
+    }
+    pthread_mutex_init(&headless_mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&headless_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    request_pending = FALSE;
+    mvt_worker_init(event_func);
+    return 0;
+}
+
+static void mvt_headless_main(void)
+{
+    struct timespec deadline;
+    unsigned int delay;
+    int pending;
+
+    loop = TRUE;
+    delay = 0;
+    pthread_mutex_lock(&headless_mutex);
+    while (loop) {
+        if (!request_pending) {
+            if (delay > 0) {
+                /* wake up for the frame due */
+                clock_gettime(CLOCK_MONOTONIC, &deadline);
+                deadline.tv_sec += delay / 1000;
+                deadline.tv_nsec += (delay % 1000) * 1000000;
+                if (deadline.tv_nsec >= 1000000000) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                pthread_cond_timedwait(&headless_cond, &headless_mutex, &deadline);
+            } else {
+                pthread_cond_wait(&headless_cond, &headless_mutex);
+            }
+        }
+        pending = request_pending;
+        request_pending = FALSE;
+        pthread_mutex_unlock(&headless_mutex);
+        if (pending)
+            mvt_handle_request();
+        delay = 0;
+        if (global_headless_screen)
+            delay = mvt_headless_present(global_headless_screen);
+        pthread_mutex_lock(&headless_mutex);
+    }
+    pthread_mutex_unlock(&headless_mutex);
+}
+
+static void mvt_headless_main_quit(void)
+{
+    pthread_mutex_lock(&headless_mutex);
+    loop = FALSE;
+    pthread_cond_signal(&headless_cond);
+    pthread_mutex_unlock(&headless_mutex);
+}
+
+static void mvt_headless_exit(void)
+{
+    mvt_worker_exit();
+    pthread_cond_destroy(&headless_cond);
+    pthread_mutex_destroy(&headless_mutex);
+    FT_Done_FreeType(library);
+}
+
+static const mvt_driver_vt_t mvt_headless_driver_vt = {
+    mvt_headless_init,
+    mvt_headless_main,
+    mvt_headless_main_quit,
+    mvt_headless_exit,
+    mvt_headless_open_screen,
+    mvt_headless_close_screen,
+    mvt_worker_open_terminal,
+    mvt_worker_close_terminal,
+    mvt_headless_set_screen_attribute,
+    mvt_worker_set_terminal_attribute,
+    mvt_worker_suspend,
+    mvt_worker_resume,
+    mvt_worker_shutdown
+};
+
+static const mvt_driver_t mvt_headless_driver = {
+    &mvt_headless_driver_vt, "headless"
+};
+
+const mvt_driver_t *mvt_get_driver(void)
+{
+    return &mvt_headless_driver;
+}
+
+/* utilities */
+
+static unsigned int mvt_headless_get_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Convert 0xRRGGBB into a pixel with the bytes R, G, B and A in
+ * memory.
+ */
+static uint32_t mvt_color_value_to_pixel(uint32_t color_value)
+{
+    uint8_t rgba[4];
+    uint32_t pixel;
+    rgba[0] = (color_value >> 16) & 255;
+    rgba[1] = (color_value >> 8) & 255;
+    rgba[2] = color_value & 255;
+    rgba[3] = 255;
+    memcpy(&pixel, rgba, sizeof pixel);
+    return pixel;
+}
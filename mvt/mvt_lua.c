@@ -379,6 +379,15 @@ static int lmvt_terminal_gc(lua_State *L)
     return 1;
 }
 
+static int lmvt_set_pool(lua_State *L)
+{
+    const char *spec = luaL_checkstring(L, 1);
+    int size = (int)luaL_checkinteger(L, 2);
+    if (mvt_set_pool(spec, size) == -1)
+        luaL_error(L, "cannot set pool");
+    return 0;
+}
+
 static int lmvt_quit(lua_State *L)
 {
     mvt_main_quit();
@@ -388,6 +397,7 @@ static int lmvt_quit(lua_State *L)
 static const luaL_Reg lmvt_f[] = {
     { "open_screen", lmvt_open_screen },
     { "open_terminal", lmvt_open_terminal },
+    { "set_pool", lmvt_set_pool },
     { "quit", lmvt_quit },
     { NULL, NULL }
 };
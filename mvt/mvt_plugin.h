@@ -33,10 +33,19 @@ struct _mvt_session_vt {
     int (*write) (mvt_session_t *session, const void *buf, size_t count, size_t *countwritten);
     void (*shutdown) (mvt_session_t *session);
     void (*resize) (mvt_session_t *session, int width, int height);
+    /* may be left out, when the pieces are written one by one */
+    int (*writev) (mvt_session_t *session, const mvt_iovec_t *iov, int iovcnt, size_t *countwritten);
+    /* may be left out, when the session can't tell */
+    int (*is_alive) (mvt_session_t *session);
 };
 
+/* A session reading from another one is a stage over its source. The
+ * sessions of a terminal are closed by the terminal, so a stage
+ * doesn't close its source. */
 struct _mvt_session {
     const mvt_session_vt_t *vt;
+    /* counted by mvt_session_read() and mvt_session_write() */
+    mvt_session_stats_t stats;
 };
 
 struct _mvt_session_plugin {
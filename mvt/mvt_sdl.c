@@ -35,6 +35,36 @@
 #define MVT_SDL_SCREEN_PSEUDOBOLD   (1<<1)
 
 #define MVT_SDL_REQUEST (SDL_USEREVENT+0)
+#define MVT_SDL_FRAME   (SDL_USEREVENT+1)
+
+/* Default number of frames presented per second at most */
+#define MVT_SDL_FRAME_RATE 60
+
+/* Number of rendered glyphs kept, and the size of their hash table */
+#define MVT_SDL_GLYPH_CACHE_SIZE 4096
+#define MVT_SDL_GLYPH_HASH_SIZE 4096
+
+/* The palette has the 256 colors, then the default colors */
+#define MVT_SDL_DEFAULT_FOREGROUND MVT_DEFAULT_COLOR
+#define MVT_SDL_DEFAULT_BACKGROUND (MVT_DEFAULT_COLOR + 1)
+#define MVT_SDL_PALETTE_SIZE (MVT_DEFAULT_COLOR + 2)
+
+/* Blanks are filled when there are this many of them in a row. A fill
+ * costs about as much as ten glyph blits, so shorter spans are blitted. */
+#define MVT_SDL_BLANK_FILL_MIN 16
+
+typedef struct _mvt_sdl_glyph mvt_sdl_glyph_t;
+
+/* A rendered glyph. Glyphs are chained in a hash bucket and in the
+ * LRU list, most recently used first. */
+struct _mvt_sdl_glyph {
+    mvt_char_t wc;
+    uint32_t foreground_color;
+    uint32_t background_color;
+    SDL_Surface *surface;
+    mvt_sdl_glyph_t *hash_next;
+    mvt_sdl_glyph_t *lru_prev, *lru_next;
+};
 
 typedef struct _mvt_sdl_screen mvt_sdl_screen_t;
 
@@ -51,12 +81,28 @@ struct _mvt_sdl_screen {
     uint32_t selection_color;
     uint32_t scroll_foreground_color;
     uint32_t scroll_background_color;
+    uint32_t palette[MVT_SDL_PALETTE_SIZE];
+    Uint32 pixel_palette[MVT_SDL_PALETTE_SIZE];
     int invalid_left, invalid_top;
     int invalid_right, invalid_bottom;
+    int dirty_left, dirty_top;
+    int dirty_right, dirty_bottom;
+    Uint32 frame_interval;
+    Uint32 frame_ticks;
+    SDL_TimerID frame_timer;
+    int frame_pending;
     int width, height;
     int cursor_x, cursor_y;
     int selection_start_x, selection_start_y;
     int selection_end_x, selection_end_y;
+    int scroll_position;
+    int virtual_height;
+    int scrollbar_y, scrollbar_height;
+
+    mvt_sdl_glyph_t *glyphs;
+    mvt_sdl_glyph_t **glyph_hash;
+    mvt_sdl_glyph_t glyph_lru;
+    int glyph_count;
 
   unsigned int flags;
 };
@@ -68,6 +114,13 @@ static int loop;
 /* utilities */
 static void mvt_color_value_to_sdl(SDL_Color *sdl_color, unsigned int color_value);
 
+static Uint32 mvt_sdl_frame_timer(Uint32 interval, void *param);
+static void mvt_sdl_screen_present(mvt_sdl_screen_t *sdl_screen);
+
+/* glyph cache */
+static SDL_Surface *mvt_sdl_glyph_lookup(mvt_sdl_screen_t *sdl_screen, mvt_char_t wc, uint32_t foreground_color, uint32_t background_color);
+static void mvt_sdl_glyph_flush(mvt_sdl_screen_t *sdl_screen);
+
 /* mvt_sdl_screen_t */
 
 static void *mvt_sdl_screen_begin(mvt_screen_t *screen);
@@ -80,7 +133,7 @@ static void mvt_sdl_screen_beep(mvt_screen_t *screen);
 static void mvt_sdl_screen_get_size(mvt_screen_t *screen, int *width, int *height);
 static int mvt_sdl_screen_resize(mvt_screen_t *screen, int width, int height);
 static void mvt_sdl_screen_set_title(mvt_screen_t *screen, const mvt_char_t *ws);
-static void mvt_sdl_screen_set_scroll_info(mvt_screen_t *screen, int top, int height, int virtual_height);
+static void mvt_sdl_screen_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height);
 static void mvt_sdl_screen_set_mode(mvt_screen_t *screen, int mode, int value);
 static int mvt_sdl_set_screen_attribute0(mvt_sdl_screen_t *sdl_screen, const char *name, const char *value);
 
@@ -113,15 +166,173 @@ int mvt_sdl_screen_init(mvt_sdl_screen_t *sdl_screen)
     sdl_screen->selection_start_y = -1;
     sdl_screen->selection_end_x = -1;
     sdl_screen->selection_end_y = -1;
+    sdl_screen->scrollbar_y = -1;
+    sdl_screen->frame_interval = 1000 / MVT_SDL_FRAME_RATE;
     return 0;
 }
 
 void
 mvt_sdl_screen_destroy(mvt_sdl_screen_t *sdl_screen)
 {
+    if (sdl_screen->frame_timer)
+        SDL_RemoveTimer(sdl_screen->frame_timer);
+    mvt_sdl_glyph_flush(sdl_screen);
+    free(sdl_screen->glyphs);
+    free(sdl_screen->glyph_hash);
     memset(sdl_screen, 0, sizeof *sdl_screen);
 }
 
+static unsigned int mvt_sdl_glyph_hash(mvt_char_t wc, uint32_t foreground_color, uint32_t background_color)
+{
+    uint32_t h = (uint32_t)wc * 2654435761u;
+    h ^= foreground_color * 40503u;
+    h ^= background_color * 9973u;
+    return (h ^ (h >> 16)) & (MVT_SDL_GLYPH_HASH_SIZE - 1);
+}
+
+static void mvt_sdl_glyph_unlink(mvt_sdl_glyph_t *glyph)
+{
+    glyph->lru_prev->lru_next = glyph->lru_next;
+    glyph->lru_next->lru_prev = glyph->lru_prev;
+}
+
+static void mvt_sdl_glyph_link(mvt_sdl_screen_t *sdl_screen, mvt_sdl_glyph_t *glyph)
+{
+    mvt_sdl_glyph_t *head = &sdl_screen->glyph_lru;
+    glyph->lru_prev = head;
+    glyph->lru_next = head->lru_next;
+    head->lru_next->lru_prev = glyph;
+    head->lru_next = glyph;
+}
+
+/**
+ * Get the rendered glyph of a character. The surface is owned by the
+ * cache and is valid until the next lookup.
+ * @retval NULL the glyph cannot be rendered
+ */
+static SDL_Surface *mvt_sdl_glyph_lookup(mvt_sdl_screen_t *sdl_screen, mvt_char_t wc, uint32_t foreground_color, uint32_t background_color)
+{
+    mvt_sdl_glyph_t *glyph, **p;
+    SDL_Surface *surface;
+    SDL_Color sdl_foreground_color, sdl_background_color;
+    Uint16 wbuf[2];
+    unsigned int h;
+
+    if (!sdl_screen->glyphs) {
+        sdl_screen->glyphs = malloc(MVT_SDL_GLYPH_CACHE_SIZE * sizeof (mvt_sdl_glyph_t));
+        sdl_screen->glyph_hash = calloc(MVT_SDL_GLYPH_HASH_SIZE, sizeof (mvt_sdl_glyph_t *));
+        if (!sdl_screen->glyphs || !sdl_screen->glyph_hash) {
+            free(sdl_screen->glyphs);
+            free(sdl_screen->glyph_hash);
+            sdl_screen->glyphs = NULL;
+            sdl_screen->glyph_hash = NULL;
+            return NULL;
+        }
+        sdl_screen->glyph_lru.lru_prev = &sdl_screen->glyph_lru;
+        sdl_screen->glyph_lru.lru_next = &sdl_screen->glyph_lru;
+        sdl_screen->glyph_count = 0;
+    }
+
+    h = mvt_sdl_glyph_hash(wc, foreground_color, background_color);
+    for (glyph = sdl_screen->glyph_hash[h]; glyph; glyph = glyph->hash_next) {
+        if (glyph->wc == wc
+            && glyph->foreground_color == foreground_color
+            && glyph->background_color == background_color) {
+            if (sdl_screen->glyph_lru.lru_next != glyph) {
+                mvt_sdl_glyph_unlink(glyph);
+                mvt_sdl_glyph_link(sdl_screen, glyph);
+            }
+            return glyph->surface;
+        }
+    }
+
+    mvt_color_value_to_sdl(&sdl_foreground_color, foreground_color);
+    mvt_color_value_to_sdl(&sdl_background_color, background_color);
+    wbuf[0] = wc;
+    wbuf[1] = 0;
+    surface = TTF_RenderUNICODE_Shaded(sdl_screen->font, wbuf,
+                                       sdl_foreground_color,
+                                       sdl_background_color);
+    if (!surface)
+        return NULL;
+
+    if (sdl_screen->glyph_count < MVT_SDL_GLYPH_CACHE_SIZE) {
+        glyph = &sdl_screen->glyphs[sdl_screen->glyph_count++];
+    } else {
+        /* evict the least recently used glyph */
+        glyph = sdl_screen->glyph_lru.lru_prev;
+        mvt_sdl_glyph_unlink(glyph);
+        p = &sdl_screen->glyph_hash[mvt_sdl_glyph_hash(glyph->wc, glyph->foreground_color, glyph->background_color)];
+        while (*p != glyph)
+            p = &(*p)->hash_next;
+        *p = glyph->hash_next;
+        SDL_FreeSurface(glyph->surface);
+    }
+    glyph->wc = wc;
+    glyph->foreground_color = foreground_color;
+    glyph->background_color = background_color;
+    glyph->surface = surface;
+    glyph->hash_next = sdl_screen->glyph_hash[h];
+    sdl_screen->glyph_hash[h] = glyph;
+    mvt_sdl_glyph_link(sdl_screen, glyph);
+    return surface;
+}
+
+/**
+ * Drop all the rendered glyphs, e.g. when the font changes.
+ */
+static void mvt_sdl_glyph_flush(mvt_sdl_screen_t *sdl_screen)
+{
+    int i;
+    if (!sdl_screen->glyphs)
+        return;
+    for (i = 0; i < sdl_screen->glyph_count; i++)
+        SDL_FreeSurface(sdl_screen->glyphs[i].surface);
+    memset(sdl_screen->glyph_hash, 0, MVT_SDL_GLYPH_HASH_SIZE * sizeof (mvt_sdl_glyph_t *));
+    sdl_screen->glyph_lru.lru_prev = &sdl_screen->glyph_lru;
+    sdl_screen->glyph_lru.lru_next = &sdl_screen->glyph_lru;
+    sdl_screen->glyph_count = 0;
+}
+
+/**
+ * Add a rectangle in pixels to the area to be presented with the
+ * next frame. The frame is presented at once when it is due, which
+ * keeps the window moving while a long request is drawing. Otherwise
+ * it is left to a timer.
+ */
+static void mvt_sdl_invalidate(mvt_sdl_screen_t *sdl_screen, const SDL_Rect *rect)
+{
+    Uint32 elapsed;
+    if (sdl_screen->dirty_left >= sdl_screen->dirty_right) {
+        sdl_screen->dirty_left = rect->x;
+        sdl_screen->dirty_top = rect->y;
+        sdl_screen->dirty_right = rect->x + rect->w;
+        sdl_screen->dirty_bottom = rect->y + rect->h;
+    } else {
+        if (sdl_screen->dirty_left > rect->x)
+            sdl_screen->dirty_left = rect->x;
+        if (sdl_screen->dirty_top > rect->y)
+            sdl_screen->dirty_top = rect->y;
+        if (sdl_screen->dirty_right < rect->x + rect->w)
+            sdl_screen->dirty_right = rect->x + rect->w;
+        if (sdl_screen->dirty_bottom < rect->y + rect->h)
+            sdl_screen->dirty_bottom = rect->y + rect->h;
+    }
+    elapsed = SDL_GetTicks() - sdl_screen->frame_ticks;
+    if (elapsed >= sdl_screen->frame_interval) {
+        mvt_sdl_screen_present(sdl_screen);
+        return;
+    }
+    if (sdl_screen->frame_pending)
+        return;
+    sdl_screen->frame_timer = SDL_AddTimer(sdl_screen->frame_interval - elapsed,
+                                           mvt_sdl_frame_timer, NULL);
+    if (sdl_screen->frame_timer)
+        sdl_screen->frame_pending = TRUE;
+    else
+        mvt_sdl_screen_present(sdl_screen);
+}
+
 static void *mvt_sdl_screen_begin(mvt_screen_t *screen)
 {
     mvt_sdl_screen_t *sdl_screen = (mvt_sdl_screen_t *)screen;
@@ -153,88 +364,128 @@ static void mvt_sdl_screen_end(mvt_screen_t *screen, void *gc)
         assert(rect.x >= 0 && rect.y >= 0);
         assert(rect.x + rect.w <= sdl_screen->width * sdl_screen->font_width);
         assert(rect.y + rect.h <= sdl_screen->height * sdl_screen->font_height);
-        SDL_UpdateRect(sdl_screen->surface, rect.x, rect.y, rect.w, rect.h);
+        mvt_sdl_invalidate(sdl_screen, &rect);
+    }
+}
+
+/**
+ * Blit the glyph of a character at a column and a pixel row.
+ */
+static void mvt_sdl_screen_blit_glyph(mvt_sdl_screen_t *sdl_screen, int x, int py, mvt_char_t wc, uint32_t foreground_color, uint32_t background_color)
+{
+    SDL_Surface *text_surface;
+    SDL_Rect rect;
+    text_surface = mvt_sdl_glyph_lookup(sdl_screen, wc,
+                                        foreground_color,
+                                        background_color);
+    if (text_surface) {
+        rect.x = x * sdl_screen->font_width;
+        rect.y = py;
+        rect.w = text_surface->w;
+        rect.h = text_surface->h;
+        SDL_BlitSurface(text_surface, NULL, sdl_screen->surface, &rect);
     }
 }
 
 static void mvt_sdl_screen_draw_text(mvt_screen_t* screen, void *gc, int x, int y, const mvt_char_t *ws, const mvt_attribute_t *attribute, size_t len)
 {
     mvt_sdl_screen_t *sdl_screen = (mvt_sdl_screen_t *)screen;
-    SDL_Surface *text_surface;
-    mvt_color_t color;
-    unsigned int color_value;
-    SDL_Color sdl_foreground_color, sdl_background_color;
-    Uint16 wbuf[2];
+    const mvt_attribute_t *start_attribute;
+    int foreground_index, background_index, swap_index;
+    uint32_t foreground_color, background_color;
+    int selection_x1, selection_x2, cursor_x;
+    int start_x, selected, on_cursor, blank_start, i, j, n;
+    mvt_char_t wc;
     SDL_Rect rect;
-    int px, py;
-    px = x * sdl_screen->font_width;
-    py = y * sdl_screen->font_height;
-    assert(x >= 0 && x + len <= sdl_screen->width);
-    assert(y >= 0 && y < sdl_screen->height);
+    int py, row;
+    assert(x >= 0 && len <= (size_t)(sdl_screen->width - x));
+    assert(y >= 0);
+    row = y - sdl_screen->scroll_position;
+    if (len == 0 || row < 0 || row >= sdl_screen->height)
+        return;
+    py = row * sdl_screen->font_height;
     if (sdl_screen->invalid_left > (int)x)
         sdl_screen->invalid_left = (int)x;
     if (sdl_screen->invalid_right < (int)(x + len - 1))
         sdl_screen->invalid_right = (int)(x + len - 1);
-    if (sdl_screen->invalid_top > y)
-        sdl_screen->invalid_top = (int)y;
-    if (sdl_screen->invalid_bottom < (int)y)
-        sdl_screen->invalid_bottom = (int)y;
-    while (len--) {
-        if (attribute->no_char) {
-            ws++;
-            attribute++;
-            px += sdl_screen->font_width;
+    if (sdl_screen->invalid_top > row)
+        sdl_screen->invalid_top = row;
+    if (sdl_screen->invalid_bottom < row)
+        sdl_screen->invalid_bottom = row;
+
+    /* the selected cells and the cursor on this line */
+    selection_x1 = 1;
+    selection_x2 = 0;
+    if (y >= sdl_screen->selection_start_y && y <= sdl_screen->selection_end_y) {
+        selection_x1 = y == sdl_screen->selection_start_y ? sdl_screen->selection_start_x : 0;
+        selection_x2 = y == sdl_screen->selection_end_y ? sdl_screen->selection_end_x : sdl_screen->width;
+    }
+    cursor_x = y == sdl_screen->cursor_y ? sdl_screen->cursor_x : -1;
+
+    while (len > 0) {
+        /* find a run of cells which are drawn with the same colors */
+        start_x = x;
+        start_attribute = attribute;
+        selected = x >= selection_x1 && x <= selection_x2;
+        on_cursor = x == cursor_x;
+        n = 0;
+        do {
+            n++;
             x++;
-            continue;
-        }
+            attribute++;
+        } while (n < (int)len
+                 && attribute->foreground_color == start_attribute->foreground_color
+                 && attribute->background_color == start_attribute->background_color
+                 && attribute->reverse == start_attribute->reverse
+                 && (x >= selection_x1 && x <= selection_x2) == selected
+                 && (x == cursor_x) == on_cursor);
+        len -= n;
 
-        color = attribute->foreground_color;
-        color_value = color == MVT_DEFAULT_COLOR ?
-            sdl_screen->foreground_color : mvt_color_value(color);
-        mvt_color_value_to_sdl(&sdl_foreground_color, color_value);
-        color = attribute->background_color;
-        color_value = color == MVT_DEFAULT_COLOR ?
-            sdl_screen->background_color : mvt_color_value(color);
-        mvt_color_value_to_sdl(&sdl_background_color, color_value);
-
-        if ((y > sdl_screen->selection_start_y ||
-             (y == sdl_screen->selection_start_y && x >= sdl_screen->selection_start_x)) &&
-            (y < sdl_screen->selection_end_y ||
-             (y == sdl_screen->selection_end_y && x <= sdl_screen->selection_end_x))) {
-            SDL_Color swap_color;
-            swap_color = sdl_background_color;
-            sdl_background_color = sdl_foreground_color;
-            sdl_foreground_color = swap_color;
+        foreground_index = start_attribute->foreground_color;
+        background_index = start_attribute->background_color;
+        if (background_index == MVT_DEFAULT_COLOR)
+            background_index = MVT_SDL_DEFAULT_BACKGROUND;
+        if (selected) {
+            swap_index = background_index;
+            background_index = foreground_index;
+            foreground_index = swap_index;
         }
-            
-        if ((x == sdl_screen->cursor_x && y == sdl_screen->cursor_y) || attribute->reverse) {
-            SDL_Color swap_color;
-            swap_color = sdl_background_color;
-            sdl_background_color = sdl_foreground_color;
-            sdl_foreground_color = swap_color;
+        if (on_cursor || start_attribute->reverse) {
+            swap_index = background_index;
+            background_index = foreground_index;
+            foreground_index = swap_index;
         }
+        foreground_color = sdl_screen->palette[foreground_index];
+        background_color = sdl_screen->palette[background_index];
 
-        if (*ws < 0x20)
-            wbuf[0] = ' ';
-        else
-            wbuf[0] = *ws;
-        ws++;
-        attribute++;
-        wbuf[1] = 0;
-        
-        text_surface = TTF_RenderUNICODE_Shaded(sdl_screen->font, wbuf,
-                                                sdl_foreground_color,
-                                                sdl_background_color);
-        if (text_surface) {
-            rect.x = px;
-            rect.y = py;
-            rect.w = text_surface->w;
-            rect.h = text_surface->h;
-            SDL_BlitSurface(text_surface, NULL, sdl_screen->surface, &rect);
-            SDL_FreeSurface(text_surface);
+        /* Glyphs are shaded with their background, so a long span
+         * of blanks is one fill, and the other cells are blitted. */
+        blank_start = -1;
+        for (i = 0; i <= n; i++) {
+            wc = i < n ? ws[i] : 0;
+            if (i < n && !start_attribute[i].no_char && (wc <= 0x20 || wc > 0xffff)) {
+                if (blank_start == -1)
+                    blank_start = i;
+                continue;
+            }
+            if (blank_start != -1 && i - blank_start >= MVT_SDL_BLANK_FILL_MIN) {
+                rect.x = (start_x + blank_start) * sdl_screen->font_width;
+                rect.y = py;
+                rect.w = (i - blank_start) * sdl_screen->font_width;
+                rect.h = sdl_screen->font_height;
+                SDL_FillRect(sdl_screen->surface, &rect, sdl_screen->pixel_palette[background_index]);
+            } else if (blank_start != -1) {
+                for (j = blank_start; j < i; j++)
+                    mvt_sdl_screen_blit_glyph(sdl_screen, start_x + j, py, ' ',
+                                              foreground_color, background_color);
+            }
+            blank_start = -1;
+            if (i == n || start_attribute[i].no_char)
+                continue;
+            mvt_sdl_screen_blit_glyph(sdl_screen, start_x + i, py, wc,
+                                      foreground_color, background_color);
         }
-        x++;
-        px += sdl_screen->font_width;
+        ws += n;
     }
 }
 
@@ -242,10 +493,16 @@ static void mvt_sdl_screen_clear_rect(mvt_screen_t *screen, void *gc, int x1, in
 {
     mvt_sdl_screen_t *sdl_screen = (mvt_sdl_screen_t *)screen;
     SDL_Rect rect;
-    unsigned int color_value;
-    Uint32 sdl_color;
     assert(x1 >= 0 && x2 >= x1 && sdl_screen->width > x2);
-    assert(y1 >= 0 && y2 >= y2 && sdl_screen->height > y2);
+    assert(y1 >= 0 && y2 >= y1);
+    y1 -= sdl_screen->scroll_position;
+    y2 -= sdl_screen->scroll_position;
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 >= sdl_screen->height)
+        y2 = sdl_screen->height - 1;
+    if (y1 > y2)
+        return;
     if (sdl_screen->invalid_left > x1) sdl_screen->invalid_left = x1;
     if (sdl_screen->invalid_top > y1) sdl_screen->invalid_top = y1;
     if (sdl_screen->invalid_right < x2) sdl_screen->invalid_right = x2;
@@ -255,14 +512,8 @@ static void mvt_sdl_screen_clear_rect(mvt_screen_t *screen, void *gc, int x1, in
     rect.w = (x2 + 1) * sdl_screen->font_width - rect.x;
     rect.h = (y2 + 1) * sdl_screen->font_height - rect.y;
     if (background_color == MVT_DEFAULT_COLOR)
-        color_value = sdl_screen->background_color;
-    else
-        color_value = mvt_color_value(background_color);
-    sdl_color = SDL_MapRGB(sdl_screen->surface->format,
-                           (color_value >> 16) & 255,
-                           (color_value >> 8 ) & 255,
-                           (color_value      ) & 255);
-    SDL_FillRect(sdl_screen->surface, &rect, sdl_color);
+        background_color = MVT_SDL_DEFAULT_BACKGROUND;
+    SDL_FillRect(sdl_screen->surface, &rect, sdl_screen->pixel_palette[background_color]);
 }
 
 static void mvt_sdl_screen_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor, int x, int y)
@@ -284,23 +535,57 @@ static void mvt_sdl_screen_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor
     }
 }
 
-static void mvt_sdl_screen_scroll(mvt_screen_t *screen, int y1, int y2, int count)
+static void mvt_sdl_screen_draw_scrollbar(mvt_sdl_screen_t *sdl_screen)
+{
+    SDL_Rect rect, inner_rect;
+    unsigned int color_value;
+    Uint32 sdl_color;
+
+    if (sdl_screen->virtual_height <= 0)
+        return;
+    rect.x = sdl_screen->width * sdl_screen->font_width;
+    rect.y = 0;
+    rect.w = MVT_SCROLLBAR_WIDTH;
+    rect.h = sdl_screen->height * sdl_screen->font_height;
+    inner_rect = rect;
+    inner_rect.y = sdl_screen->scroll_position * rect.h / sdl_screen->virtual_height;
+    inner_rect.h = (sdl_screen->scroll_position + sdl_screen->height) * rect.h / sdl_screen->virtual_height - inner_rect.y;
+    /* the history grows a line at a time, which rarely moves the thumb */
+    if (inner_rect.y == sdl_screen->scrollbar_y && inner_rect.h == sdl_screen->scrollbar_height)
+        return;
+    sdl_screen->scrollbar_y = inner_rect.y;
+    sdl_screen->scrollbar_height = inner_rect.h;
+    color_value = sdl_screen->scroll_background_color;
+    sdl_color = SDL_MapRGB(sdl_screen->surface->format,
+                           (color_value >> 16) & 0xff,
+                           (color_value >> 8 ) & 0xff,
+                           (color_value      ) & 0xff);
+    SDL_FillRect(sdl_screen->surface, &rect, sdl_color);
+    color_value = sdl_screen->scroll_foreground_color;
+    sdl_color = SDL_MapRGB(sdl_screen->surface->format,
+                           (color_value >> 16) & 0xff,
+                           (color_value >> 8 ) & 0xff,
+                           (color_value      ) & 0xff);
+    SDL_FillRect(sdl_screen->surface, &inner_rect, sdl_color);
+    mvt_sdl_invalidate(sdl_screen, &rect);
+}
+
+/**
+ * Move rows of the surface by count rows, down if it is positive,
+ * and clear the rows left behind. The scrollbar beside the rows is
+ * moved with them, so the caller draws it again.
+ */
+static void mvt_sdl_screen_scroll_rows(mvt_sdl_screen_t *sdl_screen, int y1, int y2, int count)
 {
-    mvt_sdl_screen_t *sdl_screen = (mvt_sdl_screen_t *)screen;
     SDL_Surface *surface;
     Uint8 *bufp;
     size_t bytes_per_row;
+    int clear_y;
 
-    if (y1 == -1)
-        y1 = 0;
-    if (y2 == -1)
-        y2 = sdl_screen->height - 1;
-
-    assert(y1 >= 0 && y2 >= 0);
-    assert(count != 0 && count <= y2 - y1 + 1 && count >= -(y2 - y1 + 1));
-
+    if (count == 0 || count > y2 - y1 || -count > y2 - y1)
+        return;
     surface = sdl_screen->surface;
-    bufp = mvt_sdl_screen_begin(screen);
+    bufp = mvt_sdl_screen_begin((mvt_screen_t *)sdl_screen);
     if (bufp == NULL)
         return;
     bytes_per_row = surface->pitch * sdl_screen->font_height;
@@ -313,6 +598,12 @@ static void mvt_sdl_screen_scroll(mvt_screen_t *screen, int y1, int y2, int coun
                 bufp + (y1 - count) * bytes_per_row,
                 (y2 - y1 + 1 + count) * bytes_per_row);
     }
+    clear_y = count > 0 ? y1 : y2 + count + 1;
+    mvt_sdl_screen_clear_rect((mvt_screen_t *)sdl_screen, bufp,
+                              0, clear_y + sdl_screen->scroll_position,
+                              sdl_screen->width - 1,
+                              clear_y + (count > 0 ? count : -count) - 1 + sdl_screen->scroll_position,
+                              MVT_DEFAULT_COLOR);
     if (sdl_screen->invalid_left > 0)
         sdl_screen->invalid_left = 0;
     if (sdl_screen->invalid_top > y1)
@@ -321,7 +612,22 @@ static void mvt_sdl_screen_scroll(mvt_screen_t *screen, int y1, int y2, int coun
         sdl_screen->invalid_right = sdl_screen->width - 1;
     if (sdl_screen->invalid_bottom < y2)
         sdl_screen->invalid_bottom = y2;
-    mvt_sdl_screen_end(screen, bufp);
+    mvt_sdl_screen_end((mvt_screen_t *)sdl_screen, bufp);
+    sdl_screen->scrollbar_y = -1;
+}
+
+static void mvt_sdl_screen_scroll(mvt_screen_t *screen, int y1, int y2, int count)
+{
+    mvt_sdl_screen_t *sdl_screen = (mvt_sdl_screen_t *)screen;
+    y1 = y1 == -1 ? 0 : y1 - sdl_screen->scroll_position;
+    y2 = y2 == -1 ? sdl_screen->height - 1 : y2 - sdl_screen->scroll_position;
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 >= sdl_screen->height)
+        y2 = sdl_screen->height - 1;
+    if (y1 <= y2)
+        mvt_sdl_screen_scroll_rows(sdl_screen, y1, y2, count);
+    mvt_sdl_screen_draw_scrollbar(sdl_screen);
 }
 
 static void mvt_sdl_screen_beep(mvt_screen_t *screen)
@@ -336,6 +642,26 @@ static void mvt_sdl_screen_get_size(mvt_screen_t *screen, int *width, int *heigh
     *height = sdl_screen->height;
 }
 
+/**
+ * Resolve the colors once, as RGB values and as pixels of the surface.
+ */
+static void mvt_sdl_update_palette(mvt_sdl_screen_t *sdl_screen)
+{
+    uint32_t color_value;
+    int i;
+    for (i = 0; i < MVT_DEFAULT_COLOR; i++)
+        sdl_screen->palette[i] = mvt_color_value(i);
+    sdl_screen->palette[MVT_SDL_DEFAULT_FOREGROUND] = sdl_screen->foreground_color;
+    sdl_screen->palette[MVT_SDL_DEFAULT_BACKGROUND] = sdl_screen->background_color;
+    for (i = 0; i < MVT_SDL_PALETTE_SIZE; i++) {
+        color_value = sdl_screen->palette[i];
+        sdl_screen->pixel_palette[i] = SDL_MapRGB(sdl_screen->surface->format,
+                                                  (color_value >> 16) & 255,
+                                                  (color_value >> 8 ) & 255,
+                                                  (color_value      ) & 255);
+    }
+}
+
 static int mvt_sdl_screen_resize(mvt_screen_t *screen, int width, int height)
 {
     mvt_sdl_screen_t *sdl_screen = (mvt_sdl_screen_t *)screen;
@@ -354,6 +680,8 @@ static int mvt_sdl_screen_resize(mvt_screen_t *screen, int width, int height)
     sdl_screen->surface = surface;
     sdl_screen->width = width;
     sdl_screen->height = height;
+    sdl_screen->scrollbar_y = -1;
+    mvt_sdl_update_palette(sdl_screen);
     return 0;
 }
 
@@ -374,45 +702,39 @@ static void mvt_sdl_screen_set_title(mvt_screen_t *screen, const mvt_char_t *ws)
     SDL_WM_SetCaption(buf, "mvt");
 }
 
-static void mvt_sdl_screen_set_scroll_info(mvt_screen_t *screen, int top, int height, int total_height)
+static void mvt_sdl_screen_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height)
 {
     mvt_sdl_screen_t *sdl_screen = (mvt_sdl_screen_t *)screen;
-    SDL_Rect rect, inner_rect;
-    unsigned int color_value;
-    Uint32 sdl_color;
-    rect.x = sdl_screen->width * sdl_screen->font_width;
-    rect.y = 0;
-    rect.w = MVT_SCROLLBAR_WIDTH;
-    rect.h = sdl_screen->height * sdl_screen->font_height;
-    color_value = sdl_screen->scroll_background_color;
-    sdl_color = SDL_MapRGB(sdl_screen->surface->format,
-                           (color_value >> 16) & 0xff,
-                           (color_value >> 8 ) & 0xff,
-                           (color_value      ) & 0xff);
-    SDL_FillRect(sdl_screen->surface, &rect, sdl_color);
-    inner_rect = rect;
-    inner_rect.y = top * rect.h / total_height;
-    inner_rect.h = (top + height) * rect.h / total_height - inner_rect.y;
-    color_value = sdl_screen->scroll_foreground_color;
-    sdl_color = SDL_MapRGB(sdl_screen->surface->format,
-                           (color_value >> 16) & 0xff,
-                           (color_value >> 8 ) & 0xff,
-                           (color_value      ) & 0xff);
-    SDL_FillRect(sdl_screen->surface, &inner_rect, sdl_color);
-    SDL_UpdateRect(sdl_screen->surface,
-                   rect.x, rect.y, rect.w, rect.h);
+    int count;
+
+    /* Follow the lines shown. When the console moves them up as it
+     * fills the lines saved, the surface is scrolled the same. A
+     * larger jump is followed by a repaint. */
+    count = scroll_position - sdl_screen->scroll_position;
+    sdl_screen->scroll_position = scroll_position;
+    sdl_screen->virtual_height = virtual_height;
+    if (count != 0)
+        mvt_sdl_screen_scroll_rows(sdl_screen, 0, sdl_screen->height - 1, -count);
+    mvt_sdl_screen_draw_scrollbar(sdl_screen);
 }
 
 static void mvt_sdl_screen_set_mode(mvt_screen_t *screen, int mode, int value)
 {
 }
 
-static void mvt_sdl_screen_convert_point(mvt_sdl_screen_t *sdl_screen, int x, int y, int *cx, int *cy)
+static void mvt_sdl_screen_convert_point(mvt_sdl_screen_t *sdl_screen, int x, int y, int *cx, int *cy, int *align)
 {
     int font_width = sdl_screen->font_width;
     int font_height = sdl_screen->font_height;
     if (cx != NULL) *cx = x / font_width;
-    if (cy != NULL) *cy = y / font_height;
+    if (align != NULL) *align = ((x * 2 / font_width) & 1) ? 1 : -1;
+    if (cy != NULL) *cy = y / font_height + sdl_screen->scroll_position;
+}
+
+static void mvt_sdl_screen_convert_size(mvt_sdl_screen_t *sdl_screen, int x, int y, int *width, int *height)
+{
+    if (width != NULL) *width = x / sdl_screen->font_width;
+    if (height != NULL) *height = y / sdl_screen->font_height;
 }
 
 static int mvt_sdl_update_screen(mvt_sdl_screen_t *sdl_screen)
@@ -428,6 +750,7 @@ static int mvt_sdl_update_screen(mvt_sdl_screen_t *sdl_screen)
         MVT_DEBUG_PRINT1("Unable to open TrueType font\n");
         return -1;
     }
+    mvt_sdl_glyph_flush(sdl_screen);
     if (sdl_screen->font)
         TTF_CloseFont(sdl_screen->font);
     sdl_screen->font = font;
@@ -485,8 +808,8 @@ static void mvt_sdl_close_screen(mvt_screen_t *screen)
 {
     mvt_sdl_screen_t *sdl_screen = (mvt_sdl_screen_t *)screen;
     mvt_screen_dispatch_close(screen);
-    mvt_sdl_screen_destroy(sdl_screen);
     TTF_CloseFont(sdl_screen->font);
+    mvt_sdl_screen_destroy(sdl_screen);
     free(screen);
     global_sdl_screen = NULL;
 }
@@ -507,6 +830,12 @@ static int mvt_sdl_set_screen_attribute0(mvt_sdl_screen_t *sdl_screen, const cha
         sdl_screen->scroll_foreground_color = mvt_atocolor(value);
     else if (strcmp(name, "scroll-background-color") == 0)
         sdl_screen->scroll_background_color = mvt_atocolor(value);
+    else if (strcmp(name, "frame-rate") == 0) {
+        int frame_rate = atoi(value);
+        if (frame_rate <= 0)
+            return -1;
+        sdl_screen->frame_interval = 1000 / frame_rate;
+    }
     return 0;
 }
 
@@ -611,29 +940,85 @@ static void mvt_sdl_event_keydown(mvt_sdl_screen_t *sdl_screen, SDL_Event *event
 
 static void mvt_sdl_event_mousebutton(mvt_sdl_screen_t *sdl_screen, SDL_Event *event)
 {
-    int cx, cy, button, down;
+    int cx, cy, align, button, down;
     mvt_sdl_screen_convert_point(sdl_screen, event->button.x,
-                                 event->button.y, &cx, &cy);
+                                 event->button.y, &cx, &cy, &align);
     button = event->button.button;
     down = event->type == SDL_MOUSEBUTTONDOWN;
-    mvt_screen_dispatch_mousebutton((mvt_screen_t *)sdl_screen, down, button, 0, cx, cy);
+    mvt_screen_dispatch_mousebutton((mvt_screen_t *)sdl_screen, down, button, 0, cx, cy, align);
 }
 
 static void mvt_sdl_event_mousemotion(mvt_sdl_screen_t *sdl_screen, SDL_Event *event)
 {
-    int cx, cy;
-    mvt_sdl_screen_convert_point(sdl_screen, event->button.x,
-                                 event->button.y, &cx, &cy);
-    mvt_screen_dispatch_mousemove((mvt_screen_t *)sdl_screen, cx, cy);
+    int cx, cy, align;
+    mvt_sdl_screen_convert_point(sdl_screen, event->motion.x,
+                                 event->motion.y, &cx, &cy, &align);
+    mvt_screen_dispatch_mousemove((mvt_screen_t *)sdl_screen, cx, cy, align);
+}
+
+/**
+ * Timer callback which posts a frame event. While the event queue is
+ * full, it is tried again after the interval.
+ */
+static Uint32 mvt_sdl_frame_timer(Uint32 interval, void *param)
+{
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user.code = MVT_SDL_FRAME;
+    event.user.data1 = NULL;
+    event.user.data2 = NULL;
+    if (SDL_PushEvent(&event) == -1)
+        return interval;
+    return 0;
+}
+
+/**
+ * Present what has been drawn since the last frame.
+ */
+static void mvt_sdl_screen_present(mvt_sdl_screen_t *sdl_screen)
+{
+    int right, bottom;
+    if (sdl_screen->dirty_left >= sdl_screen->dirty_right)
+        return;
+    /* the surface may have shrunk since */
+    right = sdl_screen->dirty_right;
+    if (right > sdl_screen->surface->w)
+        right = sdl_screen->surface->w;
+    bottom = sdl_screen->dirty_bottom;
+    if (bottom > sdl_screen->surface->h)
+        bottom = sdl_screen->surface->h;
+    if (sdl_screen->dirty_left < right && sdl_screen->dirty_top < bottom)
+        SDL_UpdateRect(sdl_screen->surface, sdl_screen->dirty_left, sdl_screen->dirty_top,
+                       right - sdl_screen->dirty_left, bottom - sdl_screen->dirty_top);
+    sdl_screen->dirty_left = sdl_screen->dirty_right = 0;
+    sdl_screen->dirty_top = sdl_screen->dirty_bottom = 0;
+    sdl_screen->frame_ticks = SDL_GetTicks();
+}
+
+static void mvt_sdl_event_frame(mvt_sdl_screen_t *sdl_screen, SDL_Event *event)
+{
+    if (!sdl_screen)
+        return;
+    sdl_screen->frame_timer = NULL;
+    sdl_screen->frame_pending = FALSE;
+    mvt_sdl_screen_present(sdl_screen);
 }
 
 static void mvt_sdl_event_videoresize(mvt_sdl_screen_t *sdl_screen, SDL_Event *event)
 {
+    SDL_Event next;
     int width, height;
-    mvt_sdl_screen_convert_point(sdl_screen,
-                                 event->resize.w - MVT_SCROLLBAR_WIDTH,
-                                 event->resize.h,
-                                 &width, &height);
+
+    /* A drag queues a resize for every step. Only the last size is
+     * applied: each one costs a reflow, a repaint and a SIGWINCH. */
+    while (SDL_PeepEvents(&next, 1, SDL_GETEVENT, SDL_VIDEORESIZEMASK) == 1)
+        *event = next;
+    mvt_sdl_screen_convert_size(sdl_screen,
+                                event->resize.w - MVT_SCROLLBAR_WIDTH,
+                                event->resize.h,
+                                &width, &height);
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
     if (mvt_sdl_screen_resize((mvt_screen_t *)sdl_screen, width, height) == -1)
         return;
     mvt_screen_dispatch_resize((mvt_screen_t *)sdl_screen);
@@ -641,7 +1026,7 @@ static void mvt_sdl_event_videoresize(mvt_sdl_screen_t *sdl_screen, SDL_Event *e
 
 static int mvt_sdl_init(int *argc, char ***argv, mvt_event_func_t event_func)
 {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
         fprintf(stderr, "Unable to init SDL: %s\n", SDL_GetError());
         return -1;
     }
@@ -673,6 +1058,9 @@ static void mvt_sdl_main(void)
             case MVT_SDL_REQUEST:
                 mvt_sdl_event_request(sdl_screen, &event);
                 break;
+            case MVT_SDL_FRAME:
+                mvt_sdl_event_frame(sdl_screen, &event);
+                break;
             }
             break;
         case SDL_KEYDOWN:
@@ -717,7 +1105,6 @@ static const mvt_driver_vt_t mvt_sdl_driver_vt = {
     mvt_worker_close_terminal,
     mvt_sdl_set_screen_attribute,
     mvt_worker_set_terminal_attribute,
-    mvt_worker_connect,
     mvt_worker_suspend,
     mvt_worker_resume,
     mvt_worker_shutdown
@@ -737,4 +1124,5 @@ static void mvt_color_value_to_sdl(SDL_Color *sdl_color, unsigned int color_valu
     sdl_color->r = (color_value >> 16) & 0xff;
     sdl_color->g = (color_value >> 8) & 0xff;
     sdl_color->b = color_value & 0xff;
+    sdl_color->unused = 0;
 }
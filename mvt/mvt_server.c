@@ -0,0 +1,983 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* A driver without a window. Every screen is drawn into a shared
+ * memory segment which viewers attached over a Unix domain socket
+ * read by themselves, so the server does the same work however many
+ * viewers watch a screen. See mvt_server.h for the protocol. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <assert.h>
+#include <mvt/mvt.h>
+#include "misc.h"
+#include "debug.h"
+#include "driver.h"
+#include "private.h"
+#include "mvt_server.h"
+
+/* Viewers are told a screen has changed at most this many times a
+ * second */
+#define MVT_SERVER_FRAME_RATE 60
+
+#define MVT_SERVER_MAX_CLIENTS 32
+
+/* Screens a viewer can attach to at once */
+#define MVT_SERVER_MAX_ATTACHED 16
+
+/* Rows start at a cache line so that writing one does not disturb
+ * viewers reading the next */
+#define MVT_SERVER_ROW_ALIGN 64
+
+typedef struct _mvt_server_screen mvt_server_screen_t;
+typedef struct _mvt_server_client mvt_server_client_t;
+
+struct _mvt_server_screen {
+    mvt_screen_t parent;
+    mvt_server_screen_t *next;
+    unsigned int id;
+
+    int width, height;
+    /* the shared memory segment */
+    int fd;
+    mvt_server_header_t *header;
+    size_t size;
+    uint32_t blank_attribute;
+
+    /* the virtual line at the top, and if the console has to paint
+     * all the lines again */
+    int scroll_top;
+    int repaint;
+    int damaged;
+
+    /* virtual positions */
+    int cursor_x, cursor_y;
+    int selection_start_x, selection_start_y;
+    int selection_end_x, selection_end_y;
+
+    unsigned int frame_interval;
+    unsigned int frame_ticks;
+};
+
+struct _mvt_server_client {
+    int fd;
+    unsigned int attached[MVT_SERVER_MAX_ATTACHED];
+    int attached_count;
+    /* bytes of a message not read completely */
+    unsigned char input[sizeof (mvt_server_message_t)];
+    size_t input_length;
+};
+
+static mvt_server_screen_t *screen_list = NULL;
+static unsigned int last_screen_id;
+static mvt_server_client_t *clients[MVT_SERVER_MAX_CLIENTS];
+static int client_count;
+static char *socket_path;
+static int listen_fd = -1;
+static int server_pipe[2] = { -1, -1 };
+static pthread_mutex_t server_mutex;
+static int request_pending;
+static int loop;
+
+/* utilities */
+static unsigned int mvt_server_get_ticks(void);
+
+/* mvt_server_screen_t */
+
+static void *mvt_server_screen_begin(mvt_screen_t *screen);
+static void mvt_server_screen_end(mvt_screen_t *screen, void *gc);
+static void mvt_server_screen_draw_text(mvt_screen_t *screen, void *gc, int x, int y, const mvt_char_t *ws, const mvt_attribute_t *attribute, size_t len);
+static void mvt_server_screen_clear_rect(mvt_screen_t *screen, void *gc, int x1, int y1, int x2, int y2, mvt_color_t background_color);
+static void mvt_server_screen_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor, int x, int y);
+static void mvt_server_screen_scroll(mvt_screen_t *screen, int y1, int y2, int count);
+static void mvt_server_screen_beep(mvt_screen_t *screen);
+static void mvt_server_screen_get_size(mvt_screen_t *screen, int *width, int *height);
+static int mvt_server_screen_resize(mvt_screen_t *screen, int width, int height);
+static void mvt_server_screen_set_title(mvt_screen_t *screen, const mvt_char_t *ws);
+static void mvt_server_screen_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height);
+static void mvt_server_screen_set_mode(mvt_screen_t *screen, int mode, int value);
+static int mvt_server_set_screen_attribute0(mvt_server_screen_t *server_screen, const char *name, const char *value);
+static void mvt_server_send_attached(mvt_server_client_t *client, const mvt_server_screen_t *server_screen);
+
+static const mvt_screen_vt_t server_screen_vt = {
+    mvt_server_screen_begin,
+    mvt_server_screen_end,
+    mvt_server_screen_draw_text,
+    mvt_server_screen_clear_rect,
+    mvt_server_screen_scroll,
+    mvt_server_screen_move_cursor,
+    mvt_server_screen_beep,
+    mvt_server_screen_get_size,
+    mvt_server_screen_resize,
+    mvt_server_screen_set_title,
+    mvt_server_screen_set_scroll_info,
+    mvt_server_screen_set_mode
+};
+
+static int mvt_server_screen_init(mvt_server_screen_t *server_screen)
+{
+    mvt_attribute_t blank;
+    memset(server_screen, 0, sizeof *server_screen);
+    server_screen->parent.vt = &server_screen_vt;
+    server_screen->width = 80;
+    server_screen->height = 24;
+    server_screen->fd = -1;
+    server_screen->cursor_x = -1;
+    server_screen->cursor_y = -1;
+    server_screen->selection_start_x = -1;
+    server_screen->selection_start_y = -1;
+    server_screen->selection_end_x = -1;
+    server_screen->selection_end_y = -1;
+    server_screen->frame_interval = 1000 / MVT_SERVER_FRAME_RATE;
+    memset(&blank, 0, sizeof blank);
+    blank.foreground_color = MVT_DEFAULT_COLOR;
+    blank.background_color = MVT_DEFAULT_COLOR;
+    server_screen->blank_attribute = mvt_stream_pack_attribute(&blank);
+    return 0;
+}
+
+static void mvt_server_screen_destroy(mvt_server_screen_t *server_screen)
+{
+    if (server_screen->header)
+        munmap(server_screen->header, server_screen->size);
+    if (server_screen->fd != -1)
+        close(server_screen->fd);
+    memset(server_screen, 0, sizeof *server_screen);
+}
+
+/* writing the segment */
+
+static mvt_server_row_t *mvt_server_row(const mvt_server_screen_t *server_screen, int y)
+{
+    const mvt_server_header_t *header = server_screen->header;
+    return (mvt_server_row_t *)((char *)header + header->row_offset + (size_t)y * header->row_size);
+}
+
+#define mvt_server_row_cells(row) ((mvt_server_cell_t *)((row) + 1))
+
+/**
+ * Make a row odd so that viewers retry reading it.
+ * @return cells of the row
+ */
+static mvt_server_cell_t *mvt_server_begin_row(mvt_server_screen_t *server_screen, int y)
+{
+    mvt_server_row_t *row = mvt_server_row(server_screen, y);
+    __atomic_store_n(&row->sequence, row->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    row->generation = server_screen->header->generation + 1;
+    server_screen->damaged = TRUE;
+    return mvt_server_row_cells(row);
+}
+
+static void mvt_server_end_row(mvt_server_screen_t *server_screen, int y)
+{
+    mvt_server_row_t *row = mvt_server_row(server_screen, y);
+    __atomic_store_n(&row->sequence, row->sequence + 1, __ATOMIC_RELEASE);
+}
+
+static void mvt_server_begin_header(mvt_server_header_t *header)
+{
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void mvt_server_end_header(mvt_server_header_t *header)
+{
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+static void mvt_server_fill_cells(mvt_server_cell_t *p, uint32_t attribute, size_t count)
+{
+    for (; count > 0; count--, p++) {
+        p->text = 0;
+        p->attribute = attribute;
+    }
+}
+
+/**
+ * Make a new segment, whose file descriptor is passed to viewers.
+ */
+static int mvt_server_create_segment(int width, int height, int *fd_ret, mvt_server_header_t **header_ret, size_t *size_ret)
+{
+    mvt_server_header_t *header;
+    size_t row_offset, row_size, size;
+    int fd;
+#ifndef HAVE_MEMFD_CREATE
+    char name[64];
+#endif
+
+    row_offset = (sizeof (mvt_server_header_t) + MVT_SERVER_ROW_ALIGN - 1) & ~(size_t)(MVT_SERVER_ROW_ALIGN - 1);
+    row_size = sizeof (mvt_server_row_t) + width * sizeof (mvt_server_cell_t);
+    row_size = (row_size + MVT_SERVER_ROW_ALIGN - 1) & ~(size_t)(MVT_SERVER_ROW_ALIGN - 1);
+    size = row_offset + height * row_size;
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create("mvt-screen", MFD_CLOEXEC);
+#else
+    sprintf(name, "/mvt-screen-%d-%u", (int)getpid(), last_screen_id);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1)
+        shm_unlink(name);
+#endif
+    if (fd == -1)
+        return -1;
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return -1;
+    }
+    header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    header->magic = MVT_SERVER_MAGIC;
+    header->version = MVT_SERVER_VERSION;
+    header->width = width;
+    header->height = height;
+    header->row_offset = row_offset;
+    header->row_size = row_size;
+    header->cursor_x = -1;
+    header->cursor_y = -1;
+    *fd_ret = fd;
+    *header_ret = header;
+    *size_ret = size;
+    return 0;
+}
+
+static void *mvt_server_screen_begin(mvt_screen_t *screen)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    return (void *)server_screen->header;
+}
+
+static void mvt_server_screen_end(mvt_screen_t *screen, void *gc)
+{
+}
+
+static void mvt_server_screen_draw_text(mvt_screen_t *screen, void *gc, int x, int y, const mvt_char_t *ws, const mvt_attribute_t *attribute, size_t len)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    mvt_server_cell_t *p;
+    mvt_attribute_t a;
+    int selection_x1, selection_x2, row;
+
+    /* the selected cells on this line are shown reversed */
+    selection_x1 = 1;
+    selection_x2 = 0;
+    if (y >= server_screen->selection_start_y && y <= server_screen->selection_end_y) {
+        selection_x1 = y == server_screen->selection_start_y ? server_screen->selection_start_x : 0;
+        selection_x2 = y == server_screen->selection_end_y ? server_screen->selection_end_x : server_screen->width;
+    }
+
+    row = y - server_screen->scroll_top;
+    if (row < 0 || row >= server_screen->height || x < 0 || x >= server_screen->width || len == 0)
+        return;
+    if (len > (size_t)(server_screen->width - x))
+        len = server_screen->width - x;
+
+    p = mvt_server_begin_row(server_screen, row) + x;
+    for (; len > 0; len--, x++, ws++, attribute++, p++) {
+        a = *attribute;
+        if (x >= selection_x1 && x <= selection_x2)
+            a.reverse = !a.reverse;
+        p->text = *ws;
+        p->attribute = mvt_stream_pack_attribute(&a);
+    }
+    mvt_server_end_row(server_screen, row);
+}
+
+static void mvt_server_screen_clear_rect(mvt_screen_t *screen, void *gc, int x1, int y1, int x2, int y2, mvt_color_t background_color)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    mvt_attribute_t blank;
+    uint32_t attribute;
+    int y;
+    y1 -= server_screen->scroll_top;
+    y2 -= server_screen->scroll_top;
+    if (y1 < 0)
+        y1 = 0;
+    if (x2 >= server_screen->width)
+        x2 = server_screen->width - 1;
+    if (y2 >= server_screen->height)
+        y2 = server_screen->height - 1;
+    if (x1 < 0 || y1 < 0 || x1 > x2 || y1 > y2)
+        return;
+    memset(&blank, 0, sizeof blank);
+    blank.foreground_color = MVT_DEFAULT_COLOR;
+    blank.background_color = background_color;
+    attribute = mvt_stream_pack_attribute(&blank);
+    for (y = y1; y <= y2; y++) {
+        mvt_server_fill_cells(mvt_server_begin_row(server_screen, y) + x1, attribute, x2 - x1 + 1);
+        mvt_server_end_row(server_screen, y);
+    }
+}
+
+static void mvt_server_screen_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor, int x, int y)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    switch (cursor) {
+    case MVT_CURSOR_CURRENT:
+        server_screen->cursor_x = x;
+        server_screen->cursor_y = y;
+        server_screen->damaged = TRUE;
+        break;
+    case MVT_CURSOR_SELECTION_START:
+        server_screen->selection_start_x = x;
+        server_screen->selection_start_y = y;
+        break;
+    case MVT_CURSOR_SELECTION_END:
+        server_screen->selection_end_x = x;
+        server_screen->selection_end_y = y;
+        break;
+    }
+}
+
+/**
+ * Move rows down by count rows, or up if negative, and blank the
+ * rows left. Each row is written under its own sequence, so viewers
+ * may see a scroll half done but never a row half written.
+ */
+static void mvt_server_scroll_rows(mvt_server_screen_t *server_screen, int y1, int y2, int count)
+{
+    size_t cells_size = server_screen->width * sizeof (mvt_server_cell_t);
+    int y;
+    if (count == 0)
+        return;
+    if (count >= y2 - y1 + 1 || count <= -(y2 - y1 + 1))
+        count = 0;
+    if (count > 0) {
+        for (y = y2; y >= y1 + count; y--) {
+            memcpy(mvt_server_begin_row(server_screen, y),
+                   mvt_server_row_cells(mvt_server_row(server_screen, y - count)), cells_size);
+            mvt_server_end_row(server_screen, y);
+        }
+        y2 = y1 + count - 1;
+    } else if (count < 0) {
+        for (y = y1; y <= y2 + count; y++) {
+            memcpy(mvt_server_begin_row(server_screen, y),
+                   mvt_server_row_cells(mvt_server_row(server_screen, y - count)), cells_size);
+            mvt_server_end_row(server_screen, y);
+        }
+        y1 = y2 + count + 1;
+    }
+    /* the rows scrolled in, or all if everything has gone */
+    for (y = y1; y <= y2; y++) {
+        mvt_server_fill_cells(mvt_server_begin_row(server_screen, y),
+                              server_screen->blank_attribute, server_screen->width);
+        mvt_server_end_row(server_screen, y);
+    }
+}
+
+static void mvt_server_screen_scroll(mvt_screen_t *screen, int y1, int y2, int count)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    y1 = y1 == -1 ? 0 : y1 - server_screen->scroll_top;
+    y2 = y2 == -1 ? server_screen->height - 1 : y2 - server_screen->scroll_top;
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 >= server_screen->height)
+        y2 = server_screen->height - 1;
+    if (y1 <= y2)
+        mvt_server_scroll_rows(server_screen, y1, y2, count);
+}
+
+static void mvt_server_screen_beep(mvt_screen_t *screen)
+{
+}
+
+static void mvt_server_screen_get_size(mvt_screen_t *screen, int *width, int *height)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    *width = server_screen->width;
+    *height = server_screen->height;
+}
+
+/**
+ * Make a segment of the new size. The viewers attached keep the old
+ * segment until they map the new one they are sent.
+ */
+static int mvt_server_screen_resize(mvt_screen_t *screen, int width, int height)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    mvt_server_header_t *header;
+    size_t size;
+    int fd, y, i, j;
+
+    if (width < 1 || height < 1)
+        return -1;
+    if (mvt_server_create_segment(width, height, &fd, &header, &size) == -1)
+        return -1;
+    if (server_screen->header) {
+        /* the title and the frames go on */
+        header->generation = server_screen->header->generation;
+        header->title_length = server_screen->header->title_length;
+        memcpy(header->title, server_screen->header->title, sizeof header->title);
+        munmap(server_screen->header, server_screen->size);
+        close(server_screen->fd);
+    }
+    server_screen->fd = fd;
+    server_screen->header = header;
+    server_screen->size = size;
+    server_screen->width = width;
+    server_screen->height = height;
+    for (y = 0; y < height; y++) {
+        mvt_server_fill_cells(mvt_server_begin_row(server_screen, y),
+                              server_screen->blank_attribute, width);
+        mvt_server_end_row(server_screen, y);
+    }
+    for (i = 0; i < client_count; i++) {
+        for (j = 0; j < clients[i]->attached_count; j++) {
+            if (clients[i]->attached[j] == server_screen->id)
+                mvt_server_send_attached(clients[i], server_screen);
+        }
+    }
+    return 0;
+}
+
+static void mvt_server_screen_set_title(mvt_screen_t *screen, const mvt_char_t *ws)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    mvt_server_header_t *header = server_screen->header;
+    size_t count;
+    if (!ws || !header)
+        return;
+    count = mvt_strlen(ws);
+    if (count > MVT_SERVER_TITLE_SIZE)
+        count = MVT_SERVER_TITLE_SIZE;
+    mvt_server_begin_header(header);
+    memcpy(header->title, ws, count * sizeof (mvt_char_t));
+    header->title_length = count;
+    mvt_server_end_header(header);
+    server_screen->damaged = TRUE;
+}
+
+/**
+ * Follow the lines shown. When the console moves them up as it
+ * fills the lines saved, the rows are moved the same.
+ */
+static void mvt_server_screen_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    int count = scroll_position - server_screen->scroll_top;
+    if (count == 0)
+        return;
+    server_screen->scroll_top = scroll_position;
+    if (count > 0 && count < server_screen->height) {
+        mvt_server_scroll_rows(server_screen, 0, server_screen->height - 1, -count);
+    } else {
+        server_screen->repaint = TRUE;
+        server_screen->damaged = TRUE;
+    }
+}
+
+static void mvt_server_screen_set_mode(mvt_screen_t *screen, int mode, int value)
+{
+}
+
+/* viewers */
+
+static mvt_server_screen_t *mvt_server_find_screen(unsigned int id)
+{
+    mvt_server_screen_t *server_screen;
+    for (server_screen = screen_list; server_screen; server_screen = server_screen->next) {
+        if (server_screen->id == id)
+            return server_screen;
+    }
+    return NULL;
+}
+
+/**
+ * Send a message to a viewer, and a file descriptor with it if fd is
+ * not -1. A viewer which does not read them loses the updates.
+ * @retval -1 the message is not sent
+ */
+static int mvt_server_send(mvt_server_client_t *client, uint32_t type, uint32_t screen, int32_t param1, int32_t param2, int fd)
+{
+    mvt_server_message_t message;
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof (int))];
+    } control;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    message.type = type;
+    message.screen = screen;
+    message.param1 = param1;
+    message.param2 = param2;
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = &message;
+    iov.iov_len = sizeof message;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd != -1) {
+        memset(&control, 0, sizeof control);
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof control.buf;
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof (int));
+    }
+    do {
+        n = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+    return n == sizeof message ? 0 : -1;
+}
+
+static void mvt_server_send_attached(mvt_server_client_t *client, const mvt_server_screen_t *server_screen)
+{
+    (void)mvt_server_send(client, MVT_SERVER_ATTACHED, server_screen->id,
+                          server_screen->width, server_screen->height,
+                          server_screen->fd);
+}
+
+static void mvt_server_detach(mvt_server_client_t *client, unsigned int id)
+{
+    int i;
+    for (i = 0; i < client->attached_count; i++) {
+        if (client->attached[i] == id) {
+            client->attached[i] = client->attached[--client->attached_count];
+            return;
+        }
+    }
+}
+
+static void mvt_server_attach(mvt_server_client_t *client, unsigned int id)
+{
+    mvt_server_screen_t *server_screen = mvt_server_find_screen(id);
+    int i;
+    if (!server_screen || !server_screen->header) {
+        (void)mvt_server_send(client, MVT_SERVER_ERROR, id, 0, 0, -1);
+        return;
+    }
+    for (i = 0; i < client->attached_count; i++) {
+        if (client->attached[i] == id)
+            break;
+    }
+    if (i == client->attached_count) {
+        if (client->attached_count == MVT_SERVER_MAX_ATTACHED) {
+            (void)mvt_server_send(client, MVT_SERVER_ERROR, id, 0, 0, -1);
+            return;
+        }
+        client->attached[client->attached_count++] = id;
+    }
+    mvt_server_send_attached(client, server_screen);
+}
+
+static void mvt_server_handle_message(mvt_server_client_t *client, const mvt_server_message_t *message)
+{
+    mvt_server_screen_t *server_screen;
+    switch (message->type) {
+    case MVT_SERVER_LIST:
+        for (server_screen = screen_list; server_screen; server_screen = server_screen->next) {
+            (void)mvt_server_send(client, MVT_SERVER_SCREEN, server_screen->id,
+                                  server_screen->width, server_screen->height, -1);
+        }
+        (void)mvt_server_send(client, MVT_SERVER_SCREEN, 0, 0, 0, -1);
+        break;
+    case MVT_SERVER_ATTACH:
+        mvt_server_attach(client, message->screen);
+        break;
+    case MVT_SERVER_DETACH:
+        mvt_server_detach(client, message->screen);
+        break;
+    case MVT_SERVER_KEY:
+        server_screen = mvt_server_find_screen(message->screen);
+        if (server_screen)
+            mvt_screen_dispatch_keydown((mvt_screen_t *)server_screen, message->param1, message->param2);
+        break;
+    case MVT_SERVER_RESIZE:
+        server_screen = mvt_server_find_screen(message->screen);
+        if (!server_screen
+            || message->param1 < 1 || message->param1 > 4096
+            || message->param2 < 1 || message->param2 > 4096
+            || mvt_server_screen_resize((mvt_screen_t *)server_screen, message->param1, message->param2) == -1) {
+            (void)mvt_server_send(client, MVT_SERVER_ERROR, message->screen, 0, 0, -1);
+            break;
+        }
+        mvt_screen_dispatch_resize((mvt_screen_t *)server_screen);
+        /* the console repaints the first lines rather than those shown */
+        server_screen->repaint = TRUE;
+        break;
+    default:
+        MVT_DEBUG_PRINT2("mvt_server: unknown message %u\n", message->type);
+        break;
+    }
+}
+
+static void mvt_server_accept(void)
+{
+    mvt_server_client_t *client;
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1)
+        return;
+    if (client_count == MVT_SERVER_MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+    client = malloc(sizeof (mvt_server_client_t));
+    if (!client) {
+        close(fd);
+        return;
+    }
+    memset(client, 0, sizeof *client);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    client->fd = fd;
+    clients[client_count++] = client;
+}
+
+/**
+ * Read the messages of a viewer.
+ * @retval -1 the viewer has gone
+ */
+static int mvt_server_read_client(mvt_server_client_t *client)
+{
+    unsigned char buf[sizeof (mvt_server_message_t) * 16];
+    mvt_server_message_t message;
+    ssize_t n;
+    size_t i;
+    n = read(client->fd, buf, sizeof buf);
+    if (n == 0)
+        return -1;
+    if (n == -1)
+        return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    for (i = 0; i < (size_t)n; i++) {
+        client->input[client->input_length++] = buf[i];
+        if (client->input_length < sizeof message)
+            continue;
+        client->input_length = 0;
+        memcpy(&message, client->input, sizeof message);
+        mvt_server_handle_message(client, &message);
+    }
+    return 0;
+}
+
+static void mvt_server_delete_client(int index)
+{
+    mvt_server_client_t *client = clients[index];
+    close(client->fd);
+    free(client);
+    clients[index] = clients[--client_count];
+}
+
+/**
+ * Finish the frame of a screen if one is due, and tell the viewers.
+ * @return milliseconds until the next frame is due, or 0
+ */
+static unsigned int mvt_server_present(mvt_server_screen_t *server_screen)
+{
+    mvt_server_header_t *header = server_screen->header;
+    unsigned int elapsed;
+    int i, j, x, y;
+
+    if (server_screen->repaint) {
+        server_screen->repaint = FALSE;
+        mvt_screen_dispatch_paint((mvt_screen_t *)server_screen, header,
+                                  0, server_screen->scroll_top,
+                                  server_screen->width - 1,
+                                  server_screen->scroll_top + server_screen->height - 1);
+    }
+
+    if (!server_screen->damaged)
+        return 0;
+    elapsed = mvt_server_get_ticks() - server_screen->frame_ticks;
+    if (elapsed < server_screen->frame_interval)
+        return server_screen->frame_interval - elapsed;
+
+    x = server_screen->cursor_x;
+    y = server_screen->cursor_y - server_screen->scroll_top;
+    if (x < 0 || x >= server_screen->width || y < 0 || y >= server_screen->height)
+        x = y = -1;
+    if (x != header->cursor_x || y != header->cursor_y) {
+        mvt_server_begin_header(header);
+        header->cursor_x = x;
+        header->cursor_y = y;
+        mvt_server_end_header(header);
+    }
+    __atomic_store_n(&header->generation, header->generation + 1, __ATOMIC_RELEASE);
+    for (i = 0; i < client_count; i++) {
+        for (j = 0; j < clients[i]->attached_count; j++) {
+            if (clients[i]->attached[j] == server_screen->id)
+                (void)mvt_server_send(clients[i], MVT_SERVER_UPDATE, server_screen->id,
+                                      header->generation, 0, -1);
+        }
+    }
+    server_screen->damaged = FALSE;
+    server_screen->frame_ticks = mvt_server_get_ticks();
+    return 0;
+}
+
+static int mvt_server_set_screen_attribute0(mvt_server_screen_t *server_screen, const char *name, const char *value)
+{
+    if (strcmp(name, "width") == 0)
+        server_screen->width = atoi(value);
+    else if (strcmp(name, "height") == 0)
+        server_screen->height = atoi(value);
+    else if (strcmp(name, "frame-rate") == 0) {
+        int frame_rate = atoi(value);
+        if (frame_rate <= 0)
+            return -1;
+        server_screen->frame_interval = 1000 / frame_rate;
+    }
+    return 0;
+}
+
+static mvt_screen_t *mvt_server_open_screen(char **args)
+{
+    mvt_server_screen_t *server_screen;
+    const char *name, *value;
+    char **p;
+
+    server_screen = malloc(sizeof (mvt_server_screen_t));
+    if (!server_screen)
+        return NULL;
+    mvt_server_screen_init(server_screen);
+    p = args;
+    while (*p) {
+        name = *p++;
+        if (!*p)
+            goto error;
+        value = *p++;
+        if (mvt_server_set_screen_attribute0(server_screen, name, value) == -1)
+            goto error;
+    }
+    server_screen->id = ++last_screen_id;
+    if (mvt_server_screen_resize((mvt_screen_t *)server_screen, server_screen->width, server_screen->height) == -1)
+        goto error;
+    server_screen->next = screen_list;
+    screen_list = server_screen;
+    return (mvt_screen_t *)server_screen;
+error:
+    mvt_server_screen_destroy(server_screen);
+    free(server_screen);
+    return NULL;
+}
+
+static void mvt_server_close_screen(mvt_screen_t *screen)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    mvt_server_screen_t **p;
+    int i;
+    mvt_screen_dispatch_close(screen);
+    for (p = &screen_list; *p; p = &(*p)->next) {
+        if (*p == server_screen) {
+            *p = server_screen->next;
+            break;
+        }
+    }
+    for (i = 0; i < client_count; i++) {
+        mvt_server_detach(clients[i], server_screen->id);
+        (void)mvt_server_send(clients[i], MVT_SERVER_CLOSED, server_screen->id, 0, 0, -1);
+    }
+    mvt_server_screen_destroy(server_screen);
+    free(screen);
+}
+
+static int mvt_server_set_screen_attribute(mvt_screen_t *screen, const char *name, const char *value)
+{
+    mvt_server_screen_t *server_screen = (mvt_server_screen_t *)screen;
+    if (strcmp(name, "width") == 0 || strcmp(name, "height") == 0)
+        return -1;
+    return mvt_server_set_screen_attribute0(server_screen, name, value);
+}
+
+static void mvt_server_wake_up(void)
+{
+    int saved_errno = errno;
+    if (write(server_pipe[1], "", 1) == -1) {
+        /* the pipe is full, so the main loop is woken up anyway */
+    }
+    errno = saved_errno;
+}
+
+void mvt_notify_request(void)
+{
+    pthread_mutex_lock(&server_mutex);
+    if (!request_pending) {
+        request_pending = TRUE;
+        mvt_server_wake_up();
+    }
+    pthread_mutex_unlock(&server_mutex);
+}
+
+static int mvt_server_init(int *argc, char ***argv, mvt_event_func_t event_func)
+{
+    struct sockaddr_un addr;
+    const char *path;
+    char buf[64];
+
+    path = getenv(MVT_SERVER_SOCKET_ENV);
+    if (!path) {
+        sprintf(buf, "/tmp/mvt-server-%d", (int)getuid());
+        path = buf;
+    }
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "The path of the socket is too long\n");
+        return -1;
+    }
+    socket_path = strdup(path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!socket_path || listen_fd == -1)
+        goto error;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) == -1
+        || listen(listen_fd, MVT_SERVER_MAX_CLIENTS) == -1) {
+        fprintf(stderr, "Unable to listen on %s\n", path);
+        goto error;
+    }
+    if (pipe(server_pipe) == -1) {
+        fprintf(stderr, "Unable to create a pipe\n");
+        goto error;
+    }
+    fcntl(server_pipe[0], F_SETFL, fcntl(server_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(server_pipe[1], F_SETFL, fcntl(server_pipe[1], F_GETFL) | O_NONBLOCK);
+    pthread_mutex_init(&server_mutex, NULL);
+    request_pending = FALSE;
+    mvt_worker_init(event_func);
+    return 0;
+error:
+    if (listen_fd != -1)
+        close(listen_fd);
+    listen_fd = -1;
+    free(socket_path);
+    socket_path = NULL;
+    return -1;
+}
+
+static void mvt_server_main(void)
+{
+    struct pollfd fds[MVT_SERVER_MAX_CLIENTS + 2];
+    mvt_server_screen_t *server_screen;
+    unsigned int delay, d;
+    char buf[64];
+    int i, count, pending;
+
+    loop = TRUE;
+    delay = 0;
+    while (loop) {
+        fds[0].fd = server_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = listen_fd;
+        fds[1].events = POLLIN;
+        count = client_count;
+        for (i = 0; i < count; i++) {
+            fds[i + 2].fd = clients[i]->fd;
+            fds[i + 2].events = POLLIN;
+        }
+        if (poll(fds, count + 2, delay > 0 ? (int)delay : -1) == -1 && errno != EINTR)
+            break;
+        while (read(server_pipe[0], buf, sizeof buf) > 0)
+            ;
+        pthread_mutex_lock(&server_mutex);
+        pending = request_pending;
+        request_pending = FALSE;
+        pthread_mutex_unlock(&server_mutex);
+        if (pending)
+            mvt_handle_request();
+        for (i = count - 1; i >= 0; i--) {
+            if ((fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))
+                && mvt_server_read_client(clients[i]) == -1)
+                mvt_server_delete_client(i);
+        }
+        if (fds[1].revents & POLLIN)
+            mvt_server_accept();
+        delay = 0;
+        for (server_screen = screen_list; server_screen; server_screen = server_screen->next) {
+            d = mvt_server_present(server_screen);
+            if (d > 0 && (delay == 0 || d < delay))
+                delay = d;
+        }
+    }
+}
+
+static void mvt_server_main_quit(void)
+{
+    loop = FALSE;
+    mvt_server_wake_up();
+}
+
+static void mvt_server_exit(void)
+{
+    mvt_worker_exit();
+    while (client_count > 0)
+        mvt_server_delete_client(client_count - 1);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+    free(socket_path);
+    socket_path = NULL;
+    pthread_mutex_destroy(&server_mutex);
+    close(server_pipe[0]);
+    close(server_pipe[1]);
+    server_pipe[0] = server_pipe[1] = -1;
+}
+
+static const mvt_driver_vt_t mvt_server_driver_vt = {
+    mvt_server_init,
+    mvt_server_main,
+    mvt_server_main_quit,
+    mvt_server_exit,
+    mvt_server_open_screen,
+    mvt_server_close_screen,
+    mvt_worker_open_terminal,
+    mvt_worker_close_terminal,
+    mvt_server_set_screen_attribute,
+    mvt_worker_set_terminal_attribute,
+    mvt_worker_suspend,
+    mvt_worker_resume,
+    mvt_worker_shutdown
+};
+
+static const mvt_driver_t mvt_server_driver = {
+    &mvt_server_driver_vt, "server"
+};
+
+const mvt_driver_t *mvt_get_driver(void)
+{
+    return &mvt_server_driver;
+}
+
+/* utilities */
+
+static unsigned int mvt_server_get_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,122 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef MVT_SERVER_H
+#define MVT_SERVER_H
+
+#include <mvt/mvt.h>
+
+MVT_BEGIN_DECLS
+
+/*! \addtogroup Server
+ * @{
+ *
+ * The server driver publishes each screen in a shared memory
+ * segment. Viewers talk to the server with messages on a Unix
+ * domain socket, and get the file descriptor of the segment of a
+ * screen when they attach to it. They read the cells from the
+ * segment directly.
+ *
+ * The segment is a header followed by height rows of row_size bytes
+ * from row_offset. A row is a mvt_server_row_t and width cells. The
+ * server is the only writer. It makes sequence of a row odd while it
+ * writes the row, so a viewer reads a row as
+ *
+ *   do {
+ *       s = sequence (acquire); copy the cells; s2 = sequence;
+ *   } while (s is odd || s != s2);
+ *
+ * and the cursor and the title with the sequence of the header the
+ * same way. The segment of a screen never changes its size. When the
+ * screen is resized, the viewers are sent a new one.
+ **/
+
+/** "MVTS" */
+#define MVT_SERVER_MAGIC 0x5354564d
+#define MVT_SERVER_VERSION 1
+#define MVT_SERVER_TITLE_SIZE 256
+/** the environment variable telling the path of the socket */
+#define MVT_SERVER_SOCKET_ENV "MVT_SERVER_SOCKET"
+
+typedef struct _mvt_server_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t row_offset;
+    uint32_t row_size;
+    /** number of frames finished */
+    uint32_t generation;
+    /** seqlock of the fields below */
+    uint32_t sequence;
+    int32_t cursor_x; /** -1 for no cursor */
+    int32_t cursor_y;
+    uint32_t title_length;
+    uint32_t title[MVT_SERVER_TITLE_SIZE];
+} mvt_server_header_t;
+
+typedef struct _mvt_server_row {
+    /** seqlock of the cells, odd while they are written */
+    uint32_t sequence;
+    /** the frame the row was last written in */
+    uint32_t generation;
+} mvt_server_row_t;
+
+typedef struct _mvt_server_cell {
+    uint32_t text;
+    /** packed as mvt_stream_pack_attribute does */
+    uint32_t attribute;
+} mvt_server_cell_t;
+
+/** Messages. The comments tell who sends them, and their parameters. */
+typedef enum {
+    /** viewer: list the screens */
+    MVT_SERVER_LIST = 1,
+    /** server: screen, width, height. Screen 0 ends the list */
+    MVT_SERVER_SCREEN,
+    /** viewer: screen */
+    MVT_SERVER_ATTACH,
+    /** server: screen, width, height, with the segment */
+    MVT_SERVER_ATTACHED,
+    /** viewer: screen */
+    MVT_SERVER_DETACH,
+    /** viewer: screen, meta, code */
+    MVT_SERVER_KEY,
+    /** viewer: screen, width, height */
+    MVT_SERVER_RESIZE,
+    /** server: screen, generation. Sent once a frame at most */
+    MVT_SERVER_UPDATE,
+    /** server: screen */
+    MVT_SERVER_CLOSED,
+    /** server: screen of the request which failed */
+    MVT_SERVER_ERROR
+} mvt_server_message_type_t;
+
+typedef struct _mvt_server_message {
+    uint32_t type;
+    uint32_t screen;
+    int32_t param1;
+    int32_t param2;
+} mvt_server_message_t;
+
+/** @} */
+
+MVT_END_DECLS
+
+#endif
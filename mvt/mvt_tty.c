@@ -0,0 +1,1278 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* A driver which renders a screen inside the terminal mvt runs in.
+ * It keeps a shadow of what the host terminal shows and, once a
+ * frame, sends only the cursor motions, SGR sequences and text
+ * needed to bring it up to date. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <assert.h>
+#include <mvt/mvt.h>
+#include "misc.h"
+#include "debug.h"
+#include "driver.h"
+
+/* Default number of frames sent per second at most */
+#define MVT_TTY_FRAME_RATE 60
+
+/* Bytes buffered before they are written to the host terminal */
+#define MVT_TTY_OUTPUT_SIZE 16384
+
+/* Longest cursor motion or SGR sequence */
+#define MVT_TTY_SEQUENCE_SIZE 64
+
+/* Marks a cell whose content on the host terminal is not known */
+#define MVT_TTY_UNKNOWN_CHAR 0xffffffff
+
+/* Longest gap of unchanged cells sent again rather than skipped
+ * over, as "\033[nC" takes 4 bytes */
+#define MVT_TTY_REWRITE_GAP 3
+
+typedef struct _mvt_tty_cell mvt_tty_cell_t;
+typedef struct _mvt_tty_screen mvt_tty_screen_t;
+
+struct _mvt_tty_cell {
+    mvt_char_t text;
+    mvt_attribute_t attribute;
+};
+
+struct _mvt_tty_screen {
+    mvt_screen_t parent;
+
+    int width, height;
+    /* what the host terminal shows, and what it should show */
+    mvt_tty_cell_t *front;
+    mvt_tty_cell_t *back;
+    /* cells of each line which may differ between them */
+    int *dirty_left, *dirty_right;
+    int damaged;
+    /* the virtual line at the top, and if the console has to paint
+     * all the lines again */
+    int scroll_top;
+    int repaint;
+
+    /* virtual positions */
+    int cursor_x, cursor_y;
+    int selection_start_x, selection_start_y;
+    int selection_end_x, selection_end_y;
+
+    /* state of the host terminal, -1 for a position not known */
+    int host_x, host_y;
+    mvt_attribute_t host_attribute;
+    int host_cursor_visible;
+
+    /* UTF-8 title to be sent with the next frame */
+    char *title;
+    int beep;
+
+    char output[MVT_TTY_OUTPUT_SIZE];
+    size_t output_length;
+
+    unsigned int frame_interval;
+    unsigned int frame_ticks;
+    unsigned int frame_count;
+    unsigned long frame_bytes, total_bytes, max_bytes;
+    FILE *stats;
+
+    /* bytes of a key sequence not read completely */
+    unsigned char input[16];
+    size_t input_length;
+};
+
+/* Only one screen is shown on the host terminal */
+static mvt_tty_screen_t *global_tty_screen = NULL;
+static struct termios saved_termios;
+static int saved_termios_valid;
+static int tty_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t winch_pending;
+static pthread_mutex_t tty_mutex;
+static int request_pending;
+static int input_closed;
+static int loop;
+
+static const struct {
+    const char *sequence;
+    int code;
+} mvt_tty_key_table[] = {
+    { "[A", MVT_KEYPAD_UP },
+    { "[B", MVT_KEYPAD_DOWN },
+    { "[C", MVT_KEYPAD_RIGHT },
+    { "[D", MVT_KEYPAD_LEFT },
+    { "[H", MVT_KEYPAD_HOME },
+    { "[F", MVT_KEYPAD_END },
+    { "OA", MVT_KEYPAD_UP },
+    { "OB", MVT_KEYPAD_DOWN },
+    { "OC", MVT_KEYPAD_RIGHT },
+    { "OD", MVT_KEYPAD_LEFT },
+    { "OH", MVT_KEYPAD_HOME },
+    { "OF", MVT_KEYPAD_END },
+    { "OP", MVT_KEYPAD_F1 },
+    { "OQ", MVT_KEYPAD_F2 },
+    { "OR", MVT_KEYPAD_F3 },
+    { "OS", MVT_KEYPAD_F4 },
+    { "[1~", MVT_KEYPAD_HOME },
+    { "[2~", MVT_KEYPAD_INSERT },
+    { "[3~", 0x7f },
+    { "[4~", MVT_KEYPAD_END },
+    { "[5~", MVT_KEYPAD_PAGEUP },
+    { "[6~", MVT_KEYPAD_PAGEDOWN },
+    { "[15~", MVT_KEYPAD_F5 },
+    { "[17~", MVT_KEYPAD_F6 },
+    { "[18~", MVT_KEYPAD_F7 },
+    { "[19~", MVT_KEYPAD_F8 },
+    { "[20~", MVT_KEYPAD_F9 },
+    { "[21~", MVT_KEYPAD_F10 },
+    { "[23~", MVT_KEYPAD_F11 },
+    { "[24~", MVT_KEYPAD_F12 },
+    { NULL, 0 }
+};
+
+/* utilities */
+static unsigned int mvt_tty_get_ticks(void);
+static size_t mvt_tty_encode_utf8(char *s, mvt_char_t wc);
+static size_t mvt_tty_decode_utf8(const unsigned char *s, size_t count, mvt_char_t *wc);
+
+/* mvt_tty_screen_t */
+
+static void *mvt_tty_screen_begin(mvt_screen_t *screen);
+static void mvt_tty_screen_end(mvt_screen_t *screen, void *gc);
+static void mvt_tty_screen_draw_text(mvt_screen_t *screen, void *gc, int x, int y, const mvt_char_t *ws, const mvt_attribute_t *attribute, size_t len);
+static void mvt_tty_screen_clear_rect(mvt_screen_t *screen, void *gc, int x1, int y1, int x2, int y2, mvt_color_t background_color);
+static void mvt_tty_screen_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor, int x, int y);
+static void mvt_tty_screen_scroll(mvt_screen_t *screen, int y1, int y2, int count);
+static void mvt_tty_screen_beep(mvt_screen_t *screen);
+static void mvt_tty_screen_get_size(mvt_screen_t *screen, int *width, int *height);
+static int mvt_tty_screen_resize(mvt_screen_t *screen, int width, int height);
+static void mvt_tty_screen_set_title(mvt_screen_t *screen, const mvt_char_t *ws);
+static void mvt_tty_screen_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height);
+static void mvt_tty_screen_set_mode(mvt_screen_t *screen, int mode, int value);
+static int mvt_tty_set_screen_attribute0(mvt_tty_screen_t *tty_screen, const char *name, const char *value);
+
+static const mvt_screen_vt_t tty_screen_vt = {
+    mvt_tty_screen_begin,
+    mvt_tty_screen_end,
+    mvt_tty_screen_draw_text,
+    mvt_tty_screen_clear_rect,
+    mvt_tty_screen_scroll,
+    mvt_tty_screen_move_cursor,
+    mvt_tty_screen_beep,
+    mvt_tty_screen_get_size,
+    mvt_tty_screen_resize,
+    mvt_tty_screen_set_title,
+    mvt_tty_screen_set_scroll_info,
+    mvt_tty_screen_set_mode
+};
+
+static int mvt_tty_screen_init(mvt_tty_screen_t *tty_screen)
+{
+    memset(tty_screen, 0, sizeof *tty_screen);
+    tty_screen->parent.vt = &tty_screen_vt;
+    tty_screen->width = 80;
+    tty_screen->height = 24;
+    tty_screen->cursor_x = -1;
+    tty_screen->cursor_y = -1;
+    tty_screen->selection_start_x = -1;
+    tty_screen->selection_start_y = -1;
+    tty_screen->selection_end_x = -1;
+    tty_screen->selection_end_y = -1;
+    tty_screen->host_x = -1;
+    tty_screen->host_y = -1;
+    tty_screen->host_cursor_visible = TRUE;
+    tty_screen->frame_interval = 1000 / MVT_TTY_FRAME_RATE;
+    return 0;
+}
+
+static void mvt_tty_screen_destroy(mvt_tty_screen_t *tty_screen)
+{
+    free(tty_screen->front);
+    free(tty_screen->back);
+    free(tty_screen->dirty_left);
+    free(tty_screen->dirty_right);
+    free(tty_screen->title);
+    if (tty_screen->stats)
+        fclose(tty_screen->stats);
+    memset(tty_screen, 0, sizeof *tty_screen);
+}
+
+static void mvt_tty_blank_cell(mvt_tty_cell_t *cell, mvt_color_t background_color)
+{
+    memset(cell, 0, sizeof *cell);
+    cell->attribute.foreground_color = MVT_DEFAULT_COLOR;
+    cell->attribute.background_color = background_color;
+}
+
+static void mvt_tty_fill_cells(mvt_tty_cell_t *p, const mvt_tty_cell_t *cell, size_t count)
+{
+    while (count--)
+        *p++ = *cell;
+}
+
+/**
+ * Compare the attributes the host terminal renders.
+ */
+static int mvt_tty_attribute_equal(const mvt_attribute_t *a, const mvt_attribute_t *b)
+{
+    return a->foreground_color == b->foreground_color
+        && a->background_color == b->background_color
+        && a->bright == b->bright
+        && a->dim == b->dim
+        && a->underscore == b->underscore
+        && a->blink == b->blink
+        && a->reverse == b->reverse
+        && a->hidden == b->hidden;
+}
+
+/**
+ * Mark a cell the host terminal may have erased.
+ */
+static void mvt_tty_forget_cell(mvt_tty_cell_t *cell)
+{
+    cell->text = MVT_TTY_UNKNOWN_CHAR;
+    cell->attribute.wide = 0;
+    cell->attribute.no_char = 0;
+}
+
+static int mvt_tty_cell_equal(const mvt_tty_cell_t *a, const mvt_tty_cell_t *b)
+{
+    return a->text == b->text
+        && a->attribute.wide == b->attribute.wide
+        && a->attribute.no_char == b->attribute.no_char
+        && mvt_tty_attribute_equal(&a->attribute, &b->attribute);
+}
+
+/* output */
+
+/**
+ * Write the buffered bytes to the host terminal.
+ */
+static void mvt_tty_flush(mvt_tty_screen_t *tty_screen)
+{
+    const char *p = tty_screen->output;
+    size_t count = tty_screen->output_length;
+    ssize_t n;
+    tty_screen->frame_bytes += count;
+    while (count > 0) {
+        n = write(STDOUT_FILENO, p, count);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                struct pollfd fds;
+                fds.fd = STDOUT_FILENO;
+                fds.events = POLLOUT;
+                poll(&fds, 1, -1);
+                continue;
+            }
+            break;
+        }
+        p += n;
+        count -= n;
+    }
+    tty_screen->output_length = 0;
+}
+
+static void mvt_tty_put(mvt_tty_screen_t *tty_screen, const char *s, size_t count)
+{
+    size_t n;
+    while (count > 0) {
+        if (tty_screen->output_length == MVT_TTY_OUTPUT_SIZE)
+            mvt_tty_flush(tty_screen);
+        n = MVT_TTY_OUTPUT_SIZE - tty_screen->output_length;
+        if (n > count)
+            n = count;
+        memcpy(&tty_screen->output[tty_screen->output_length], s, n);
+        tty_screen->output_length += n;
+        s += n;
+        count -= n;
+    }
+}
+
+static void mvt_tty_puts(mvt_tty_screen_t *tty_screen, const char *s)
+{
+    mvt_tty_put(tty_screen, s, strlen(s));
+}
+
+static int mvt_tty_put_color(char *s, mvt_color_t color, int base)
+{
+    if (color == MVT_DEFAULT_COLOR)
+        return sprintf(s, "%d;", base + 9);
+    if (color < 8)
+        return sprintf(s, "%d;", base + color);
+    if (color < 16)
+        return sprintf(s, "%d;", base + 60 + color - 8);
+    return sprintf(s, "%d;5;%d;", base + 8, color);
+}
+
+/**
+ * Send the shortest SGR sequence changing the attribute of the host
+ * terminal. Turning off a flag needs a reset, after which only what
+ * differs from the default is set.
+ */
+static void mvt_tty_set_attribute(mvt_tty_screen_t *tty_screen, const mvt_attribute_t *attribute)
+{
+    mvt_attribute_t *host = &tty_screen->host_attribute;
+    char buf[MVT_TTY_SEQUENCE_SIZE];
+    int n;
+
+    if (mvt_tty_attribute_equal(host, attribute))
+        return;
+    n = sprintf(buf, "\033[");
+    if ((host->bright && !attribute->bright)
+        || (host->dim && !attribute->dim)
+        || (host->underscore && !attribute->underscore)
+        || (host->blink && !attribute->blink)
+        || (host->reverse && !attribute->reverse)
+        || (host->hidden && !attribute->hidden)) {
+        /* an empty parameter resets */
+        buf[n++] = ';';
+        memset(host, 0, sizeof *host);
+        host->foreground_color = MVT_DEFAULT_COLOR;
+        host->background_color = MVT_DEFAULT_COLOR;
+    }
+    if (attribute->bright && !host->bright)
+        n += sprintf(buf + n, "1;");
+    if (attribute->dim && !host->dim)
+        n += sprintf(buf + n, "2;");
+    if (attribute->underscore && !host->underscore)
+        n += sprintf(buf + n, "4;");
+    if (attribute->blink && !host->blink)
+        n += sprintf(buf + n, "5;");
+    if (attribute->reverse && !host->reverse)
+        n += sprintf(buf + n, "7;");
+    if (attribute->hidden && !host->hidden)
+        n += sprintf(buf + n, "8;");
+    if (attribute->foreground_color != host->foreground_color)
+        n += mvt_tty_put_color(buf + n, attribute->foreground_color, 30);
+    if (attribute->background_color != host->background_color)
+        n += mvt_tty_put_color(buf + n, attribute->background_color, 40);
+    buf[n - 1] = 'm';
+    mvt_tty_put(tty_screen, buf, n);
+    *host = *attribute;
+}
+
+/**
+ * Move the cursor of the host terminal with the shortest of an
+ * absolute position and relative motions.
+ */
+static void mvt_tty_move_host_cursor(mvt_tty_screen_t *tty_screen, int x, int y)
+{
+    char best[MVT_TTY_SEQUENCE_SIZE], buf[MVT_TTY_SEQUENCE_SIZE];
+    int best_n, n, host_x, host_y, d;
+
+    host_x = tty_screen->host_x;
+    host_y = tty_screen->host_y;
+    if (host_x == x && host_y == y)
+        return;
+    if (x == 0 && y == 0)
+        best_n = sprintf(best, "\033[H");
+    else if (x == 0)
+        best_n = sprintf(best, "\033[%dH", y + 1);
+    else
+        best_n = sprintf(best, "\033[%d;%dH", y + 1, x + 1);
+
+    if (host_x >= 0 && host_y >= 0) {
+        n = 0;
+        if (x == 0 && host_x != 0) {
+            buf[n++] = '\r';
+            host_x = 0;
+        }
+        if (y > host_y) {
+            /* the scrolling region is the whole screen here, so a
+             * line feed never scrolls */
+            d = y - host_y;
+            if (d <= 3) {
+                while (d--)
+                    buf[n++] = '\n';
+            } else {
+                n += sprintf(buf + n, "\033[%dB", d);
+            }
+        } else if (y < host_y) {
+            d = host_y - y;
+            n += d == 1 ? sprintf(buf + n, "\033[A") : sprintf(buf + n, "\033[%dA", d);
+        }
+        if (x > host_x) {
+            d = x - host_x;
+            n += d == 1 ? sprintf(buf + n, "\033[C") : sprintf(buf + n, "\033[%dC", d);
+        } else if (x < host_x) {
+            d = host_x - x;
+            if (d <= 3) {
+                while (d--)
+                    buf[n++] = '\b';
+            } else {
+                n += sprintf(buf + n, "\033[%dD", d);
+            }
+        }
+        if (n < best_n) {
+            memcpy(best, buf, n);
+            best_n = n;
+        }
+    }
+    mvt_tty_put(tty_screen, best, best_n);
+    tty_screen->host_x = x;
+    tty_screen->host_y = y;
+}
+
+/**
+ * Send a cell and the pad of a wide character after it.
+ * @return number of cells sent
+ */
+static int mvt_tty_put_cell(mvt_tty_screen_t *tty_screen, int x, int y)
+{
+    mvt_tty_cell_t *front = &tty_screen->front[y * tty_screen->width];
+    const mvt_tty_cell_t *cell = &tty_screen->back[y * tty_screen->width + x];
+    char buf[8];
+    mvt_char_t wc;
+    int n;
+
+    n = cell->attribute.wide && x + 1 < tty_screen->width ? 2 : 1;
+    wc = cell->text;
+    if (wc < 0x20 || (wc >= 0x7f && wc < 0xa0) || cell->attribute.no_char
+        || (n == 1 && cell->attribute.wide))
+        wc = ' ';
+    mvt_tty_set_attribute(tty_screen, &cell->attribute);
+    mvt_tty_put(tty_screen, buf, mvt_tty_encode_utf8(buf, wc));
+
+    /* overwriting a half of a wide character erases the other half */
+    if (x > 0 && front[x].attribute.no_char)
+        mvt_tty_forget_cell(&front[x - 1]);
+    if (x + n < tty_screen->width
+        && (front[x + n - 1].attribute.wide || front[x + n].attribute.no_char))
+        mvt_tty_forget_cell(&front[x + n]);
+    front[x] = cell[0];
+    if (n == 2)
+        front[x + 1] = cell[1];
+
+    tty_screen->host_x += n;
+    if (tty_screen->host_x >= tty_screen->width) {
+        /* the cursor may be pending to wrap */
+        tty_screen->host_x = -1;
+        tty_screen->host_y = -1;
+    }
+    return n;
+}
+
+/**
+ * Tell if the cells from the host cursor up to x can be sent again
+ * instead of moving the cursor, and it is shorter.
+ */
+static int mvt_tty_can_rewrite(const mvt_tty_screen_t *tty_screen, int x, int y)
+{
+    const mvt_tty_cell_t *cell;
+    int i;
+    if (tty_screen->host_y != y || tty_screen->host_x < 0
+        || x <= tty_screen->host_x || x - tty_screen->host_x > MVT_TTY_REWRITE_GAP)
+        return FALSE;
+    cell = &tty_screen->front[y * tty_screen->width];
+    for (i = tty_screen->host_x; i < x; i++) {
+        if ((cell[i].text != 0 && cell[i].text < 0x20) || cell[i].text >= 0x7f
+            || cell[i].attribute.wide || cell[i].attribute.no_char
+            || !mvt_tty_attribute_equal(&cell[i].attribute, &tty_screen->host_attribute))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static void mvt_tty_update_line(mvt_tty_screen_t *tty_screen, int y)
+{
+    mvt_tty_cell_t *front = &tty_screen->front[y * tty_screen->width];
+    const mvt_tty_cell_t *back = &tty_screen->back[y * tty_screen->width];
+    int x = tty_screen->dirty_left[y];
+    int right = tty_screen->dirty_right[y];
+    int start, i;
+    char c;
+
+    while (x <= right) {
+        if (mvt_tty_cell_equal(&front[x], &back[x])) {
+            x++;
+            continue;
+        }
+        /* a wide character is sent from its first cell */
+        if (x > 0 && back[x].attribute.no_char && back[x - 1].attribute.wide)
+            x--;
+        if (mvt_tty_can_rewrite(tty_screen, x, y)) {
+            for (i = tty_screen->host_x; i < x; i++) {
+                c = front[i].text ? front[i].text : ' ';
+                mvt_tty_put(tty_screen, &c, 1);
+            }
+            tty_screen->host_x = x;
+        } else {
+            mvt_tty_move_host_cursor(tty_screen, x, y);
+        }
+        start = x;
+        x += mvt_tty_put_cell(tty_screen, x, y);
+        /* the cells around may have been erased with a wide character */
+        if (x < tty_screen->width && x > right && front[x].text == MVT_TTY_UNKNOWN_CHAR)
+            right = x;
+        if (start > 0 && front[start - 1].text == MVT_TTY_UNKNOWN_CHAR)
+            x = start - 1;
+    }
+    tty_screen->dirty_left[y] = tty_screen->width;
+    tty_screen->dirty_right[y] = -1;
+}
+
+static void mvt_tty_invalidate(mvt_tty_screen_t *tty_screen, int x1, int y, int x2)
+{
+    if (tty_screen->dirty_left[y] > x1)
+        tty_screen->dirty_left[y] = x1;
+    if (tty_screen->dirty_right[y] < x2)
+        tty_screen->dirty_right[y] = x2;
+    tty_screen->damaged = TRUE;
+}
+
+static void *mvt_tty_screen_begin(mvt_screen_t *screen)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    return (void *)tty_screen->back;
+}
+
+static void mvt_tty_screen_end(mvt_screen_t *screen, void *gc)
+{
+}
+
+static void mvt_tty_screen_draw_text(mvt_screen_t *screen, void *gc, int x, int y, const mvt_char_t *ws, const mvt_attribute_t *attribute, size_t len)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    mvt_tty_cell_t *p;
+    int selection_x1, selection_x2;
+
+    /* the selected cells on this line are shown reversed */
+    selection_x1 = 1;
+    selection_x2 = 0;
+    if (y >= tty_screen->selection_start_y && y <= tty_screen->selection_end_y) {
+        selection_x1 = y == tty_screen->selection_start_y ? tty_screen->selection_start_x : 0;
+        selection_x2 = y == tty_screen->selection_end_y ? tty_screen->selection_end_x : tty_screen->width;
+    }
+
+    y -= tty_screen->scroll_top;
+    if (y < 0 || y >= tty_screen->height || x < 0 || x >= tty_screen->width || len == 0)
+        return;
+    if (len > (size_t)(tty_screen->width - x))
+        len = tty_screen->width - x;
+    mvt_tty_invalidate(tty_screen, x, y, x + len - 1);
+
+    p = &tty_screen->back[y * tty_screen->width + x];
+    for (; len > 0; len--, x++, ws++, attribute++, p++) {
+        p->text = *ws;
+        p->attribute = *attribute;
+        if (x >= selection_x1 && x <= selection_x2)
+            p->attribute.reverse = !p->attribute.reverse;
+    }
+}
+
+static void mvt_tty_screen_clear_rect(mvt_screen_t *screen, void *gc, int x1, int y1, int x2, int y2, mvt_color_t background_color)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    mvt_tty_cell_t blank;
+    int y;
+    y1 -= tty_screen->scroll_top;
+    y2 -= tty_screen->scroll_top;
+    if (y1 < 0)
+        y1 = 0;
+    if (x2 >= tty_screen->width)
+        x2 = tty_screen->width - 1;
+    if (y2 >= tty_screen->height)
+        y2 = tty_screen->height - 1;
+    if (x1 < 0 || y1 < 0 || x1 > x2 || y1 > y2)
+        return;
+    mvt_tty_blank_cell(&blank, background_color);
+    for (y = y1; y <= y2; y++) {
+        mvt_tty_fill_cells(&tty_screen->back[y * tty_screen->width + x1], &blank, x2 - x1 + 1);
+        mvt_tty_invalidate(tty_screen, x1, y, x2);
+    }
+}
+
+static void mvt_tty_screen_move_cursor(mvt_screen_t *screen, mvt_cursor_t cursor, int x, int y)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    switch (cursor) {
+    case MVT_CURSOR_CURRENT:
+        tty_screen->cursor_x = x;
+        tty_screen->cursor_y = y;
+        tty_screen->damaged = TRUE;
+        break;
+    case MVT_CURSOR_SELECTION_START:
+        tty_screen->selection_start_x = x;
+        tty_screen->selection_start_y = y;
+        break;
+    case MVT_CURSOR_SELECTION_END:
+        tty_screen->selection_end_x = x;
+        tty_screen->selection_end_y = y;
+        break;
+    }
+}
+
+/**
+ * Move lines of a grid down by count lines, or up if negative, and
+ * fill the lines left with the blank.
+ */
+static void mvt_tty_shift_lines(mvt_tty_cell_t *cells, int width, int y1, int y2, int count, const mvt_tty_cell_t *blank)
+{
+    int height = y2 - y1 + 1;
+    if (count > 0) {
+        memmove(&cells[(y1 + count) * width], &cells[y1 * width],
+                (height - count) * width * sizeof (mvt_tty_cell_t));
+        mvt_tty_fill_cells(&cells[y1 * width], blank, count * width);
+    } else {
+        memmove(&cells[y1 * width], &cells[(y1 - count) * width],
+                (height + count) * width * sizeof (mvt_tty_cell_t));
+        mvt_tty_fill_cells(&cells[(y2 + count + 1) * width], blank, -count * width);
+    }
+}
+
+static void mvt_tty_shift_spans(int *spans, int y1, int y2, int count, int value)
+{
+    int height = y2 - y1 + 1;
+    int i;
+    if (count > 0) {
+        memmove(&spans[y1 + count], &spans[y1], (height - count) * sizeof (int));
+        for (i = y1; i < y1 + count; i++)
+            spans[i] = value;
+    } else {
+        memmove(&spans[y1], &spans[y1 - count], (height + count) * sizeof (int));
+        for (i = y2 + count + 1; i <= y2; i++)
+            spans[i] = value;
+    }
+}
+
+/**
+ * Scroll the host terminal as well, so that the lines moved are not
+ * sent again. The shadow is moved the same way.
+ */
+static void mvt_tty_scroll_lines(mvt_tty_screen_t *tty_screen, int y1, int y2, int count)
+{
+    mvt_tty_cell_t blank;
+    char buf[MVT_TTY_SEQUENCE_SIZE];
+    int full, n;
+
+    assert(y1 >= 0 && y2 < tty_screen->height);
+    if (count == 0 || count >= y2 - y1 + 1 || count <= -(y2 - y1 + 1))
+        return;
+    mvt_tty_blank_cell(&blank, MVT_DEFAULT_COLOR);
+    mvt_tty_shift_lines(tty_screen->back, tty_screen->width, y1, y2, count, &blank);
+    mvt_tty_shift_lines(tty_screen->front, tty_screen->width, y1, y2, count, &blank);
+    mvt_tty_shift_spans(tty_screen->dirty_left, y1, y2, count, tty_screen->width);
+    mvt_tty_shift_spans(tty_screen->dirty_right, y1, y2, count, -1);
+
+    /* the lines scrolled in are erased with the current background */
+    mvt_tty_set_attribute(tty_screen, &blank.attribute);
+    full = y1 == 0 && y2 == tty_screen->height - 1;
+    n = 0;
+    if (!full)
+        n += sprintf(buf + n, "\033[%d;%dr", y1 + 1, y2 + 1);
+    if (count < 0)
+        n += count == -1 ? sprintf(buf + n, "\033[S") : sprintf(buf + n, "\033[%dS", -count);
+    else
+        n += count == 1 ? sprintf(buf + n, "\033[T") : sprintf(buf + n, "\033[%dT", count);
+    if (!full) {
+        /* setting the scrolling region homes the cursor */
+        n += sprintf(buf + n, "\033[r");
+        tty_screen->host_x = 0;
+        tty_screen->host_y = 0;
+    }
+    mvt_tty_put(tty_screen, buf, n);
+    tty_screen->damaged = TRUE;
+}
+
+static void mvt_tty_screen_scroll(mvt_screen_t *screen, int y1, int y2, int count)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    y1 = y1 == -1 ? 0 : y1 - tty_screen->scroll_top;
+    y2 = y2 == -1 ? tty_screen->height - 1 : y2 - tty_screen->scroll_top;
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 >= tty_screen->height)
+        y2 = tty_screen->height - 1;
+    if (y1 <= y2)
+        mvt_tty_scroll_lines(tty_screen, y1, y2, count);
+}
+
+static void mvt_tty_screen_beep(mvt_screen_t *screen)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    tty_screen->beep = TRUE;
+    tty_screen->damaged = TRUE;
+}
+
+static void mvt_tty_screen_get_size(mvt_screen_t *screen, int *width, int *height)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    *width = tty_screen->width;
+    *height = tty_screen->height;
+}
+
+/**
+ * Change the size of the grids. The host terminal is cleared, as it
+ * is not known how it has laid out the lines for the new size.
+ */
+static int mvt_tty_screen_resize(mvt_screen_t *screen, int width, int height)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    mvt_tty_cell_t *front, *back, blank;
+    int *dirty_left, *dirty_right;
+    int y;
+
+    if (width < 1 || height < 1)
+        return -1;
+    front = malloc((size_t)width * height * sizeof (mvt_tty_cell_t));
+    back = malloc((size_t)width * height * sizeof (mvt_tty_cell_t));
+    dirty_left = malloc(height * sizeof (int));
+    dirty_right = malloc(height * sizeof (int));
+    if (!front || !back || !dirty_left || !dirty_right) {
+        free(front);
+        free(back);
+        free(dirty_left);
+        free(dirty_right);
+        return -1;
+    }
+    free(tty_screen->front);
+    free(tty_screen->back);
+    free(tty_screen->dirty_left);
+    free(tty_screen->dirty_right);
+    tty_screen->front = front;
+    tty_screen->back = back;
+    tty_screen->dirty_left = dirty_left;
+    tty_screen->dirty_right = dirty_right;
+    tty_screen->width = width;
+    tty_screen->height = height;
+
+    mvt_tty_blank_cell(&blank, MVT_DEFAULT_COLOR);
+    mvt_tty_fill_cells(front, &blank, (size_t)width * height);
+    mvt_tty_fill_cells(back, &blank, (size_t)width * height);
+    for (y = 0; y < height; y++) {
+        dirty_left[y] = width;
+        dirty_right[y] = -1;
+    }
+    tty_screen->host_attribute = blank.attribute;
+    mvt_tty_puts(tty_screen, "\033[m\033[H\033[2J");
+    tty_screen->host_x = 0;
+    tty_screen->host_y = 0;
+    tty_screen->damaged = TRUE;
+    return 0;
+}
+
+static void mvt_tty_screen_set_title(mvt_screen_t *screen, const mvt_char_t *ws)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    char *title, *s;
+    if (!ws)
+        return;
+    title = malloc(mvt_strlen(ws) * 4 + 1);
+    if (!title)
+        return;
+    for (s = title; *ws; ws++) {
+        if (*ws >= 0x20 && *ws != 0x7f)
+            s += mvt_tty_encode_utf8(s, *ws);
+    }
+    *s = '\0';
+    free(tty_screen->title);
+    tty_screen->title = title;
+    tty_screen->damaged = TRUE;
+}
+
+/**
+ * Follow the lines shown. When the console moves them up as it
+ * fills the lines saved, the host terminal is scrolled the same.
+ */
+static void mvt_tty_screen_set_scroll_info(mvt_screen_t *screen, int scroll_position, int virtual_height)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    int count = scroll_position - tty_screen->scroll_top;
+    if (count == 0)
+        return;
+    tty_screen->scroll_top = scroll_position;
+    if (count > 0 && count < tty_screen->height) {
+        mvt_tty_scroll_lines(tty_screen, 0, tty_screen->height - 1, -count);
+    } else {
+        tty_screen->repaint = TRUE;
+        tty_screen->damaged = TRUE;
+    }
+}
+
+static void mvt_tty_screen_set_mode(mvt_screen_t *screen, int mode, int value)
+{
+}
+
+/**
+ * Send the changes of the frame if one is due.
+ * @return milliseconds until the next frame is due, or 0
+ */
+static unsigned int mvt_tty_present(mvt_tty_screen_t *tty_screen)
+{
+    unsigned int elapsed;
+    int x, y, visible;
+
+    if (tty_screen->repaint) {
+        tty_screen->repaint = FALSE;
+        mvt_screen_dispatch_paint((mvt_screen_t *)tty_screen, tty_screen->back,
+                                  0, tty_screen->scroll_top,
+                                  tty_screen->width - 1,
+                                  tty_screen->scroll_top + tty_screen->height - 1);
+    }
+
+    if (!tty_screen->damaged)
+        return 0;
+    elapsed = mvt_tty_get_ticks() - tty_screen->frame_ticks;
+    if (elapsed < tty_screen->frame_interval)
+        return tty_screen->frame_interval - elapsed;
+
+    if (tty_screen->title) {
+        mvt_tty_puts(tty_screen, "\033]2;");
+        mvt_tty_puts(tty_screen, tty_screen->title);
+        mvt_tty_puts(tty_screen, "\007");
+        free(tty_screen->title);
+        tty_screen->title = NULL;
+    }
+    if (tty_screen->beep) {
+        mvt_tty_puts(tty_screen, "\007");
+        tty_screen->beep = FALSE;
+    }
+    for (y = 0; y < tty_screen->height; y++) {
+        if (tty_screen->dirty_left[y] <= tty_screen->dirty_right[y])
+            mvt_tty_update_line(tty_screen, y);
+    }
+    x = tty_screen->cursor_x;
+    y = tty_screen->cursor_y - tty_screen->scroll_top;
+    visible = x >= 0 && x < tty_screen->width && y >= 0 && y < tty_screen->height;
+    if (visible)
+        mvt_tty_move_host_cursor(tty_screen, x, y);
+    if (visible != tty_screen->host_cursor_visible) {
+        mvt_tty_puts(tty_screen, visible ? "\033[?25h" : "\033[?25l");
+        tty_screen->host_cursor_visible = visible;
+    }
+    mvt_tty_flush(tty_screen);
+
+    tty_screen->frame_count++;
+    tty_screen->total_bytes += tty_screen->frame_bytes;
+    if (tty_screen->max_bytes < tty_screen->frame_bytes)
+        tty_screen->max_bytes = tty_screen->frame_bytes;
+    MVT_DEBUG_PRINT3("mvt_tty_present: frame %u, %lu bytes\n", tty_screen->frame_count, tty_screen->frame_bytes);
+    if (tty_screen->stats)
+        fprintf(tty_screen->stats, "%u %lu\n", tty_screen->frame_count, tty_screen->frame_bytes);
+    tty_screen->frame_bytes = 0;
+    tty_screen->damaged = FALSE;
+    tty_screen->frame_ticks = mvt_tty_get_ticks();
+    return 0;
+}
+
+/* input */
+
+static void mvt_tty_dispatch_keys(mvt_tty_screen_t *tty_screen, const unsigned char *s, size_t count)
+{
+    mvt_char_t wc;
+    size_t i, n;
+    int meta;
+
+    while (count > 0) {
+        meta = FALSE;
+        if (s[0] == 0x1b && count > 1) {
+            for (i = 0; mvt_tty_key_table[i].sequence; i++) {
+                n = strlen(mvt_tty_key_table[i].sequence);
+                if (n < count && memcmp(s + 1, mvt_tty_key_table[i].sequence, n) == 0)
+                    break;
+            }
+            if (mvt_tty_key_table[i].sequence) {
+                mvt_screen_dispatch_keydown((mvt_screen_t *)tty_screen, FALSE, mvt_tty_key_table[i].code);
+                s += n + 1;
+                count -= n + 1;
+                continue;
+            }
+            if (s[1] == '[') {
+                /* skip a sequence which is not known */
+                for (n = 2; n < count && (s[n] < 0x40 || s[n] > 0x7e); n++)
+                    ;
+                if (n < count) {
+                    s += n + 1;
+                    count -= n + 1;
+                    continue;
+                }
+                if (count <= sizeof tty_screen->input) {
+                    /* keep the rest for the next read */
+                    memmove(tty_screen->input, s, count);
+                    tty_screen->input_length = count;
+                    return;
+                }
+            }
+            /* ESC before a character is a meta key */
+            meta = TRUE;
+            s++;
+            count--;
+        }
+        n = mvt_tty_decode_utf8(s, count, &wc);
+        if (n == 0) {
+            /* keep the rest for the next read */
+            if (meta) {
+                s--;
+                count++;
+            }
+            if (count <= sizeof tty_screen->input) {
+                memmove(tty_screen->input, s, count);
+                tty_screen->input_length = count;
+            }
+            return;
+        }
+        mvt_screen_dispatch_keydown((mvt_screen_t *)tty_screen, meta, wc);
+        s += n;
+        count -= n;
+    }
+}
+
+static void mvt_tty_read_input(mvt_tty_screen_t *tty_screen)
+{
+    unsigned char buf[256 + sizeof tty_screen->input];
+    size_t count;
+    ssize_t n;
+
+    count = tty_screen->input_length;
+    memcpy(buf, tty_screen->input, count);
+    tty_screen->input_length = 0;
+    n = read(STDIN_FILENO, buf + count, sizeof buf - count);
+    if (n <= 0) {
+        if (n == 0 || (errno != EINTR && errno != EAGAIN))
+            input_closed = TRUE;
+        return;
+    }
+    mvt_tty_dispatch_keys(tty_screen, buf, count + n);
+}
+
+/**
+ * Follow the size of the host terminal.
+ */
+static void mvt_tty_update_size(mvt_tty_screen_t *tty_screen)
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0 || ws.ws_row == 0)
+        return;
+    if (ws.ws_col == tty_screen->width && ws.ws_row == tty_screen->height)
+        return;
+    if (mvt_tty_screen_resize((mvt_screen_t *)tty_screen, ws.ws_col, ws.ws_row) == -1)
+        return;
+    mvt_screen_dispatch_resize((mvt_screen_t *)tty_screen);
+    /* the console repaints the first lines rather than those shown */
+    tty_screen->repaint = TRUE;
+}
+
+static int mvt_tty_set_screen_attribute0(mvt_tty_screen_t *tty_screen, const char *name, const char *value)
+{
+    if (strcmp(name, "width") == 0)
+        tty_screen->width = atoi(value);
+    else if (strcmp(name, "height") == 0)
+        tty_screen->height = atoi(value);
+    else if (strcmp(name, "frame-rate") == 0) {
+        int frame_rate = atoi(value);
+        if (frame_rate <= 0)
+            return -1;
+        tty_screen->frame_interval = 1000 / frame_rate;
+    } else if (strcmp(name, "stats") == 0) {
+        /* a file to write bytes sent a frame */
+        FILE *fp = fopen(value, "w");
+        if (!fp)
+            return -1;
+        setvbuf(fp, NULL, _IOLBF, 0);
+        if (tty_screen->stats)
+            fclose(tty_screen->stats);
+        tty_screen->stats = fp;
+    }
+    return 0;
+}
+
+static mvt_screen_t *mvt_tty_open_screen(char **args)
+{
+    mvt_tty_screen_t *tty_screen;
+    struct termios termios;
+    struct winsize ws;
+    const char *name, *value;
+    char **p;
+
+    if (global_tty_screen) {
+        MVT_DEBUG_PRINT1("Only one screen can be opened on tty\n");
+        return NULL;
+    }
+    tty_screen = malloc(sizeof (mvt_tty_screen_t));
+    if (!tty_screen)
+        return NULL;
+    mvt_tty_screen_init(tty_screen);
+    p = args;
+    while (*p) {
+        name = *p++;
+        if (!*p)
+            goto error;
+        value = *p++;
+        if (mvt_tty_set_screen_attribute0(tty_screen, name, value) == -1)
+            goto error;
+    }
+    /* the size of the host terminal wins over the attributes */
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0) {
+        tty_screen->width = ws.ws_col;
+        tty_screen->height = ws.ws_row;
+    }
+    if (tcgetattr(STDIN_FILENO, &saved_termios) == 0) {
+        saved_termios_valid = TRUE;
+        termios = saved_termios;
+        cfmakeraw(&termios);
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &termios);
+    }
+    /* the alternate screen keeps what the host terminal showed */
+    mvt_tty_puts(tty_screen, "\033[?1049h");
+    if (mvt_tty_screen_resize((mvt_screen_t *)tty_screen, tty_screen->width, tty_screen->height) == -1)
+        goto error;
+    global_tty_screen = tty_screen;
+    return (mvt_screen_t *)tty_screen;
+error:
+    if (saved_termios_valid) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+        saved_termios_valid = FALSE;
+    }
+    mvt_tty_screen_destroy(tty_screen);
+    free(tty_screen);
+    return NULL;
+}
+
+static void mvt_tty_close_screen(mvt_screen_t *screen)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    mvt_screen_dispatch_close(screen);
+    mvt_tty_puts(tty_screen, "\033[m\033[?25h\033[?1049l");
+    mvt_tty_flush(tty_screen);
+    if (saved_termios_valid) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+        saved_termios_valid = FALSE;
+    }
+    if (tty_screen->stats && tty_screen->frame_count > 0)
+        fprintf(tty_screen->stats, "# %u frames, %lu bytes, %lu bytes a frame on average, %lu at most\n",
+                tty_screen->frame_count, tty_screen->total_bytes,
+                tty_screen->total_bytes / tty_screen->frame_count, tty_screen->max_bytes);
+    mvt_tty_screen_destroy(tty_screen);
+    free(screen);
+    global_tty_screen = NULL;
+}
+
+static int mvt_tty_set_screen_attribute(mvt_screen_t *screen, const char *name, const char *value)
+{
+    mvt_tty_screen_t *tty_screen = (mvt_tty_screen_t *)screen;
+    if (strcmp(name, "width") == 0 || strcmp(name, "height") == 0)
+        return -1;
+    return mvt_tty_set_screen_attribute0(tty_screen, name, value);
+}
+
+static void mvt_tty_wake_up(void)
+{
+    int saved_errno = errno;
+    if (write(tty_pipe[1], "", 1) == -1) {
+        /* the pipe is full, so the main loop is woken up anyway */
+    }
+    errno = saved_errno;
+}
+
+static void mvt_tty_sigwinch(int signum)
+{
+    winch_pending = TRUE;
+    mvt_tty_wake_up();
+}
+
+void mvt_notify_request(void)
+{
+    pthread_mutex_lock(&tty_mutex);
+    if (!request_pending) {
+        request_pending = TRUE;
+        mvt_tty_wake_up();
+    }
+    pthread_mutex_unlock(&tty_mutex);
+}
+
+static int mvt_tty_init(int *argc, char ***argv, mvt_event_func_t event_func)
+{
+    struct sigaction action;
+    if (pipe(tty_pipe) == -1) {
+        fprintf(stderr, "Unable to create a pipe\n");
+        return -1;
+    }
+    fcntl(tty_pipe[0], F_SETFL, fcntl(tty_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(tty_pipe[1], F_SETFL, fcntl(tty_pipe[1], F_GETFL) | O_NONBLOCK);
+    memset(&action, 0, sizeof action);
+    action.sa_handler = mvt_tty_sigwinch;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &action, NULL);
+    pthread_mutex_init(&tty_mutex, NULL);
+    request_pending = FALSE;
+    input_closed = FALSE;
+    mvt_worker_init(event_func);
+    return 0;
+}
+
+static void mvt_tty_main(void)
+{
+    struct pollfd fds[2];
+    unsigned int delay;
+    char buf[64];
+    int pending;
+
+    loop = TRUE;
+    delay = 0;
+    while (loop) {
+        fds[0].fd = tty_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = input_closed || !global_tty_screen ? -1 : STDIN_FILENO;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        if (poll(fds, 2, delay > 0 ? (int)delay : -1) == -1 && errno != EINTR)
+            break;
+        while (read(tty_pipe[0], buf, sizeof buf) > 0)
+            ;
+        pthread_mutex_lock(&tty_mutex);
+        pending = request_pending;
+        request_pending = FALSE;
+        pthread_mutex_unlock(&tty_mutex);
+        if (pending)
+            mvt_handle_request();
+        if (winch_pending) {
+            winch_pending = FALSE;
+            if (global_tty_screen)
+                mvt_tty_update_size(global_tty_screen);
+        }
+        if (global_tty_screen && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+            mvt_tty_read_input(global_tty_screen);
+        delay = 0;
+        if (global_tty_screen)
+            delay = mvt_tty_present(global_tty_screen);
+    }
+}
+
+static void mvt_tty_main_quit(void)
+{
+    loop = FALSE;
+    mvt_tty_wake_up();
+}
+
+static void mvt_tty_exit(void)
+{
+    struct sigaction action;
+    mvt_worker_exit();
+    memset(&action, 0, sizeof action);
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGWINCH, &action, NULL);
+    pthread_mutex_destroy(&tty_mutex);
+    close(tty_pipe[0]);
+    close(tty_pipe[1]);
+    tty_pipe[0] = tty_pipe[1] = -1;
+}
+
+static const mvt_driver_vt_t mvt_tty_driver_vt = {
+    mvt_tty_init,
+    mvt_tty_main,
+    mvt_tty_main_quit,
+    mvt_tty_exit,
+    mvt_tty_open_screen,
+    mvt_tty_close_screen,
+    mvt_worker_open_terminal,
+    mvt_worker_close_terminal,
+    mvt_tty_set_screen_attribute,
+    mvt_worker_set_terminal_attribute,
+    mvt_worker_suspend,
+    mvt_worker_resume,
+    mvt_worker_shutdown
+};
+
+static const mvt_driver_t mvt_tty_driver = {
+    &mvt_tty_driver_vt, "tty"
+};
+
+const mvt_driver_t *mvt_get_driver(void)
+{
+    return &mvt_tty_driver;
+}
+
+/* utilities */
+
+static unsigned int mvt_tty_get_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static size_t mvt_tty_encode_utf8(char *s, mvt_char_t wc)
+{
+    if (wc < 0x80) {
+        s[0] = wc;
+        return 1;
+    }
+    if (wc < 0x800) {
+        s[0] = 0xc0 | (wc >> 6);
+        s[1] = 0x80 | (wc & 0x3f);
+        return 2;
+    }
+    if (wc < 0x10000) {
+        s[0] = 0xe0 | (wc >> 12);
+        s[1] = 0x80 | ((wc >> 6) & 0x3f);
+        s[2] = 0x80 | (wc & 0x3f);
+        return 3;
+    }
+    if (wc < 0x110000) {
+        s[0] = 0xf0 | (wc >> 18);
+        s[1] = 0x80 | ((wc >> 12) & 0x3f);
+        s[2] = 0x80 | ((wc >> 6) & 0x3f);
+        s[3] = 0x80 | (wc & 0x3f);
+        return 4;
+    }
+    s[0] = '?';
+    return 1;
+}
+
+/**
+ * Decode a UTF-8 character. A byte which does not start a character
+ * is taken as it is.
+ * @return number of bytes used, or 0 if the character continues
+ * beyond count bytes
+ */
+static size_t mvt_tty_decode_utf8(const unsigned char *s, size_t count, mvt_char_t *wc)
+{
+    size_t n, i;
+    if (s[0] < 0xc0 || s[0] >= 0xf8) {
+        *wc = s[0];
+        return 1;
+    }
+    n = s[0] < 0xe0 ? 2 : s[0] < 0xf0 ? 3 : 4;
+    if (count < n)
+        return 0;
+    *wc = s[0] & (0x3f >> (n - 1));
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            *wc = s[0];
+            return 1;
+        }
+        *wc = (*wc << 6) | (s[i] & 0x3f);
+    }
+    return n;
+}
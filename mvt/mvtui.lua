@@ -26,6 +26,9 @@ local M = {}
 M.default_screen_spec = ""
 M.default_terminal_spec_list = {}
 M.default_session = ""
+-- sessions of pool_spec kept started for new terminals
+M.pool_spec = "pty"
+M.pool_size = 0
 M.font_size_table = { 8, 10, 12, 14, 16, 20, 24 }
 M.screen_key_bind_table = {}
 M.terminal_key_bind_table = {}
@@ -242,6 +245,9 @@ function M.quit ()
 end
 
 function M.start_default_ui ()
+   if M.pool_size > 0 then
+      mvt.set_pool(M.pool_spec, M.pool_size)
+   end
    local screen = M.open_screen(M.default_screen_spec)
    screen:open_new_terminal_and_connect()
    local version = mvt.major_version
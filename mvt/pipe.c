@@ -17,6 +17,21 @@
  * Boston, MA 02111-1307, USA.
  */
 
+/* A session whose other end is the program embedding the terminal.
+ * Each direction is a ring with one producer and one consumer, which
+ * only share the indices, so neither side takes a lock to move bytes.
+ * The program writes the input in place between mvt_pipe_lock_in()
+ * and mvt_pipe_unlock_in(), and reads the output in place between
+ * mvt_pipe_lock_out() and mvt_pipe_unlock_out().
+ *
+ * With threads, reading an empty ring or writing a full one waits
+ * until the other side moves, and the mutex is only taken when a side
+ * waits or wakes one which does. Without them, nothing waits and the
+ * sides poll. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #include <mvt/mvt.h>
 #include "private.h"
 #include "debug.h"
@@ -25,19 +40,42 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if defined(_MSC_VER)
+#include <windows.h>
+#endif
 
-#define MVT_PIPE_DEFAULT_DATA_SIZE 1024
+#define MVT_PIPE_DEFAULT_DATA_SIZE 1048576
+#define MVT_PIPE_MIN_DATA_SIZE 4096
 
 typedef struct _mvt_pipe mvt_pipe_t;
+typedef struct _mvt_pipe_ring mvt_pipe_ring_t;
+
+/* head and tail run freely and are masked into the data, so the ring
+ * is empty when they are equal and full when they are size apart */
+struct _mvt_pipe_ring {
+    uint8_t *data;
+    size_t size;
+    size_t head;
+    size_t tail;
+    /* where a span which didn't fit before the end was moved to the
+     * start, so the bytes from here to the end are skipped */
+    size_t pad;
+};
 
 struct _mvt_pipe {
     mvt_session_t parent;
-    uint8_t *in_data;
-    size_t in_length;
-    size_t in_offset;
-    uint8_t *out_data;
-    size_t out_length;
-    size_t out_offset;
+    mvt_pipe_ring_t in;
+    mvt_pipe_ring_t out;
+    int in_closed;
+    int closed;
+#ifdef HAVE_PTHREAD
+    int waiters;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
 };
 
 static void mvt_pipe_close(mvt_session_t *session);
@@ -53,32 +91,180 @@ static const mvt_session_vt_t mvt_pipe_vt = {
     mvt_pipe_read,
     mvt_pipe_write,
     mvt_pipe_shutdown,
-    mvt_pipe_resize
+    mvt_pipe_resize,
+    NULL,
+    NULL
 };
 
+#if defined(__GNUC__)
+#define mvt_pipe_load(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define mvt_pipe_store(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+static size_t mvt_pipe_load_size(const volatile size_t *p)
+{
+    size_t v = *p;
+    MemoryBarrier();
+    return v;
+}
+#define mvt_pipe_load(p) mvt_pipe_load_size(p)
+#define mvt_pipe_store(p, v) (MemoryBarrier(), *(volatile size_t *)(p) = (v), MemoryBarrier())
+#else
+#define mvt_pipe_load(p) (*(volatile size_t *)(p))
+#define mvt_pipe_store(p, v) (*(volatile size_t *)(p) = (v))
+#endif
+
+static int mvt_pipe_ring_init(mvt_pipe_ring_t *ring, size_t size)
+{
+    memset(ring, 0, sizeof *ring);
+    ring->data = (uint8_t *)malloc(size);
+    if (ring->data == NULL)
+        return -1;
+    ring->size = size;
+    ring->pad = (size_t)-1;
+    return 0;
+}
+
+/**
+ * The bytes which can be read at once from the tail, skipping the pad
+ * when the tail is at it.
+ */
+static size_t mvt_pipe_ring_readable(mvt_pipe_ring_t *ring, uint8_t **data)
+{
+    size_t head = mvt_pipe_load(&ring->head);
+    size_t tail = ring->tail;
+    size_t pad = mvt_pipe_load(&ring->pad);
+    size_t offset, n;
+
+    if (tail != head && tail == pad) {
+        tail += ring->size - (tail & (ring->size - 1));
+        mvt_pipe_store(&ring->tail, tail);
+    }
+    offset = tail & (ring->size - 1);
+    n = head - tail;
+    if (n > ring->size - offset)
+        n = ring->size - offset;
+    if (pad - tail < n)
+        n = pad - tail;
+    *data = ring->data + offset;
+    return n;
+}
+
+static void mvt_pipe_ring_consume(mvt_pipe_ring_t *ring, size_t count)
+{
+    mvt_pipe_store(&ring->tail, ring->tail + count);
+}
+
+/**
+ * The bytes which can be written at once from the head, without
+ * moving to the start.
+ */
+static size_t mvt_pipe_ring_writable(mvt_pipe_ring_t *ring, uint8_t **data)
+{
+    size_t tail = mvt_pipe_load(&ring->tail);
+    size_t offset = ring->head & (ring->size - 1);
+    size_t n = ring->size - (ring->head - tail);
+
+    if (n > ring->size - offset)
+        n = ring->size - offset;
+    *data = ring->data + offset;
+    return n;
+}
+
+static void mvt_pipe_ring_produce(mvt_pipe_ring_t *ring, size_t count)
+{
+    mvt_pipe_store(&ring->head, ring->head + count);
+}
+
+/**
+ * A span of count bytes in one piece, moving to the start when it
+ * doesn't fit before the end.
+ * @return the span, or NULL if there isn't room now
+ */
+static uint8_t *mvt_pipe_ring_reserve(mvt_pipe_ring_t *ring, size_t count)
+{
+    size_t tail = mvt_pipe_load(&ring->tail);
+    size_t offset = ring->head & (ring->size - 1);
+    size_t room = ring->size - (ring->head - tail);
+    size_t skip = 0;
+
+    if (count > ring->size - offset)
+        skip = ring->size - offset;
+    if (skip + count > room)
+        return NULL;
+    if (skip > 0) {
+        /* the reader is past the last pad, since the ring has had
+         * room for the whole skip */
+        mvt_pipe_store(&ring->pad, ring->head);
+        mvt_pipe_ring_produce(ring, skip);
+        offset = 0;
+    }
+    return ring->data + offset;
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * Wake the sides waiting for the pipe. The indices are stored before
+ * the waiters are counted, and a waiter counts itself before it looks
+ * at them, so one of them sees the other.
+ */
+static void mvt_pipe_wake(mvt_pipe_t *pipe)
+{
+    if (__atomic_load_n(&pipe->waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pipe->mutex);
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->mutex);
+    }
+}
+
+#define mvt_pipe_wait_begin(pipe) \
+    (pthread_mutex_lock(&(pipe)->mutex), \
+     __atomic_add_fetch(&(pipe)->waiters, 1, __ATOMIC_SEQ_CST))
+#define mvt_pipe_wait(pipe) pthread_cond_wait(&(pipe)->cond, &(pipe)->mutex)
+#define mvt_pipe_wait_end(pipe) \
+    (__atomic_sub_fetch(&(pipe)->waiters, 1, __ATOMIC_SEQ_CST), \
+     pthread_mutex_unlock(&(pipe)->mutex))
+#else
+#define mvt_pipe_wake(pipe)
+#endif
+
+/**
+ * Open a pipe.
+ * args: size - the bytes each direction holds, rounded up to a power
+ * of two
+ */
 mvt_session_t *
-mvt_pipe_open (void)
+mvt_pipe_open (char **args, mvt_session_t *source, int width, int height)
 {
-    mvt_pipe_t *pipe = (mvt_pipe_t *)malloc(sizeof (mvt_pipe_t));
+    mvt_pipe_t *pipe;
+    size_t size = MVT_PIPE_DEFAULT_DATA_SIZE, n;
+
     MVT_DEBUG_PRINT1("mvt_pipe_open\n");
+    while (*args != NULL) {
+        if (strcmp(args[0], "size") == 0) {
+            n = strtoul(args[1], NULL, 10);
+            for (size = MVT_PIPE_MIN_DATA_SIZE; size < n && size * 2 > size; size *= 2)
+                ;
+        }
+        args += 2;
+    }
+    pipe = (mvt_pipe_t *)malloc(sizeof (mvt_pipe_t));
     if (pipe == NULL)
         return NULL;
+    memset(pipe, 0, sizeof (mvt_pipe_t));
     pipe->parent.vt = &mvt_pipe_vt;
-    pipe->in_data = (uint8_t *)malloc(MVT_PIPE_DEFAULT_DATA_SIZE);
-    if (pipe->in_data == NULL) {
+    if (mvt_pipe_ring_init(&pipe->in, size) == -1) {
         free(pipe);
         return NULL;
     }
-    pipe->in_offset = 0;
-    pipe->in_length = MVT_PIPE_DEFAULT_DATA_SIZE;
-    pipe->out_data = (uint8_t *)malloc(MVT_PIPE_DEFAULT_DATA_SIZE);
-    if (pipe->in_data == NULL) {
-        free(pipe->in_data);
+    if (mvt_pipe_ring_init(&pipe->out, size) == -1) {
+        free(pipe->in.data);
         free(pipe);
         return NULL;
     }
-    pipe->out_offset = 0;
-    pipe->out_length = MVT_PIPE_DEFAULT_DATA_SIZE;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&pipe->mutex, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+#endif
     return &pipe->parent;
 }
 
@@ -87,61 +273,113 @@ mvt_pipe_close(mvt_session_t *session)
 {
     mvt_pipe_t *pipe = (mvt_pipe_t *)session;
 
-    free(pipe->in_data);
-    free(pipe->out_data);
+#ifdef HAVE_PTHREAD
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->mutex);
+#endif
+    free(pipe->in.data);
+    free(pipe->out.data);
     free(pipe);
 }
 
 static int
 mvt_pipe_connect (mvt_session_t *session)
 {
-    mvt_pipe_t *pipe = (mvt_pipe_t *)session;
-
     MVT_DEBUG_PRINT1("mvt_pipe_connect()\n");
 
     return 1;
 }
 
+/**
+ * Read the input, waiting while there is none.
+ * @return 0, or -1 when the input is closed and has been read
+ */
 static int
 mvt_pipe_read (mvt_session_t *session, void *buf, size_t count, size_t *countread)
 {
     mvt_pipe_t *pipe = (mvt_pipe_t *)session;
+    uint8_t *p = (uint8_t *)buf, *data;
     size_t n;
 
-    n = pipe->in_offset;
-    if (n > count)
-        n = count;
-    if (n > 0) {
-        memcpy(buf, pipe->in_data, n);
-        if (n < pipe->in_offset)
-            memmove(pipe->in_data, pipe->in_data + n, pipe->in_offset - n);
-        pipe->in_offset -= n;
+    *countread = 0;
+    n = mvt_pipe_ring_readable(&pipe->in, &data);
+#ifdef HAVE_PTHREAD
+    if (n == 0) {
+        mvt_pipe_wait_begin(pipe);
+        while ((n = mvt_pipe_ring_readable(&pipe->in, &data)) == 0
+               && !__atomic_load_n(&pipe->in_closed, __ATOMIC_SEQ_CST)
+               && !pipe->closed)
+            mvt_pipe_wait(pipe);
+        mvt_pipe_wait_end(pipe);
     }
-    *countread = n;
-
+#endif
+    /* the second span is the rest from the start of the ring */
+    while (n > 0 && count > 0) {
+        if (n > count)
+            n = count;
+        memcpy(p, data, n);
+        mvt_pipe_ring_consume(&pipe->in, n);
+        p += n;
+        count -= n;
+        *countread += n;
+        n = mvt_pipe_ring_readable(&pipe->in, &data);
+    }
+    if (*countread == 0 && (pipe->in_closed || pipe->closed))
+        return -1;
+    mvt_pipe_wake(pipe);
     return 0;
 }
 
+/**
+ * Write the output, waiting while it is full.
+ */
 static int
 mvt_pipe_write (mvt_session_t *session, const void *buf, size_t count, size_t *countwritten)
 {
     mvt_pipe_t *pipe = (mvt_pipe_t *)session;
+    const uint8_t *p = (const uint8_t *)buf;
+    uint8_t *data;
     size_t n;
 
-    n = pipe->out_length - pipe->out_offset;
-    if (n > count)
-        n = count;
-    if (n > 0) {
-        memcpy(pipe->out_data + pipe->out_offset, buf, n);
-        pipe->out_offset += n;
+    *countwritten = 0;
+    n = mvt_pipe_ring_writable(&pipe->out, &data);
+#ifdef HAVE_PTHREAD
+    if (n == 0 && count > 0) {
+        mvt_pipe_wait_begin(pipe);
+        while ((n = mvt_pipe_ring_writable(&pipe->out, &data)) == 0 && !pipe->closed)
+            mvt_pipe_wait(pipe);
+        mvt_pipe_wait_end(pipe);
     }
-    *countwritten = n;
+#endif
+    if (pipe->closed)
+        return -1;
+    while (n > 0 && count > 0) {
+        if (n > count)
+            n = count;
+        memcpy(data, p, n);
+        mvt_pipe_ring_produce(&pipe->out, n);
+        p += n;
+        count -= n;
+        *countwritten += n;
+        n = mvt_pipe_ring_writable(&pipe->out, &data);
+    }
+    mvt_pipe_wake(pipe);
     return 0;
 }
 
 static void
 mvt_pipe_shutdown (mvt_session_t *session)
 {
+    mvt_pipe_t *pipe = (mvt_pipe_t *)session;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&pipe->mutex);
+    pipe->closed = TRUE;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->mutex);
+#else
+    pipe->closed = TRUE;
+#endif
 }
 
 static void
@@ -149,55 +387,87 @@ mvt_pipe_resize (mvt_session_t *session, int width, int height)
 {
 }
 
+/**
+ * Get count bytes of the input in one piece to write in place,
+ * waiting for the room. The bytes are at most half the size, which an
+ * empty ring always has in one piece wherever its head is.
+ * @return the bytes, or NULL if they are too many or the pipe is shut
+ * down
+ */
 void *
 mvt_pipe_lock_in (mvt_session_t *session, size_t count)
 {
     mvt_pipe_t *pipe = (mvt_pipe_t *)session;
+    uint8_t *data;
 
-    if (pipe->in_offset + count > pipe->in_length) {
-        uint8_t *data = (uint8_t *)realloc(pipe->in_data, pipe->in_offset + count);
-        if (data == NULL)
-            return NULL;
-        pipe->in_data = data;
-        pipe->in_length = pipe->in_offset + count;
+    if (count > pipe->in.size / 2)
+        return NULL;
+    data = mvt_pipe_ring_reserve(&pipe->in, count);
+#ifdef HAVE_PTHREAD
+    if (data == NULL) {
+        mvt_pipe_wait_begin(pipe);
+        while ((data = mvt_pipe_ring_reserve(&pipe->in, count)) == NULL && !pipe->closed)
+            mvt_pipe_wait(pipe);
+        mvt_pipe_wait_end(pipe);
     }
-    return pipe->in_data + pipe->in_offset;
+#endif
+    if (pipe->closed)
+        return NULL;
+    return data;
 }
 
+/**
+ * Pass count bytes written since mvt_pipe_lock_in() to the terminal.
+ */
 void
 mvt_pipe_unlock_in (mvt_session_t *session, size_t count)
 {
     mvt_pipe_t *pipe = (mvt_pipe_t *)session;
 
-    if (pipe->in_offset + count > pipe->in_length)
-        return;
+    mvt_pipe_ring_produce(&pipe->in, count);
+    mvt_pipe_wake(pipe);
+}
 
-    pipe->in_offset += count;
+/**
+ * Tell the terminal that no more input comes. The session ends when
+ * it has read what is left.
+ */
+void
+mvt_pipe_close_in (mvt_session_t *session)
+{
+    mvt_pipe_t *pipe = (mvt_pipe_t *)session;
+
+#ifdef HAVE_PTHREAD
+    __atomic_store_n(&pipe->in_closed, TRUE, __ATOMIC_SEQ_CST);
+#else
+    pipe->in_closed = TRUE;
+#endif
+    mvt_pipe_wake(pipe);
 }
 
+/**
+ * Get the output in one piece to read in place. The rest of it comes
+ * from the next call after mvt_pipe_unlock_out().
+ */
 void *
 mvt_pipe_lock_out (mvt_session_t *session, size_t *count)
 {
     mvt_pipe_t *pipe = (mvt_pipe_t *)session;
+    uint8_t *data;
 
-    *count = pipe->out_offset;
+    *count = mvt_pipe_ring_readable(&pipe->out, &data);
 
-    return pipe->out_data;
+    return data;
 }
 
+/**
+ * Drop count bytes of the output read since mvt_pipe_lock_out().
+ */
 void
 mvt_pipe_unlock_out (mvt_session_t *session, size_t count)
 {
     mvt_pipe_t *pipe = (mvt_pipe_t *)session;
 
-    assert(count <= pipe->out_offset);
-
-    if (count > pipe->out_offset)
-        return;
-
-    if (count < pipe->out_offset) {
-        memmove(pipe->out_data, pipe->out_data + count, pipe->out_offset - count);
-    }
-    pipe->out_offset -= count;
+    mvt_pipe_ring_consume(&pipe->out, count);
+    mvt_pipe_wake(pipe);
 }
-
@@ -28,6 +28,9 @@
 
 typedef struct _mvt_telnet mvt_telnet_t;
 typedef struct _mvt_console mvt_console_t;
+typedef struct _mvt_cell mvt_cell_t;
+typedef struct _mvt_line mvt_line_t;
+typedef struct _mvt_stream_state mvt_stream_state_t;
 
 #define mvt_screen_begin(screen) ((*(screen)->vt->begin)((screen)))
 #define mvt_screen_end(screen, gc) ((*(screen)->vt->end)((screen), (gc)))
@@ -43,10 +46,71 @@ typedef struct _mvt_console mvt_console_t;
 #define mvt_screen_set_scroll_info(screen, scroll_position, virtual_height) ((*(screen)->vt->set_scroll_info)((screen), (scroll_position), (virtual_height)))
 #define mvt_screen_set_mode(screen, mode, value) ((*(screen)->vt->set_mode)((screen), (mode), (value)))
 
+/*! \addtogroup Cell
+ * @{
+ */
+
+/**
+ * a character cell. The text and the attribute are stored side by
+ * side so that writing, moving and painting a cell touches a single
+ * memory stream.
+ */
+struct _mvt_cell {
+    mvt_char_t text;
+    mvt_attribute_t attribute;
+};
+
+/**
+ * a run of cells. With ENABLE_SPLIT_CELLS, the default, texts and
+ * attributes are kept in two parallel arrays, which paint hands to the
+ * screen as they are. Otherwise this is an array of interleaved cells.
+ */
+#ifdef ENABLE_SPLIT_CELLS
+typedef struct _mvt_row {
+    mvt_char_t *text;
+    mvt_attribute_t *attribute;
+} mvt_row_t;
+#define mvt_row_text(row, x) ((row).text[x])
+#define mvt_row_attribute(row, x) ((row).attribute[x])
+#else
+typedef mvt_cell_t *mvt_row_t;
+#define mvt_row_text(row, x) ((row)[x].text)
+#define mvt_row_attribute(row, x) ((row)[x].attribute)
+#endif
+
+int mvt_row_alloc(mvt_row_t *row, size_t count);
+int mvt_row_realloc(mvt_row_t *row, size_t count);
+void mvt_row_free(mvt_row_t *row);
+void mvt_row_fill(mvt_row_t row, size_t x, size_t count, const mvt_attribute_t *attribute);
+void mvt_row_move(mvt_row_t dst, size_t dst_x, mvt_row_t src, size_t src_x, size_t count);
+void mvt_row_unpack(mvt_row_t row, size_t x, size_t count, mvt_char_t *text_buffer, mvt_attribute_t *attribute_buffer, const mvt_char_t **text, const mvt_attribute_t **attribute);
+size_t mvt_row_save(mvt_row_t row, size_t count, void *buf);
+void mvt_row_load(mvt_row_t row, size_t count, const void *buf);
+
+/** @} */
+
 /*! \addtogroup Console
  * @{
  */
 
+/**
+ * a line in the buffer. A blank line is cleared with blank_attribute
+ * regardless of what its cells hold, and the cells are filled when
+ * the line is written next. A line whose generation differs from the
+ * console's was cleared by a full reset. A line keeps the width it
+ * was laid out for; it is clipped or padded with blank_attribute when
+ * the console is of a different width.
+ */
+struct _mvt_line {
+    mvt_row_t cells;
+    int capacity; /** number of cells allocated */
+    int width; /** number of valid cells */
+    unsigned int generation;
+    int blank;
+    int wrapped; /** the text continues on the next line */
+    mvt_attribute_t blank_attribute;
+};
+
 /**
  * a console
  */
@@ -54,14 +118,18 @@ struct _mvt_console {
     mvt_screen_t *screen;
     
     int offset;
-    mvt_char_t *text_buffer;
-    mvt_attribute_t *attribute_buffer;
+    mvt_line_t *lines; /** a ring of virtual_height lines */
+    unsigned int generation;
+    mvt_attribute_t reset_attribute; /** attribute of the last full reset */
+    mvt_char_t *paint_text; /** scratch row handed to draw_text */
+    mvt_attribute_t *paint_attribute; /** scratch row handed to draw_text */
     int width;
     int height;
     int virtual_height;
     int save_height;
     
     int top;
+    int below_height; /** lines below the screen which may not be blank */
 
     int cursor_x; /** a virtual X position of the cursor */
     int cursor_y; /** a virtual Y position of the cursor */
@@ -136,6 +204,95 @@ void mvt_console_set_selection(mvt_console_t *console, int x1, int y1, int align
 void mvt_console_get_selection(const mvt_console_t *console, int *start_vx, int *start_vy, int *end_vx, int *end_vy);
 #define mvt_console_has_selection(console) ((console)->selection_y1 != -1)
 int mvt_console_set_title(mvt_console_t *console, const mvt_char_t *ws);
+int mvt_console_capture(const mvt_console_t *console, mvt_stream_state_t *state);
+size_t mvt_console_save(const mvt_console_t *console, uint8_t *buf);
+size_t mvt_console_restore(mvt_console_t *console, const uint8_t *data, size_t count);
+
+/** @} */
+
+/*! \addtogroup Stream
+ * @{
+ */
+
+/**
+ * the visible cells of a console as they are sent to remote viewers
+ */
+struct _mvt_stream_state {
+    uint32_t sequence;
+    int width;
+    int height;
+    mvt_char_t *text;
+    uint32_t *attribute; /** packed by mvt_stream_pack_attribute */
+    int cursor_x;
+    int cursor_y;
+    int cursor_visible;
+    mvt_char_t *title;
+    size_t title_length;
+};
+
+typedef struct _mvt_stream_buffer {
+    uint8_t *data;
+    size_t length;
+    size_t size;
+} mvt_stream_buffer_t;
+
+typedef struct _mvt_stream_server mvt_stream_server_t;
+
+uint32_t mvt_stream_pack_attribute(const mvt_attribute_t *attribute);
+void mvt_stream_unpack_attribute(mvt_attribute_t *attribute, uint32_t value);
+void mvt_stream_state_init(mvt_stream_state_t *state);
+void mvt_stream_state_destroy(mvt_stream_state_t *state);
+int mvt_stream_state_resize(mvt_stream_state_t *state, int width, int height);
+int mvt_stream_state_set_title(mvt_stream_state_t *state, const mvt_char_t *ws, size_t count);
+int mvt_stream_state_copy(mvt_stream_state_t *dst, const mvt_stream_state_t *src);
+int mvt_stream_encode(mvt_stream_buffer_t *buffer, const mvt_stream_state_t *base, const mvt_stream_state_t *state);
+size_t mvt_stream_update_length(const uint8_t *data, size_t count);
+int mvt_stream_decode(mvt_stream_state_t *state, const uint8_t *data, size_t count);
+int mvt_terminal_capture(const mvt_terminal_t *terminal, mvt_stream_state_t *state);
+#ifdef HAVE_PTHREAD
+mvt_stream_server_t *mvt_stream_server_open(const char *path);
+void mvt_stream_server_close(mvt_stream_server_t *server);
+int mvt_stream_server_publish(mvt_stream_server_t *server, mvt_stream_state_t *state);
+int mvt_stream_server_get_stats(mvt_stream_server_t *server, int index, mvt_stream_stats_t *stats);
+#endif
+
+/** @} */
+
+/*! \addtogroup Record
+ * @{
+ */
+
+typedef struct _mvt_recorder mvt_recorder_t;
+typedef struct _mvt_player mvt_player_t;
+
+mvt_recorder_t *mvt_recorder_open(const char *path, const mvt_terminal_t *terminal, uint64_t position, unsigned int ticks);
+void mvt_recorder_close(mvt_recorder_t *recorder);
+int mvt_recorder_write(mvt_recorder_t *recorder, uint64_t position, const void *buf, size_t count, unsigned int ticks);
+int mvt_recorder_keyframe_due(const mvt_recorder_t *recorder, uint64_t position, unsigned int ticks);
+int mvt_recorder_keyframe(mvt_recorder_t *recorder, int resize, uint64_t position, const void *data, size_t size, unsigned int ticks);
+mvt_player_t *mvt_player_open(const char *path);
+void mvt_player_close(mvt_player_t *player);
+int mvt_player_next(mvt_player_t *player);
+int mvt_player_seek(mvt_player_t *player, uint64_t time);
+mvt_terminal_t *mvt_player_get_terminal(const mvt_player_t *player);
+uint64_t mvt_player_get_time(const mvt_player_t *player);
+uint64_t mvt_player_get_duration(const mvt_player_t *player);
+uint64_t mvt_player_get_start_time(const mvt_player_t *player);
+
+/** @} */
+
+/*! \addtogroup RawLog
+ * @{
+ */
+
+#ifndef WIN32
+typedef struct _mvt_raw_log mvt_raw_log_t;
+
+mvt_raw_log_t *mvt_raw_log_open(const char *path);
+void mvt_raw_log_close(mvt_raw_log_t *log);
+ssize_t mvt_raw_log_read(mvt_raw_log_t *log, int fd, void *buf, size_t count);
+void mvt_raw_log_write(mvt_raw_log_t *log, const void *buf, size_t count);
+#endif
 
 /** @} */
 
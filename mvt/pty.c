@@ -30,20 +30,49 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <poll.h>
 #include <signal.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#define mvt_sigmask(how, set, old) pthread_sigmask(how, set, old)
+#else
+#define mvt_sigmask(how, set, old) sigprocmask(how, set, old)
+#endif
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
 
 #include <mvt/mvt.h>
 #include "private.h"
 #include "debug.h"
 
+/* The pipe the exec session reads from is made this large. */
+#define MVT_EXEC_PIPE_SIZE (1024 * 1024)
+
 /* pty */
 
+extern char **environ;
+
 typedef struct _mvt_pty mvt_pty_t;
 struct _mvt_pty {
     mvt_session_t parent;
     const char *terminal_type;
     pid_t pid;
+    /* the fds read from and written to, which are the same for a pty */
     int fd;
+    int write_fd;
+    /* what is read before the output of the command */
+    const char *prefix;
+    /* the last byte written was CR */
+    int cr_written;
+    mvt_raw_log_t *log;
+    /* the program, its arguments without argv[0], and the variables
+     * set as NAME=VALUE or unset as NAME */
+    char *command;
+    char **args;
+    size_t num_args;
+    char **env;
+    size_t num_env;
 };
 
 static void mvt_pty_close(mvt_session_t *session);
@@ -52,6 +81,11 @@ static int mvt_pty_read(mvt_session_t *session, void *buf, size_t count, size_t
 static int mvt_pty_write(mvt_session_t *session, const void *buf, size_t count, size_t *countwritten);
 static void mvt_pty_shutdown(mvt_session_t *session);
 static void mvt_pty_resize(mvt_session_t *session, int columns, int rows);
+static int mvt_pty_is_alive(mvt_session_t *session);
+
+static int mvt_exec_connect(mvt_session_t *session);
+static int mvt_exec_write(mvt_session_t *session, const void *buf, size_t count, size_t *countwritten);
+static void mvt_exec_resize(mvt_session_t *session, int columns, int rows);
 
 static const mvt_session_vt_t mvt_pty_vt = {
     mvt_pty_close,
@@ -59,100 +93,417 @@ static const mvt_session_vt_t mvt_pty_vt = {
     mvt_pty_read,
     mvt_pty_write,
     mvt_pty_shutdown,
-    mvt_pty_resize
+    mvt_pty_resize,
+    NULL,
+    mvt_pty_is_alive
 };
 
-mvt_session_t *
-mvt_pty_open (char **args, mvt_session_t *source, int width, int height)
+static const mvt_session_vt_t mvt_exec_vt = {
+    mvt_pty_close,
+    mvt_exec_connect,
+    mvt_pty_read,
+    mvt_exec_write,
+    mvt_pty_shutdown,
+    mvt_exec_resize,
+    NULL,
+    mvt_pty_is_alive
+};
+
+static int mvt_pty_add_string(char ***list, size_t *count, const char *s)
+{
+    char **p = realloc(*list, (*count + 2) * sizeof (char *));
+    if (p == NULL)
+        return -1;
+    *list = p;
+    p[*count] = strdup(s);
+    if (p[*count] == NULL)
+        return -1;
+    p[++*count] = NULL;
+    return 0;
+}
+
+static void mvt_pty_free_strings(char **list, size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+        free(list[i]);
+    free(list);
+}
+
+static void mvt_pty_delete(mvt_pty_t *pty)
+{
+    if (pty->log)
+        mvt_raw_log_close(pty->log);
+    free(pty->command);
+    mvt_pty_free_strings(pty->args, pty->num_args);
+    mvt_pty_free_strings(pty->env, pty->num_env);
+    free(pty);
+}
+
+/**
+ * Make a session of the arguments, which are "command", the program
+ * run instead of $SHELL, "arg", given once for each argument, "env",
+ * given as NAME=VALUE to set a variable or NAME to unset it, and
+ * "log".
+ */
+static mvt_session_t *
+mvt_pty_new (char **args, const mvt_session_vt_t *vt, const char *terminal_type)
 {
     mvt_pty_t *pty;
 
-    MVT_DEBUG_PRINT1("mvt_pty_open\n");
-    
     pty = malloc(sizeof (mvt_pty_t));
     if (pty == NULL)
         return NULL;
     memset(pty, 0, sizeof *pty);
-    pty->parent.vt = &mvt_pty_vt;
-    pty->terminal_type = "xterm";
+    pty->parent.vt = vt;
+    pty->terminal_type = terminal_type;
+    pty->fd = -1;
+    pty->write_fd = -1;
+    while (*args) {
+        const char *name, *value;
+        name = *args++;
+        value = *args++;
+        if (value == NULL) value = "";
+        if (strcmp(name, "log") == 0) {
+            if (pty->log)
+                mvt_raw_log_close(pty->log);
+            pty->log = mvt_raw_log_open(value);
+            if (pty->log == NULL) {
+                mvt_pty_delete(pty);
+                return NULL;
+            }
+        } else if (strcmp(name, "command") == 0) {
+            free(pty->command);
+            pty->command = strdup(value);
+            if (pty->command == NULL) {
+                mvt_pty_delete(pty);
+                return NULL;
+            }
+        } else if (strcmp(name, "arg") == 0) {
+            if (mvt_pty_add_string(&pty->args, &pty->num_args, value) == -1) {
+                mvt_pty_delete(pty);
+                return NULL;
+            }
+        } else if (strcmp(name, "env") == 0) {
+            if (mvt_pty_add_string(&pty->env, &pty->num_env, value) == -1) {
+                mvt_pty_delete(pty);
+                return NULL;
+            }
+        }
+    }
 	return (mvt_session_t *)pty;
 }
 
+mvt_session_t *
+mvt_pty_open (char **args, mvt_session_t *source, int width, int height)
+{
+    MVT_DEBUG_PRINT1("mvt_pty_open\n");
+    return mvt_pty_new(args, &mvt_pty_vt, "xterm");
+}
+
+/**
+ * Open a session running a command on pipes instead of a pty, which
+ * passes output through faster but isn't a terminal to the command.
+ * Its stdout and stderr are the same pipe, so their output is kept in
+ * order. The arguments are those of the pty session.
+ */
+mvt_session_t *
+mvt_exec_open (char **args, mvt_session_t *source, int width, int height)
+{
+    MVT_DEBUG_PRINT1("mvt_exec_open\n");
+    return mvt_pty_new(args, &mvt_exec_vt, "dumb");
+}
+
 static void
 mvt_pty_close (mvt_session_t *session)
 {
     mvt_pty_t *pty = (mvt_pty_t *)session;
     if (pty->pid != 0)
         mvt_pty_shutdown(session);
-    close(pty->fd);
-    free(pty);
+    if (pty->write_fd != -1 && pty->write_fd != pty->fd)
+        close(pty->write_fd);
+    if (pty->fd != -1)
+        close(pty->fd);
+    mvt_pty_delete(pty);
+}
+
+/**
+ * Tell if NAME=VALUE or NAME has the name.
+ */
+static int mvt_pty_env_match(const char *entry, const char *name)
+{
+    size_t len = strcspn(name, "=");
+    return strncmp(entry, name, len) == 0 && (entry[len] == '=' || entry[len] == '\0');
+}
+
+/**
+ * Make the environment of the child, which points into environ and
+ * the strings of the session.
+ */
+static char **mvt_pty_make_env(mvt_pty_t *pty, char *term)
+{
+    static const char *unset[] = { "TERM", "LINES", "COLUMNS", "TERMCAP", NULL };
+    char **envp, **e;
+    size_t count, i, j;
+    for (count = 0; environ[count]; count++)
+        ;
+    envp = malloc((count + pty->num_env + 2) * sizeof (char *));
+    if (envp == NULL)
+        return NULL;
+    j = 0;
+    for (e = environ; *e; e++) {
+        for (i = 0; unset[i]; i++)
+            if (mvt_pty_env_match(*e, unset[i]))
+                break;
+        if (unset[i])
+            continue;
+        for (i = 0; i < pty->num_env; i++)
+            if (mvt_pty_env_match(*e, pty->env[i]))
+                break;
+        if (i < pty->num_env)
+            continue;
+        envp[j++] = *e;
+    }
+    envp[j++] = term;
+    for (i = 0; i < pty->num_env; i++) {
+        if (strchr(pty->env[i], '='))
+            envp[j++] = pty->env[i];
+    }
+    envp[j] = NULL;
+    return envp;
+}
+
+#ifdef HAVE_POSIX_SPAWN_SETSID
+/**
+ * Run the child without copying the page tables of this process,
+ * which a large one makes fork() slow at. The child is made a session
+ * leader before it opens the slave, which then becomes its
+ * controlling terminal. Without a slave, its stdin is in_fd and its
+ * stdout and stderr are out_fd.
+ */
+static pid_t mvt_pty_spawn(const char *slave, int in_fd, int out_fd, char **argv, char **envp)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    pid_t pid;
+    int ret;
+
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return -1;
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+    if (slave) {
+        ret = posix_spawn_file_actions_addopen(&actions, 0, slave, O_RDWR, 0);
+        in_fd = out_fd = 0;
+    } else {
+        ret = posix_spawn_file_actions_adddup2(&actions, in_fd, 0);
+    }
+    if (ret == 0)
+        ret = posix_spawn_file_actions_adddup2(&actions, out_fd, 1);
+    if (ret == 0)
+        ret = posix_spawn_file_actions_adddup2(&actions, out_fd, 2);
+    /* threads of the terminal may block or catch signals */
+    sigemptyset(&mask);
+    if (ret == 0)
+        ret = posix_spawnattr_setsigmask(&attr, &mask);
+    sigfillset(&mask);
+    if (ret == 0)
+        ret = posix_spawnattr_setsigdefault(&attr, &mask);
+    if (ret == 0)
+        ret = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    if (ret == 0)
+        ret = posix_spawnp(&pid, argv[0], &actions, &attr, argv, envp);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return ret == 0 ? pid : -1;
+}
+#else
+static pid_t mvt_pty_spawn(const char *slave, int in_fd, int out_fd, char **argv, char **envp)
+{
+    sigset_t mask;
+    pid_t pid;
+    int fd;
+
+    pid = fork();
+    if (pid != 0)
+        return pid;
+    setsid();
+    if (slave) {
+        fd = open(slave, O_RDWR);
+        if (fd < 0)
+            _exit(127);
+        in_fd = out_fd = fd;
+    }
+    dup2(in_fd, 0);
+    dup2(out_fd, 1);
+    dup2(out_fd, 2);
+    if (slave && fd > 2)
+        close(fd);
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    environ = envp;
+    execvp(argv[0], argv);
+    _exit(127);
+}
+#endif
+
+/**
+ * Run the command of the session as mvt_pty_spawn() does.
+ */
+static pid_t mvt_pty_run(mvt_pty_t *pty, const char *slave, int in_fd, int out_fd)
+{
+    char term[64];
+    char **argv, **envp;
+    pid_t pid;
+    size_t i;
+
+    argv = malloc((pty->num_args + 2) * sizeof (char *));
+    if (argv == NULL)
+        return -1;
+    argv[0] = pty->command;
+    if (argv[0] == NULL)
+        argv[0] = getenv("SHELL");
+    if (argv[0] == NULL)
+        argv[0] = "/bin/sh";
+    for (i = 0; i < pty->num_args; i++)
+        argv[i + 1] = pty->args[i];
+    argv[i + 1] = NULL;
+    snprintf(term, sizeof term, "TERM=%s", pty->terminal_type);
+    envp = mvt_pty_make_env(pty, term);
+    if (envp == NULL) {
+        free(argv);
+        return -1;
+    }
+    pid = mvt_pty_spawn(slave, in_fd, out_fd, argv, envp);
+    free(envp);
+    free(argv);
+    return pid;
 }
 
 static int
 mvt_pty_connect (mvt_session_t *session)
 {
     mvt_pty_t *pty = (mvt_pty_t *)session;
-    int ptm, pts, pid, fd, f;
-    char *argv[3];
-    char *shell;
+    char slave[64];
+    const char *name;
+    int ptm, pid;
 
     MVT_DEBUG_PRINT1("mvt_pty_connect\n");
     
-#if 0
-    ptm = open("/dev/ptmx", O_RDWR | O_NONBLOCK);
-#endif
-    ptm = open("/dev/ptmx", O_RDWR);
+    ptm = open("/dev/ptmx", O_RDWR | O_NOCTTY | O_CLOEXEC);
     if (ptm < 0) {
         return -1; 
     }
-    pid = fork();
+    name = NULL;
+    if (grantpt(ptm) == 0 && unlockpt(ptm) == 0)
+        name = ptsname(ptm);
+    if (name == NULL || strlen(name) >= sizeof slave) {
+        close(ptm);
+        return -1;
+    }
+    strcpy(slave, name);
+
+    pid = mvt_pty_run(pty, slave, -1, -1);
     if (pid < 0) {
         close(ptm);
 		return -1;
     }
-    if (pid == 0) {
-        if (grantpt(ptm) < 0)
-            exit(1);
-        if (unlockpt(ptm) < 0)
-            exit(1);
-        pts = open(ptsname(ptm), O_RDWR);
-        if (pts < 0)
-            exit(1);
-        close(ptm);
-        for (fd = 0; fd < 3; fd++) {
-            close(fd);
-            dup(pts);
-            fcntl(fd, F_SETFD, 0);
-	}
-        pid = setsid();
-        tcsetpgrp(0, pid);
-        setenv("TERM", pty->terminal_type, TRUE);
-        unsetenv("LINES");
-        unsetenv("COLUMNS");
-        unsetenv("TERMCAP");
-        shell = getenv("SHELL");
-        if (shell == NULL) shell = "/bin/sh";
-        argv[0] = shell;
-        argv[1] = NULL;
-        execv (shell, argv);
-        exit (1);
-    }
-    f = fcntl(ptm, F_GETFD);
-    fcntl(ptm, F_SETFD, f | FD_CLOEXEC);
     pty->fd = ptm;
+    pty->write_fd = ptm;
     pty->pid = pid;
     return 1;
 }
 
+/* a pipe whose ends are closed in the child, which only keeps the
+ * ends posix_spawn or fork dup'ed onto its stdio */
+static int
+mvt_exec_pipe (int fds[2])
+{
+#ifdef HAVE_PIPE2
+    return pipe2(fds, O_CLOEXEC);
+#else
+    if (pipe(fds) == -1)
+        return -1;
+    if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) == -1
+        || fcntl(fds[1], F_SETFD, FD_CLOEXEC) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+static int
+mvt_exec_connect (mvt_session_t *session)
+{
+    mvt_pty_t *pty = (mvt_pty_t *)session;
+    int in[2], out[2];
+    pid_t pid;
+
+    MVT_DEBUG_PRINT1("mvt_exec_connect\n");
+
+    if (mvt_exec_pipe(in) == -1)
+        return -1;
+    if (mvt_exec_pipe(out) == -1) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+#ifdef F_SETPIPE_SZ
+    /* a pipe holds 64K by default, and the command stops whenever
+     * it is full; a larger one beyond the limit is just refused */
+    fcntl(out[0], F_SETPIPE_SZ, MVT_EXEC_PIPE_SIZE);
+#endif
+    pid = mvt_pty_run(pty, NULL, in[0], out[1]);
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) {
+        close(in[1]);
+        close(out[0]);
+        return -1;
+    }
+    pty->fd = out[0];
+    pty->write_fd = in[1];
+    pty->pid = pid;
+    /* nothing turns LF into CR LF as a pty does, so the terminal is
+     * put in the new line mode */
+    pty->prefix = "\033[20h";
+    return 1;
+}
+
 static int
 mvt_pty_read(mvt_session_t *session, void *buf, size_t count, size_t *countread)
 {
     mvt_pty_t *pty = (mvt_pty_t *)session;
+    struct pollfd pfd;
+    size_t total = 0;
     ssize_t n;
-    n = read(pty->fd, buf, count);
-    if (n <= 0)
+    /* Wait for the first bytes, then take whatever else the child
+     * has written without waiting, so that a flood is read in one
+     * batch. */
+    pfd.fd = pty->fd;
+    pfd.events = POLLIN;
+    if (pty->prefix && strlen(pty->prefix) <= count) {
+        total = strlen(pty->prefix);
+        memcpy(buf, pty->prefix, total);
+        pty->prefix = NULL;
+    }
+    do {
+        if (pty->log)
+            n = mvt_raw_log_read(pty->log, pty->fd, (char *)buf + total, count - total);
+        else
+            n = read(pty->fd, (char *)buf + total, count - total);
+        if (n <= 0)
+            break;
+        total += n;
+    } while (total < count && poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN));
+    if (total == 0)
         return -1;
-	*countread = n;
+	*countread = total;
     return 0;
 }
 
@@ -161,23 +512,103 @@ mvt_pty_write(mvt_session_t *session, const void *buf, size_t count, size_t *cou
 {
     mvt_pty_t *pty = (mvt_pty_t *)session;
     ssize_t n;
-    n = write(pty->fd, buf, count);
+    n = write(pty->write_fd, buf, count);
     if (n <= 0)
         return -1;
 	*countwritten = n;
     return 0;
 }
 
+static int mvt_exec_write_all(int fd, const char *p, size_t count)
+{
+    ssize_t n;
+    while (count > 0) {
+        n = write(fd, p, count);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        count -= n;
+    }
+    return 0;
+}
+
+/**
+ * Write to the stdin of the command. Return sends CR LF in the new
+ * line mode, which is written as LF, and a CR alone is too, as a pty
+ * would. A command which has closed its stdin makes write() raise
+ * SIGPIPE, which is blocked and taken back rather than let kill the
+ * terminal.
+ */
+static int
+mvt_exec_write(mvt_session_t *session, const void *buf, size_t count, size_t *countwritten)
+{
+    mvt_pty_t *pty = (mvt_pty_t *)session;
+    static const struct timespec zero = { 0, 0 };
+    const char *p = buf, *end = p + count, *q;
+    sigset_t mask, old_mask;
+    int ret = 0;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    mvt_sigmask(SIG_BLOCK, &mask, &old_mask);
+    while (p < end && ret == 0) {
+        if (pty->cr_written && *p == '\n') {
+            pty->cr_written = FALSE;
+            p++;
+            continue;
+        }
+        q = memchr(p, '\r', end - p);
+        if (q == NULL)
+            q = end;
+        ret = mvt_exec_write_all(pty->write_fd, p, q - p);
+        pty->cr_written = FALSE;
+        if (ret == 0 && q < end) {
+            ret = mvt_exec_write_all(pty->write_fd, "\n", 1);
+            pty->cr_written = TRUE;
+            q++;
+        }
+        p = q;
+    }
+    if (ret == -1 && errno == EPIPE)
+        sigtimedwait(&mask, NULL, &zero);
+    mvt_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (ret == -1)
+        return -1;
+    *countwritten = count;
+    return 0;
+}
+
 static void mvt_pty_shutdown(mvt_session_t *session)
 {
     int status;
     mvt_pty_t *pty = (mvt_pty_t *)session;
+    /* kill(0) would kill our own process group */
+    if (pty->pid == 0)
+        return;
     kill(pty->pid, SIGKILL);
     waitpid(pty->pid, &status, 0);
     MVT_DEBUG_PRINT2("The child process %d was killed.\n", pty->pid);
     pty->pid = 0;
 }
 
+/**
+ * Reap the child if it has exited, so that the session isn't taken
+ * for a live one.
+ */
+static int mvt_pty_is_alive(mvt_session_t *session)
+{
+    int status;
+    mvt_pty_t *pty = (mvt_pty_t *)session;
+    if (pty->pid == 0)
+        return FALSE;
+    if (waitpid(pty->pid, &status, WNOHANG) == 0)
+        return TRUE;
+    MVT_DEBUG_PRINT2("The child process %d has exited.\n", pty->pid);
+    pty->pid = 0;
+    return FALSE;
+}
+
 static void mvt_pty_resize(mvt_session_t *session, int width, int height)
 {
     mvt_pty_t *pty = (mvt_pty_t *)session;
@@ -188,3 +619,8 @@ static void mvt_pty_resize(mvt_session_t *session, int width, int height)
     ws.ws_xpixel = ws.ws_ypixel = 0;
     ioctl(pty->fd, TIOCSWINSZ, &ws);
 }
+
+static void mvt_exec_resize(mvt_session_t *session, int width, int height)
+{
+    /* pipes have no size */
+}
@@ -0,0 +1,326 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Logging the raw bytes a session reads. With splice(), the bytes
+ * are moved from the session into a pipe, duplicated with tee() into
+ * a second pipe which is spliced into the log file, and only then
+ * read from the first pipe for the terminal, so the log never copies
+ * them into user space. Without splice(), or when the descriptor is
+ * a tty or can't be spliced, the bytes are written to the log as they
+ * are read.
+ *
+ * The "log" session is a stage over any other one, which writes what
+ * it reads from its source to the log, as in "log:path=file" over a
+ * telnet session. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#ifndef WIN32
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <mvt/mvt.h>
+#include "private.h"
+#include "debug.h"
+
+/* what a pipe holds at least, and so what is read at once */
+#define MVT_RAW_LOG_PIPE_SIZE 65536
+
+struct _mvt_raw_log {
+    int fd;
+#ifdef HAVE_SPLICE
+    /* -1 until the first read tells the descriptor */
+    int use_splice;
+    int data_pipe[2];
+    int log_pipe[2];
+#endif
+};
+
+/**
+ * Open a log, appending to the file. The file isn't opened with
+ * O_APPEND, which splice() refuses to write to.
+ */
+mvt_raw_log_t *mvt_raw_log_open(const char *path)
+{
+    mvt_raw_log_t *log = malloc(sizeof (mvt_raw_log_t));
+    if (!log)
+        return NULL;
+    memset(log, 0, sizeof *log);
+    log->fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (log->fd == -1) {
+        free(log);
+        return NULL;
+    }
+    lseek(log->fd, 0, SEEK_END);
+#ifdef HAVE_SPLICE
+    log->data_pipe[0] = log->data_pipe[1] = -1;
+    log->log_pipe[0] = log->log_pipe[1] = -1;
+    if (pipe2(log->data_pipe, O_CLOEXEC) == 0 && pipe2(log->log_pipe, O_CLOEXEC) == 0)
+        log->use_splice = -1;
+#endif
+    return log;
+}
+
+void mvt_raw_log_close(mvt_raw_log_t *log)
+{
+#ifdef HAVE_SPLICE
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (log->data_pipe[i] != -1)
+            close(log->data_pipe[i]);
+        if (log->log_pipe[i] != -1)
+            close(log->log_pipe[i]);
+    }
+#endif
+    close(log->fd);
+    free(log);
+}
+
+/**
+ * Write bytes to the log. A log which can't be written to loses
+ * them rather than stopping the session.
+ */
+void mvt_raw_log_write(mvt_raw_log_t *log, const void *buf, size_t count)
+{
+    const char *p = buf;
+    ssize_t n;
+    while (count > 0) {
+        n = write(log->fd, p, count);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        p += n;
+        count -= n;
+    }
+}
+
+static ssize_t mvt_raw_log_read_fully(int fd, void *buf, size_t count)
+{
+    char *p = buf;
+    ssize_t n;
+    while (count > 0) {
+        n = read(fd, p, count);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        count -= n;
+    }
+    return p - (char *)buf;
+}
+
+#ifdef HAVE_SPLICE
+/**
+ * Read through the pipes.
+ * @return bytes read, 0 at the end, or -1 on an error, or -2 if the
+ * descriptor can't be spliced
+ */
+static ssize_t mvt_raw_log_splice(mvt_raw_log_t *log, int fd, void *buf, size_t count)
+{
+    char drop[4096];
+    ssize_t n, teed, left, moved;
+
+    do {
+        n = splice(fd, NULL, log->data_pipe[1], NULL, count, 0);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1 && (errno == EINVAL || errno == ENOSYS))
+        return -2;
+    if (n <= 0)
+        return n;
+
+    /* the log pipe is empty, so it takes all the bytes but rarely */
+    do {
+        teed = tee(log->data_pipe[0], log->log_pipe[1], n, 0);
+    } while (teed == -1 && errno == EINTR);
+    if (teed < 0)
+        teed = 0;
+    left = teed;
+    while (left > 0) {
+        moved = splice(log->log_pipe[0], NULL, log->fd, NULL, left, SPLICE_F_MOVE);
+        if (moved == -1 && errno == EINTR)
+            continue;
+        if (moved <= 0)
+            break;
+        left -= moved;
+    }
+    /* the log doesn't take spliced bytes, drop what it hasn't taken and
+     * write them from the buffer */
+    teed -= left;
+    while (left > 0) {
+        moved = read(log->log_pipe[0], drop, left < (ssize_t)sizeof drop ? left : (ssize_t)sizeof drop);
+        if (moved <= 0)
+            break;
+        left -= moved;
+    }
+
+    if (mvt_raw_log_read_fully(log->data_pipe[0], buf, n) == -1)
+        return -1;
+    if (teed < n)
+        mvt_raw_log_write(log, (char *)buf + teed, n - teed);
+    return n;
+}
+#endif
+
+/**
+ * Read from a descriptor as read() does, and append what is read to
+ * the log.
+ */
+ssize_t mvt_raw_log_read(mvt_raw_log_t *log, int fd, void *buf, size_t count)
+{
+    ssize_t n;
+    if (count > MVT_RAW_LOG_PIPE_SIZE)
+        count = MVT_RAW_LOG_PIPE_SIZE;
+#ifdef HAVE_SPLICE
+    /* a tty copies the bytes for splice() anyway, in small reads which
+     * make the pipes cost more than they save */
+    if (log->use_splice == -1)
+        log->use_splice = !isatty(fd);
+    if (log->use_splice) {
+        n = mvt_raw_log_splice(log, fd, buf, count);
+        if (n != -2)
+            return n;
+        MVT_DEBUG_PRINT1("mvt_raw_log_read: splice is not supported\n");
+        log->use_splice = FALSE;
+    }
+#endif
+    n = read(fd, buf, count);
+    if (n > 0)
+        mvt_raw_log_write(log, buf, n);
+    return n;
+}
+
+typedef struct _mvt_log mvt_log_t;
+
+struct _mvt_log {
+    mvt_session_t parent;
+    mvt_session_t *source;
+    mvt_raw_log_t *log;
+};
+
+static void mvt_log_close(mvt_session_t *session);
+static int mvt_log_connect(mvt_session_t *session);
+static int mvt_log_read(mvt_session_t *session, void *buf, size_t count, size_t *countread);
+static int mvt_log_write(mvt_session_t *session, const void *buf, size_t count, size_t *countwritten);
+static void mvt_log_shutdown(mvt_session_t *session);
+static void mvt_log_resize(mvt_session_t *session, int width, int height);
+static int mvt_log_writev(mvt_session_t *session, const mvt_iovec_t *iov, int iovcnt, size_t *countwritten);
+
+static int mvt_log_is_alive(mvt_session_t *session);
+
+static const mvt_session_vt_t mvt_log_vt = {
+    mvt_log_close,
+    mvt_log_connect,
+    mvt_log_read,
+    mvt_log_write,
+    mvt_log_shutdown,
+    mvt_log_resize,
+    mvt_log_writev,
+    mvt_log_is_alive
+};
+
+/**
+ * Open a stage logging what its source reads.
+ * args: path - the file appended to
+ */
+mvt_session_t *mvt_log_open(char **args, mvt_session_t *source, int width, int height)
+{
+    mvt_log_t *log;
+    const char *path = NULL;
+
+    MVT_DEBUG_PRINT1("mvt_log_open\n");
+    for (; *args; args += 2) {
+        if (strcmp(args[0], "path") == 0)
+            path = args[1];
+    }
+    if (source == NULL || path == NULL)
+        return NULL;
+    log = malloc(sizeof (mvt_log_t));
+    if (log == NULL)
+        return NULL;
+    memset(log, 0, sizeof *log);
+    log->parent.vt = &mvt_log_vt;
+    log->source = source;
+    log->log = mvt_raw_log_open(path);
+    if (log->log == NULL) {
+        free(log);
+        return NULL;
+    }
+    return &log->parent;
+}
+
+static void mvt_log_close(mvt_session_t *session)
+{
+    mvt_log_t *log = (mvt_log_t *)session;
+    mvt_raw_log_close(log->log);
+    free(log);
+}
+
+static int mvt_log_connect(mvt_session_t *session)
+{
+    mvt_log_t *log = (mvt_log_t *)session;
+    return mvt_session_connect(log->source);
+}
+
+/**
+ * Read from the source into the buffer, and log the bytes from there.
+ */
+static int mvt_log_read(mvt_session_t *session, void *buf, size_t count, size_t *countread)
+{
+    mvt_log_t *log = (mvt_log_t *)session;
+    if (mvt_session_read(log->source, buf, count, countread) < 0)
+        return -1;
+    mvt_raw_log_write(log->log, buf, *countread);
+    return 0;
+}
+
+static int mvt_log_write(mvt_session_t *session, const void *buf, size_t count, size_t *countwritten)
+{
+    mvt_log_t *log = (mvt_log_t *)session;
+    return mvt_session_write(log->source, buf, count, countwritten);
+}
+
+static int mvt_log_writev(mvt_session_t *session, const mvt_iovec_t *iov, int iovcnt, size_t *countwritten)
+{
+    mvt_log_t *log = (mvt_log_t *)session;
+    return mvt_session_writev(log->source, iov, iovcnt, countwritten);
+}
+
+static void mvt_log_shutdown(mvt_session_t *session)
+{
+}
+
+static void mvt_log_resize(mvt_session_t *session, int width, int height)
+{
+    mvt_log_t *log = (mvt_log_t *)session;
+    mvt_session_resize(log->source, width, height);
+}
+
+static int mvt_log_is_alive(mvt_session_t *session)
+{
+    mvt_log_t *log = (mvt_log_t *)session;
+    return mvt_session_is_alive(log->source);
+}
+
+#endif
@@ -0,0 +1,523 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mvt/mvt.h>
+#include "private.h"
+#include "debug.h"
+
+/*! \addtogroup Record
+ * @{
+ *
+ * A recording is a mvt_record_file_header_t followed by records, each
+ * of which is a mvt_record_header_t and length bytes:
+ *
+ *   OUTPUT    a uint64_t position and the bytes read from the session
+ *   KEYFRAME  a uint64_t position and the terminal as
+ *             mvt_terminal_save saves it
+ *   RESIZE    a keyframe written after the terminal is resized
+ *
+ * A position counts the bytes read from the session since the
+ * terminal was opened. Output is recorded by the thread reading it
+ * once the terminal has taken it, and keyframes by the thread owning
+ * the terminal, so output taken before a keyframe may be recorded
+ * after it. The player skips output before the position of the
+ * keyframe it starts from. The bytes of a record always end on a
+ * whole character.
+ *
+ * Times are milliseconds from the start of the recording. A keyframe
+ * is written first, then every MVT_RECORD_KEYFRAME_BYTES bytes or
+ * MVT_RECORD_KEYFRAME_INTERVAL milliseconds of output, so that the
+ * player goes to any time by loading the last keyframe before it and
+ * writing only the output after it. A keyframe waits for at least as
+ * much output as the last one took, so that a long history doesn't
+ * make keyframes most of the file. The file is only appended to, and
+ * flushed with each keyframe. A record cut short by a crash is
+ * ignored.
+ **/
+
+/** "MVTR" */
+#define MVT_RECORD_MAGIC 0x5254564d
+#define MVT_RECORD_VERSION 2
+
+#define MVT_RECORD_KEYFRAME_BYTES (1024 * 1024)
+#define MVT_RECORD_KEYFRAME_INTERVAL (60 * 1000)
+
+/* offsets are 64 bits even where long is 32 bits */
+#ifdef _MSC_VER
+#define mvt_record_seek(fp, offset, whence) _fseeki64((fp), (offset), (whence))
+#define mvt_record_tell(fp) _ftelli64(fp)
+#else
+#define mvt_record_seek(fp, offset, whence) fseeko((fp), (off_t)(offset), (whence))
+#define mvt_record_tell(fp) ((int64_t)ftello(fp))
+#endif
+
+typedef enum {
+    MVT_RECORD_OUTPUT = 1,
+    MVT_RECORD_KEYFRAME,
+    MVT_RECORD_RESIZE
+} mvt_record_type_t;
+
+typedef struct _mvt_record_file_header {
+    uint32_t magic;
+    uint32_t version;
+    /** seconds since the epoch when the recording started */
+    uint64_t start_time;
+} mvt_record_file_header_t;
+
+typedef struct _mvt_record_header {
+    uint32_t type;
+    uint32_t length;
+    uint64_t time;
+} mvt_record_header_t;
+
+struct _mvt_recorder {
+    FILE *fp;
+    uint64_t time;
+    unsigned int ticks;
+    uint64_t keyframe_time;
+    uint64_t keyframe_position; /** the position of the last keyframe */
+    size_t keyframe_size; /** bytes the last keyframe took */
+};
+
+typedef struct _mvt_player_keyframe {
+    int64_t offset;
+    uint64_t time;
+} mvt_player_keyframe_t;
+
+struct _mvt_player {
+    FILE *fp;
+    mvt_terminal_t *terminal;
+    uint64_t start_time;
+    mvt_player_keyframe_t *keyframes;
+    size_t keyframe_count;
+    int64_t end; /** the end of the last whole record */
+    uint64_t duration;
+    int64_t offset; /** the next record */
+    uint64_t time;
+    uint64_t position; /** the position of the output played last */
+    uint8_t *buf;
+    size_t buf_size;
+    mvt_char_t *text;
+    size_t text_size;
+};
+
+static int mvt_record_reserve(uint8_t **buf, size_t *buf_size, size_t size)
+{
+    uint8_t *new_buf;
+    if (size <= *buf_size)
+        return 0;
+    new_buf = realloc(*buf, size);
+    if (!new_buf)
+        return -1;
+    *buf = new_buf;
+    *buf_size = size;
+    return 0;
+}
+
+/* mvt_recorder_t */
+
+static void mvt_recorder_tick(mvt_recorder_t *recorder, unsigned int ticks)
+{
+    /* the ticks wrap around, the differences don't; the threads
+     * recording take them in turn, but not always in order */
+    if ((int)(ticks - recorder->ticks) <= 0)
+        return;
+    recorder->time += (unsigned int)(ticks - recorder->ticks);
+    recorder->ticks = ticks;
+}
+
+static int mvt_recorder_put(mvt_recorder_t *recorder, mvt_record_type_t type, uint64_t position, const void *data, size_t length)
+{
+    mvt_record_header_t header;
+    header.type = type;
+    header.length = sizeof position + length;
+    header.time = recorder->time;
+    if (fwrite(&header, sizeof header, 1, recorder->fp) != 1
+        || fwrite(&position, sizeof position, 1, recorder->fp) != 1
+        || (length > 0 && fwrite(data, length, 1, recorder->fp) != 1))
+        return -1;
+    return 0;
+}
+
+/**
+ * Start recording a terminal into a new file.
+ * @param position the position of the output the terminal has taken
+ * @param ticks the current time in milliseconds
+ */
+mvt_recorder_t *mvt_recorder_open(const char *path, const mvt_terminal_t *terminal, uint64_t position, unsigned int ticks)
+{
+    mvt_recorder_t *recorder;
+    mvt_record_file_header_t header;
+    void *data;
+    size_t size;
+
+    recorder = malloc(sizeof (mvt_recorder_t));
+    if (!recorder)
+        return NULL;
+    memset(recorder, 0, sizeof *recorder);
+    recorder->ticks = ticks;
+    recorder->fp = fopen(path, "wb");
+    if (!recorder->fp) {
+        free(recorder);
+        return NULL;
+    }
+    header.magic = MVT_RECORD_MAGIC;
+    header.version = MVT_RECORD_VERSION;
+    header.start_time = time(NULL);
+    if (fwrite(&header, sizeof header, 1, recorder->fp) != 1
+        || mvt_terminal_save(terminal, &data, &size) == -1) {
+        mvt_recorder_close(recorder);
+        return NULL;
+    }
+    if (mvt_recorder_keyframe(recorder, FALSE, position, data, size, ticks) == -1) {
+        free(data);
+        mvt_recorder_close(recorder);
+        return NULL;
+    }
+    free(data);
+    return recorder;
+}
+
+void mvt_recorder_close(mvt_recorder_t *recorder)
+{
+    fclose(recorder->fp);
+    free(recorder);
+}
+
+/**
+ * Record bytes read from the session, which the terminal has taken.
+ * The file isn't flushed.
+ * @param position the position of the first byte
+ * @retval 0 success
+ * @retval -1 the file can't be written to
+ */
+int mvt_recorder_write(mvt_recorder_t *recorder, uint64_t position, const void *buf, size_t count, unsigned int ticks)
+{
+    mvt_recorder_tick(recorder, ticks);
+    return mvt_recorder_put(recorder, MVT_RECORD_OUTPUT, position, buf, count);
+}
+
+/**
+ * Tell whether enough output has been recorded since the last
+ * keyframe for another.
+ * @param position the position of the output the terminal has taken
+ */
+int mvt_recorder_keyframe_due(const mvt_recorder_t *recorder, uint64_t position, unsigned int ticks)
+{
+    uint64_t bytes = position - recorder->keyframe_position;
+    uint64_t time = recorder->time;
+    if ((int)(ticks - recorder->ticks) > 0)
+        time += (unsigned int)(ticks - recorder->ticks);
+    return bytes >= recorder->keyframe_size
+        && (bytes >= MVT_RECORD_KEYFRAME_BYTES
+            || time - recorder->keyframe_time >= MVT_RECORD_KEYFRAME_INTERVAL);
+}
+
+/**
+ * Record the terminal, and flush the file.
+ * @param resize the terminal has been resized, which the output
+ * after it depends on
+ * @param position the position of the output the terminal has taken
+ * @param data the terminal as mvt_terminal_save saves it
+ */
+int mvt_recorder_keyframe(mvt_recorder_t *recorder, int resize, uint64_t position, const void *data, size_t size, unsigned int ticks)
+{
+    mvt_recorder_tick(recorder, ticks);
+    recorder->keyframe_time = recorder->time;
+    recorder->keyframe_position = position;
+    recorder->keyframe_size = size;
+    if (mvt_recorder_put(recorder, resize ? MVT_RECORD_RESIZE : MVT_RECORD_KEYFRAME,
+                         position, data, size) == -1
+        || fflush(recorder->fp) != 0)
+        return -1;
+    return 0;
+}
+
+/* mvt_player_t */
+
+static int mvt_player_read_header(mvt_player_t *player, int64_t offset, mvt_record_header_t *header)
+{
+    if (offset + (int64_t)sizeof *header > player->end
+        || mvt_record_seek(player->fp, offset, SEEK_SET) != 0
+        || fread(header, sizeof *header, 1, player->fp) != 1)
+        return -1;
+    return 0;
+}
+
+/**
+ * Open a recording, and find its keyframes. Only the headers of the
+ * records are read.
+ */
+mvt_player_t *mvt_player_open(const char *path)
+{
+    mvt_player_t *player;
+    mvt_record_file_header_t file_header;
+    mvt_record_header_t header;
+    mvt_player_keyframe_t *keyframes;
+    size_t keyframe_size = 0;
+    int64_t offset, file_size;
+
+    player = malloc(sizeof (mvt_player_t));
+    if (!player)
+        return NULL;
+    memset(player, 0, sizeof *player);
+    player->fp = fopen(path, "rb");
+    if (!player->fp)
+        goto error;
+    if (fread(&file_header, sizeof file_header, 1, player->fp) != 1
+        || file_header.magic != MVT_RECORD_MAGIC
+        || file_header.version != MVT_RECORD_VERSION
+        || mvt_record_seek(player->fp, 0, SEEK_END) != 0
+        || (file_size = mvt_record_tell(player->fp)) == -1)
+        goto error;
+    player->start_time = file_header.start_time;
+    player->end = file_size;
+    offset = sizeof file_header;
+    while (mvt_player_read_header(player, offset, &header) == 0
+           && header.length <= (uint64_t)(file_size - offset) - sizeof header
+           && header.length >= sizeof (uint64_t)) {
+        if (header.type == MVT_RECORD_KEYFRAME || header.type == MVT_RECORD_RESIZE) {
+            if (player->keyframe_count == keyframe_size) {
+                keyframe_size = keyframe_size ? keyframe_size * 2 : 64;
+                keyframes = realloc(player->keyframes, keyframe_size * sizeof (mvt_player_keyframe_t));
+                if (!keyframes)
+                    goto error;
+                player->keyframes = keyframes;
+            }
+            player->keyframes[player->keyframe_count].offset = offset;
+            player->keyframes[player->keyframe_count].time = header.time;
+            player->keyframe_count++;
+        }
+        player->duration = header.time;
+        offset += sizeof header + header.length;
+    }
+    player->end = offset;
+    if (player->keyframe_count == 0)
+        goto error;
+    player->terminal = mvt_terminal_new(80, 24, 0);
+    if (!player->terminal || mvt_player_seek(player, 0) == -1)
+        goto error;
+    return player;
+error:
+    mvt_player_close(player);
+    return NULL;
+}
+
+void mvt_player_close(mvt_player_t *player)
+{
+    if (player->fp)
+        fclose(player->fp);
+    if (player->terminal)
+        mvt_terminal_delete(player->terminal);
+    free(player->keyframes);
+    free(player->buf);
+    free(player->text);
+    free(player);
+}
+
+/**
+ * Read the body of the record at the offset into the buffer.
+ */
+static int mvt_player_read_record(mvt_player_t *player, int64_t offset, mvt_record_header_t *header)
+{
+    if (mvt_player_read_header(player, offset, header) == -1
+        || header->length > (uint64_t)(player->end - offset) - sizeof *header
+        || header->length < sizeof (uint64_t)
+        || mvt_record_reserve(&player->buf, &player->buf_size, header->length) == -1
+        || (header->length > 0 && fread(player->buf, header->length, 1, player->fp) != 1))
+        return -1;
+    return 0;
+}
+
+/**
+ * Load the keyframe in the buffer.
+ */
+static int mvt_player_restore(mvt_player_t *player, size_t length)
+{
+    uint64_t position;
+    memcpy(&position, player->buf, sizeof position);
+    if (mvt_terminal_restore(player->terminal, player->buf + sizeof position,
+                             length - sizeof position) == -1)
+        return -1;
+    player->position = position;
+    return 0;
+}
+
+/**
+ * Decode the output in the buffer as the worker does with iconv: a
+ * byte which doesn't start a valid UTF-8 sequence is skipped, and
+ * the bytes played before are skipped.
+ */
+static int mvt_player_write(mvt_player_t *player, size_t length)
+{
+    const uint8_t *p = player->buf + sizeof (uint64_t), *end = player->buf + length;
+    mvt_char_t *ws, buf[256];
+    mvt_char_t wc, min;
+    uint64_t position;
+    int i, n;
+
+    memcpy(&position, player->buf, sizeof position);
+    length -= sizeof position;
+    if (position + length <= player->position)
+        return 0;
+    if (position < player->position)
+        p += player->position - position;
+    player->position = position + length;
+
+    if (length > player->text_size) {
+        ws = realloc(player->text, length * sizeof (mvt_char_t));
+        if (!ws)
+            return -1;
+        player->text = ws;
+        player->text_size = length;
+    }
+    ws = player->text;
+    while (p < end) {
+        wc = *p;
+        if (wc < 0x80) {
+            *ws++ = wc;
+            p++;
+            continue;
+        }
+        n = wc < 0xc2 ? 0 : wc < 0xe0 ? 1 : wc < 0xf0 ? 2 : wc < 0xf5 ? 3 : 0;
+        min = n == 1 ? 0x80 : n == 2 ? 0x800 : 0x10000;
+        if (n == 0 || end - p <= n) {
+            p++;
+            continue;
+        }
+        wc &= 0x3f >> n;
+        for (i = 1; i <= n && (p[i] & 0xc0) == 0x80; i++)
+            wc = wc << 6 | (p[i] & 0x3f);
+        if (i <= n || wc < min || (wc >= 0xd800 && wc < 0xe000) || wc >= 0x110000) {
+            p++;
+            continue;
+        }
+        *ws++ = wc;
+        p += n + 1;
+    }
+    mvt_terminal_write(player->terminal, player->text, ws - player->text);
+    /* throw away the answers to the queries in the output */
+    while (mvt_terminal_read(player->terminal, buf, sizeof buf / sizeof buf[0]) > 0)
+        ;
+    return 0;
+}
+
+/**
+ * Play the next record.
+ * @retval 1 a record is played
+ * @retval 0 the end of the recording
+ * @retval -1 the recording is broken or out of memory
+ */
+int mvt_player_next(mvt_player_t *player)
+{
+    mvt_record_header_t header;
+    if (player->offset >= player->end)
+        return 0;
+    if (mvt_player_read_record(player, player->offset, &header) == -1)
+        return -1;
+    switch (header.type) {
+    case MVT_RECORD_OUTPUT:
+        if (mvt_player_write(player, header.length) == -1)
+            return -1;
+        break;
+    case MVT_RECORD_RESIZE:
+        /* the output which follows is laid out for the new size */
+        if (mvt_player_restore(player, header.length) == -1)
+            return -1;
+        break;
+    default:
+        /* keyframes only save the state which has been played */
+        break;
+    }
+    player->offset += sizeof header + header.length;
+    player->time = header.time;
+    return 1;
+}
+
+/**
+ * Go to a time, by loading the last keyframe before it and playing
+ * the records after the keyframe until the time.
+ * @param time milliseconds from the start
+ */
+int mvt_player_seek(mvt_player_t *player, uint64_t time)
+{
+    mvt_record_header_t header;
+    size_t lo = 0, hi = player->keyframe_count, mid;
+    int64_t offset;
+    int ret;
+
+    /* the last keyframe whose time isn't after the time */
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (player->keyframes[mid].time <= time)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    offset = player->keyframes[lo].offset;
+    if (mvt_player_read_record(player, offset, &header) == -1
+        || mvt_player_restore(player, header.length) == -1)
+        return -1;
+    player->offset = offset + sizeof header + header.length;
+    player->time = header.time;
+    while (player->offset < player->end) {
+        if (mvt_player_read_header(player, player->offset, &header) == -1)
+            return -1;
+        if (header.time > time)
+            break;
+        ret = mvt_player_next(player);
+        if (ret <= 0)
+            return ret;
+    }
+    return 0;
+}
+
+/** @return the terminal played, which has no screen */
+mvt_terminal_t *mvt_player_get_terminal(const mvt_player_t *player)
+{
+    return player->terminal;
+}
+
+/** @return milliseconds from the start to the record played last */
+uint64_t mvt_player_get_time(const mvt_player_t *player)
+{
+    return player->time;
+}
+
+/** @return milliseconds from the start to the last record */
+uint64_t mvt_player_get_duration(const mvt_player_t *player)
+{
+    return player->duration;
+}
+
+/** @return seconds since the epoch when the recording started */
+uint64_t mvt_player_get_start_time(const mvt_player_t *player)
+{
+    return player->start_time;
+}
+
+/** @} */
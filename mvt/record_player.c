@@ -0,0 +1,120 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Show the screen of a recording at a time, and how long it took to
+ * get there.
+ *
+ *   record_player [-t msec] file
+ *
+ * Without -t the screen at the end is shown.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mvt/mvt.h>
+#include "private.h"
+
+static unsigned long get_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void put_char(mvt_char_t wc)
+{
+    if (wc == 0)
+        wc = ' ';
+    if (wc < 0x80) {
+        putchar(wc);
+    } else if (wc < 0x800) {
+        putchar(0xc0 | (wc >> 6));
+        putchar(0x80 | (wc & 0x3f));
+    } else if (wc < 0x10000) {
+        putchar(0xe0 | (wc >> 12));
+        putchar(0x80 | ((wc >> 6) & 0x3f));
+        putchar(0x80 | (wc & 0x3f));
+    } else {
+        putchar(0xf0 | (wc >> 18));
+        putchar(0x80 | ((wc >> 12) & 0x3f));
+        putchar(0x80 | ((wc >> 6) & 0x3f));
+        putchar(0x80 | (wc & 0x3f));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    mvt_player_t *player;
+    mvt_stream_state_t state;
+    mvt_attribute_t attribute;
+    unsigned long long time = (unsigned long long)-1;
+    unsigned long usec;
+    int c, x, y;
+
+    while ((c = getopt(argc, argv, "t:")) != -1) {
+        switch (c) {
+        case 't':
+            time = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "usage: %s [-t msec] file\n", argv[0]);
+        return 1;
+    }
+    usec = get_usec();
+    player = mvt_player_open(argv[optind]);
+    if (!player) {
+        fprintf(stderr, "%s: not a recording\n", argv[optind]);
+        return 1;
+    }
+    printf("opened in %lu usec, %llu msec long\n",
+           get_usec() - usec, (unsigned long long)mvt_player_get_duration(player));
+    usec = get_usec();
+    if (mvt_player_seek(player, time) == -1) {
+        fprintf(stderr, "%s: broken recording\n", argv[optind]);
+        mvt_player_close(player);
+        return 1;
+    }
+    printf("at %llu msec in %lu usec\n",
+           (unsigned long long)mvt_player_get_time(player), get_usec() - usec);
+    mvt_stream_state_init(&state);
+    if (mvt_terminal_capture(mvt_player_get_terminal(player), &state) == 0) {
+        for (y = 0; y < state.height; y++) {
+            for (x = 0; x < state.width; x++) {
+                mvt_stream_unpack_attribute(&attribute, state.attribute[y * state.width + x]);
+                /* the right half of a wide character */
+                if (!attribute.no_char)
+                    put_char(state.text[y * state.width + x]);
+            }
+            putchar('\n');
+        }
+    }
+    mvt_stream_state_destroy(&state);
+    mvt_player_close(player);
+    return 0;
+}
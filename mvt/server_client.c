@@ -0,0 +1,294 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* A viewer of the server driver, which follows a screen from its
+ * shared memory segment and tells how many rows it has read and how
+ * long it took.
+ *
+ *   server_client [-s path] -l
+ *   server_client [-s path] [-k keys] [-n count] [-o file] screen
+ *
+ * -l lists the screens, -k types the keys on the screen, -n quits
+ * after the number of updates and -o writes the last cells to the
+ * file.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <mvt/mvt.h>
+#include "misc.h"
+#include "mvt_server.h"
+
+typedef struct _viewer {
+    int fd;
+    unsigned int screen;
+    const mvt_server_header_t *header;
+    size_t size;
+    int width, height;
+    /* the cells read, and the sequences of the rows they were read at */
+    mvt_server_cell_t *cells;
+    uint32_t *sequence;
+    int cursor_x, cursor_y;
+    unsigned long updates, rows, retries, usec;
+} viewer_t;
+
+static unsigned long get_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static int send_message(int fd, uint32_t type, uint32_t screen, int32_t param1, int32_t param2)
+{
+    mvt_server_message_t message;
+    message.type = type;
+    message.screen = screen;
+    message.param1 = param1;
+    message.param2 = param2;
+    return write(fd, &message, sizeof message) == sizeof message ? 0 : -1;
+}
+
+/**
+ * Receive a message, and the file descriptor sent with it.
+ */
+static int receive_message(int fd, mvt_server_message_t *message, int *passed_fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof (int))];
+    } control;
+    struct cmsghdr *cmsg;
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = message;
+    iov.iov_len = sizeof *message;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+    if (recvmsg(fd, &msg, MSG_WAITALL) != sizeof *message)
+        return -1;
+    *passed_fd = -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(passed_fd, CMSG_DATA(cmsg), sizeof (int));
+    return 0;
+}
+
+static int map_segment(viewer_t *viewer, int fd, int width, int height)
+{
+    const mvt_server_header_t *header;
+    size_t size;
+    header = mmap(NULL, sizeof *header, PROT_READ, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+        return -1;
+    size = header->row_offset + (size_t)header->height * header->row_size;
+    if (header->magic != MVT_SERVER_MAGIC || header->version != MVT_SERVER_VERSION
+        || (int)header->width != width || (int)header->height != height) {
+        munmap((void *)header, sizeof *header);
+        return -1;
+    }
+    munmap((void *)header, sizeof *header);
+    header = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+        return -1;
+    if (viewer->header)
+        munmap((void *)viewer->header, viewer->size);
+    free(viewer->cells);
+    free(viewer->sequence);
+    viewer->header = header;
+    viewer->size = size;
+    viewer->width = width;
+    viewer->height = height;
+    viewer->cells = malloc((size_t)width * height * sizeof (mvt_server_cell_t));
+    /* a row written is never at sequence 0 */
+    viewer->sequence = calloc(height, sizeof (uint32_t));
+    return viewer->cells && viewer->sequence ? 0 : -1;
+}
+
+/**
+ * Read the rows written since they were read last.
+ */
+static void read_rows(viewer_t *viewer)
+{
+    const mvt_server_header_t *header = viewer->header;
+    const mvt_server_row_t *row;
+    uint32_t s1, s2;
+    unsigned long usec = get_usec();
+    int y;
+
+    for (y = 0; y < viewer->height; y++) {
+        row = (const mvt_server_row_t *)((const char *)header + header->row_offset + (size_t)y * header->row_size);
+        for (;;) {
+            s1 = __atomic_load_n(&row->sequence, __ATOMIC_ACQUIRE);
+            if (s1 == viewer->sequence[y])
+                break;
+            memcpy(&viewer->cells[(size_t)y * viewer->width], row + 1,
+                   viewer->width * sizeof (mvt_server_cell_t));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            s2 = __atomic_load_n(&row->sequence, __ATOMIC_RELAXED);
+            if (!(s1 & 1) && s1 == s2) {
+                viewer->sequence[y] = s1;
+                viewer->rows++;
+                break;
+            }
+            viewer->retries++;
+        }
+    }
+    for (;;) {
+        s1 = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        viewer->cursor_x = header->cursor_x;
+        viewer->cursor_y = header->cursor_y;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED);
+        if (!(s1 & 1) && s1 == s2)
+            break;
+        viewer->retries++;
+    }
+    viewer->usec += get_usec() - usec;
+}
+
+static int write_cells(const char *path, const viewer_t *viewer)
+{
+    FILE *fp = fopen(path, "wb");
+    int header[4];
+    size_t i, count = (size_t)viewer->width * viewer->height;
+    if (!fp)
+        return -1;
+    header[0] = viewer->width;
+    header[1] = viewer->height;
+    header[2] = viewer->cursor_x;
+    header[3] = viewer->cursor_y;
+    fwrite(header, sizeof header, 1, fp);
+    for (i = 0; i < count; i++)
+        fwrite(&viewer->cells[i].text, sizeof (uint32_t), 1, fp);
+    for (i = 0; i < count; i++)
+        fwrite(&viewer->cells[i].attribute, sizeof (uint32_t), 1, fp);
+    return fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    mvt_server_message_t message;
+    viewer_t viewer;
+    const char *path, *keys = NULL, *output = NULL;
+    char buf[64];
+    unsigned long limit = 0;
+    int list = FALSE, c, fd;
+
+    path = getenv(MVT_SERVER_SOCKET_ENV);
+    if (!path) {
+        sprintf(buf, "/tmp/mvt-server-%d", (int)getuid());
+        path = buf;
+    }
+    while ((c = getopt(argc, argv, "s:lk:n:o:")) != -1) {
+        switch (c) {
+        case 's':
+            path = optarg;
+            break;
+        case 'l':
+            list = TRUE;
+            break;
+        case 'k':
+            keys = optarg;
+            break;
+        case 'n':
+            limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            return 1;
+        }
+    }
+    if ((list ? optind != argc : optind + 1 != argc) || strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "usage: %s [-s path] -l\n"
+                "       %s [-s path] [-k keys] [-n count] [-o file] screen\n", argv[0], argv[0]);
+        return 1;
+    }
+    memset(&viewer, 0, sizeof viewer);
+    viewer.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (viewer.fd == -1 || connect(viewer.fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+        perror(path);
+        return 1;
+    }
+
+    if (list) {
+        send_message(viewer.fd, MVT_SERVER_LIST, 0, 0, 0);
+        while (receive_message(viewer.fd, &message, &fd) == 0) {
+            if (message.type != MVT_SERVER_SCREEN || message.screen == 0)
+                break;
+            printf("%u %dx%d\n", message.screen, message.param1, message.param2);
+        }
+        return 0;
+    }
+
+    viewer.screen = atoi(argv[optind]);
+    send_message(viewer.fd, MVT_SERVER_ATTACH, viewer.screen, 0, 0);
+    while (receive_message(viewer.fd, &message, &fd) == 0) {
+        if (message.screen != viewer.screen)
+            continue;
+        if (message.type == MVT_SERVER_ERROR || message.type == MVT_SERVER_CLOSED)
+            break;
+        if (message.type == MVT_SERVER_ATTACHED) {
+            if (fd == -1 || map_segment(&viewer, fd, message.param1, message.param2) == -1) {
+                fprintf(stderr, "cannot map the screen\n");
+                return 1;
+            }
+            read_rows(&viewer);
+            for (; keys && *keys; keys++)
+                send_message(viewer.fd, MVT_SERVER_KEY, viewer.screen, FALSE, (unsigned char)*keys);
+        } else if (message.type == MVT_SERVER_UPDATE && viewer.header) {
+            read_rows(&viewer);
+            viewer.updates++;
+            if (viewer.updates == limit)
+                break;
+        }
+    }
+    printf("%lu updates, %lu rows read, %lu retries, %lu usec\n",
+           viewer.updates, viewer.rows, viewer.retries, viewer.usec);
+    if (output && viewer.cells && write_cells(output, &viewer) == -1) {
+        perror(output);
+        return 1;
+    }
+    close(viewer.fd);
+    if (viewer.header)
+        munmap((void *)viewer.header, viewer.size);
+    free(viewer.cells);
+    free(viewer.sequence);
+    return 0;
+}
@@ -24,6 +24,55 @@
 #include "private.h"
 #include "debug.h"
 
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__GNUC__)
+#define MVT_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define MVT_THREAD_LOCAL __declspec(thread)
+#else
+#define MVT_THREAD_LOCAL
+#endif
+
+/* The stats are counted by the threads reading and writing the
+ * session, and got by any thread, so each counter is added to and
+ * loaded whole. */
+#if defined(__GNUC__)
+#define mvt_session_add(p, v) __atomic_fetch_add(p, v, __ATOMIC_RELAXED)
+#define mvt_session_load(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#define mvt_session_add(p, v) InterlockedExchangeAdd64((volatile LONGLONG *)(p), (LONGLONG)(v))
+#define mvt_session_load(p) ((unsigned long long)InterlockedCompareExchange64((volatile LONGLONG *)(p), 0, 0))
+#else
+#define mvt_session_add(p, v) (*(p) += (v))
+#define mvt_session_load(p) (*(p))
+#endif
+
+/* The time spent in the sessions which the session being called has
+ * called, which isn't counted as its own. */
+static MVT_THREAD_LOCAL unsigned long long mvt_session_nested_nsec;
+
+static unsigned long long
+mvt_session_get_nsec (void)
+{
+#ifdef WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return count.QuadPart / frequency.QuadPart * 1000000000ULL
+        + count.QuadPart % frequency.QuadPart * 1000000000ULL / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
 /*! \addtogroup Session
  * @{
  **/
@@ -54,13 +103,80 @@ mvt_session_connect (mvt_session_t *session)
 int
 mvt_session_read (mvt_session_t *session, void *buf, size_t count, size_t *countread)
 {
-    return (*session->vt->read)(session, buf, count, countread);
+    unsigned long long nested = mvt_session_nested_nsec;
+    unsigned long long start, elapsed;
+    int ret;
+
+    mvt_session_nested_nsec = 0;
+    start = mvt_session_get_nsec();
+    ret = (*session->vt->read)(session, buf, count, countread);
+    elapsed = mvt_session_get_nsec() - start;
+    mvt_session_add(&session->stats.read_calls, 1);
+    if (ret == 0)
+        mvt_session_add(&session->stats.read_bytes, *countread);
+    mvt_session_add(&session->stats.read_nsec, elapsed - mvt_session_nested_nsec);
+    mvt_session_nested_nsec = nested + elapsed;
+    return ret;
 }
 
 int
 mvt_session_write (mvt_session_t *session, const void *buf, size_t count, size_t *countwritten)
 {
-    return (*session->vt->write)(session, buf, count, countwritten);
+    unsigned long long nested = mvt_session_nested_nsec;
+    unsigned long long start, elapsed;
+    int ret;
+
+    mvt_session_nested_nsec = 0;
+    start = mvt_session_get_nsec();
+    ret = (*session->vt->write)(session, buf, count, countwritten);
+    elapsed = mvt_session_get_nsec() - start;
+    mvt_session_add(&session->stats.write_calls, 1);
+    if (ret == 0)
+        mvt_session_add(&session->stats.write_bytes, *countwritten);
+    mvt_session_add(&session->stats.write_nsec, elapsed - mvt_session_nested_nsec);
+    mvt_session_nested_nsec = nested + elapsed;
+    return ret;
+}
+
+/**
+ * Write pieces of data at once. Like mvt_session_write(), fewer bytes
+ * than all of them can be written.
+ * @param session a session
+ * @param iov pieces
+ * @param iovcnt count of the pieces
+ * @param countwritten bytes written
+ * @retval 0 success
+ * @retval -1 fail
+ **/
+int
+mvt_session_writev (mvt_session_t *session, const mvt_iovec_t *iov, int iovcnt, size_t *countwritten)
+{
+    unsigned long long nested, start, elapsed;
+    size_t n;
+    int i, ret;
+
+    if (!session->vt->writev) {
+        *countwritten = 0;
+        for (i = 0; i < iovcnt; i++) {
+            if (mvt_session_write(session, iov[i].base, iov[i].len, &n) < 0)
+                return *countwritten > 0 ? 0 : -1;
+            *countwritten += n;
+            if (n < iov[i].len)
+                break;
+        }
+        return 0;
+    }
+    nested = mvt_session_nested_nsec;
+    mvt_session_nested_nsec = 0;
+    start = mvt_session_get_nsec();
+    ret = (*session->vt->writev)(session, iov, iovcnt, countwritten);
+    elapsed = mvt_session_get_nsec() - start;
+    mvt_session_add(&session->stats.write_calls, 1);
+    if (ret == 0)
+        mvt_session_add(&session->stats.write_bytes, *countwritten);
+    mvt_session_add(&session->stats.write_nsec, elapsed - mvt_session_nested_nsec);
+    mvt_session_nested_nsec = nested + elapsed;
+    return ret;
 }
 
 void
@@ -76,6 +192,37 @@ mvt_session_resize (mvt_session_t *session, int width, int height)
     (*session->vt->resize)(session, width, height);
 }
 
+/**
+ * Tell whether the peer of a connected session is still there, as far
+ * as the session can tell without reading.
+ * @return FALSE if the session has ended, TRUE otherwise
+ **/
+int
+mvt_session_is_alive (mvt_session_t *session)
+{
+    if (session->vt->is_alive == NULL)
+        return TRUE;
+    return (*session->vt->is_alive)(session);
+}
+
+/**
+ * Get the bytes which have gone through the session, and the time
+ * spent in it. The time spent in the sessions it reads from or writes
+ * to isn't counted, so it is what the session itself costs, or how
+ * long the session at the bottom has waited for its peer. The
+ * counters are each got whole, but not all at the same moment.
+ **/
+void
+mvt_session_get_stats (const mvt_session_t *session, mvt_session_stats_t *stats)
+{
+    stats->read_calls = mvt_session_load(&session->stats.read_calls);
+    stats->read_bytes = mvt_session_load(&session->stats.read_bytes);
+    stats->read_nsec = mvt_session_load(&session->stats.read_nsec);
+    stats->write_calls = mvt_session_load(&session->stats.write_calls);
+    stats->write_bytes = mvt_session_load(&session->stats.write_bytes);
+    stats->write_nsec = mvt_session_load(&session->stats.write_nsec);
+}
+
 /**
  * @}
  **/
@@ -0,0 +1,180 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Time starting and reading the pty and exec sessions.
+ *
+ *   session_bench [-m mbytes] [-n count] [file]
+ *
+ * Connect latency is measured with /bin/true as the child, after
+ * growing this process by -m megabytes. With a file, it is also read
+ * through cat in both sessions, and the throughput and the CPU time
+ * of this process are shown.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <mvt/mvt.h>
+#include "private.h"
+
+#define BENCH_BUFFER_SIZE 65536
+
+static unsigned long long get_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double get_cpu_sec(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static mvt_session_t *open_session(const char *proto, char **args)
+{
+    if (strcmp(proto, "exec") == 0)
+        return mvt_exec_open(args, NULL, 80, 24);
+    return mvt_pty_open(args, NULL, 80, 24);
+}
+
+/* read until the child closes its end, and return the bytes read */
+static unsigned long long read_all(mvt_session_t *session, char *buf)
+{
+    unsigned long long total = 0;
+    size_t n;
+    while (mvt_session_read(session, buf, BENCH_BUFFER_SIZE, &n) == 0)
+        total += n;
+    return total;
+}
+
+static int bench_spawn(const char *proto, int count, char *buf)
+{
+    char *args[] = { "command", "true", NULL };
+    unsigned long long nsec, connect_nsec = 0, exit_nsec = 0;
+    mvt_session_t *session;
+    int i;
+    for (i = 0; i < count; i++) {
+        session = open_session(proto, args);
+        if (!session)
+            return -1;
+        nsec = get_nsec();
+        if (mvt_session_connect(session) == -1) {
+            mvt_session_close(session);
+            return -1;
+        }
+        connect_nsec += get_nsec() - nsec;
+        read_all(session, buf);
+        exit_nsec += get_nsec() - nsec;
+        mvt_session_close(session);
+    }
+    printf("  %-4s connect %8.3f ms  until exit %8.3f ms\n", proto,
+           connect_nsec / 1e6 / count, exit_nsec / 1e6 / count);
+    return 0;
+}
+
+static int bench_read(const char *proto, const char *file, char *buf)
+{
+    char *args[] = { "command", "cat", "arg", NULL, NULL };
+    unsigned long long nsec, total;
+    mvt_session_t *session;
+    double cpu;
+    args[3] = (char *)file;
+    session = open_session(proto, args);
+    if (!session)
+        return -1;
+    if (mvt_session_connect(session) == -1) {
+        mvt_session_close(session);
+        return -1;
+    }
+    nsec = get_nsec();
+    cpu = get_cpu_sec();
+    total = read_all(session, buf);
+    nsec = get_nsec() - nsec;
+    cpu = get_cpu_sec() - cpu;
+    mvt_session_close(session);
+    printf("  %-4s read %llu bytes, %8.1f MB/s, %.2f s CPU\n", proto,
+           total, total / 1e6 / (nsec / 1e9), cpu);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *protos[] = { "pty", "exec" };
+    char *ballast = NULL, *buf;
+    size_t mbytes = 0;
+    int count = 30;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "m:n:")) != -1) {
+        switch (c) {
+        case 'm':
+            mbytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-m mbytes] [-n count] [file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 1 < argc || count <= 0) {
+        fprintf(stderr, "usage: %s [-m mbytes] [-n count] [file]\n", argv[0]);
+        return 1;
+    }
+    buf = malloc(BENCH_BUFFER_SIZE);
+    if (mbytes > 0)
+        ballast = malloc(mbytes << 20);
+    if (!buf || (mbytes > 0 && !ballast)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    /* touch every page, so that fork has them to copy */
+    if (ballast)
+        memset(ballast, 1, mbytes << 20);
+    printf("%lu MB grown, mean of %d\n", (unsigned long)mbytes, count);
+    for (i = 0; i < 2; i++) {
+        if (bench_spawn(protos[i], count, buf) == -1) {
+            fprintf(stderr, "%s: can't start /bin/true\n", protos[i]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        for (i = 0; i < 2; i++) {
+            if (bench_read(protos[i], argv[optind], buf) == -1) {
+                fprintf(stderr, "%s: can't cat %s\n", protos[i], argv[optind]);
+                return 1;
+            }
+        }
+    }
+    free(ballast);
+    free(buf);
+    return 0;
+}
@@ -17,25 +17,63 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #include <mvt/mvt.h>
 #include "private.h"
 #include "debug.h"
 
 #ifdef WIN32
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <netdb.h>
 #include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+/* milliseconds an attempt has before the next address is tried along
+ * with it, as RFC 8305 suggests */
+#define MVT_SOCKET_ATTEMPT_DELAY 250
+/* addresses tried for a host */
+#define MVT_SOCKET_MAX_ADDRESSES 16
+
 typedef struct _mvt_socket mvt_socket_t;
+#if !defined(WIN32) && defined(HAVE_PTHREAD)
+typedef struct _mvt_socket_connector mvt_socket_connector_t;
+
+/* A connect going on in its own thread, shared by the session and the
+ * thread until both have let it go, so that closing the session never
+ * waits for a slow resolver. */
+struct _mvt_socket_connector {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int refcount;
+    int done;
+    int cancelled;
+    /* the connected socket until the session takes it, or -1 */
+    int fd;
+    /* written to to stop the attempts */
+    int wake[2];
+    char *hostname;
+    char service[16];
+    int delay;
+};
+#endif
 
 struct _mvt_socket {
     mvt_session_t parent;
@@ -44,8 +82,18 @@ struct _mvt_socket {
 #else
 	int sock;
 #endif
-    const char *hostname;
+    char *hostname;
     int port;
+    int delay;
+    int nodelay;
+#ifndef WIN32
+    mvt_raw_log_t *log;
+#endif
+#if !defined(WIN32) && defined(HAVE_PTHREAD)
+    mvt_socket_connector_t *connector;
+    /* sock is set, and the connector needn't be asked */
+    int connected;
+#endif
 };
 
 mvt_session_t *mvt_socket_open(char **args, mvt_session_t *source, int width, int height);
@@ -55,6 +103,9 @@ static int mvt_socket_read (mvt_session_t *session, void *buf, size_t count, siz
 static int mvt_socket_write (mvt_session_t *session, const void *buf, size_t count, size_t *countwritten);
 static void mvt_socket_shutdown (mvt_session_t *session);
 static void mvt_socket_resize (mvt_session_t *session, int width, int height);
+#ifndef WIN32
+static int mvt_socket_writev (mvt_session_t *session, const mvt_iovec_t *iov, int iovcnt, size_t *countwritten);
+#endif
 
 static const mvt_session_vt_t mvt_socket_vt = {
     mvt_socket_close,
@@ -62,9 +113,26 @@ static const mvt_session_vt_t mvt_socket_vt = {
     mvt_socket_read,
     mvt_socket_write,
     mvt_socket_shutdown,
-    mvt_socket_resize
+    mvt_socket_resize,
+#ifndef WIN32
+    mvt_socket_writev,
+#else
+    NULL,
+#endif
+    NULL
 };
 
+/**
+ * Open a socket session, which connects to a host over TCP.
+ * args: hostname - the name or the address of the host
+ *       port - the port connected to
+ *       delay - milliseconds before another address is tried while
+ *               one is connecting, 250 by default
+ *       nodelay - 0 to let TCP hold small writes back until the ones
+ *                 before are acknowledged, which it doesn't by default
+ *                 as the worker gathers the keys itself
+ *       log - a file the bytes read are appended to
+ */
 mvt_session_t *
 mvt_socket_open (char **args, mvt_session_t *source, int width, int height)
 {
@@ -74,73 +142,372 @@ mvt_socket_open (char **args, mvt_session_t *source, int width, int height)
         return NULL;
     memset(sock, 0, sizeof *sock);
     sock->parent.vt = &mvt_socket_vt;
-    sock->sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (
 #ifdef WIN32
-    sock->sock == INVALID_SOCKET
+    sock->sock = INVALID_SOCKET;
 #else
-    sock->sock == -1
+    sock->sock = -1;
 #endif
-    ) {
-        free(sock);
-        return NULL;
-    }
 	sock->port = -1;
+    sock->delay = MVT_SOCKET_ATTEMPT_DELAY;
+    sock->nodelay = TRUE;
 	while (*args) {
 		const char *name, *value;
 		name = *args++;
 		value = *args++;
 		if (value == NULL) value = "";
 		if (strcmp(name, "hostname") == 0) {
+            free(sock->hostname);
             sock->hostname = strdup(value);
 		} else if (strcmp(name, "port") == 0) {
 			sock->port = atoi(value);
+        } else if (strcmp(name, "delay") == 0) {
+            sock->delay = atoi(value);
+        } else if (strcmp(name, "nodelay") == 0) {
+            sock->nodelay = atoi(value);
+#ifndef WIN32
+		} else if (strcmp(name, "log") == 0) {
+            if (sock->log)
+                mvt_raw_log_close(sock->log);
+            sock->log = mvt_raw_log_open(value);
+            if (sock->log == NULL) {
+                free(sock->hostname);
+                free(sock);
+                return NULL;
+            }
+#endif
 		}
 	}
-    if (sock->port < 0) {
+    if (sock->port < 0 || sock->port > 65535) {
+#ifndef WIN32
+        if (sock->log)
+            mvt_raw_log_close(sock->log);
+#endif
+        free(sock->hostname);
         free(sock);
         return NULL;
     }
     return &sock->parent;
 }
 
+/**
+ * Resolve the host and put its addresses in the order they are tried,
+ * alternating the families from the one the resolver prefers.
+ * @return the number of addresses, or -1 if there are none
+ */
+static int
+mvt_socket_resolve (const char *hostname, const char *service, struct addrinfo **list,
+                    struct addrinfo **order)
+{
+    struct addrinfo hints, *ai;
+    struct addrinfo *first[MVT_SOCKET_MAX_ADDRESSES], *other[MVT_SOCKET_MAX_ADDRESSES];
+    int num_first = 0, num_other = 0, count = 0, i;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo(hostname, service, &hints, list) != 0)
+        return -1;
+    for (ai = *list; ai; ai = ai->ai_next) {
+        if (ai->ai_family == (*list)->ai_family) {
+            if (num_first < MVT_SOCKET_MAX_ADDRESSES)
+                first[num_first++] = ai;
+        } else if (num_other < MVT_SOCKET_MAX_ADDRESSES) {
+            other[num_other++] = ai;
+        }
+    }
+    for (i = 0; count < MVT_SOCKET_MAX_ADDRESSES && (i < num_first || i < num_other); i++) {
+        if (i < num_first)
+            order[count++] = first[i];
+        if (i < num_other && count < MVT_SOCKET_MAX_ADDRESSES)
+            order[count++] = other[i];
+    }
+    return count;
+}
+
+#ifdef WIN32
+/**
+ * Connect to the addresses in turn.
+ */
+static SOCKET
+mvt_socket_race (const char *hostname, const char *service, int delay)
+{
+    struct addrinfo *list, *order[MVT_SOCKET_MAX_ADDRESSES];
+    SOCKET fd = INVALID_SOCKET;
+    int count, i;
+
+    count = mvt_socket_resolve(hostname, service, &list, order);
+    if (count == -1)
+        return INVALID_SOCKET;
+    for (i = 0; i < count; i++) {
+        fd = socket(order[i]->ai_family, SOCK_STREAM, 0);
+        if (fd == INVALID_SOCKET)
+            continue;
+        if (connect(fd, order[i]->ai_addr, (int)order[i]->ai_addrlen) == 0)
+            break;
+        closesocket(fd);
+        fd = INVALID_SOCKET;
+    }
+    freeaddrinfo(list);
+    return fd;
+}
+#else
+/**
+ * Connect to the addresses of a host, starting the next attempt when
+ * one fails or hasn't finished in the delay, and keep the socket which
+ * connects first.
+ * @param wake a descriptor which stops the attempts when it can be
+ * read, or -1
+ * @return the socket, blocking, or -1
+ */
+static int
+mvt_socket_race (const char *hostname, const char *service, int delay, int wake)
+{
+    struct addrinfo *list, *order[MVT_SOCKET_MAX_ADDRESSES];
+    /* the wake descriptor, and the sockets connecting */
+    struct pollfd pfd[MVT_SOCKET_MAX_ADDRESSES + 1];
+    int count, next = 0, num_pfd = 1, start = TRUE, fd = -1, err, ret, i;
+    socklen_t len;
+
+    count = mvt_socket_resolve(hostname, service, &list, order);
+    if (count == -1)
+        return -1;
+    pfd[0].fd = wake;
+    pfd[0].events = POLLIN;
+    while (fd == -1) {
+        if (start && next < count) {
+            struct addrinfo *ai = order[next++];
+            int s = socket(ai->ai_family, SOCK_STREAM, 0);
+            start = FALSE;
+            if (s == -1 || fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) == -1) {
+                if (s != -1)
+                    close(s);
+                start = TRUE;
+                continue;
+            }
+            MVT_DEBUG_PRINT2("mvt_socket_race: trying family %d\n", ai->ai_family);
+            if (connect(s, ai->ai_addr, ai->ai_addrlen) == 0) {
+                fd = s;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                close(s);
+                start = TRUE;
+                continue;
+            }
+            pfd[num_pfd].fd = s;
+            pfd[num_pfd].events = POLLOUT;
+            num_pfd++;
+        }
+        if (num_pfd == 1 && next == count)
+            break;
+        ret = poll(pfd, num_pfd, next < count ? delay : -1);
+        if (ret == -1 && errno != EINTR)
+            break;
+        if (ret == 0)
+            start = TRUE;
+        if (ret <= 0)
+            continue;
+        if (pfd[0].revents)
+            break;
+        for (i = 1; i < num_pfd; i++) {
+            if (!pfd[i].revents)
+                continue;
+            len = sizeof err;
+            if (getsockopt(pfd[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+                fd = pfd[i].fd;
+                pfd[i] = pfd[--num_pfd];
+                break;
+            }
+            /* another address is tried now rather than after the delay */
+            close(pfd[i].fd);
+            pfd[i--] = pfd[--num_pfd];
+            start = TRUE;
+        }
+    }
+    for (i = 1; i < num_pfd; i++)
+        close(pfd[i].fd);
+    freeaddrinfo(list);
+    if (fd != -1)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return fd;
+}
+#endif
+
+/**
+ * Set the options of the socket connected.
+ */
+static void
+mvt_socket_set_options (mvt_socket_t *socket)
+{
+    int value = socket->nodelay ? 1 : 0;
+    setsockopt(socket->sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&value, sizeof value);
+}
+
+#if !defined(WIN32) && defined(HAVE_PTHREAD)
+static void
+mvt_socket_connector_unref (mvt_socket_connector_t *connector)
+{
+    int refcount;
+
+    pthread_mutex_lock(&connector->mutex);
+    refcount = --connector->refcount;
+    pthread_mutex_unlock(&connector->mutex);
+    if (refcount > 0)
+        return;
+    if (connector->fd != -1)
+        close(connector->fd);
+    close(connector->wake[0]);
+    close(connector->wake[1]);
+    pthread_cond_destroy(&connector->cond);
+    pthread_mutex_destroy(&connector->mutex);
+    free(connector->hostname);
+    free(connector);
+}
+
+static void *
+mvt_socket_connector_main (void *data)
+{
+    mvt_socket_connector_t *connector = data;
+    int fd;
+
+    fd = mvt_socket_race(connector->hostname, connector->service, connector->delay,
+                         connector->wake[0]);
+    MVT_DEBUG_PRINT2("mvt_socket_connector_main: fd=%d\n", fd);
+    pthread_mutex_lock(&connector->mutex);
+    connector->fd = fd;
+    connector->done = TRUE;
+    pthread_cond_broadcast(&connector->cond);
+    pthread_mutex_unlock(&connector->mutex);
+    mvt_socket_connector_unref(connector);
+    return NULL;
+}
+
+/**
+ * Start resolving and connecting in a thread of its own.
+ */
+static int
+mvt_socket_connector_start (mvt_socket_t *socket, const char *service)
+{
+    mvt_socket_connector_t *connector;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int ret;
+
+    connector = malloc(sizeof (mvt_socket_connector_t));
+    if (connector == NULL)
+        return -1;
+    memset(connector, 0, sizeof *connector);
+    connector->fd = -1;
+    connector->delay = socket->delay;
+    strcpy(connector->service, service);
+    if ((socket->hostname && (connector->hostname = strdup(socket->hostname)) == NULL)
+        || pipe(connector->wake) == -1) {
+        free(connector->hostname);
+        free(connector);
+        return -1;
+    }
+    pthread_mutex_init(&connector->mutex, NULL);
+    pthread_cond_init(&connector->cond, NULL);
+    connector->refcount = 2;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, mvt_socket_connector_main, connector);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        connector->refcount = 1;
+        mvt_socket_connector_unref(connector);
+        return -1;
+    }
+    socket->connector = connector;
+    return 0;
+}
+
+/**
+ * Wait for the connector to finish, and take the socket it connected.
+ * @return 0, or -1 if it hasn't connected or the session is shut down
+ */
+static int
+mvt_socket_wait (mvt_socket_t *socket)
+{
+    mvt_socket_connector_t *connector = socket->connector;
+
+    if (__atomic_load_n(&socket->connected, __ATOMIC_ACQUIRE))
+        return 0;
+    if (connector == NULL)
+        return -1;
+    pthread_mutex_lock(&connector->mutex);
+    while (!connector->done && !connector->cancelled)
+        pthread_cond_wait(&connector->cond, &connector->mutex);
+    if (connector->done && connector->fd != -1 && !connector->cancelled) {
+        socket->sock = connector->fd;
+        connector->fd = -1;
+        mvt_socket_set_options(socket);
+        __atomic_store_n(&socket->connected, TRUE, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&connector->mutex);
+    return __atomic_load_n(&socket->connected, __ATOMIC_ACQUIRE) ? 0 : -1;
+}
+#else
+#define mvt_socket_wait(socket) ((socket)->sock == -1 ? -1 : 0)
+#endif
+
 static void
 mvt_socket_close(mvt_session_t *session)
 {
     mvt_socket_t *socket = (mvt_socket_t *)session;
 #ifdef WIN32
-    closesocket(socket->sock);
-    socket->sock = INVALID_SOCKET;
+    if (socket->sock != INVALID_SOCKET)
+        closesocket(socket->sock);
 #else
-    close(socket->sock);
-    socket->sock = -1;
+#ifdef HAVE_PTHREAD
+    if (socket->connector) {
+        mvt_socket_shutdown(session);
+        mvt_socket_connector_unref(socket->connector);
+    }
+#endif
+    if (socket->sock != -1)
+        close(socket->sock);
+    if (socket->log)
+        mvt_raw_log_close(socket->log);
 #endif
+    free(socket->hostname);
+    free(socket);
 }
 
+/**
+ * Connect to the host. With threads, the host is resolved and
+ * connected to in the background, and the first read or write waits
+ * for it, failing as the end of the stream if it can't connect, so
+ * that a slow or unreachable host doesn't hold the caller.
+ * @return 1 if connected, 0 if connecting, or -1 on an error
+ */
 static int
 mvt_socket_connect (mvt_session_t *session)
 {
     mvt_socket_t *socket = (mvt_socket_t *)session;
-    struct hostent* hostent;
-    struct sockaddr_in addr;
+    char service[16];
 
     MVT_DEBUG_PRINT3("mvt_socket_connect(%s,%d)\n", socket->hostname, socket->port);
 
-    hostent = gethostbyname(socket->hostname);
-    if (hostent == NULL) return -1;
-    
-    memset(&addr, 0, sizeof addr);
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons((short)socket->port);
-    memcpy(&addr.sin_addr, hostent->h_addr_list[0], hostent->h_length);
-    if (connect(socket->sock, (struct sockaddr *)&addr, sizeof addr) != 0) {
+    sprintf(service, "%d", socket->port);
 #ifdef WIN32
-        if (WSAGetLastError() == WSAEWOULDBLOCK) return 0;
-#endif
+    socket->sock = mvt_socket_race(socket->hostname, service, socket->delay);
+    if (socket->sock == INVALID_SOCKET)
         return -1;
-    }
-
+    mvt_socket_set_options(socket);
     return 1;
+#elif defined(HAVE_PTHREAD)
+    if (socket->connector)
+        return -1;
+    return mvt_socket_connector_start(socket, service) == -1 ? -1 : 0;
+#else
+    socket->sock = mvt_socket_race(socket->hostname, service, socket->delay, -1);
+    if (socket->sock == -1)
+        return -1;
+    mvt_socket_set_options(socket);
+    return 1;
+#endif
 }
 
 static int
@@ -149,7 +516,32 @@ mvt_socket_read (mvt_session_t *session, void *buf, size_t count, size_t *countr
     mvt_socket_t *socket = (mvt_socket_t *)session;
     int ret;
 
+    if (mvt_socket_wait(socket) == -1)
+        return -1;
+#ifndef WIN32
+    if (socket->log)
+        ret = mvt_raw_log_read(socket->log, socket->sock, buf, count);
+    else
+#endif
     ret = recv(socket->sock, buf, count, 0);
+#ifndef WIN32
+    /* take whatever else has arrived without waiting */
+    while (ret > 0 && (size_t)ret < count) {
+        struct pollfd pfd;
+        ssize_t n;
+        pfd.fd = socket->sock;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLIN))
+            break;
+        if (socket->log)
+            n = mvt_raw_log_read(socket->log, socket->sock, (char *)buf + ret, count - ret);
+        else
+            n = recv(socket->sock, (char *)buf + ret, count - ret, 0);
+        if (n <= 0)
+            break;
+        ret += n;
+    }
+#endif
     MVT_DEBUG_PRINT2("mvt_socket_notify_socket_read: ret=%d\n", ret);
     if (ret == -1) {
 #ifdef WIN32
@@ -174,6 +566,8 @@ mvt_socket_write (mvt_session_t *session, const void *buf, size_t count, size_t
     mvt_socket_t *socket = (mvt_socket_t *)session;
     int ret;
 
+    if (mvt_socket_wait(socket) == -1)
+        return -1;
     ret = send(socket->sock, buf, count, 0);
     if (ret < 0)
         return -1;
@@ -183,9 +577,64 @@ mvt_socket_write (mvt_session_t *session, const void *buf, size_t count, size_t
     return 0;
 }
 
+#ifndef WIN32
+/* pieces passed to writev() at once */
+#define MVT_SOCKET_IOV_MAX 64
+
+static int
+mvt_socket_writev (mvt_session_t *session, const mvt_iovec_t *iov, int iovcnt, size_t *countwritten)
+{
+    mvt_socket_t *socket = (mvt_socket_t *)session;
+    struct iovec vec[MVT_SOCKET_IOV_MAX];
+    ssize_t ret;
+    int i;
+
+    if (mvt_socket_wait(socket) == -1)
+        return -1;
+    if (iovcnt > MVT_SOCKET_IOV_MAX)
+        iovcnt = MVT_SOCKET_IOV_MAX;
+    for (i = 0; i < iovcnt; i++) {
+        vec[i].iov_base = (void *)iov[i].base;
+        vec[i].iov_len = iov[i].len;
+    }
+    do {
+        ret = writev(socket->sock, vec, iovcnt);
+    } while (ret == -1 && errno == EINTR);
+    if (ret <= 0)
+        return -1;
+    *countwritten = ret;
+    return 0;
+}
+#endif
+
 static void
 mvt_socket_shutdown (mvt_session_t *session)
 {
+#ifndef WIN32
+    mvt_socket_t *socket = (mvt_socket_t *)session;
+#ifdef HAVE_PTHREAD
+    mvt_socket_connector_t *connector = socket->connector;
+    char c = 0;
+
+    if (connector) {
+        /* the sock is taken under the lock */
+        pthread_mutex_lock(&connector->mutex);
+        if (!connector->cancelled) {
+            connector->cancelled = TRUE;
+            if (write(connector->wake[1], &c, 1) == -1)
+                MVT_DEBUG_PRINT1("mvt_socket_shutdown: cannot wake the connector\n");
+            pthread_cond_broadcast(&connector->cond);
+        }
+        if (socket->sock != -1)
+            shutdown(socket->sock, SHUT_RDWR);
+        pthread_mutex_unlock(&connector->mutex);
+        return;
+    }
+#endif
+    /* a reader blocked in recv() returns */
+    if (socket->sock != -1)
+        shutdown(socket->sock, SHUT_RDWR);
+#endif
 }
 
 static void
@@ -0,0 +1,203 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* A client of the socket session, which reads a host until it closes
+ * and tells how long the first byte took and how much was read.
+ *
+ *   socket_client [-t] [-d msec] [-c msec] [-k keys] [-o file] host port
+ *
+ * -t runs a telnet session over the socket and tells how much it
+ * compressed, -d sets how long an address is tried before the next,
+ * -c shuts the socket down from another thread after the time and
+ * tells how soon the read returned, -k types the keys once the first
+ * output has arrived and -o writes the output to the file.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <mvt/mvt.h>
+#include "private.h"
+
+#define CLIENT_BUFFER_SIZE 4096
+#define CLIENT_USAGE "usage: %s [-t] [-d msec] [-c msec] [-k keys] [-o file] host port\n"
+
+static mvt_session_t *cancel_session;
+static unsigned long cancel_msec;
+static unsigned long cancel_usec;
+
+static unsigned long get_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void *cancel_main(void *data)
+{
+    struct timespec ts;
+    ts.tv_sec = cancel_msec / 1000;
+    ts.tv_nsec = (cancel_msec % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+    cancel_usec = get_usec();
+    mvt_session_shutdown(cancel_session);
+    return NULL;
+}
+
+static int write_keys(mvt_session_t *session, const char *keys)
+{
+    size_t count = strlen(keys), n;
+    while (count > 0) {
+        if (mvt_session_write(session, keys, count, &n) < 0)
+            return -1;
+        keys += n;
+        count -= n;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *socket_args[] = { "hostname", NULL, "port", NULL, NULL, NULL, NULL };
+    char *telnet_args[] = { NULL };
+    mvt_session_t *sock, *session;
+    const char *keys = NULL, *output = NULL;
+    unsigned long long total = 0, read_bytes, inflated_bytes, written_bytes, deflated_bytes;
+    unsigned long usec, end_usec;
+    pthread_t cancel_thread;
+    char buf[CLIENT_BUFFER_SIZE];
+    FILE *fp = NULL;
+    int telnet = FALSE;
+    int c, ret = 0;
+    size_t n;
+
+    while ((c = getopt(argc, argv, "td:c:k:o:")) != -1) {
+        switch (c) {
+        case 't':
+            telnet = TRUE;
+            break;
+        case 'd':
+            socket_args[4] = "delay";
+            socket_args[5] = optarg;
+            break;
+        case 'c':
+            cancel_msec = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            keys = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            fprintf(stderr, CLIENT_USAGE, argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 2 != argc) {
+        fprintf(stderr, CLIENT_USAGE, argv[0]);
+        return 1;
+    }
+    if (output && (fp = fopen(output, "wb")) == NULL) {
+        perror(output);
+        return 1;
+    }
+    socket_args[1] = argv[optind];
+    socket_args[3] = argv[optind + 1];
+    sock = mvt_socket_open(socket_args, NULL, 80, 24);
+    if (!sock) {
+        fprintf(stderr, "%s: bad port\n", argv[optind + 1]);
+        return 1;
+    }
+    session = sock;
+    if (telnet) {
+        session = mvt_telnet_open(telnet_args, sock, 80, 24);
+        if (!session) {
+            fprintf(stderr, "out of memory\n");
+            mvt_session_close(sock);
+            return 1;
+        }
+    }
+    usec = get_usec();
+    if (mvt_session_connect(session) == -1) {
+        fprintf(stderr, "%s: can't connect\n", argv[optind]);
+        ret = 1;
+        goto out;
+    }
+    /* the socket, as a telnet session doesn't stop its source */
+    cancel_session = sock;
+    if (cancel_msec > 0 && pthread_create(&cancel_thread, NULL, cancel_main, NULL) != 0) {
+        fprintf(stderr, "can't start a thread\n");
+        ret = 1;
+        goto out;
+    }
+    while (mvt_session_read(session, buf, sizeof buf, &n) == 0) {
+        if (total == 0 && n > 0)
+            printf("first byte after %lu ms\n", (get_usec() - usec) / 1000);
+        if (fp && n > 0 && fwrite(buf, 1, n, fp) != n) {
+            perror(output);
+            ret = 1;
+            break;
+        }
+        total += n;
+        if (keys && total > 0) {
+            if (write_keys(session, keys) == -1) {
+                fprintf(stderr, "%s: can't write the keys\n", argv[optind]);
+                ret = 1;
+                break;
+            }
+            keys = NULL;
+        }
+    }
+    end_usec = get_usec();
+    printf("read %llu bytes in %.3f s\n", total, (end_usec - usec) / 1e6);
+    if (cancel_msec > 0) {
+        /* the read may have ended before the shutdown */
+        pthread_join(cancel_thread, NULL);
+        if (cancel_usec <= end_usec)
+            printf("shut down after %lu ms, the read returned %lu ms later\n",
+                   (cancel_usec - usec) / 1000, (end_usec - cancel_usec) / 1000);
+    }
+    if (telnet && mvt_telnet_get_compression(session, &read_bytes, &inflated_bytes,
+                                             &written_bytes, &deflated_bytes) == 0) {
+        printf("inflated %llu bytes from %llu, %.1f:1\n", inflated_bytes, read_bytes,
+               read_bytes ? (double)inflated_bytes / read_bytes : 0.0);
+        printf("deflated %llu bytes to %llu\n", written_bytes, deflated_bytes);
+    }
+    if (keys) {
+        fprintf(stderr, "%s: closed before the keys were typed\n", argv[optind]);
+        ret = 1;
+    }
+out:
+    if (fp && fclose(fp) != 0) {
+        perror(output);
+        ret = 1;
+    }
+    if (session != sock)
+        mvt_session_close(session);
+    mvt_session_close(sock);
+    return ret;
+}
@@ -0,0 +1,881 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef HAVE_PTHREAD
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include <mvt/mvt.h>
+#include "private.h"
+#include "debug.h"
+
+/*! \addtogroup Stream
+ * @{
+ *
+ * An update is a 32-bit little endian length and a body of unsigned
+ * LEB128 numbers:
+ *
+ *   sequence, base sequence, width, height, flags,
+ *   [cursor x, cursor y, cursor visible]   if flags & 1
+ *   [title length, characters]             if flags & 2
+ *   [rows scrolled up]                     if flags & 4
+ *   spans of cells: y + 1, x, count, then runs of
+ *     count of cells, attribute, characters
+ *   0 after the last span
+ *
+ * A span changes cells of the state with the base sequence after
+ * its rows are scrolled, where blank cells are scrolled in. The
+ * state with the sequence 0 is blank cells. The viewer answers an
+ * update with its sequence as a 32-bit little endian number.
+ **/
+
+/* Spans are split at this many cells which did not change */
+#define MVT_STREAM_SPAN_GAP 8
+
+/* The attribute of blank cells of the state 0 */
+#define MVT_STREAM_BLANK_ATTRIBUTE (MVT_DEFAULT_COLOR | (MVT_DEFAULT_COLOR << 9))
+
+#define MVT_STREAM_FLAG_CURSOR (1 << 0)
+#define MVT_STREAM_FLAG_TITLE  (1 << 1)
+#define MVT_STREAM_FLAG_SCROLL (1 << 2)
+
+/**
+ * Pack an attribute into a number, which is the same on any machine.
+ */
+uint32_t mvt_stream_pack_attribute(const mvt_attribute_t *attribute)
+{
+    return attribute->foreground_color
+        | (attribute->background_color << 9)
+        | (attribute->wide << 18)
+        | (attribute->no_char << 19)
+        | (attribute->bright << 20)
+        | (attribute->dim << 21)
+        | (attribute->underscore << 22)
+        | (attribute->blink << 23)
+        | (attribute->reverse << 24)
+        | (attribute->hidden << 25);
+}
+
+void mvt_stream_unpack_attribute(mvt_attribute_t *attribute, uint32_t value)
+{
+    memset(attribute, 0, sizeof *attribute);
+    attribute->foreground_color = value & 0x1ff;
+    attribute->background_color = (value >> 9) & 0x1ff;
+    attribute->wide = (value >> 18) & 1;
+    attribute->no_char = (value >> 19) & 1;
+    attribute->bright = (value >> 20) & 1;
+    attribute->dim = (value >> 21) & 1;
+    attribute->underscore = (value >> 22) & 1;
+    attribute->blink = (value >> 23) & 1;
+    attribute->reverse = (value >> 24) & 1;
+    attribute->hidden = (value >> 25) & 1;
+}
+
+void mvt_stream_state_init(mvt_stream_state_t *state)
+{
+    memset(state, 0, sizeof *state);
+}
+
+void mvt_stream_state_destroy(mvt_stream_state_t *state)
+{
+    free(state->text);
+    free(state->attribute);
+    free(state->title);
+    memset(state, 0, sizeof *state);
+}
+
+/**
+ * Change the size of a state, making all the cells blank.
+ * @retval 0 success
+ * @retval -1 out of memory, the state is left unchanged
+ */
+int mvt_stream_state_resize(mvt_stream_state_t *state, int width, int height)
+{
+    size_t count = (size_t)width * height;
+    mvt_char_t *text;
+    uint32_t *attribute;
+    size_t i;
+    if (width != state->width || height != state->height) {
+        text = malloc(count * sizeof (mvt_char_t));
+        attribute = malloc(count * sizeof (uint32_t));
+        if ((!text || !attribute) && count > 0) {
+            free(text);
+            free(attribute);
+            return -1;
+        }
+        free(state->text);
+        free(state->attribute);
+        state->text = text;
+        state->attribute = attribute;
+        state->width = width;
+        state->height = height;
+    }
+    memset(state->text, 0, count * sizeof (mvt_char_t));
+    for (i = 0; i < count; i++)
+        state->attribute[i] = MVT_STREAM_BLANK_ATTRIBUTE;
+    return 0;
+}
+
+int mvt_stream_state_set_title(mvt_stream_state_t *state, const mvt_char_t *ws, size_t count)
+{
+    mvt_char_t *title = NULL;
+    if (count > 0) {
+        title = malloc(count * sizeof (mvt_char_t));
+        if (!title)
+            return -1;
+        memcpy(title, ws, count * sizeof (mvt_char_t));
+    }
+    free(state->title);
+    state->title = title;
+    state->title_length = count;
+    return 0;
+}
+
+int mvt_stream_state_copy(mvt_stream_state_t *dst, const mvt_stream_state_t *src)
+{
+    size_t count = (size_t)src->width * src->height;
+    if (dst->width != src->width || dst->height != src->height) {
+        if (mvt_stream_state_resize(dst, src->width, src->height) == -1)
+            return -1;
+    }
+    if (mvt_stream_state_set_title(dst, src->title, src->title_length) == -1)
+        return -1;
+    memcpy(dst->text, src->text, count * sizeof (mvt_char_t));
+    memcpy(dst->attribute, src->attribute, count * sizeof (uint32_t));
+    dst->sequence = src->sequence;
+    dst->cursor_x = src->cursor_x;
+    dst->cursor_y = src->cursor_y;
+    dst->cursor_visible = src->cursor_visible;
+    return 0;
+}
+
+/* encoder */
+
+static int mvt_stream_reserve(mvt_stream_buffer_t *buffer, size_t count)
+{
+    size_t size;
+    uint8_t *data;
+    if (buffer->length + count <= buffer->size)
+        return 0;
+    size = buffer->size ? buffer->size : 256;
+    while (size < buffer->length + count)
+        size *= 2;
+    data = realloc(buffer->data, size);
+    if (!data)
+        return -1;
+    buffer->data = data;
+    buffer->size = size;
+    return 0;
+}
+
+static int mvt_stream_put_number(mvt_stream_buffer_t *buffer, uint32_t value)
+{
+    if (mvt_stream_reserve(buffer, 5) == -1)
+        return -1;
+    while (value >= 0x80) {
+        buffer->data[buffer->length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buffer->data[buffer->length++] = value;
+    return 0;
+}
+
+static void mvt_stream_put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 255;
+    p[1] = (value >> 8) & 255;
+    p[2] = (value >> 16) & 255;
+    p[3] = (value >> 24) & 255;
+}
+
+static uint32_t mvt_stream_get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int mvt_stream_row_equal(const mvt_stream_state_t *a, int ay, const mvt_stream_state_t *b, int by)
+{
+    size_t ai = (size_t)ay * a->width, bi = (size_t)by * b->width;
+    return memcmp(&a->text[ai], &b->text[bi], a->width * sizeof (mvt_char_t)) == 0
+        && memcmp(&a->attribute[ai], &b->attribute[bi], a->width * sizeof (uint32_t)) == 0;
+}
+
+/**
+ * Find how many rows the screen has scrolled up since the base, so
+ * that the rows are moved rather than sent again.
+ * @return number of rows, or 0
+ */
+static int mvt_stream_find_scroll(const mvt_stream_state_t *base, const mvt_stream_state_t *state)
+{
+    int height = state->height;
+    int shift, y, matched, best = 0, best_matched;
+    best_matched = 0;
+    for (y = 0; y < height; y++)
+        if (mvt_stream_row_equal(state, y, base, y))
+            best_matched++;
+    if (best_matched == height)
+        return 0;
+    for (shift = 1; shift < height; shift++) {
+        /* the top row tells where to look */
+        if (!mvt_stream_row_equal(state, 0, base, shift))
+            continue;
+        matched = 0;
+        for (y = 0; y < height - shift; y++)
+            if (mvt_stream_row_equal(state, y, base, y + shift))
+                matched++;
+        if (matched > best_matched) {
+            best = shift;
+            best_matched = matched;
+            if (matched == height - shift)
+                break;
+        }
+    }
+    return best;
+}
+
+/**
+ * Encode cells of a span as runs sharing an attribute.
+ */
+static int mvt_stream_put_span(mvt_stream_buffer_t *buffer, const mvt_stream_state_t *state, int x, int y, int count)
+{
+    const mvt_char_t *text = &state->text[(size_t)y * state->width + x];
+    const uint32_t *attribute = &state->attribute[(size_t)y * state->width + x];
+    int i, n;
+    if (mvt_stream_put_number(buffer, y + 1) == -1
+        || mvt_stream_put_number(buffer, x) == -1
+        || mvt_stream_put_number(buffer, count) == -1)
+        return -1;
+    for (i = 0; i < count; i += n) {
+        for (n = 1; i + n < count && attribute[i + n] == attribute[i]; n++)
+            ;
+        if (mvt_stream_put_number(buffer, n) == -1
+            || mvt_stream_put_number(buffer, attribute[i]) == -1)
+            return -1;
+        if (mvt_stream_reserve(buffer, n * 5) == -1)
+            return -1;
+        for (; n > 0; n--, i++) {
+            /* most characters take a byte */
+            mvt_stream_put_number(buffer, text[i]);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Append spans of cells of a row which differ from a row of the base.
+ */
+static int mvt_stream_put_row(mvt_stream_buffer_t *buffer, const mvt_stream_state_t *state, int y, const mvt_char_t *base_text, const uint32_t *base_attribute)
+{
+    const mvt_char_t *text = &state->text[(size_t)y * state->width];
+    const uint32_t *attribute = &state->attribute[(size_t)y * state->width];
+    int x, x1, gap;
+#define MVT_STREAM_CELL_EQUAL(x) (text[x] == base_text[x] && attribute[x] == base_attribute[x])
+    x = 0;
+    while (x < state->width) {
+        if (MVT_STREAM_CELL_EQUAL(x)) {
+            x++;
+            continue;
+        }
+        /* a span ends at enough cells which did not change */
+        x1 = x;
+        gap = 0;
+        for (x++; x < state->width && gap < MVT_STREAM_SPAN_GAP; x++) {
+            if (MVT_STREAM_CELL_EQUAL(x))
+                gap++;
+            else
+                gap = 0;
+        }
+        if (mvt_stream_put_span(buffer, state, x1, y, x - gap - x1) == -1)
+            return -1;
+    }
+#undef MVT_STREAM_CELL_EQUAL
+    return 0;
+}
+
+/**
+ * Append an update from the base state to the state to a buffer.
+ * Rows are scrolled if the screen has scrolled, and then only the
+ * spans of cells which differ are sent. When the size differs, they
+ * are compared with blank cells.
+ * @retval 0 success
+ * @retval -1 out of memory
+ */
+int mvt_stream_encode(mvt_stream_buffer_t *buffer, const mvt_stream_state_t *base, const mvt_stream_state_t *state)
+{
+    mvt_stream_state_t blank;
+    size_t start, row;
+    uint32_t flags;
+    int y, i, shift;
+    int ret = -1;
+
+    mvt_stream_state_init(&blank);
+    if (base->width != state->width || base->height != state->height) {
+        if (mvt_stream_state_resize(&blank, state->width, state->height) == -1)
+            return -1;
+        base = &blank;
+    }
+    shift = base != &blank ? mvt_stream_find_scroll(base, state) : 0;
+    if (shift > 0) {
+        /* blank cells for the rows scrolled in */
+        if (mvt_stream_state_resize(&blank, state->width, 1) == -1)
+            return -1;
+    }
+    if (mvt_stream_reserve(buffer, 4) == -1)
+        goto error;
+    start = buffer->length;
+    buffer->length += 4;
+
+    flags = 0;
+    if (state->cursor_x != base->cursor_x || state->cursor_y != base->cursor_y
+        || state->cursor_visible != base->cursor_visible || base == &blank)
+        flags |= MVT_STREAM_FLAG_CURSOR;
+    if (state->title_length != base->title_length
+        || (state->title_length > 0
+            && memcmp(state->title, base->title, state->title_length * sizeof (mvt_char_t)) != 0))
+        flags |= MVT_STREAM_FLAG_TITLE;
+    if (shift > 0)
+        flags |= MVT_STREAM_FLAG_SCROLL;
+    if (mvt_stream_put_number(buffer, state->sequence) == -1
+        || mvt_stream_put_number(buffer, base == &blank ? 0 : base->sequence) == -1
+        || mvt_stream_put_number(buffer, state->width) == -1
+        || mvt_stream_put_number(buffer, state->height) == -1
+        || mvt_stream_put_number(buffer, flags) == -1)
+        goto error;
+    if (flags & MVT_STREAM_FLAG_CURSOR) {
+        if (mvt_stream_put_number(buffer, state->cursor_x) == -1
+            || mvt_stream_put_number(buffer, state->cursor_y) == -1
+            || mvt_stream_put_number(buffer, state->cursor_visible) == -1)
+            goto error;
+    }
+    if (flags & MVT_STREAM_FLAG_TITLE) {
+        if (mvt_stream_put_number(buffer, state->title_length) == -1)
+            goto error;
+        for (i = 0; i < (int)state->title_length; i++) {
+            if (mvt_stream_put_number(buffer, state->title[i]) == -1)
+                goto error;
+        }
+    }
+    if (flags & MVT_STREAM_FLAG_SCROLL) {
+        if (mvt_stream_put_number(buffer, shift) == -1)
+            goto error;
+    }
+
+    for (y = 0; y < state->height; y++) {
+        if (y + shift < state->height) {
+            if (mvt_stream_row_equal(state, y, base, y + shift))
+                continue;
+            row = (size_t)(y + shift) * state->width;
+            if (mvt_stream_put_row(buffer, state, y, &base->text[row], &base->attribute[row]) == -1)
+                goto error;
+        } else {
+            if (mvt_stream_put_row(buffer, state, y, blank.text, blank.attribute) == -1)
+                goto error;
+        }
+    }
+    if (mvt_stream_put_number(buffer, 0) == -1)
+        goto error;
+    mvt_stream_put32(&buffer->data[start], buffer->length - start - 4);
+    ret = 0;
+error:
+    mvt_stream_state_destroy(&blank);
+    return ret;
+}
+
+/* decoder */
+
+static int mvt_stream_get_number(const uint8_t **p, const uint8_t *end, uint32_t *value)
+{
+    uint32_t v = 0;
+    int shift;
+    for (shift = 0; shift < 35; shift += 7) {
+        if (*p == end)
+            return -1;
+        v |= (uint32_t)(**p & 0x7f) << shift;
+        if (!(*(*p)++ & 0x80)) {
+            *value = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Get the length of the update at the head of the data.
+ * @return number of bytes of the update including its length, or 0
+ * if more data are needed
+ */
+size_t mvt_stream_update_length(const uint8_t *data, size_t count)
+{
+    size_t length;
+    if (count < 4)
+        return 0;
+    length = mvt_stream_get32(data) + 4;
+    return length <= count ? length : 0;
+}
+
+/**
+ * Apply an update to the state it was made on.
+ * @param data the update including its length
+ * @retval 0 success
+ * @retval -1 the update is broken, or is not made on the state
+ */
+int mvt_stream_decode(mvt_stream_state_t *state, const uint8_t *data, size_t count)
+{
+    const uint8_t *p = data + 4, *end = data + count;
+    uint32_t sequence, base, width, height, flags, value;
+    uint32_t y, x, n, run, attribute;
+    mvt_char_t *title;
+    size_t i;
+
+    if (count < 4 || mvt_stream_get32(data) != count - 4)
+        return -1;
+    if (mvt_stream_get_number(&p, end, &sequence) == -1
+        || mvt_stream_get_number(&p, end, &base) == -1
+        || mvt_stream_get_number(&p, end, &width) == -1
+        || mvt_stream_get_number(&p, end, &height) == -1
+        || mvt_stream_get_number(&p, end, &flags) == -1)
+        return -1;
+    if (width > 0xffff || height > 0xffff)
+        return -1;
+    if (base == 0 || width != (uint32_t)state->width || height != (uint32_t)state->height) {
+        if (base != 0)
+            return -1;
+        if (mvt_stream_state_resize(state, width, height) == -1)
+            return -1;
+        /* the state 0 has no title and the cursor at the origin */
+        free(state->title);
+        state->title = NULL;
+        state->title_length = 0;
+        state->cursor_x = 0;
+        state->cursor_y = 0;
+        state->cursor_visible = 0;
+    } else if (base != state->sequence) {
+        return -1;
+    }
+    if (flags & MVT_STREAM_FLAG_CURSOR) {
+        if (mvt_stream_get_number(&p, end, &value) == -1)
+            return -1;
+        state->cursor_x = value;
+        if (mvt_stream_get_number(&p, end, &value) == -1)
+            return -1;
+        state->cursor_y = value;
+        if (mvt_stream_get_number(&p, end, &value) == -1)
+            return -1;
+        state->cursor_visible = value;
+    }
+    if (flags & MVT_STREAM_FLAG_TITLE) {
+        if (mvt_stream_get_number(&p, end, &n) == -1 || n > (uint32_t)(end - p))
+            return -1;
+        title = NULL;
+        if (n > 0) {
+            title = malloc(n * sizeof (mvt_char_t));
+            if (!title)
+                return -1;
+        }
+        for (i = 0; i < n; i++) {
+            if (mvt_stream_get_number(&p, end, &value) == -1) {
+                free(title);
+                return -1;
+            }
+            title[i] = value;
+        }
+        free(state->title);
+        state->title = title;
+        state->title_length = n;
+    }
+    if (flags & MVT_STREAM_FLAG_SCROLL) {
+        if (mvt_stream_get_number(&p, end, &n) == -1 || n == 0 || n >= height)
+            return -1;
+        i = (size_t)n * width;
+        memmove(state->text, &state->text[i], ((size_t)width * height - i) * sizeof (mvt_char_t));
+        memmove(state->attribute, &state->attribute[i], ((size_t)width * height - i) * sizeof (uint32_t));
+        memset(&state->text[(size_t)width * height - i], 0, i * sizeof (mvt_char_t));
+        for (i = (size_t)width * (height - n); i < (size_t)width * height; i++)
+            state->attribute[i] = MVT_STREAM_BLANK_ATTRIBUTE;
+    }
+    for (;;) {
+        if (mvt_stream_get_number(&p, end, &y) == -1)
+            return -1;
+        if (y == 0)
+            break;
+        y--;
+        if (mvt_stream_get_number(&p, end, &x) == -1
+            || mvt_stream_get_number(&p, end, &n) == -1)
+            return -1;
+        if (y >= height || x > width || n > width - x)
+            return -1;
+        i = (size_t)y * width + x;
+        while (n > 0) {
+            if (mvt_stream_get_number(&p, end, &run) == -1
+                || mvt_stream_get_number(&p, end, &attribute) == -1
+                || run == 0 || run > n)
+                return -1;
+            n -= run;
+            for (; run > 0; run--, i++) {
+                if (mvt_stream_get_number(&p, end, &value) == -1)
+                    return -1;
+                state->text[i] = value;
+                state->attribute[i] = attribute;
+            }
+        }
+    }
+    if (p != end)
+        return -1;
+    state->sequence = sequence;
+    return 0;
+}
+
+#ifdef HAVE_PTHREAD
+
+/* server */
+
+#define MVT_STREAM_MAX_CLIENTS 8
+
+typedef struct _mvt_stream_client mvt_stream_client_t;
+
+struct _mvt_stream_client {
+    int fd;
+    /* the state the viewer has, and the one sent to it */
+    mvt_stream_state_t acked;
+    mvt_stream_state_t sent;
+    int outstanding;
+    mvt_stream_buffer_t output;
+    size_t output_offset;
+    uint8_t input[4];
+    size_t input_length;
+    /* what was sent, changed under the mutex of the server */
+    mvt_stream_stats_t stats;
+};
+
+struct _mvt_stream_server {
+    char *path;
+    int listen_fd;
+    int wake_pipe[2];
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    /* the latest state published, if the thread has to quit and the
+     * viewers in the order they came */
+    mvt_stream_state_t current;
+    int quit;
+    mvt_stream_client_t *clients[MVT_STREAM_MAX_CLIENTS];
+    int client_count;
+};
+
+static unsigned long mvt_stream_get_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void mvt_stream_wake_up(mvt_stream_server_t *server)
+{
+    if (write(server->wake_pipe[1], "", 1) == -1) {
+        /* the pipe is full, so the thread is woken up anyway */
+    }
+}
+
+static void mvt_stream_client_delete(mvt_stream_server_t *server, int index)
+{
+    mvt_stream_client_t *client = server->clients[index];
+    pthread_mutex_lock(&server->mutex);
+    server->client_count--;
+    memmove(&server->clients[index], &server->clients[index + 1],
+            (server->client_count - index) * sizeof (mvt_stream_client_t *));
+    pthread_mutex_unlock(&server->mutex);
+    MVT_DEBUG_PRINT4("mvt_stream: viewer left after %llu updates, %llu bytes, %llu usec to encode\n",
+                     client->stats.updates, client->stats.bytes, client->stats.encode_usec);
+    close(client->fd);
+    mvt_stream_state_destroy(&client->acked);
+    mvt_stream_state_destroy(&client->sent);
+    free(client->output.data);
+    free(client);
+}
+
+static void mvt_stream_accept(mvt_stream_server_t *server)
+{
+    mvt_stream_client_t *client;
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd == -1)
+        return;
+    if (server->client_count == MVT_STREAM_MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+    client = malloc(sizeof (mvt_stream_client_t));
+    if (!client) {
+        close(fd);
+        return;
+    }
+    memset(client, 0, sizeof *client);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    client->fd = fd;
+    mvt_stream_state_init(&client->acked);
+    mvt_stream_state_init(&client->sent);
+    pthread_mutex_lock(&server->mutex);
+    server->clients[server->client_count++] = client;
+    pthread_mutex_unlock(&server->mutex);
+}
+
+/**
+ * Read the answers of a viewer.
+ * @retval -1 the viewer has gone
+ */
+static int mvt_stream_client_read(mvt_stream_client_t *client)
+{
+    uint8_t buf[64];
+    mvt_stream_state_t swap;
+    ssize_t n;
+    size_t i;
+    n = read(client->fd, buf, sizeof buf);
+    if (n == 0)
+        return -1;
+    if (n == -1)
+        return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    for (i = 0; i < (size_t)n; i++) {
+        client->input[client->input_length++] = buf[i];
+        if (client->input_length < 4)
+            continue;
+        client->input_length = 0;
+        if (client->outstanding && mvt_stream_get32(client->input) == client->sent.sequence) {
+            swap = client->acked;
+            client->acked = client->sent;
+            client->sent = swap;
+            client->outstanding = FALSE;
+        }
+    }
+    return 0;
+}
+
+static int mvt_stream_client_write(mvt_stream_client_t *client)
+{
+    ssize_t n;
+    while (client->output_offset < client->output.length) {
+        n = write(client->fd, client->output.data + client->output_offset,
+                  client->output.length - client->output_offset);
+        if (n == -1)
+            return errno == EINTR || errno == EAGAIN ? 0 : -1;
+        client->output_offset += n;
+    }
+    client->output.length = 0;
+    client->output_offset = 0;
+    return 0;
+}
+
+/**
+ * Send the latest state to a viewer which has acknowledged its last
+ * update. The states published meanwhile are skipped.
+ */
+static int mvt_stream_client_update(mvt_stream_server_t *server, mvt_stream_client_t *client)
+{
+    unsigned long usec;
+    size_t length;
+    int ret;
+    if (client->outstanding)
+        return 0;
+    pthread_mutex_lock(&server->mutex);
+    ret = 0;
+    if (client->acked.sequence != server->current.sequence)
+        ret = mvt_stream_state_copy(&client->sent, &server->current) == -1 ? -1 : 1;
+    pthread_mutex_unlock(&server->mutex);
+    if (ret <= 0)
+        return ret;
+    usec = mvt_stream_get_usec();
+    length = client->output.length;
+    if (mvt_stream_encode(&client->output, &client->acked, &client->sent) == -1)
+        return -1;
+    usec = mvt_stream_get_usec() - usec;
+    client->outstanding = TRUE;
+    pthread_mutex_lock(&server->mutex);
+    client->stats.updates++;
+    client->stats.bytes += client->output.length - length;
+    client->stats.encode_usec += usec;
+    pthread_mutex_unlock(&server->mutex);
+    MVT_DEBUG_PRINT5("mvt_stream: update %u on %u, %lu bytes, %lu usec\n",
+                     client->sent.sequence, client->acked.sequence,
+                     (unsigned long)(client->output.length - length), usec);
+    return mvt_stream_client_write(client);
+}
+
+static void *mvt_stream_thread(void *data)
+{
+    mvt_stream_server_t *server = (mvt_stream_server_t *)data;
+    struct pollfd fds[MVT_STREAM_MAX_CLIENTS + 2];
+    mvt_stream_client_t *client;
+    char buf[64];
+    int i, count, quit;
+
+    for (;;) {
+        fds[0].fd = server->wake_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = server->listen_fd;
+        fds[1].events = POLLIN;
+        count = server->client_count;
+        for (i = 0; i < count; i++) {
+            client = server->clients[i];
+            fds[i + 2].fd = client->fd;
+            fds[i + 2].events = POLLIN;
+            if (client->output_offset < client->output.length)
+                fds[i + 2].events |= POLLOUT;
+        }
+        if (poll(fds, count + 2, -1) == -1 && errno != EINTR)
+            break;
+        while (read(server->wake_pipe[0], buf, sizeof buf) > 0)
+            ;
+        pthread_mutex_lock(&server->mutex);
+        quit = server->quit;
+        pthread_mutex_unlock(&server->mutex);
+        if (quit)
+            break;
+        for (i = count - 1; i >= 0; i--) {
+            client = server->clients[i];
+            if (((fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))
+                 && mvt_stream_client_read(client) == -1)
+                || ((fds[i + 2].revents & POLLOUT) && mvt_stream_client_write(client) == -1))
+                mvt_stream_client_delete(server, i);
+        }
+        if (fds[1].revents & POLLIN)
+            mvt_stream_accept(server);
+        for (i = server->client_count - 1; i >= 0; i--) {
+            client = server->clients[i];
+            if (mvt_stream_client_update(server, client) == -1)
+                mvt_stream_client_delete(server, i);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Listen for viewers on a local socket.
+ * @param path path of the socket
+ * @return a server, or NULL on error
+ */
+mvt_stream_server_t *mvt_stream_server_open(const char *path)
+{
+    mvt_stream_server_t *server;
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof addr.sun_path)
+        return NULL;
+    server = malloc(sizeof (mvt_stream_server_t));
+    if (!server)
+        return NULL;
+    memset(server, 0, sizeof *server);
+    mvt_stream_state_init(&server->current);
+    server->wake_pipe[0] = server->wake_pipe[1] = -1;
+    server->path = strdup(path);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!server->path || server->listen_fd == -1)
+        goto error;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof addr) == -1
+        || listen(server->listen_fd, MVT_STREAM_MAX_CLIENTS) == -1
+        || pipe(server->wake_pipe) == -1)
+        goto error;
+    fcntl(server->wake_pipe[0], F_SETFL, fcntl(server->wake_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(server->wake_pipe[1], F_SETFL, fcntl(server->wake_pipe[1], F_GETFL) | O_NONBLOCK);
+    pthread_mutex_init(&server->mutex, NULL);
+    if (pthread_create(&server->thread, NULL, mvt_stream_thread, server) != 0) {
+        pthread_mutex_destroy(&server->mutex);
+        goto error;
+    }
+    return server;
+error:
+    if (server->listen_fd != -1)
+        close(server->listen_fd);
+    if (server->wake_pipe[0] != -1) {
+        close(server->wake_pipe[0]);
+        close(server->wake_pipe[1]);
+    }
+    free(server->path);
+    free(server);
+    return NULL;
+}
+
+void mvt_stream_server_close(mvt_stream_server_t *server)
+{
+    pthread_mutex_lock(&server->mutex);
+    server->quit = TRUE;
+    pthread_mutex_unlock(&server->mutex);
+    mvt_stream_wake_up(server);
+    pthread_join(server->thread, NULL);
+    while (server->client_count > 0)
+        mvt_stream_client_delete(server, 0);
+    close(server->listen_fd);
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+    unlink(server->path);
+    pthread_mutex_destroy(&server->mutex);
+    mvt_stream_state_destroy(&server->current);
+    free(server->path);
+    free(server);
+}
+
+/**
+ * Make a state the latest one. The viewers are sent it as soon as
+ * they have acknowledged their last update.
+ */
+int mvt_stream_server_publish(mvt_stream_server_t *server, mvt_stream_state_t *state)
+{
+    int ret;
+    pthread_mutex_lock(&server->mutex);
+    state->sequence = server->current.sequence + 1;
+    if (state->sequence == 0)
+        state->sequence = 1;
+    ret = mvt_stream_state_copy(&server->current, state);
+    pthread_mutex_unlock(&server->mutex);
+    mvt_stream_wake_up(server);
+    return ret;
+}
+
+/**
+ * Get the counters of a viewer, 0 being the one connected first.
+ * @return 0, or -1 if there isn't such a viewer
+ */
+int mvt_stream_server_get_stats(mvt_stream_server_t *server, int index, mvt_stream_stats_t *stats)
+{
+    int ret = -1;
+    pthread_mutex_lock(&server->mutex);
+    if (index >= 0 && index < server->client_count) {
+        *stats = server->clients[index]->stats;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&server->mutex);
+    return ret;
+}
+
+#endif
+
+/** @} */
@@ -0,0 +1,157 @@
+/* Multi-purpose Virtual Terminal
+ * Copyright (C) 2013 Katsuya Iida
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* A viewer of the screen stream, which rebuilds the screen from the
+ * updates and tells how large they are and how long they take to
+ * apply.
+ *
+ *   stream_client [-d msec] [-n count] [-o file] path
+ *
+ * -d waits after each update as a slow viewer would, -n quits after
+ * the number of updates and -o writes the last screen to the file,
+ * as the server packs it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <mvt/mvt.h>
+#include "private.h"
+
+static unsigned long get_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static int write_state(const char *path, const mvt_stream_state_t *state)
+{
+    FILE *fp = fopen(path, "wb");
+    int header[5];
+    size_t count = (size_t)state->width * state->height;
+    if (!fp)
+        return -1;
+    header[0] = state->width;
+    header[1] = state->height;
+    header[2] = state->cursor_x;
+    header[3] = state->cursor_y;
+    header[4] = state->cursor_visible;
+    fwrite(header, sizeof header, 1, fp);
+    fwrite(state->text, sizeof (mvt_char_t), count, fp);
+    fwrite(state->attribute, sizeof (uint32_t), count, fp);
+    fwrite(state->title, sizeof (mvt_char_t), state->title_length, fp);
+    return fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    mvt_stream_state_t state;
+    uint8_t *data = NULL, ack[4];
+    size_t size = 0, length = 0, n;
+    unsigned long updates = 0, bytes = 0, usec, total_usec = 0, limit = 0;
+    int delay = 0, fd, c;
+    const char *output = NULL;
+    ssize_t r;
+
+    while ((c = getopt(argc, argv, "d:n:o:")) != -1) {
+        switch (c) {
+        case 'd':
+            delay = atoi(optarg);
+            break;
+        case 'n':
+            limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (optind + 1 != argc || strlen(argv[optind]) >= sizeof addr.sun_path) {
+        fprintf(stderr, "usage: %s [-d msec] [-n count] [-o file] path\n", argv[0]);
+        return 1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, argv[optind]);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+        perror(argv[optind]);
+        return 1;
+    }
+    mvt_stream_state_init(&state);
+    for (;;) {
+        if (length == size) {
+            size = size ? size * 2 : 65536;
+            data = realloc(data, size);
+            if (!data)
+                return 1;
+        }
+        r = read(fd, data + length, size - length);
+        if (r <= 0)
+            break;
+        length += r;
+        while ((n = mvt_stream_update_length(data, length)) > 0) {
+            usec = get_usec();
+            if (mvt_stream_decode(&state, data, n) == -1) {
+                fprintf(stderr, "broken update\n");
+                return 1;
+            }
+            usec = get_usec() - usec;
+            updates++;
+            bytes += n;
+            total_usec += usec;
+            printf("update %lu: %lu bytes, %lu usec\n",
+                   (unsigned long)state.sequence, (unsigned long)n, usec);
+            memmove(data, data + n, length - n);
+            length -= n;
+            if (delay > 0)
+                usleep(delay * 1000);
+            ack[0] = state.sequence & 255;
+            ack[1] = (state.sequence >> 8) & 255;
+            ack[2] = (state.sequence >> 16) & 255;
+            ack[3] = (state.sequence >> 24) & 255;
+            if (write(fd, ack, sizeof ack) != sizeof ack)
+                break;
+            if (updates == limit)
+                goto done;
+        }
+    }
+done:
+    printf("%lu updates, %lu bytes, %lu usec to decode\n", updates, bytes, total_usec);
+    if (output && write_state(output, &state) == -1) {
+        perror(output);
+        return 1;
+    }
+    close(fd);
+    mvt_stream_state_destroy(&state);
+    free(data);
+    return 0;
+}
@@ -17,6 +17,9 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #include <mvt/mvt.h>
 #include "private.h"
 /* #define MVT_DEBUG */
@@ -25,6 +28,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #define MVT_COMMAND_SE   (240)
 #define MVT_COMMAND_SB   (250)
@@ -44,6 +53,14 @@
 #define MVT_OPTION_TOGGLE_FLOW_CONTROL (33)
 #define MVT_OPTION_LINEMODE            (34)
 #define MVT_OPTION_NEW_ENVIRON         (39)
+#define MVT_OPTION_COMPRESS2           (86)
+#define MVT_OPTION_COMPRESS3           (87)
+
+/* what is read from the source at once while inflating */
+#define MVT_TELNET_PENDING_SIZE 65536
+#define MVT_TELNET_DEFLATE_SIZE 16384
+/* pieces of the data sent at once */
+#define MVT_TELNET_IOV_MAX 64
 
 enum _mvt_telnet_state_t {
     MVT_TELNET_STATE_NORMAL,
@@ -68,8 +85,34 @@ struct _mvt_telnet {
     const char *x_display_location;
 	int width;
 	int height;
+#ifdef HAVE_ZLIB
+    /* MCCP2 inflates what the server sends, MCCP3 deflates what is
+     * sent to it */
+    int compress;
+    int inflating;
+    int inflate_started;
+    int deflating;
+    z_stream inflater;
+    z_stream deflater;
+    /* bytes read from the source and still to be parsed, which are
+     * compressed while inflating */
+    uint8_t *pending;
+    size_t pending_offset;
+    size_t pending_length;
+    size_t pending_size;
+    unsigned long long read_bytes;
+    unsigned long long inflated_bytes;
+    unsigned long long written_bytes;
+    unsigned long long deflated_bytes;
+#endif
+#ifdef HAVE_PTHREAD
+    /* the replies from the reading thread and the writes go out whole,
+     * and share the deflater */
+    pthread_mutex_t write_mutex;
+#endif
 };
 
+static const uint8_t *mvt_telnet_parse(mvt_telnet_t *telnet, uint8_t **qp, const uint8_t *p, const uint8_t *lp);
 static void mvt_telnet_process_iac(mvt_telnet_t *telnet, uint8_t c);
 static void mvt_telnet_negotiate(mvt_telnet_t *telnet, uint8_t command, uint8_t c);
 static void mvt_telnet_reply_negotiate(mvt_telnet_t *telnet, uint8_t command, uint8_t c);
@@ -96,6 +139,15 @@ static void mvt_telnet_send_naws(mvt_telnet_t *telnet);
 static int mvt_telnet_negotiate_echo(mvt_telnet_t *telnet, uint8_t command, int option);
 static int mvt_telnet_negotiate_terminal_type(mvt_telnet_t *telnet, uint8_t command, int option);
 static int mvt_telnet_negotiate_new_environ(mvt_telnet_t *telnet, uint8_t command, int option);
+#ifdef HAVE_ZLIB
+static int mvt_telnet_negotiate_compress(mvt_telnet_t *telnet, uint8_t command, int option);
+static void mvt_telnet_sub_command_compress2(mvt_telnet_t *telnet, const uint8_t *p, size_t len);
+static void mvt_telnet_begin_deflate(mvt_telnet_t *telnet);
+static int mvt_telnet_read_pending(mvt_telnet_t *telnet, uint8_t *buf, size_t len, size_t *countread);
+static int mvt_telnet_unread(mvt_telnet_t *telnet, const uint8_t *p, size_t len);
+#endif
+static int mvt_telnet_send_all(mvt_telnet_t *telnet, mvt_iovec_t *iov, int iovcnt);
+static int mvt_telnet_send(mvt_telnet_t *telnet, mvt_iovec_t *iov, int iovcnt);
 static size_t mvt_telnet_write0(mvt_telnet_t *session, const void *buf, size_t len);
 static void mvt_telnet_close(mvt_session_t *session);
 static int mvt_telnet_connect(mvt_session_t *session);
@@ -119,7 +171,9 @@ static const mvt_session_vt_t mvt_telnet_vt = {
     mvt_telnet_read,
     mvt_telnet_write,
     mvt_telnet_shutdown,
-    mvt_telnet_resize
+    mvt_telnet_resize,
+    NULL,
+    NULL
 };
 
 static const mvt_telnet_negotiate_t negotiate_list[] =
@@ -154,6 +208,20 @@ static const mvt_telnet_negotiate_t negotiate_list[] =
       NULL,
       mvt_telnet_sub_command_new_environ,
     },
+#ifdef HAVE_ZLIB
+    {
+      MVT_OPTION_COMPRESS2,
+      mvt_telnet_negotiate_compress,
+      NULL,
+      mvt_telnet_sub_command_compress2
+    },
+    {
+      MVT_OPTION_COMPRESS3,
+      mvt_telnet_negotiate_compress,
+      NULL,
+      NULL
+    },
+#endif
     { -1,
       NULL,
       NULL,
@@ -173,6 +241,12 @@ mvt_telnet_open (char **args, mvt_session_t *source, int width, int height)
     telnet->source = source;
 	telnet->width = width;
 	telnet->height = height;
+#ifdef HAVE_ZLIB
+	telnet->compress = TRUE;
+#endif
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&telnet->write_mutex, NULL);
+#endif
 	while (*args) {
 		const char *name, *value;
 		name = *args++;
@@ -184,6 +258,10 @@ mvt_telnet_open (char **args, mvt_session_t *source, int width, int height)
 			telnet->x_display_location = strdup(value);
 		} else if (strcmp(name, "username") == 0) {
 			telnet->username = strdup(value);
+#ifdef HAVE_ZLIB
+		} else if (strcmp(name, "compress") == 0) {
+			telnet->compress = atoi(value) != 0;
+#endif
 		}
 	}
     return &telnet->parent;
@@ -193,7 +271,23 @@ static void
 mvt_telnet_close(mvt_session_t *session)
 {
     mvt_telnet_t *telnet = (mvt_telnet_t *)session;
-    mvt_session_close(telnet->source);
+#ifdef HAVE_ZLIB
+    MVT_DEBUG_PRINT5("mvt_telnet_close: read %llu inflated %llu written %llu deflated %llu\n",
+                     telnet->read_bytes, telnet->inflated_bytes,
+                     telnet->written_bytes, telnet->deflated_bytes);
+    if (telnet->inflating)
+        inflateEnd(&telnet->inflater);
+    if (telnet->deflating)
+        deflateEnd(&telnet->deflater);
+    free(telnet->pending);
+#endif
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&telnet->write_mutex);
+#endif
+    free((char *)telnet->terminal_type);
+    free((char *)telnet->x_display_location);
+    free((char *)telnet->username);
+    free(telnet);
 }
 
 static int
@@ -209,33 +303,70 @@ mvt_telnet_read (mvt_session_t *session, void *buf, size_t len, size_t *countrea
 {
     mvt_telnet_t *telnet = (mvt_telnet_t *)session;
     uint8_t *q = buf;
+#ifdef HAVE_ZLIB
     const uint8_t *p;
+#endif
     const uint8_t *lp;
     size_t n;
+    int ret;
 
-    if (mvt_session_read(telnet->source, buf, len, &n) < 0) {
+#ifdef HAVE_ZLIB
+    if (telnet->inflating || telnet->pending_offset < telnet->pending_length)
+        ret = mvt_telnet_read_pending(telnet, buf, len, &n);
+    else
+#endif
+        ret = mvt_session_read(telnet->source, buf, len, &n);
+    if (ret < 0) {
         MVT_DEBUG_PRINT1("mvt_telnet_notify_socket_read\n");
         return -1;
     }
-    p = buf;
     lp = (uint8_t *)buf + n;
+#ifdef HAVE_ZLIB
+    p = mvt_telnet_parse(telnet, &q, buf, lp);
+    /* the rest is compressed, and is inflated at the next read */
+    if (p < lp && mvt_telnet_unread(telnet, p, lp - p) == -1)
+        return -1;
+#else
+    mvt_telnet_parse(telnet, &q, buf, lp);
+#endif
+    *countread = q - (uint8_t *)buf;
+    return 0;
+}
+
+/**
+ * Take the commands out of the bytes from p to lp, moving the data to
+ * *qp in place.
+ * @return where the bytes stopped being parsed, which is before lp
+ * when the rest is compressed
+ */
+static const uint8_t *
+mvt_telnet_parse(mvt_telnet_t *telnet, uint8_t **qp, const uint8_t *p, const uint8_t *lp)
+{
+    uint8_t *q = *qp;
+    const uint8_t *e;
+    size_t i;
+
     while (p < lp) {
         switch (telnet->state) {
         case MVT_TELNET_STATE_NORMAL:
-            if (*p == MVT_COMMAND_IAC) { /* IAC */
-                /* MVT_DEBUG_PRINT3("mvt_telnet_notify_socket_read: IAC\n"); */
+            e = memchr(p, MVT_COMMAND_IAC, lp - p);
+            i = (e ? e : lp) - p;
+            /* the data stays where it is until a command is taken out */
+            if (q != p)
+                memmove(q, p, i);
+            q += i;
+            p += i;
+            if (e) { /* IAC */
                 telnet->state = MVT_TELNET_STATE_IAC;
                 p++;
-            } else {
-                size_t i = 0;
-                MVT_DEBUG_PRINT1("mvt_telnet_notify_socket_read: normal\n");
-                while (p + i < lp && p[i] != MVT_COMMAND_IAC) i++;
-                memmove(q, p, i);
-                q += i;
-                p += i;
             }
             break;
         case MVT_TELNET_STATE_IAC:
+            if (*p == MVT_COMMAND_IAC) { /* an escaped 0xff */
+                *q++ = *p++;
+                telnet->state = MVT_TELNET_STATE_NORMAL;
+                break;
+            }
             mvt_telnet_process_iac(telnet, *p++);
             break;
         case MVT_TELNET_STATE_NEGOTIATE:
@@ -253,8 +384,8 @@ mvt_telnet_read (mvt_session_t *session, void *buf, size_t len, size_t *countrea
                 telnet->state = MVT_TELNET_STATE_SB_IAC;
                 p++;
             } else {
-                size_t i = 0;
-                while (p + i < lp && p[i] != MVT_COMMAND_IAC) i++;
+                e = memchr(p, MVT_COMMAND_IAC, lp - p);
+                i = (e ? e : lp) - p;
                 telnet->sub_command_length += i;
                 mvt_telnet_sub_command(telnet, telnet->tmp, p, i);
                 p += i;
@@ -269,6 +400,13 @@ mvt_telnet_read (mvt_session_t *session, void *buf, size_t len, size_t *countrea
                 break;
             }
             p++;
+#ifdef HAVE_ZLIB
+            if (telnet->inflate_started) {
+                telnet->inflate_started = FALSE;
+                *qp = q;
+                return p;
+            }
+#endif
             break;
         default:
             telnet->state = MVT_TELNET_STATE_NORMAL;
@@ -277,8 +415,8 @@ mvt_telnet_read (mvt_session_t *session, void *buf, size_t len, size_t *countrea
             break;
         }
     }
-    *countread = q - (uint8_t *)buf;
-    return 0;
+    *qp = q;
+    return p;
 }
 
 static void
@@ -370,6 +508,10 @@ mvt_telnet_negotiate(mvt_telnet_t *telnet, uint8_t command, uint8_t option)
     case MVT_COMMAND_WILL:
       mvt_telnet_reply_negotiate(telnet, ok ? MVT_COMMAND_DO : MVT_COMMAND_DONT, option);
       mvt_telnet_set_option_will(telnet, option, ok);
+#ifdef HAVE_ZLIB
+      if (ok && option == MVT_OPTION_COMPRESS3)
+        mvt_telnet_begin_deflate(telnet);
+#endif
       break;
     case MVT_COMMAND_WONT:
       mvt_telnet_reply_negotiate(telnet, MVT_COMMAND_DONT, option);
@@ -454,18 +596,23 @@ mvt_telnet_sub_command_terminal_type(mvt_telnet_t *telnet, const uint8_t *p, siz
 {
   if (len == -1)
     {
+      static const uint8_t se[2] = { MVT_COMMAND_IAC, MVT_COMMAND_SE };
       uint8_t buf[4];
       const char *type;
+      mvt_iovec_t iov[3];
       buf[0] = MVT_COMMAND_IAC; /* IAC */
       buf[1] = MVT_COMMAND_SB; /* SB */
       buf[2] = 24; /* TERMINAL-TYPE */
       buf[3] = 0; /* IS */
       MVT_DEBUG_PRINT1("mvt_telnet_state_reply_terminal_type\n");
-      mvt_telnet_write0(telnet, buf, 4);
       type = telnet->terminal_type ? telnet->terminal_type : "vt100";
-      mvt_telnet_write0(telnet, type, strlen(type));
-      buf[1] = MVT_COMMAND_SE; /* SE */
-      mvt_telnet_write0(telnet, buf, 2);
+      iov[0].base = buf;
+      iov[0].len = 4;
+      iov[1].base = type;
+      iov[1].len = strlen(type);
+      iov[2].base = se;
+      iov[2].len = 2;
+      mvt_telnet_send(telnet, iov, 3);
     }
   else
     {
@@ -495,8 +642,10 @@ mvt_telnet_sub_command_new_environ(mvt_telnet_t *telnet, const uint8_t *p, size_
 {
   if (len == -1)
     {
+      static const uint8_t se[2] = { MVT_COMMAND_IAC, MVT_COMMAND_SE };
       uint8_t buf[10];
       const char *username;
+      mvt_iovec_t iov[3];
       buf[0] = MVT_COMMAND_IAC; /* IAC */
       buf[1] = MVT_COMMAND_SB; /* SB */
       buf[2] = MVT_OPTION_NEW_ENVIRON;
@@ -508,11 +657,14 @@ mvt_telnet_sub_command_new_environ(mvt_telnet_t *telnet, const uint8_t *p, size_
       buf[8] = 'R';
       buf[9] = 1; /* VALUE */
       MVT_DEBUG_PRINT1("mvt_telnet_state_reply_terminal_type\n");
-      mvt_telnet_write0(telnet, buf, 10);
       username = telnet->username;
-      mvt_telnet_write0(telnet, username, strlen(username));
-      buf[1] = MVT_COMMAND_SE; /* SE */
-      mvt_telnet_write0(telnet, buf, 2);
+      iov[0].base = buf;
+      iov[0].len = 10;
+      iov[1].base = username;
+      iov[1].len = strlen(username);
+      iov[2].base = se;
+      iov[2].len = 2;
+      mvt_telnet_send(telnet, iov, 3);
     }
   else
     {
@@ -524,6 +676,193 @@ mvt_telnet_sub_command_new_environ(mvt_telnet_t *telnet, const uint8_t *p, size_
     }
 }
 
+#ifdef HAVE_ZLIB
+static int
+mvt_telnet_negotiate_compress(mvt_telnet_t *telnet, uint8_t command, int option)
+{
+  switch (command)
+    {
+    case MVT_COMMAND_WILL:
+      return telnet->compress;
+    case MVT_COMMAND_DO:
+      return FALSE;
+    }
+  return FALSE;
+}
+
+/**
+ * IAC SB COMPRESS2 IAC SE, after which the server sends a zlib stream
+ * until the stream ends.
+ */
+static void
+mvt_telnet_sub_command_compress2(mvt_telnet_t *telnet, const uint8_t *p, size_t len)
+{
+  if (len != -1 || telnet->inflating || !mvt_telnet_get_option_will(telnet, MVT_OPTION_COMPRESS2))
+    return;
+  if (telnet->pending_size == 0)
+    {
+      telnet->pending = malloc(MVT_TELNET_PENDING_SIZE);
+      if (telnet->pending == NULL)
+        return;
+      telnet->pending_size = MVT_TELNET_PENDING_SIZE;
+    }
+  memset(&telnet->inflater, 0, sizeof telnet->inflater);
+  if (inflateInit(&telnet->inflater) != Z_OK)
+    return;
+  MVT_DEBUG_PRINT1("mvt_telnet_sub_command_compress2: inflating\n");
+  telnet->inflating = TRUE;
+  telnet->inflate_started = TRUE;
+}
+
+/**
+ * Inflate the pending bytes into the buffer, reading the source when
+ * all of them are inflated, or copy them when the stream has ended.
+ */
+static int
+mvt_telnet_read_pending(mvt_telnet_t *telnet, uint8_t *buf, size_t len, size_t *countread)
+{
+  z_stream *z = &telnet->inflater;
+  size_t n;
+  int ret;
+
+  if (telnet->pending_offset == telnet->pending_length)
+    {
+      if (mvt_session_read(telnet->source, telnet->pending, telnet->pending_size, &n) < 0)
+        return -1;
+      telnet->pending_offset = 0;
+      telnet->pending_length = n;
+    }
+  if (!telnet->inflating)
+    {
+      n = telnet->pending_length - telnet->pending_offset;
+      if (n > len)
+        n = len;
+      memcpy(buf, telnet->pending + telnet->pending_offset, n);
+      telnet->pending_offset += n;
+      *countread = n;
+      return 0;
+    }
+  z->next_in = telnet->pending + telnet->pending_offset;
+  z->avail_in = telnet->pending_length - telnet->pending_offset;
+  z->next_out = buf;
+  z->avail_out = len;
+  ret = inflate(z, Z_SYNC_FLUSH);
+  telnet->read_bytes += telnet->pending_length - telnet->pending_offset - z->avail_in;
+  telnet->pending_offset = telnet->pending_length - z->avail_in;
+  *countread = len - z->avail_out;
+  telnet->inflated_bytes += *countread;
+  if (ret == Z_STREAM_END)
+    {
+      /* what follows the stream isn't compressed */
+      MVT_DEBUG_PRINT1("mvt_telnet_read_pending: end of the stream\n");
+      inflateEnd(z);
+      telnet->inflating = FALSE;
+    }
+  else if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+      MVT_DEBUG_PRINT2("mvt_telnet_read_pending: inflate: %d\n", ret);
+      return -1;
+    }
+  return 0;
+}
+
+/**
+ * Keep bytes read but not parsed in front of the pending ones.
+ */
+static int
+mvt_telnet_unread(mvt_telnet_t *telnet, const uint8_t *p, size_t len)
+{
+  size_t rest = telnet->pending_length - telnet->pending_offset;
+  uint8_t *pending;
+
+  if (len <= telnet->pending_offset)
+    {
+      telnet->pending_offset -= len;
+      memcpy(telnet->pending + telnet->pending_offset, p, len);
+      return 0;
+    }
+  pending = malloc(len + rest > MVT_TELNET_PENDING_SIZE ? len + rest : MVT_TELNET_PENDING_SIZE);
+  if (pending == NULL)
+    return -1;
+  memcpy(pending, p, len);
+  memcpy(pending + len, telnet->pending + telnet->pending_offset, rest);
+  free(telnet->pending);
+  telnet->pending = pending;
+  telnet->pending_size = len + rest > MVT_TELNET_PENDING_SIZE ? len + rest : MVT_TELNET_PENDING_SIZE;
+  telnet->pending_offset = 0;
+  telnet->pending_length = len + rest;
+  return 0;
+}
+
+/**
+ * Agreed to MCCP3: say that what follows is compressed, and compress
+ * it from here on.
+ */
+static void
+mvt_telnet_begin_deflate(mvt_telnet_t *telnet)
+{
+  static const uint8_t start[5] =
+    {
+      MVT_COMMAND_IAC, MVT_COMMAND_SB, MVT_OPTION_COMPRESS3, MVT_COMMAND_IAC, MVT_COMMAND_SE
+    };
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&telnet->write_mutex);
+#endif
+  if (!telnet->deflating)
+    {
+      memset(&telnet->deflater, 0, sizeof telnet->deflater);
+      if (deflateInit(&telnet->deflater, Z_DEFAULT_COMPRESSION) == Z_OK)
+        {
+          mvt_iovec_t iov;
+          iov.base = start;
+          iov.len = sizeof start;
+          if (mvt_telnet_send_all(telnet, &iov, 1) == 0)
+            telnet->deflating = TRUE;
+          else
+            deflateEnd(&telnet->deflater);
+        }
+    }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&telnet->write_mutex);
+#endif
+}
+
+/**
+ * Compress the pieces and send them at once, so that the server
+ * doesn't wait for the rest of a block.
+ */
+static int
+mvt_telnet_deflate(mvt_telnet_t *telnet, const mvt_iovec_t *iov, int iovcnt)
+{
+  z_stream *z = &telnet->deflater;
+  uint8_t out[MVT_TELNET_DEFLATE_SIZE];
+  mvt_iovec_t piece;
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    {
+      z->next_in = (Bytef *)iov[i].base;
+      z->avail_in = iov[i].len;
+      do
+        {
+          z->next_out = out;
+          z->avail_out = sizeof out;
+          if (deflate(z, i == iovcnt - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+            return -1;
+          piece.base = out;
+          piece.len = sizeof out - z->avail_out;
+          if (mvt_telnet_send_all(telnet, &piece, 1) == -1)
+            return -1;
+          telnet->deflated_bytes += piece.len;
+        }
+      while (z->avail_out == 0);
+      telnet->written_bytes += iov[i].len;
+    }
+  return 0;
+}
+#endif
+
 #ifdef ENABLE_DEBUG
 static const char *
 mvt_telnet_command_name(uint8_t c)
@@ -586,27 +925,103 @@ mvt_set_index_flag(void *flags, int size, int index, int value)
     *p &= ~(1 << (index & 7));
 }
 
+/**
+ * Write all of the pieces to the source, moving past what each write
+ * has taken.
+ */
+static int
+mvt_telnet_send_all(mvt_telnet_t *telnet, mvt_iovec_t *iov, int iovcnt)
+{
+    size_t n;
+
+    for (;;) {
+        while (iovcnt > 0 && iov->len == 0) {
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt == 0)
+            return 0;
+        if (mvt_session_writev(telnet->source, iov, iovcnt, &n) < 0 || n == 0)
+            return -1;
+        while (n >= iov->len) {
+            n -= iov->len;
+            iov++;
+            iovcnt--;
+            if (iovcnt == 0)
+                return 0;
+        }
+        iov->base = (const uint8_t *)iov->base + n;
+        iov->len -= n;
+    }
+}
+
+/**
+ * Send the pieces whole, through the deflater when compressing.
+ */
+static int
+mvt_telnet_send(mvt_telnet_t *telnet, mvt_iovec_t *iov, int iovcnt)
+{
+    int ret;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&telnet->write_mutex);
+#endif
+#ifdef HAVE_ZLIB
+    if (telnet->deflating)
+        ret = mvt_telnet_deflate(telnet, iov, iovcnt);
+    else
+#endif
+        ret = mvt_telnet_send_all(telnet, iov, iovcnt);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&telnet->write_mutex);
+#endif
+    return ret;
+}
+
 static size_t
 mvt_telnet_write0(mvt_telnet_t *telnet, const void *buf, size_t count)
 {
-    size_t n;
-    if (mvt_session_write(telnet->source, buf, count, &n) < 0) {
+    mvt_iovec_t iov;
+    iov.base = buf;
+    iov.len = count;
+    if (mvt_telnet_send(telnet, &iov, 1) == -1)
         return (size_t)-1;
-    }
-    return n;
+    return count;
 }
 
+/**
+ * Send the data with each IAC doubled. A piece ends after each IAC
+ * and the next one starts at it again, so the IACs are sent twice
+ * without copying the data.
+ */
 static int
 mvt_telnet_write (mvt_session_t *session, const void *buf, size_t count, size_t *countwritten)
 {
-    size_t ret;
     mvt_telnet_t *telnet = (mvt_telnet_t *)session;
-    ret = mvt_telnet_write0(telnet, buf, count);
-    if (ret < 0)
-        return -1;
-    if (ret == 0)
+    mvt_iovec_t iov[MVT_TELNET_IOV_MAX];
+    const uint8_t *start = buf;
+    const uint8_t *p = buf;
+    const uint8_t *lp = p + count;
+    const uint8_t *e;
+    int n = 0;
+
+    while ((e = memchr(p, MVT_COMMAND_IAC, lp - p)) != NULL) {
+        iov[n].base = start;
+        iov[n].len = e + 1 - start;
+        n++;
+        start = e;
+        p = e + 1;
+        if (n == MVT_TELNET_IOV_MAX) {
+            if (mvt_telnet_send(telnet, iov, n) == -1)
+                return -1;
+            n = 0;
+        }
+    }
+    iov[n].base = start;
+    iov[n].len = lp - start;
+    n++;
+    if (mvt_telnet_send(telnet, iov, n) == -1)
         return -1;
-    *countwritten = ret;
+    *countwritten = count;
     return 0;
 }
 
@@ -614,6 +1029,30 @@ static void mvt_telnet_shutdown(mvt_session_t *session)
 {
 }
 
+/**
+ * Get how many bytes were read and written compressed, and how many
+ * they were before being compressed, which tells the compression
+ * ratio.
+ * @return 0, or -1 if compression isn't built in
+ */
+int mvt_telnet_get_compression(mvt_session_t *session, unsigned long long *read_bytes,
+                               unsigned long long *inflated_bytes,
+                               unsigned long long *written_bytes,
+                               unsigned long long *deflated_bytes)
+{
+#ifdef HAVE_ZLIB
+    mvt_telnet_t *telnet = (mvt_telnet_t *)session;
+    *read_bytes = telnet->read_bytes;
+    *inflated_bytes = telnet->inflated_bytes;
+    *written_bytes = telnet->written_bytes;
+    *deflated_bytes = telnet->deflated_bytes;
+    return 0;
+#else
+    *read_bytes = *inflated_bytes = *written_bytes = *deflated_bytes = 0;
+    return -1;
+#endif
+}
+
 static void mvt_telnet_resize(mvt_session_t *session, int columns, int rows)
 {
     mvt_telnet_t *telnet = (mvt_telnet_t *)session;
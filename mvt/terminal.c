@@ -75,6 +75,7 @@ typedef enum _mvt_terminal_state {
 #define MVT_TERMINAL_FLAG_NORMCURSOR (1 << 3)
 #define MVT_TERMINAL_FLAG_INSERTMODE (1 << 4)
 #define MVT_TERMINAL_FLAG_VT200MOUSE (1 << 5)
+#define MVT_TERMINAL_FLAG_NEWLINE    (1 << 6)
 
 struct _mvt_terminal {
     mvt_console_t console;
@@ -91,6 +92,31 @@ struct _mvt_terminal {
     int mouse_align;
 };
 
+/** "MVTT" */
+#define MVT_TERMINAL_SAVED_MAGIC 0x5454564d
+#define MVT_TERMINAL_SAVED_VERSION 1
+
+/* how cells are laid out in memory, which saved data must agree on */
+#ifdef ENABLE_SPLIT_CELLS
+#define MVT_TERMINAL_SAVED_LAYOUT (0x10000 | sizeof (mvt_char_t) << 8 | sizeof (mvt_attribute_t))
+#else
+#define MVT_TERMINAL_SAVED_LAYOUT (sizeof (mvt_char_t) << 8 | sizeof (mvt_attribute_t))
+#endif
+
+/**
+ * the state saved by mvt_terminal_save, followed by the console
+ */
+typedef struct _mvt_terminal_saved {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout;
+    int32_t flags;
+    int32_t state;
+    int32_t private;
+    int32_t num_params;
+    int32_t params[MVT_TERMINAL_MAX_PARAMS];
+} mvt_terminal_saved_t;
+
 #define MVT_IS_CONTROL(wc) ((wc) < 0x20)
 static int mvt_terminal_init(mvt_terminal_t *terminal, int width, int height, int save_height);
 static void mvt_terminal_destroy(mvt_terminal_t *terminal);
@@ -178,6 +204,80 @@ void mvt_terminal_repaint(const mvt_terminal_t *terminal)
     mvt_console_repaint(&terminal->console);
 }
 
+int mvt_terminal_capture(const mvt_terminal_t *terminal, mvt_stream_state_t *state)
+{
+    return mvt_console_capture(&terminal->console, state);
+}
+
+/**
+ * Save the whole state of a terminal, the modes, the parser, the
+ * lines and the title, so that mvt_terminal_restore can bring it back
+ * without the output being written again. The data is read back only
+ * by the same build.
+ * @param data the data allocated with malloc
+ * @param size its size
+ * @retval 0 success
+ * @retval -1 out of memory
+ */
+int mvt_terminal_save(const mvt_terminal_t *terminal, void **data, size_t *size)
+{
+    mvt_terminal_saved_t saved;
+    uint8_t *buf;
+    size_t n;
+    int i;
+    n = sizeof saved + mvt_console_save(&terminal->console, NULL);
+    buf = malloc(n);
+    if (!buf)
+        return -1;
+    memset(&saved, 0, sizeof saved);
+    saved.magic = MVT_TERMINAL_SAVED_MAGIC;
+    saved.version = MVT_TERMINAL_SAVED_VERSION;
+    saved.layout = MVT_TERMINAL_SAVED_LAYOUT;
+    saved.flags = terminal->flags;
+    saved.state = terminal->state;
+    saved.private = terminal->private;
+    saved.num_params = terminal->num_params;
+    for (i = 0; i < MVT_TERMINAL_MAX_PARAMS; i++)
+        saved.params[i] = terminal->params[i];
+    memcpy(buf, &saved, sizeof saved);
+    mvt_console_save(&terminal->console, buf + sizeof saved);
+    *data = buf;
+    *size = n;
+    return 0;
+}
+
+/**
+ * Bring back the state saved by mvt_terminal_save. The terminal keeps
+ * its screen, and is repainted on it. Data which is mapped from a
+ * file can be given as it is, as it is only read.
+ * @retval 0 success
+ * @retval -1 the data is broken, of another build, or out of memory
+ */
+int mvt_terminal_restore(mvt_terminal_t *terminal, const void *data, size_t size)
+{
+    mvt_terminal_saved_t saved;
+    int i;
+    if (size < sizeof saved)
+        return -1;
+    memcpy(&saved, data, sizeof saved);
+    if (saved.magic != MVT_TERMINAL_SAVED_MAGIC
+        || saved.version != MVT_TERMINAL_SAVED_VERSION
+        || saved.layout != MVT_TERMINAL_SAVED_LAYOUT
+        || saved.state < MVT_TERMINAL_STATE_NORMAL || saved.state > MVT_TERMINAL_STATE_OSC_TEXT
+        || saved.num_params < 0 || saved.num_params >= MVT_TERMINAL_MAX_PARAMS)
+        return -1;
+    if (mvt_console_restore(&terminal->console, (const uint8_t *)data + sizeof saved, size - sizeof saved) == 0)
+        return -1;
+    terminal->flags = saved.flags;
+    terminal->state = saved.state;
+    terminal->private = saved.private != 0;
+    terminal->num_params = saved.num_params;
+    for (i = 0; i < MVT_TERMINAL_MAX_PARAMS; i++)
+        terminal->params[i] = saved.params[i];
+    terminal->mouse_capture = 0;
+    return 0;
+}
+
 size_t mvt_terminal_write(mvt_terminal_t *terminal, const mvt_char_t *ws, size_t len)
 {
     const mvt_char_t *p = ws;
@@ -240,6 +340,8 @@ static void mvt_terminal_write_control(mvt_terminal_t *terminal, mvt_char_t wc)
     case 11: /* VERTICAL TAB */
     case 12: /* FORM FEED */
         mvt_console_line_feed(&terminal->console);
+        if (terminal->flags & MVT_TERMINAL_FLAG_NEWLINE)
+            mvt_console_carriage_return(&terminal->console);
         break;
     case 13: /* CARRIAGE RETURN */
         mvt_console_carriage_return(&terminal->console);
@@ -402,9 +504,11 @@ static void mvt_terminal_write_sm(mvt_terminal_t *terminal, int value)
             else
                 terminal->flags &= ~MVT_TERMINAL_FLAG_INSERTMODE;
             break;
+        case MVT_ANSIMODE_LNM:
+            mvt_set_flag(&terminal->flags, MVT_TERMINAL_FLAG_NEWLINE, value);
+            break;
         case MVT_ANSIMODE_HEM:
         case MVT_ANSIMODE_SRM:
-        case MVT_ANSIMODE_LNM:
             MVT_DEBUG_PRINT2("mvt_terminal_write_csi: not supported ANSI mode %d.\n", terminal->params[i]);
             break;
         default:
@@ -701,6 +805,8 @@ int mvt_terminal_keydown(mvt_terminal_t *terminal, int meta, int code)
             count = 1;
         }
     }
+    if (count == 1 && wbuf[0] == '\r' && (terminal->flags & MVT_TERMINAL_FLAG_NEWLINE))
+        wbuf[count++] = '\n';
     if (count > 0) {
         mvt_console_append_input(&terminal->console, wbuf, count);
         if (terminal->flags & MVT_TERMINAL_FLAG_ECHO) {
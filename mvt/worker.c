@@ -24,6 +24,7 @@
 #include <string.h>
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
+#include <time.h>
 #endif
 #ifdef HAVE_SDL
 #include <SDL.h>
@@ -50,13 +51,37 @@
 #define PTHREAD_LIL_ENDIAN 0
 #define PTHREAD_BIG_ENDIAN 1
 
+/* The read buffer doubles up to MVT_READ_BUFFER_MAX while reads fill
+ * it, and halves back to MVT_READ_BUFFER_SIZE while they don't use a
+ * quarter of it. */
 #define MVT_READ_BUFFER_SIZE 4096
+#define MVT_READ_BUFFER_MAX 262144
 #define MVT_WRITE_BUFFER_SIZE 4096
-#define MVT_MAX_SESSIONS 3
+/* In the throughput mode the keys are gathered into this many bytes
+ * at most, by default MVT_WRITE_BYTES bytes for MVT_WRITE_USEC
+ * microseconds from the first. */
+#define MVT_WRITE_GATHER_SIZE 65536
+#define MVT_WRITE_BYTES 16384
+#define MVT_WRITE_USEC 2000
+#define MVT_MIN_SESSIONS 4
+#define MVT_MAX_POOL 64
+/* A spec the pool fails to open is tried again after this many
+ * milliseconds, doubled on each failure up to MVT_POOL_RETRY_MAX. */
+#define MVT_POOL_RETRY_MSEC 1000
+#define MVT_POOL_RETRY_MAX 60000
+
+/* The session is told the window size at most once in this many
+ * milliseconds. */
+#define MVT_RESIZE_INTERVAL 100
 
 typedef struct _mvt_worker_request mvt_worker_request_t;
 typedef struct _mvt_worker mvt_worker_t;
 
+/* the keys are written as they come */
+#define MVT_WRITE_MODE_LATENCY 0
+/* the keys coming close together are written at once */
+#define MVT_WRITE_MODE_THROUGHPUT 1
+
 typedef enum {
     MVT_WORKER_WRITE,
     MVT_WORKER_READ,
@@ -71,12 +96,20 @@ struct _mvt_worker_request {
     size_t count;
     size_t result;
     int resized;
+    /* a read answered even if there is nothing to read */
+    int nowait;
+    /* the bytes read from the session up to the end of the text
+     * written */
+    uint64_t position;
 };
 
 /* This object is accessed by threads */
 struct _mvt_worker {
     mvt_terminal_t *terminal;
-    mvt_session_t *session_list[MVT_MAX_SESSIONS];
+    /* the stages from the bottom, the session the terminal talks to
+     * being the last */
+    mvt_session_t **session_list;
+    int session_list_size;
     int last_session;
 #ifdef HAVE_PTHREAD
     pthread_t input_thread;
@@ -98,7 +131,25 @@ struct _mvt_worker {
 #endif
     unsigned int resized : 1;
     unsigned int active : 1;
+    /* the session was taken connected from the pool */
+    unsigned int connected : 1;
     mvt_worker_request_t *pending_read_message;
+    /* how the keys are written, set under the global mutex */
+    int write_mode;
+    size_t write_bytes;
+    unsigned int write_usec;
+    /* the file the output is recorded into, changed under the global
+     * mutex */
+    mvt_recorder_t *recorder;
+    /* the bytes read from the session, by the input thread */
+    uint64_t read_position;
+    /* the bytes read from the session which the terminal has taken */
+    uint64_t taken_position;
+#ifdef HAVE_PTHREAD
+    /* remote viewers and the state last captured for them */
+    mvt_stream_server_t *stream;
+    mvt_stream_state_t stream_state;
+#endif
 };
 
 #ifdef HAVE_PTHREAD
@@ -110,6 +161,23 @@ static SDL_mutex *global_mutex;
 #ifdef HAVE_WIN32_THREAD
 static HANDLE global_mutex;
 #endif
+/* Sessions opened and connected ahead, for terminals opening
+ * sessions of the spec. The pool thread refills the list. */
+static mvt_session_t *pool_list[MVT_MAX_POOL];
+static int pool_count;
+static int pool_size;
+static char *pool_spec;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t pool_mutex;
+static pthread_cond_t pool_cond;
+static pthread_t pool_thread;
+#endif
+#ifdef HAVE_SDL
+static SDL_mutex *pool_mutex;
+static SDL_cond *pool_cond;
+static SDL_Thread *pool_thread;
+#endif
+static int pool_running;
 static mvt_worker_t *shutdown_terminal;
 static mvt_worker_request_t *message_queue;
 static mvt_worker_request_t **message_last;
@@ -118,9 +186,11 @@ static mvt_event_func_t global_event_func = NULL;
 static void mvt_worker_response_read(mvt_worker_request_t *message);
 static void mvt_worker_response_write(mvt_worker_request_t *message);
 static void mvt_worker_response_close(mvt_worker_request_t *message);
-static size_t mvt_worker_read(mvt_worker_t *worker, mvt_char_t *ws, size_t count, int *resized);
-static size_t mvt_worker_write(mvt_worker_t *worker, const void *ws, size_t count);
+static size_t mvt_worker_read(mvt_worker_t *worker, mvt_char_t *ws, size_t count, int *resized, int nowait);
+static size_t mvt_worker_write(mvt_worker_t *worker, const void *ws, size_t count, uint64_t position);
+static void mvt_worker_record_keyframe(mvt_worker_t *worker, int resize);
 static void mvt_worker_close(mvt_worker_t *worker);
+static void mvt_worker_publish(mvt_worker_t *worker);
 
 #ifdef HAVE_PTHREAD
 #define mvt_mutex_lock(mutex) pthread_mutex_lock(mutex)
@@ -135,6 +205,59 @@ static void mvt_worker_close(mvt_worker_t *worker);
 #define mvt_cond_wait(cond, mutex) SDL_CondWait(*(cond), *(mutex))
 #endif
 
+#ifdef HAVE_PTHREAD
+static unsigned int mvt_get_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void mvt_delay(unsigned int ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+static unsigned long long mvt_get_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void mvt_delay_usec(unsigned int usec)
+{
+    struct timespec ts;
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+/* the cond is on the realtime clock, which is the default */
+static void mvt_cond_wait_timeout(pthread_cond_t *cond, pthread_mutex_t *mutex, unsigned int ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(cond, mutex, &ts);
+}
+#endif
+#ifdef HAVE_SDL
+#define mvt_cond_wait_timeout(cond, mutex, ms) SDL_CondWaitTimeout(*(cond), *(mutex), ms)
+#define mvt_get_ticks() SDL_GetTicks()
+#define mvt_delay(ms) SDL_Delay(ms)
+#define mvt_get_usec() ((unsigned long long)SDL_GetTicks() * 1000)
+#define mvt_delay_usec(usec) SDL_Delay(((usec) + 999) / 1000)
+#endif
+
 static int mvt_worker_send_request(mvt_worker_request_t *message)
 {
     mvt_mutex_lock(&global_mutex);
@@ -217,7 +340,7 @@ static void mvt_worker_response_read(mvt_worker_request_t *message)
                                         message->ws,
                                         message->count);
     message->resized = FALSE;
-    if (message->result > 0) {
+    if (message->result > 0 || message->nowait) {
         mvt_cond_signal(&worker->read_cond);
         return;
     }
@@ -235,7 +358,10 @@ static void mvt_worker_response_write(mvt_worker_request_t *message)
     message->result = mvt_terminal_write(worker->terminal,
                                          message->ws,
                                          message->count);
+    worker->taken_position = message->position;
     mvt_cond_signal(&worker->write_cond);
+    mvt_worker_record_keyframe(worker, FALSE);
+    mvt_worker_publish(worker);
 }
 
 static void mvt_worker_response_close(mvt_worker_request_t *message)
@@ -295,7 +421,11 @@ mvt_terminal_t *mvt_worker_open_terminal(char **args)
             save_lines = atoi(value);
     }
     worker->active = FALSE;
+    worker->connected = FALSE;
     worker->last_session = -1;
+    worker->write_mode = MVT_WRITE_MODE_LATENCY;
+    worker->write_bytes = MVT_WRITE_BYTES;
+    worker->write_usec = MVT_WRITE_USEC;
     worker->terminal = mvt_terminal_new(width, height, save_lines);
     mvt_terminal_set_driver_data(worker->terminal, worker);
 #ifdef HAVE_PTHREAD
@@ -317,7 +447,12 @@ void mvt_worker_close_terminal(mvt_terminal_t *terminal)
         mvt_screen_set_driver_data(screen, NULL);
     mvt_shutdown(terminal);
     mvt_terminal_delete(terminal);
+    if (worker->recorder)
+        mvt_recorder_close(worker->recorder);
 #ifdef HAVE_PTHREAD
+    if (worker->stream)
+        mvt_stream_server_close(worker->stream);
+    mvt_stream_state_destroy(&worker->stream_state);
     pthread_cond_destroy(&worker->read_cond);
     pthread_cond_destroy(&worker->write_cond);
 #endif
@@ -325,10 +460,11 @@ void mvt_worker_close_terminal(mvt_terminal_t *terminal)
     SDL_DestroyCond(worker->read_cond);
     SDL_DestroyCond(worker->write_cond);
 #endif
+    free(worker->session_list);
     free(worker);
 }
 
-static size_t mvt_worker_read(mvt_worker_t *worker, mvt_char_t *ws, size_t count, int *resized)
+static size_t mvt_worker_read(mvt_worker_t *worker, mvt_char_t *ws, size_t count, int *resized, int nowait)
 {
     mvt_worker_request_t message;
     size_t result;
@@ -336,6 +472,7 @@ static size_t mvt_worker_read(mvt_worker_t *worker, mvt_char_t *ws, size_t count
     message.worker = worker;
     message.ws = ws;
     message.count = count;
+    message.nowait = nowait;
     if (mvt_worker_send_request(&message) == -1) {
         *resized = FALSE;
         return 0;
@@ -345,7 +482,7 @@ static size_t mvt_worker_read(mvt_worker_t *worker, mvt_char_t *ws, size_t count
     return result;
 }
 
-static size_t mvt_worker_write(mvt_worker_t *worker, const void *ws, size_t count)
+static size_t mvt_worker_write(mvt_worker_t *worker, const void *ws, size_t count, uint64_t position)
 {
     mvt_worker_request_t message;
     size_t result;
@@ -353,12 +490,43 @@ static size_t mvt_worker_write(mvt_worker_t *worker, const void *ws, size_t coun
     message.worker = worker;
     message.ws = (mvt_char_t *)ws;
     message.count = count;
+    message.nowait = FALSE;
+    message.position = position;
     if (mvt_worker_send_request(&message) == -1)
         return 0;
     result = message.result;
     return result;
 }
 
+/**
+ * Record the terminal if the recorder is due a keyframe, or always
+ * after a resize. The terminal is saved outside the global mutex, as
+ * only this thread changes it, so that the input thread isn't held
+ * up.
+ */
+static void mvt_worker_record_keyframe(mvt_worker_t *worker, int resize)
+{
+    void *data;
+    size_t size;
+    int due;
+    mvt_mutex_lock(&global_mutex);
+    due = worker->recorder
+        && (resize || mvt_recorder_keyframe_due(worker->recorder, worker->taken_position, mvt_get_ticks()));
+    mvt_mutex_unlock(&global_mutex);
+    if (!due || mvt_terminal_save(worker->terminal, &data, &size) == -1)
+        return;
+    mvt_mutex_lock(&global_mutex);
+    /* the input thread closes the recorder when it fails */
+    if (worker->recorder
+        && mvt_recorder_keyframe(worker->recorder, resize, worker->taken_position,
+                                 data, size, mvt_get_ticks()) == -1) {
+        mvt_recorder_close(worker->recorder);
+        worker->recorder = NULL;
+    }
+    mvt_mutex_unlock(&global_mutex);
+    free(data);
+}
+
 static void mvt_worker_close(mvt_worker_t *worker)
 {
     mvt_worker_request_t message;
@@ -366,35 +534,126 @@ static void mvt_worker_close(mvt_worker_t *worker)
     message.worker = worker;
     message.ws = NULL;
     message.count = 0;
+    message.nowait = FALSE;
     (void)mvt_worker_send_request(&message);
 }
 
+/**
+ * Send the screen to remote viewers if any listen.
+ */
+static void mvt_worker_publish(mvt_worker_t *worker)
+{
+#ifdef HAVE_PTHREAD
+    if (!worker->stream)
+        return;
+    if (mvt_terminal_capture(worker->terminal, &worker->stream_state) == -1)
+        return;
+    (void)mvt_stream_server_publish(worker->stream, &worker->stream_state);
+#endif
+}
+
 int mvt_worker_set_terminal_attribute(mvt_terminal_t *terminal, const char *name, const char *value)
 {
+    mvt_worker_t *worker = (mvt_worker_t *)mvt_terminal_get_driver_data(terminal);
+    if (strcmp(name, "record") == 0) {
+        /* the path of a file to record the output into */
+        mvt_recorder_t *recorder = NULL, *old_recorder;
+        if (value && *value) {
+            recorder = mvt_recorder_open(value, terminal, worker->taken_position, mvt_get_ticks());
+            if (!recorder)
+                return -1;
+        }
+        mvt_mutex_lock(&global_mutex);
+        old_recorder = worker->recorder;
+        worker->recorder = recorder;
+        mvt_mutex_unlock(&global_mutex);
+        if (old_recorder)
+            mvt_recorder_close(old_recorder);
+        return 0;
+    }
+#ifdef HAVE_PTHREAD
+    if (strcmp(name, "stream") == 0) {
+        /* the path of a local socket for remote viewers */
+        if (worker->stream) {
+            mvt_stream_server_close(worker->stream);
+            worker->stream = NULL;
+        }
+        if (value && *value) {
+            worker->stream = mvt_stream_server_open(value);
+            if (!worker->stream)
+                return -1;
+            mvt_worker_publish(worker);
+        }
+        return 0;
+    }
+#endif
+    if (strcmp(name, "write-mode") == 0) {
+        /* "latency" to write each key at once, or "throughput" to
+         * gather the keys coming close together */
+        int mode;
+        if (!value)
+            return -1;
+        if (strcmp(value, "latency") == 0)
+            mode = MVT_WRITE_MODE_LATENCY;
+        else if (strcmp(value, "throughput") == 0)
+            mode = MVT_WRITE_MODE_THROUGHPUT;
+        else
+            return -1;
+        mvt_mutex_lock(&global_mutex);
+        worker->write_mode = mode;
+        mvt_mutex_unlock(&global_mutex);
+        return 0;
+    }
+    if (strcmp(name, "write-bytes") == 0) {
+        /* the bytes gathered at most in the throughput mode */
+        long bytes = value ? strtol(value, NULL, 10) : 0;
+        if (bytes <= 0 || bytes > MVT_WRITE_GATHER_SIZE)
+            return -1;
+        mvt_mutex_lock(&global_mutex);
+        worker->write_bytes = bytes;
+        mvt_mutex_unlock(&global_mutex);
+        return 0;
+    }
+    if (strcmp(name, "write-usec") == 0) {
+        /* how long the first key gathered waits at most */
+        long usec = value ? strtol(value, NULL, 10) : -1;
+        if (usec < 0 || usec > 1000000)
+            return -1;
+        mvt_mutex_lock(&global_mutex);
+        worker->write_usec = usec;
+        mvt_mutex_unlock(&global_mutex);
+        return 0;
+    }
     return 0;
 }
 
 void mvt_screen_dispatch_resize(mvt_screen_t *screen)
 {
     mvt_worker_t *worker = (mvt_worker_t *)mvt_screen_get_driver_data(screen);
+    int old_width, old_height, width, height;
     if (!worker)
         return;
+    mvt_terminal_get_size(worker->terminal, &old_width, &old_height);
     mvt_terminal_resize(worker->terminal);
-    mvt_mutex_lock(&global_mutex);
-    worker->resized = TRUE;
-    mvt_mutex_unlock(&global_mutex);
-    mvt_worker_data_ready(worker->terminal);
+    mvt_terminal_get_size(worker->terminal, &width, &height);
+    if (width != old_width || height != old_height) {
+        mvt_mutex_lock(&global_mutex);
+        worker->resized = TRUE;
+        mvt_mutex_unlock(&global_mutex);
+        mvt_worker_data_ready(worker->terminal);
+        mvt_worker_record_keyframe(worker, TRUE);
+    }
     mvt_terminal_repaint(worker->terminal);
+    mvt_worker_publish(worker);
 }
 
 static int worker_input(void *data)
 {
     mvt_terminal_t *terminal = (mvt_terminal_t *)data;
     mvt_worker_t *worker = (mvt_worker_t *)mvt_terminal_get_driver_data(terminal);
-    char buf[MVT_READ_BUFFER_SIZE];
-    char wbuf[MVT_READ_BUFFER_SIZE];
-    char *s, *ws;
-    size_t count, wcount, n;
+    char *buf, *wbuf;
+    char *s, *s0, *ws, *p, *q;
+    size_t size, new_size, count, wcount, n;
     iconv_t cd;
     int need_read;
 #if PTHREAD_BYTEORDER == PTHREAD_LIL_ENDIAN
@@ -405,25 +664,40 @@ static int worker_input(void *data)
 #endif
     if (cd == (iconv_t)-1)
         return -1;
+    /* A UTF-8 byte makes at most one character, so a buffer read is
+     * converted and written to the terminal at once. */
+    size = MVT_READ_BUFFER_SIZE;
+    buf = malloc(size);
+    wbuf = malloc(size * sizeof (mvt_char_t));
+    if (buf == NULL || wbuf == NULL) {
+        free(buf);
+        free(wbuf);
+        iconv_close(cd);
+        return -1;
+    }
+    new_size = size;
     s = buf;
     count = 0;
     ws = wbuf;
-    wcount = MVT_READ_BUFFER_SIZE;
+    wcount = size * sizeof (mvt_char_t);
     need_read = TRUE;
     for (;;) {
         if (need_read) {
-            if (mvt_session_read(worker->session_list[worker->last_session], s, MVT_READ_BUFFER_SIZE - count, &n) < 0)
+            if (mvt_session_read(worker->session_list[worker->last_session], s, size - count, &n) < 0)
                 break;
             s = buf;
             count += n;
+            if (count == size && size < MVT_READ_BUFFER_MAX)
+                new_size = size * 2;
+            else if (count < size / 4 && size > MVT_READ_BUFFER_SIZE)
+                new_size = size / 2;
         }
+        s0 = s;
         for (;;) {
             n = iconv(cd, &s, &count, (char **)&ws, &wcount);
             if (n != (size_t)-1) {
                 need_read = TRUE;
                 assert(count == 0);
-                s = buf;
-                count = 0;
                 break;
             } else if (errno == E2BIG) {
                 need_read = FALSE;
@@ -431,8 +705,6 @@ static int worker_input(void *data)
             } else if (errno == EINVAL) {
                 assert(count > 0);
                 need_read = TRUE;
-                memmove(buf, s, count);
-                s = buf + count;
                 break;
             }
             assert(count > 0);
@@ -457,30 +729,91 @@ static int worker_input(void *data)
                 }
             }
 #endif
-            mvt_worker_write(worker, (mvt_char_t *)wbuf, (ws - wbuf) / sizeof (mvt_char_t));
+            mvt_worker_write(worker, (mvt_char_t *)wbuf, (ws - wbuf) / sizeof (mvt_char_t),
+                             worker->read_position + (s - s0));
             /* We don't have to copy wbuf as iconv converts one
              * character at a time */
             ws = wbuf;
-            wcount = MVT_READ_BUFFER_SIZE;
+            wcount = size * sizeof (mvt_char_t);
+        }
+        /* the bytes converted, or skipped as invalid, are recorded as
+         * read once the terminal has taken them */
+        if (s > s0) {
+            mvt_mutex_lock(&global_mutex);
+            if (worker->recorder
+                && mvt_recorder_write(worker->recorder, worker->read_position, s0, s - s0,
+                                      mvt_get_ticks()) == -1) {
+                mvt_recorder_close(worker->recorder);
+                worker->recorder = NULL;
+            }
+            mvt_mutex_unlock(&global_mutex);
+            worker->read_position += s - s0;
+        }
+        if (need_read) {
+            memmove(buf, s, count);
+            s = buf + count;
+        }
+        /* what is left of the buffer is at its start when it is read
+         * again */
+        if (need_read && new_size != size) {
+            p = malloc(new_size);
+            q = malloc(new_size * sizeof (mvt_char_t));
+            if (p != NULL && q != NULL) {
+                memcpy(p, buf, count);
+                free(buf);
+                free(wbuf);
+                buf = p;
+                wbuf = q;
+                size = new_size;
+            } else {
+                free(p);
+                free(q);
+            }
+            s = buf + count;
+            ws = wbuf;
+            wcount = size * sizeof (mvt_char_t);
+            new_size = size;
         }
     }
+    free(buf);
+    free(wbuf);
     iconv_close(cd);
     mvt_worker_close(worker);
     return 0;
 }
 
+/**
+ * Write the bytes to the session.
+ * @return 0, or -1 if the session can't be written to
+ */
+static int worker_flush(mvt_worker_t *worker, const char *p, size_t count)
+{
+    size_t n;
+    while (count > 0) {
+        if (mvt_session_write(worker->session_list[worker->last_session], p, count, &n) < 0)
+            return -1;
+        p += n;
+        count -= n;
+    }
+    return 0;
+}
+
 static int worker_output(void *data)
 {
     mvt_terminal_t *terminal = (mvt_terminal_t *)data;
     mvt_worker_t *worker = (mvt_worker_t *)mvt_terminal_get_driver_data(terminal);
-    char buf[MVT_WRITE_BUFFER_SIZE];
+    char buf[MVT_WRITE_GATHER_SIZE];
     char wbuf[MVT_WRITE_BUFFER_SIZE];
     char *s, *ws;
-    size_t count, wcount, n;
+    size_t count, wcount, n, write_bytes;
     iconv_t cd;
     int need_read;
     int resized;
     int width, height;
+    int session_width, session_height;
+    int write_mode;
+    unsigned int resize_ticks, elapsed;
+    unsigned long long now, due;
 
 #if PTHREAD_BYTEORDER == PTHREAD_LIL_ENDIAN
     cd = iconv_open("UTF-8", "UCS-4LE");
@@ -489,19 +822,57 @@ static int worker_output(void *data)
     cd = iconv_open("UTF-8", "UCS-4BE");
 #endif
     s = buf;
-    count = MVT_READ_BUFFER_SIZE;
+    count = MVT_WRITE_BUFFER_SIZE;
     ws = wbuf;
     wcount = 0;
     need_read = TRUE;
+    session_width = -1;
+    session_height = -1;
+    resize_ticks = mvt_get_ticks() - MVT_RESIZE_INTERVAL;
+    due = 0;
     if (cd == (iconv_t)-1)
         return -1;
     for (;;) {
         if (need_read) {
-            n = mvt_worker_read(worker, (mvt_char_t *)ws, (MVT_WRITE_BUFFER_SIZE - wcount) / sizeof (mvt_char_t), &resized);
+            /* while bytes are gathered, a read only takes what has
+             * come since */
+            n = mvt_worker_read(worker, (mvt_char_t *)ws, (MVT_WRITE_BUFFER_SIZE - wcount) / sizeof (mvt_char_t), &resized, s > buf);
+            if (n == 0 && s > buf && !resized) {
+                now = mvt_get_usec();
+                if (now < due) {
+                    mvt_delay_usec(due - now);
+                    continue;
+                }
+                if (worker_flush(worker, buf, s - buf) == -1)
+                    return 0;
+                s = buf;
+                count = MVT_WRITE_BUFFER_SIZE;
+                due = 0;
+                continue;
+            }
             if (n == 0) {
+                /* the keys go before the new size */
+                if (s > buf) {
+                    if (worker_flush(worker, buf, s - buf) == -1)
+                        return 0;
+                    s = buf;
+                    count = MVT_WRITE_BUFFER_SIZE;
+                    due = 0;
+                }
                 if (resized) {
+                    /* Resizes arriving while we wait collapse into
+                     * the resized flag, so only the latest size is
+                     * sent. */
+                    elapsed = mvt_get_ticks() - resize_ticks;
+                    if (elapsed < MVT_RESIZE_INTERVAL)
+                        mvt_delay(MVT_RESIZE_INTERVAL - elapsed);
                     mvt_terminal_get_size(worker->terminal, &width, &height);
-                    mvt_session_resize(worker->session_list[worker->last_session], width, height);
+                    if (width != session_width || height != session_height) {
+                        mvt_session_resize(worker->session_list[worker->last_session], width, height);
+                        session_width = width;
+                        session_height = height;
+                        resize_ticks = mvt_get_ticks();
+                    }
                     continue;
                 } else {
                     break;
@@ -533,21 +904,74 @@ static int worker_output(void *data)
             wcount--;
         }
         if (s > buf) {
-            const char *p = buf;
-            while (p < s) {
-                if (mvt_session_write(worker->session_list[worker->last_session], p, s - p, &n) < 0)
-                    return 0;
-                p += n;
+            mvt_mutex_lock(&global_mutex);
+            write_mode = worker->write_mode;
+            write_bytes = worker->write_bytes;
+            if (due == 0)
+                due = mvt_get_usec() + worker->write_usec;
+            mvt_mutex_unlock(&global_mutex);
+            /* the bytes wait for more until they are due or there is
+             * no room for more */
+            if (write_mode == MVT_WRITE_MODE_THROUGHPUT
+                && (size_t)(s - buf) < write_bytes
+                && s - buf + MVT_WRITE_BUFFER_SIZE <= MVT_WRITE_GATHER_SIZE
+                && mvt_get_usec() < due) {
+                count = MVT_WRITE_BUFFER_SIZE;
+                continue;
             }
+            if (worker_flush(worker, buf, s - buf) == -1)
+                return 0;
             s = buf;
-            count = MVT_READ_BUFFER_SIZE;
+            count = MVT_WRITE_BUFFER_SIZE;
+            due = 0;
         }
     }
     iconv_close(cd);
     return 0;
 }
 
+static int worker_pool(void *data)
+{
+    mvt_session_t *session;
+    unsigned int retry_msec = MVT_POOL_RETRY_MSEC;
+    mvt_mutex_lock(&pool_mutex);
+    for (;;) {
+        while (pool_size > 0 && pool_count >= pool_size)
+            mvt_cond_wait(&pool_cond, &pool_mutex);
+        if (pool_size == 0)
+            break;
+        mvt_mutex_unlock(&pool_mutex);
+        /* the size is set when the session is taken */
+        session = mvt_session_open(pool_spec, NULL, 80, 24);
+        if (session && mvt_session_connect(session) < 0) {
+            mvt_session_close(session);
+            session = NULL;
+        }
+        mvt_mutex_lock(&pool_mutex);
+        if (session == NULL) {
+            /* a spec which fails, as when the host is down, is tried
+             * again later and less often */
+            if (pool_size > 0)
+                mvt_cond_wait_timeout(&pool_cond, &pool_mutex, retry_msec);
+            retry_msec *= 2;
+            if (retry_msec > MVT_POOL_RETRY_MAX)
+                retry_msec = MVT_POOL_RETRY_MAX;
+            continue;
+        }
+        retry_msec = MVT_POOL_RETRY_MSEC;
+        pool_list[pool_count++] = session;
+    }
+    mvt_mutex_unlock(&pool_mutex);
+    return 0;
+}
+
 #ifdef HAVE_PTHREAD
+static void *pthread_worker_pool(void *data)
+{
+    worker_pool(data);
+    return NULL;
+}
+
 static void *pthread_worker_input(void *data)
 {
     worker_input(data);
@@ -561,6 +985,87 @@ static void *pthread_worker_output(void *data)
 }
 #endif
 
+/**
+ * Keep sessions of a spec opened and connected ahead, which
+ * terminals opening their first session of the spec take instead of
+ * opening one. The sessions are refilled in the background.
+ * @param spec spec of the sessions
+ * @param size number of the sessions kept, or 0 to close them
+ * @return 0 on success, -1 on failure
+ */
+int
+mvt_set_pool (const char *spec, int size)
+{
+    char *new_spec = NULL;
+
+    if (size < 0 || size > MVT_MAX_POOL)
+        return -1;
+    if (size > 0) {
+        new_spec = strdup(spec);
+        if (new_spec == NULL)
+            return -1;
+    }
+    if (pool_running) {
+        mvt_mutex_lock(&pool_mutex);
+        pool_size = 0;
+        mvt_cond_signal(&pool_cond);
+        mvt_mutex_unlock(&pool_mutex);
+#ifdef HAVE_PTHREAD
+        pthread_join(pool_thread, NULL);
+#endif
+#ifdef HAVE_SDL
+        SDL_WaitThread(pool_thread, NULL);
+#endif
+        pool_running = FALSE;
+    }
+    while (pool_count > 0)
+        mvt_session_close(pool_list[--pool_count]);
+    free(pool_spec);
+    pool_spec = new_spec;
+    pool_size = size;
+    if (size == 0)
+        return 0;
+#ifdef HAVE_PTHREAD
+    pool_running = pthread_create(&pool_thread, NULL, pthread_worker_pool, NULL) == 0;
+#endif
+#ifdef HAVE_SDL
+    pool_thread = SDL_CreateThread(worker_pool, NULL);
+    pool_running = pool_thread != NULL;
+#endif
+    if (!pool_running) {
+        free(pool_spec);
+        pool_spec = NULL;
+        pool_size = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Take a session of the spec from the pool. Sessions which have ended
+ * while they waited, as when their shell has exited, are closed.
+ */
+static mvt_session_t *mvt_worker_take_pooled(const char *spec)
+{
+    mvt_session_t *session;
+    if (pool_spec == NULL || strcmp(spec, pool_spec) != 0)
+        return NULL;
+    for (;;) {
+        session = NULL;
+        mvt_mutex_lock(&pool_mutex);
+        if (pool_count > 0) {
+            /* the oldest, whose shell has most likely started */
+            session = pool_list[0];
+            memmove(&pool_list[0], &pool_list[1], --pool_count * sizeof (mvt_session_t *));
+            mvt_cond_signal(&pool_cond);
+        }
+        mvt_mutex_unlock(&pool_mutex);
+        if (session == NULL || mvt_session_is_alive(session))
+            return session;
+        mvt_session_close(session);
+    }
+}
+
 int
 mvt_open (mvt_terminal_t *terminal, const char *spec)
 {
@@ -569,12 +1074,27 @@ mvt_open (mvt_terminal_t *terminal, const char *spec)
     mvt_session_t *source;
 
     mvt_terminal_get_size(terminal, &width, &height);
-    if (worker->last_session == -1)
+    if (worker->last_session + 1 == worker->session_list_size) {
+        int size = worker->session_list_size ? worker->session_list_size * 2 : MVT_MIN_SESSIONS;
+        mvt_session_t **list = realloc(worker->session_list, size * sizeof (mvt_session_t *));
+        if (list == NULL)
+            return -1;
+        worker->session_list = list;
+        worker->session_list_size = size;
+    }
+    if (worker->last_session == -1) {
+        source = mvt_worker_take_pooled(spec);
+        if (source) {
+            mvt_session_resize(source, width, height);
+            worker->session_list[++worker->last_session] = source;
+            worker->connected = TRUE;
+            return 0;
+        }
         source = NULL;
-    else
+    } else {
         source = worker->session_list[worker->last_session];
-    if (worker->last_session + 1 == MVT_MAX_SESSIONS)
-        return -1;
+    }
+    worker->connected = FALSE;
     worker->session_list[worker->last_session + 1] = mvt_session_open(spec, source, width, height);
     if (worker->session_list[worker->last_session + 1] == NULL)
         return -1;
@@ -590,7 +1110,9 @@ mvt_connect (mvt_terminal_t *terminal)
 
     if (worker->last_session == -1)
         return -1;
-    mvt_session_connect(worker->session_list[worker->last_session]);
+    if (!worker->connected
+        && mvt_session_connect(worker->session_list[worker->last_session]) < 0)
+        return -1;
     worker->active = TRUE;
 #ifdef HAVE_SDL
     assert(!worker->input_thread);
@@ -607,6 +1129,55 @@ mvt_connect (mvt_terminal_t *terminal)
     return 0;
 }
 
+/**
+ * Get the session the terminal talks to, for a program which is the
+ * other end of it.
+ */
+mvt_session_t *
+mvt_get_session (mvt_terminal_t *terminal)
+{
+    mvt_worker_t *worker = (mvt_worker_t *)mvt_terminal_get_driver_data(terminal);
+
+    if (worker->last_session == -1)
+        return NULL;
+    return worker->session_list[worker->last_session];
+}
+
+/**
+ * Get the counters of a stage of the sessions, 0 being the session
+ * the terminal talks to and the higher ones the stages under it.
+ * @return 0, or -1 if there isn't such a stage
+ */
+int
+mvt_get_session_stats (mvt_terminal_t *terminal, int index, mvt_session_stats_t *stats)
+{
+    mvt_worker_t *worker = (mvt_worker_t *)mvt_terminal_get_driver_data(terminal);
+
+    if (index < 0 || index > worker->last_session)
+        return -1;
+    mvt_session_get_stats(worker->session_list[worker->last_session - index], stats);
+    return 0;
+}
+
+/**
+ * Get the counters of a remote viewer of the screen, 0 being the one
+ * connected first.
+ * @return 0, or -1 if there isn't such a viewer
+ */
+int
+mvt_get_stream_stats (mvt_terminal_t *terminal, int index, mvt_stream_stats_t *stats)
+{
+#ifdef HAVE_PTHREAD
+    mvt_worker_t *worker = (mvt_worker_t *)mvt_terminal_get_driver_data(terminal);
+
+    if (!worker->stream)
+        return -1;
+    return mvt_stream_server_get_stats(worker->stream, index, stats);
+#else
+    return -1;
+#endif
+}
+
 int mvt_attach(mvt_terminal_t *terminal, mvt_screen_t *screen)
 {
     mvt_worker_t *worker = (mvt_worker_t *)mvt_screen_get_driver_data(screen);
@@ -620,6 +1191,8 @@ int mvt_attach(mvt_terminal_t *terminal, mvt_screen_t *screen)
         return 0;
     if (mvt_terminal_set_screen(terminal, screen) == -1)
         return -1;
+    /* the terminal has taken the size of the screen */
+    mvt_worker_record_keyframe(worker, TRUE);
     mvt_screen_dispatch_resize(screen);
     return 0;
 }
@@ -659,7 +1232,9 @@ void mvt_worker_shutdown(mvt_terminal_t *terminal)
     mvt_mutex_lock(&global_mutex);
     shutdown_terminal = worker;
     mvt_mutex_unlock(&global_mutex);
-    mvt_session_shutdown(worker->session_list[worker->last_session]);
+    /* each stage, as the reading one may wait for any under it */
+    for (i = worker->last_session; i >= 0; i--)
+        mvt_session_shutdown(worker->session_list[i]);
     message = worker->pending_read_message;
     if (message) {
         message->result = 0;
@@ -709,6 +1284,14 @@ void mvt_worker_init(mvt_event_func_t event_func)
 #endif
 #ifdef HAVE_SDL
     global_mutex = SDL_CreateMutex();
+#endif
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&pool_mutex, NULL);
+    pthread_cond_init(&pool_cond, NULL);
+#endif
+#ifdef HAVE_SDL
+    pool_mutex = SDL_CreateMutex();
+    pool_cond = SDL_CreateCond();
 #endif
     message_queue = NULL;
     message_last = &message_queue;
@@ -718,10 +1301,15 @@ void mvt_worker_init(mvt_event_func_t event_func)
 
 void mvt_worker_exit(void)
 {
+    mvt_set_pool(NULL, 0);
 #ifdef HAVE_PTHREAD
+    pthread_cond_destroy(&pool_cond);
+    pthread_mutex_destroy(&pool_mutex);
     pthread_mutex_destroy(&global_mutex);
 #endif
 #ifdef HAVE_SDL
+    SDL_DestroyCond(pool_cond);
+    SDL_DestroyMutex(pool_mutex);
     SDL_DestroyMutex(global_mutex);
 #endif
 }
@@ -828,8 +1416,13 @@ static mvt_session_plugin_list_t *first_plugin;
 
 static const char *default_plugin_proto_list[] = {
     "socket",
+    "pipe",
+#ifndef WIN32
+    "log",
+#endif
 #ifdef ENABLE_PTY
     "pty",
+    "exec",
 #endif
 #ifdef ENABLE_TELNET
 	"telnet",
@@ -839,8 +1432,13 @@ static const char *default_plugin_proto_list[] = {
 
 static const mvt_session_plugin_t default_plugin_list[] = {
     { mvt_socket_open },
+    { mvt_pipe_open },
+#ifndef WIN32
+    { mvt_log_open },
+#endif
 #ifdef ENABLE_PTY
     { mvt_pty_open },
+    { mvt_exec_open },
 #endif
 #ifdef ENABLE_TELNET
 	{ mvt_telnet_open },
@@ -905,6 +1503,8 @@ mvt_session_open (const char *spec, mvt_session_t *source, int width, int height
 	while (list != NULL) {
 		if (strcmp(proto, list->proto) == 0) {
 			session = (*list->plugin.open)(args + 1, source, width, height);
+			if (session != NULL)
+				memset(&session->stats, 0, sizeof session->stats);
 			break;
 		}
 		list = list->next;
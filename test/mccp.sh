@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Read a local stand-in telnet server speaking MCCP2 and MCCP3 with
+# the socket client, and check what the client shows.
+#
+#   test/mccp.sh [directory of socket_client]
+
+bindir=${1:-mvt}
+srcdir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+python3 "$srcdir/telnet_server.py" "$tmp/port" "$tmp/expected" &
+server=$!
+i=0
+while [ ! -f "$tmp/port" ]; do
+    i=$((i + 1))
+    if [ $i -gt 50 ]; then
+        echo "mccp: the server hasn't started"
+        exit 1
+    fi
+    sleep 0.1
+done
+
+# the keys are the ones telnet_server.py waits for
+"$bindir/socket_client" -t -k "$(printf 'guest\377\r')" -o "$tmp/output" \
+    127.0.0.1 "$(cat "$tmp/port")" || exit 1
+wait $server || exit 1
+if cmp "$tmp/expected" "$tmp/output"; then
+    echo "mccp: ok"
+else
+    echo "mccp: the output differs"
+    exit 1
+fi
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Connect the socket client to a host resolving to ::1 and 127.0.0.1
+# while test/stall_server.py stalls one or both of them, and check
+# that the other address is raced in within a second and that a
+# shutdown stops a connect which can't finish.
+#
+#   test/socket_stall.sh [directory of socket_client] [host]
+#
+# The host is localhost by default, which has to resolve to both
+# addresses; the test is skipped otherwise.
+
+bindir=${1:-mvt}
+host=${2:-localhost}
+srcdir=$(dirname "$0")
+tmp=$(mktemp -d)
+server=
+trap 'test -n "$server" && kill $server 2>/dev/null; rm -rf "$tmp"' EXIT
+
+if ! python3 -c 'import socket, sys
+addresses = set(ai[4][0] for ai in socket.getaddrinfo(sys.argv[1], 0, 0, socket.SOCK_STREAM))
+sys.exit(not {"::1", "127.0.0.1"} <= addresses)' "$host"; then
+    echo "socket_stall: skipped, $host doesn't resolve to both ::1 and 127.0.0.1"
+    exit 77
+fi
+
+start_server() {
+    rm -f "$tmp/port"
+    python3 "$srcdir/stall_server.py" "$tmp/port" "$@" &
+    server=$!
+    i=0
+    while [ ! -f "$tmp/port" ]; do
+        i=$((i + 1))
+        if [ $i -gt 50 ]; then
+            echo "socket_stall: the server hasn't started"
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
+
+stop_server() {
+    kill $server
+    wait $server 2>/dev/null
+    server=
+}
+
+# one address stalled: the other one answers before the SYN to the
+# stalled one would even be sent again
+for stalled in ::1 127.0.0.1; do
+    if [ $stalled = ::1 ]; then other=127.0.0.1; else other=::1; fi
+    start_server $stalled
+    timeout 10 "$bindir/socket_client" -o "$tmp/output" "$host" "$(cat "$tmp/port")" \
+        > "$tmp/log" || exit 1
+    stop_server
+    msec=$(sed -n 's/^first byte after \([0-9]*\) ms$/\1/p' "$tmp/log")
+    if ! grep -q "hello from $other" "$tmp/output" || [ -z "$msec" ] || [ "$msec" -ge 1000 ]; then
+        echo "socket_stall: $stalled stalled, expected $other within a second"
+        cat "$tmp/log" "$tmp/output"
+        exit 1
+    fi
+    echo "socket_stall: $stalled stalled, $other answered after $msec ms"
+done
+
+# both stalled: a read waiting for the connect returns at the shutdown
+start_server ::1 127.0.0.1
+timeout 10 "$bindir/socket_client" -c 500 "$host" "$(cat "$tmp/port")" > "$tmp/log" || exit 1
+stop_server
+msec=$(sed -n 's/^shut down after [0-9]* ms, the read returned \([0-9]*\) ms later$/\1/p' "$tmp/log")
+if [ -z "$msec" ] || [ "$msec" -ge 100 ]; then
+    echo "socket_stall: the read didn't return at the shutdown"
+    cat "$tmp/log"
+    exit 1
+fi
+echo "socket_stall: both stalled, the read returned $msec ms after the shutdown"
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+#
+# Listen on ::1 and 127.0.0.1 at the same port, with the addresses
+# given stalled: their accept queue is kept full, so that a connect to
+# them waits for the SYN to be sent again as a black-holed host would.
+# The other addresses answer each connection with a line saying which
+# address it reached.
+#
+#   stall_server.py port_file stalled...
+#
+# The port is written to port_file. The server runs until it is killed,
+# or for 60 seconds.
+
+import os
+import select
+import socket
+import sys
+import time
+
+ADDRESSES = (("::1", socket.AF_INET6), ("127.0.0.1", socket.AF_INET))
+
+
+def listen(port):
+    """Bind every address at the port, or a free port for both."""
+    listeners = {}
+    for address, family in ADDRESSES:
+        sock = socket.socket(family, socket.SOCK_STREAM)
+        if family == socket.AF_INET6:
+            sock.setsockopt(socket.IPPROTO_IPV6, socket.IPV6_V6ONLY, 1)
+        sock.bind((address, port))
+        port = sock.getsockname()[1]
+        listeners[address] = sock
+    return port, listeners
+
+
+def stall(address, family, sock, port):
+    """Fill the accept queue, and return the connections filling it."""
+    sock.listen(0)
+    held = []
+    while True:
+        conn = socket.socket(family, socket.SOCK_STREAM)
+        conn.settimeout(0.3)
+        try:
+            conn.connect((address, port))
+        except socket.timeout:
+            conn.close()
+            return held
+        held.append(conn)
+
+
+def main():
+    port_file, stalled = sys.argv[1], sys.argv[2:]
+    for tries in range(10):
+        try:
+            port, listeners = listen(0)
+            break
+        except OSError:
+            # the port was free for one family only
+            continue
+    else:
+        sys.exit("stall_server: no port is free for both families")
+    held = []
+    answering = []
+    for address, family in ADDRESSES:
+        if address in stalled:
+            held += stall(address, family, listeners[address], port)
+        else:
+            listeners[address].listen(16)
+            answering.append(listeners[address])
+    with open(port_file + ".tmp", "w") as f:
+        f.write("%d\n" % port)
+    os.rename(port_file + ".tmp", port_file)
+    deadline = time.time() + 60
+    while time.time() < deadline:
+        ready, _, _ = select.select(answering, [], [], 1)
+        for sock in ready:
+            conn, _ = sock.accept()
+            conn.sendall(b"hello from %s\r\n" % sock.getsockname()[0].encode())
+            conn.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# A telnet server standing in for one which speaks MCCP2 and MCCP3,
+# serving one client on 127.0.0.1.
+#
+#   telnet_server.py port_file expected_file
+#
+# The port listened on is written to port_file. The server compresses
+# what it sends, first in one stream and then in another after some
+# plain bytes, and sends the compressed bytes in the same segment as
+# the command starting them, so the client has to keep them for the
+# next read. It waits for the keys, which the client compresses,
+# before ending the first stream. What the client should show is
+# written to expected_file.
+
+import os
+import socket
+import sys
+import zlib
+
+IAC, DONT, DO, WONT, WILL, SB, SE = 255, 254, 253, 252, 251, 250, 240
+ECHO, COMPRESS2, COMPRESS3 = 1, 86, 87
+
+# typed by test/mccp.sh, with an IAC which the client escapes
+KEYS = b"guest\xff\r"
+
+
+class Reader:
+    """Take the commands out of what the client sends, inflating it
+    once the client has started MCCP3."""
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.raw = b""
+        self.inflater = None
+        self.data = b""
+        self.commands = []
+
+    def read(self):
+        chunk = self.sock.recv(65536)
+        if not chunk:
+            raise EOFError("the client has closed")
+        if self.inflater:
+            self.raw += self.inflater.decompress(chunk)
+        else:
+            self.raw += chunk
+        self.parse()
+
+    def parse(self):
+        while self.raw:
+            p = self.raw
+            if p[0] != IAC:
+                i = p.find(bytes([IAC]))
+                if i == -1:
+                    i = len(p)
+                self.data += p[:i]
+                self.raw = p[i:]
+                continue
+            if len(p) < 2:
+                return
+            if p[1] == IAC:
+                self.data += bytes([IAC])
+                self.raw = p[2:]
+            elif p[1] in (WILL, WONT, DO, DONT):
+                if len(p) < 3:
+                    return
+                self.commands.append((p[1], p[2]))
+                self.raw = p[3:]
+            elif p[1] == SB:
+                i = p.find(bytes([IAC, SE]))
+                if i == -1:
+                    return
+                self.commands.append((SB, p[2]))
+                rest = p[i + 2:]
+                if p[2] == COMPRESS3:
+                    # what follows is the client's compressed stream
+                    self.inflater = zlib.decompressobj()
+                    rest = self.inflater.decompress(rest)
+                self.raw = rest
+            else:
+                self.raw = p[2:]
+
+
+def escape(data):
+    return data.replace(bytes([IAC]), bytes([IAC, IAC]))
+
+
+def main():
+    port_file, expected_file = sys.argv[1:3]
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(1)
+    with open(port_file + ".tmp", "w") as f:
+        f.write("%d\n" % listener.getsockname()[1])
+    os.rename(port_file + ".tmp", port_file)
+    listener.settimeout(10)
+    conn, _ = listener.accept()
+    conn.settimeout(10)
+    listener.close()
+    reader = Reader(conn)
+
+    conn.sendall(bytes([IAC, WILL, COMPRESS2, IAC, WILL, COMPRESS3]))
+    while (DO, COMPRESS2) not in reader.commands or (SB, COMPRESS3) not in reader.commands:
+        if (DONT, COMPRESS2) in reader.commands or (DONT, COMPRESS3) in reader.commands:
+            sys.exit("telnet_server: the client refused compression")
+        reader.read()
+
+    greeting = b"login: \xff\r\n" + b"".join(
+        b"%05d the quick brown fox jumps over the lazy dog\r\n" % i for i in range(20000))
+    body = b"welcome\r\n" + b"\x1b[1mbold\x1b[m\r\n" * 5000
+    between = b"between the streams\r\n"
+    tail = b"".join(b"%05d tail\r\n" % i for i in range(2000))
+    after = b"after the streams\r\n"
+
+    # the first stream, with a command inside it, starts in the same
+    # segment as the command starting it
+    first = zlib.compressobj()
+    start = bytes([IAC, SB, COMPRESS2, IAC, SE])
+    conn.sendall(start + first.compress(escape(greeting) + bytes([IAC, WILL, ECHO]))
+                 + first.flush(zlib.Z_SYNC_FLUSH))
+    while KEYS not in reader.data:
+        if len(reader.data) > len(KEYS):
+            sys.exit("telnet_server: keys %r, not %r" % (reader.data, KEYS))
+        reader.read()
+
+    # the end of the first stream, the plain bytes and the whole of the
+    # second stream, at once
+    second = zlib.compressobj()
+    conn.sendall(first.compress(escape(body)) + first.flush(zlib.Z_FINISH)
+                 + escape(between) + start
+                 + second.compress(escape(tail)) + second.flush(zlib.Z_FINISH)
+                 + escape(after))
+    conn.shutdown(socket.SHUT_WR)
+    try:
+        while True:
+            reader.read()
+    except EOFError:
+        pass
+    conn.close()
+    if (DO, ECHO) not in reader.commands:
+        sys.exit("telnet_server: no reply to the command in the stream")
+    with open(expected_file, "wb") as f:
+        f.write(greeting + body + between + tail + after)
+
+
+if __name__ == "__main__":
+    main()